@@ -0,0 +1,289 @@
+// Runs many independent emulator sessions on every core of the machine.
+//
+// Usage: gb_batch <job list> [--threads N] [--mode cycle|fast|jit] [--idle-skip on|off]
+//
+// Each line of the job list is a job:
+//     <rom> <frames> [movie] [output]
+// Use "-" to leave the movie or the output out. Lines starting with '#' are comments.
+//
+// A movie is a list of "<frame> <buttons>" lines, the buttons are held from that frame until the next
+// line. Buttons are RIGHT, LEFT, UP, DOWN, A, B, SELECT and START separated by spaces, or "-" for none.
+// The output is the last frame as a binary PPM image.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <mutex>
+#include <thread>
+
+#include "common.h"
+#include "gameboy.h"
+#include "array.h"
+#include "file_handling.h"
+
+#define MAX_PATH_LENGTH 256
+#define MAX_WORKERS 256
+
+struct InputChange{
+    u32 frame;
+    u8 buttons; // Button bits.
+};
+
+struct Job{
+    char rom_path[MAX_PATH_LENGTH];
+    char movie_path[MAX_PATH_LENGTH];
+    char output_path[MAX_PATH_LENGTH];
+    u32 frames;
+
+    // Results
+    bool failed;
+    f64 seconds;
+    u64 frame_hash;
+    u64 halt_skipped_cycles;
+    u64 idle_loop_skipped_cycles;
+};
+
+// Jobs [begin, end) of one worker. The owner takes them from the end and other workers steal from
+// the beginning once their own queue is empty.
+struct WorkQueue{
+    std::mutex lock;
+    u32 begin;
+    u32 end;
+};
+
+struct Batch{
+    Job *jobs;
+    u32 *queued_jobs; // Jobs that can run, the queues hold ranges of this.
+    WorkQueue queues[MAX_WORKERS];
+    u32 worker_count;
+    ExecutionMode mode;
+    bool skip_idle_loops;
+};
+
+// Names of the button bits, starting from the lowest.
+static const char *buttons[8] = {"RIGHT", "LEFT", "UP", "DOWN", "A", "B", "SELECT", "START"};
+
+static bool load_movie(const char *path, Array<InputChange> *movie){
+    char *text = text_file_to_string(path);
+    if(!text) return false;
+
+    char *line = text;
+    while(*line){
+        char *next = strchr(line, '\n');
+        if(next) *next++ = '\0';
+        else next = line + strlen(line);
+
+        InputChange change = {};
+        i32 read = 0;
+        if(line[0] != '#' && sscanf(line, "%u%n", &change.frame, &read) == 1){
+            char *token = line + read;
+            char name[16];
+            while(sscanf(token, "%15s%n", name, &read) == 1){
+                token += read;
+                for(i32 i = 0; i < 8; i++){
+                    if(strcmp(name, buttons[i]) == 0) change.buttons |= 1 << i;
+                }
+            }
+            array_add(movie, change);
+        }
+        line = next;
+    }
+
+    free(text);
+    return true;
+}
+
+static u64 hash_frame(const u8 *frame){
+    u64 hash = 14695981039346656037ull; // FNV-1a
+    for(i32 i = 0; i < BUFFER_SIZE; i++){
+        hash = (hash ^ frame[i]) * 1099511628211ull;
+    }
+    return hash;
+}
+
+static bool write_ppm(const char *path, const u8 *frame){
+    FILE *file;
+    fopen_s(&file, path, "wb");
+    if(!file) return false;
+
+    fprintf(file, "P6\n%d %d\n255\n", WINDOW_WIDTH, WINDOW_HEIGHT);
+    fwrite(frame, 1, BUFFER_SIZE, file);
+    fclose(file);
+    return true;
+}
+
+static void run_job(Job *job, ExecutionMode mode, bool skip_idle_loops){
+    Array<InputChange> movie = make_array<InputChange>();
+    if(job->movie_path[0] && !load_movie(job->movie_path, &movie)){
+        printf("Could not load the movie %s\n", job->movie_path);
+        job->failed = true;
+        delete_array(&movie);
+        return;
+    }
+
+    Gameboy *gmb = (Gameboy*)calloc(1, sizeof(Gameboy));
+    init_gameboy(gmb, job->rom_path);
+    if(!set_execution_mode(gmb, mode)){
+        set_execution_mode(gmb, EXECUTION_INSTRUCTION);
+    }
+    gmb->skip_idle_loops = skip_idle_loops;
+
+    u8 held = 0;
+    u32 next_change = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    for(u32 frame = 0; frame < job->frames; frame++){
+        while(next_change < movie.size && movie.data[next_change].frame <= frame){
+            held = movie.data[next_change++].buttons;
+        }
+        run_gameboy(gmb, 0, 1, held);
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    job->seconds = std::chrono::duration<f64>(end - start).count();
+    job->frame_hash = hash_frame(gmb->ppu.frame);
+    job->halt_skipped_cycles = gmb->halt_skipped_cycles;
+    job->idle_loop_skipped_cycles = gmb->idle_loop_skipped_cycles;
+    if(job->output_path[0] && !write_ppm(job->output_path, gmb->ppu.frame)){
+        printf("Could not write %s\n", job->output_path);
+        job->failed = true;
+    }
+
+    free_gameboy(gmb);
+    free(gmb);
+    delete_array(&movie);
+}
+
+static bool take_job(Batch *batch, u32 worker, Job **job){
+    for(u32 i = 0; i < batch->worker_count; i++){
+        u32 victim = (worker + i) % batch->worker_count;
+        WorkQueue *queue = &batch->queues[victim];
+
+        std::lock_guard<std::mutex> guard(queue->lock);
+        if(queue->begin == queue->end) continue;
+
+        u32 slot = victim == worker ? --queue->end : queue->begin++;
+        *job = &batch->jobs[batch->queued_jobs[slot]];
+        return true;
+    }
+    return false;
+}
+
+static void run_worker(Batch *batch, u32 worker){
+    Job *job;
+    while(take_job(batch, worker, &job)){
+        run_job(job, batch->mode, batch->skip_idle_loops);
+    }
+}
+
+static bool load_jobs(const char *path, Array<Job> *jobs){
+    char *text = text_file_to_string(path);
+    if(!text) return false;
+
+    char *line = text;
+    while(*line){
+        char *next = strchr(line, '\n');
+        if(next) *next++ = '\0';
+        else next = line + strlen(line);
+
+        Job job = {};
+        char movie[MAX_PATH_LENGTH] = "-";
+        char output[MAX_PATH_LENGTH] = "-";
+        if(line[0] != '#' && sscanf(line, "%255s %u %255s %255s", job.rom_path, &job.frames, movie, output) >= 2){
+            if(strcmp(movie, "-") != 0)  strcpy(job.movie_path, movie);
+            if(strcmp(output, "-") != 0) strcpy(job.output_path, output);
+
+            if(!file_exists(job.rom_path)){ // init_gameboy can't recover from a missing ROM.
+                printf("ROM %s not found\n", job.rom_path);
+                job.failed = true;
+            }
+            array_add(jobs, job);
+        }
+        line = next;
+    }
+
+    free(text);
+    return true;
+}
+
+int main(int argc, const char **argv){
+    if(argc < 2){
+        printf("Usage: gb_batch <job list> [--threads N] [--mode cycle|fast|jit] [--idle-skip on|off]\n");
+        return -1;
+    }
+
+    Batch *batch = new Batch();
+    batch->worker_count = std::thread::hardware_concurrency();
+    batch->mode = EXECUTION_JIT;
+    batch->skip_idle_loops = true;
+    for(i32 i = 2; i + 1 < argc; i += 2){
+        if(strcmp(argv[i], "--threads") == 0){
+            batch->worker_count = atoi(argv[i + 1]);
+        }
+        else if(strcmp(argv[i], "--mode") == 0){
+            if(strcmp(argv[i + 1], "cycle") == 0)     batch->mode = EXECUTION_MACHINE_CYCLE;
+            else if(strcmp(argv[i + 1], "fast") == 0) batch->mode = EXECUTION_INSTRUCTION;
+            else if(strcmp(argv[i + 1], "jit") == 0)  batch->mode = EXECUTION_JIT;
+        }
+        else if(strcmp(argv[i], "--idle-skip") == 0){
+            batch->skip_idle_loops = strcmp(argv[i + 1], "off") != 0;
+        }
+    }
+    if(batch->worker_count < 1) batch->worker_count = 1;
+    if(batch->worker_count > MAX_WORKERS) batch->worker_count = MAX_WORKERS;
+
+    Array<Job> jobs = make_array<Job>();
+    if(!load_jobs(argv[1], &jobs)){
+        printf("Could not load the job list %s\n", argv[1]);
+        return -1;
+    }
+    batch->jobs = jobs.data;
+
+    // Jobs that already failed are left out of the queues.
+    Array<u32> queued = make_array<u32>();
+    for(u32 i = 0; i < jobs.size; i++){
+        if(!jobs.data[i].failed) array_add(&queued, i);
+    }
+    batch->queued_jobs = queued.data;
+
+    // Each worker starts with a contiguous run of the jobs.
+    for(u32 i = 0; i < batch->worker_count; i++){
+        batch->queues[i].begin = (u32)((u64)queued.size * i / batch->worker_count);
+        batch->queues[i].end   = (u32)((u64)queued.size * (i + 1) / batch->worker_count);
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    std::thread *workers = new std::thread[batch->worker_count];
+    for(u32 i = 0; i < batch->worker_count; i++){
+        workers[i] = std::thread(run_worker, batch, i);
+    }
+    for(u32 i = 0; i < batch->worker_count; i++){
+        workers[i].join();
+    }
+    auto end = std::chrono::steady_clock::now();
+    f64 seconds = std::chrono::duration<f64>(end - start).count();
+
+    u64 total_frames = 0;
+    u32 failed = 0;
+    for(u32 i = 0; i < jobs.size; i++){
+        Job *job = &jobs.data[i];
+        if(job->failed){
+            printf("job %u\t%s\tFAILED\n", i, job->rom_path);
+            failed++;
+            continue;
+        }
+        printf("job %u\t%s\t%u frames\t%.3fs\t%.1f fps\thash %016llx\tskipped %llu halted, %llu polling\n", i, job->rom_path,
+               job->frames, job->seconds, job->frames / job->seconds, (unsigned long long)job->frame_hash,
+               (unsigned long long)job->halt_skipped_cycles, (unsigned long long)job->idle_loop_skipped_cycles);
+        total_frames += job->frames;
+    }
+    printf("%u jobs, %u failed, %u threads, %llu frames in %.3fs, %.1f fps\n", jobs.size, failed, batch->worker_count,
+           (unsigned long long)total_frames, seconds, total_frames / seconds);
+
+    delete[] workers;
+    delete_array(&queued);
+    delete_array(&jobs);
+    delete batch;
+    return failed ? 1 : 0;
+}
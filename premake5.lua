@@ -1,3 +1,8 @@
+newoption {
+   trigger = "alu-tables",
+   description = "Take the ALU and DAA flags from precomputed tables"
+}
+
  workspace "MyWorkspace"
    configurations { "Debug", "Release" }
    platforms { "x64" }
@@ -34,9 +39,12 @@ project "Gameboy"
 
    filter "toolset:msc*"
       links { "SDL3",  "SDL2_mixer", "SDL2_ttf", "shell32"}
-      buildoptions { "/W3", "/std:c++20" }
+      buildoptions { "/W3", "/std:c++20", "/constexpr:steps10000000" }
       -- linkoptions { "/SUBSYSTEM:CONSOLE" }
 
+   filter "options:alu-tables"
+      defines { "ALU_FLAG_TABLES=1" }
+
    filter "platforms:x64"
       architecture "x64"
 
@@ -60,12 +68,15 @@ project "Tests"
 
    files {"src/**.cpp", "src/**.c", "src/**.h", "tests/src/**.cpp"}
    removefiles { "src/main.cpp" }
-   includedirs {"src"}
+   includedirs {"src", "vendor/sdl/include"}
 
    filter "toolset:msc*"
-      buildoptions { "/W3", "/std:c++20" }
+      buildoptions { "/W3", "/std:c++20", "/constexpr:steps10000000" }
       -- linkoptions { "/SUBSYSTEM:CONSOLE" }
 
+   filter "options:alu-tables"
+      defines { "ALU_FLAG_TABLES=1" }
+
    filter "platforms:x64"
       architecture "x64"
 
@@ -75,4 +86,36 @@ project "Tests"
 
    filter "configurations:Release"
       defines { "NDEBUG" }
-      optimize "On"
\ No newline at end of file
+      optimize "On"
+project "gb_batch"
+   objdir ("batch/build/obj/%{cfg.platform}/%{cfg.buildcfg}")
+   targetdir ("batch/build/bin/%{cfg.platform}/%{cfg.buildcfg}")
+   debugdir ""
+
+   kind "ConsoleApp"
+   language "C++"
+
+   files {"src/**.cpp", "src/**.c", "src/**.h", "batch/src/**.cpp"}
+   removefiles { "src/main.cpp" }
+   includedirs {"src", "vendor/sdl/include"}
+
+   filter "toolset:gcc or toolset:clang"
+      buildoptions { "-std=c++20" }
+      links { "pthread" }
+
+   filter "toolset:msc*"
+      buildoptions { "/W3", "/std:c++20", "/constexpr:steps10000000" }
+
+   filter "options:alu-tables"
+      defines { "ALU_FLAG_TABLES=1" }
+
+   filter "platforms:x64"
+      architecture "x64"
+
+   filter "configurations:Debug"
+      defines { "DEBUG" }
+      symbols "On"
+
+   filter "configurations:Release"
+      defines { "NDEBUG" }
+      optimize "On"
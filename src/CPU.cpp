@@ -1,7 +1,14 @@
 #include "CPU.h"
 #include "ppu.h"
+#include "gameboy.h"
+#include "block_cache.h"
 #include <stdio.h>
 
+// IE & IF, so checking for an interrupt doesn't have to read both registers.
+static void update_pending_interrupts(CPU *cpu){
+    cpu->pending_interrupts = cpu->memory->data[0xFFFF] & cpu->memory->data[0xFF0F] & 0x1F;
+}
+
 void init_cpu(CPU *cpu, Memory *memory){
     cpu->memory = memory;
 
@@ -10,6 +17,7 @@ void init_cpu(CPU *cpu, Memory *memory){
     cpu->period = 1000.f/(cpu->clock_speed);
     cpu->machine_cycles_per_frame = (u32)(cpu->frame_time / cpu->period);
     cpu->cycles_delta = 0;
+    cpu->timer_cycle = 0;
 
     cpu->memory->data[0xFF40] = 0x91;
     
@@ -26,10 +34,12 @@ void init_cpu(CPU *cpu, Memory *memory){
     cpu->memory->data[0xFF49] = 0xE4; // Palette OBJ1 register.
 
     cpu->memory->data[0xFF41] = 0x80; // STAT register.
+    update_pending_interrupts(cpu);
 
     cpu->scheduled_ei = false;
     cpu->is_extended = false;
     cpu->handling_interrupt = false;
+    cpu->interrupt_cycle = 0;
     cpu->fetched_next_instruction = false;
     cpu->halt = false;
 
@@ -51,20 +61,47 @@ void init_cpu(CPU *cpu, Memory *memory){
     cpu->register_map[7] = &cpu->A;
 
     cpu->AF = 0x01B0;
+    cpu->lazy_flags = LAZY_FLAGS_NONE;
     cpu->BC = 0x0013;
     cpu->DE = 0x00D8;
     cpu->HL = 0x014D;
     cpu->SP = 0xFFFE;
 
-    fopen_s(&cpu->fp, "Log" , "w" );
-	if( !cpu->fp ){
-		printf("File could not be opened\n" );
-        assert(false)
+}
+
+// When running whole instructions at once the timers, DMA and PPU lag behind the CPU. Bring them
+// up to date before the CPU reads or changes anything they can see.
+static void sync_hardware(CPU *cpu, u16 address, bool is_write){
+    if(!cpu->pending_cycles || !cpu->gameboy) return; // A CPU on its own, like in the opcode tests, has no hardware to catch up.
+
+    bool visible_to_hardware = (address >= 0x8000 && address <= 0x9FFF) ||  // VRAM
+                               (address >= 0xFE00 && address <= 0xFF7F) ||  // OAM and IO registers
+                               (is_write && address <= 0x7FFF)          ||  // MBC registers change what DMA reads
+                               cpu->DMA_transfer_in_progress;
+    if(visible_to_hardware){
+        catch_up_hardware(cpu->gameboy);
     }
 }
 
-static u8 read_memory_cpu(CPU *cpu, u16 address){
-    if(address >= 0x0000 && address <= 0x7FFF){
+// The rows of buttons selected in FF00 read as 0 where a button is pressed.
+static u8 read_joypad(CPU *cpu){
+    u8 select = cpu->memory->data[0xFF00] & 0x30;
+    u8 pressed = 0;
+    if(!(select & 0x10)) pressed |= cpu->buttons & 0x0F; // Dpad
+    if(!(select & 0x20)) pressed |= cpu->buttons >> 4;   // A, B, Select and Start
+    return 0xC0 | select | (~pressed & 0x0F);
+}
+
+u8 read_memory_cpu(CPU *cpu, u16 address){
+    sync_hardware(cpu, address, false); // Can change what the page table points to.
+
+    u8 *page = cpu->memory->read_pages[address >> 8];
+    if(page) return page[address & 0xFF];
+
+    if(address < 0xFF00 && cpu->memory->is_bus_locked){ // OAM DMA
+        return 0xFF;
+    }
+    else if(address >= 0x0000 && address <= 0x7FFF){
         return read_from_MBC(cpu->memory, address);
     }
     else if(address >= 0x8000 && address <= 0x9FFF && cpu->memory->is_vram_locked){ // VRAM
@@ -77,17 +114,48 @@ static u8 read_memory_cpu(CPU *cpu, u16 address){
         return 0xFF;
     }
     else if(address == 0xFF00){
-        return cpu->memory->data[address];
+        return read_joypad(cpu);
     }
-    else if(address >= 0xFE00 && address <= 0xFE9F && cpu->memory->is_oam_locked){ // OAM
-        return 0xFF;
+    else if((address == 0xFF04 || address == 0xFF05) && cpu->gameboy){ // DIV and TIMA
+        sync_timers(cpu, cpu->gameboy->scheduler.cycle);
     }
     
     return cpu->memory->data[address];
 }
 
-static void write_memory_cpu(CPU *cpu, u16 address, u8 value){
+void write_memory_cpu(CPU *cpu, u16 address, u8 value){
     assert(address < MEMORY_SIZE);
+    sync_hardware(cpu, address, true);
+
+    u8 *page = cpu->memory->write_pages[address >> 8];
+    if(page){
+        page[address & 0xFF] = value;
+        return;
+    }
+
+    if(address < 0xFF00 && cpu->memory->is_bus_locked){ // OAM DMA
+        return;
+    }
+
+    if(address <= 0x7FFF){ // Blocks are keyed by bank, only stop following the current one.
+        cpu->decoded = NULL;
+        cpu->leave_block = true;
+    }
+    else if(cpu->block_cache && is_ram_code_page(cpu->block_cache, address)){
+        invalidate_ram_blocks(cpu->block_cache, cpu->memory);
+        cpu->decoded = NULL;
+        cpu->leave_block = true;
+    }
+
+    if(cpu->gameboy && ((address >= 0x8000 && address <= 0x9FFF) || (address >= 0xFF40 && address <= 0xFF4B))){
+        PPU *ppu = &cpu->gameboy->ppu;
+        bool was_drawing_whole_line = ppu->drawing_whole_line;
+        ppu_prepare_for_write(ppu); // VRAM and LCD registers, the line being drawn may need the old value.
+        if(was_drawing_whole_line && !ppu->drawing_whole_line) reschedule_ppu(cpu->gameboy); // The FIFO finishes the line.
+    }
+    else if(cpu->gameboy && address >= 0xFE00 && address <= 0xFE9F){
+        ppu_prepare_for_oam_write(&cpu->gameboy->ppu);
+    }
 
     if(address >= 0x8000 && address <= 0x9FFF && cpu->memory->is_vram_locked){ // VRAM
         return;
@@ -104,65 +172,225 @@ static void write_memory_cpu(CPU *cpu, u16 address, u8 value){
         cpu->memory->data[address] = 0x00;
         return;
     }
+    else if((address == 0xFF05 || address == 0xFF07) && cpu->gameboy){ // The timer counts up to now with the old TIMA and TAC.
+        sync_timers(cpu, cpu->gameboy->scheduler.cycle);
+        cpu->memory->data[address] = value;
+        reschedule_timer(cpu->gameboy);
+        return;
+    }
+    else if(address == 0xFF0F || address == 0xFFFF){ // IF and IE
+        cpu->memory->data[address] = value;
+        update_pending_interrupts(cpu);
+        return;
+    }
     else if(address == 0xFF46){ // Initiate DMA transfer. The value written is the upper byte of the address to copy from.
         cpu->memory->data[address] = value;
         cpu->DMA_transfer_in_progress = true;
         cpu->DMA_source = value << 8;
+        cpu->transferred_bytes = 0; // Starts over if one was running.
+        if(cpu->gameboy) schedule_cpu_event(cpu->gameboy, EVENT_DMA);
+        return;
+    }
+    else if(address == 0xFF00){ // Only the row select bits can be written.
+        cpu->memory->data[address] = value & 0x30;
+        return;
+    }
+    else if(address >= 0x8000 && address <= 0x97FF && cpu->gameboy){ // Tile data
+        cpu->memory->data[address] = value;
+        ppu_update_tile_row(&cpu->gameboy->ppu, address);
         return;
     }
 
     cpu->memory->data[address] = value;
+    if(cpu->gameboy && address >= 0xFF40 && address <= 0xFF4B){ // LCDC, STAT and LYC decide when the PPU has to run next.
+        reschedule_ppu(cpu->gameboy);
+    }
+}
+
+u8 fetch(CPU *cpu){
+    u8 byte;
+    const DecodedInstruction *decoded = cpu->decoded;
+    if(decoded && (u16)(cpu->PC - decoded->address) < decoded->length){
+        byte = decoded->bytes[cpu->PC - decoded->address];
+    }
+    else{
+        byte = read_memory_cpu(cpu, cpu->PC);
+    }
+    cpu->PC++;
+    return byte;
+}
+
+
+// Flags of the 8-bit arithmetic, the tables below are generated from these.
+
+static constexpr u8 add_flags(u8 left, u8 right, u8 carry){
+    u8 flags = (u8)(left + right + carry) == 0 ? FLAG_ZERO : 0;
+    if((left & 0x0F) + (right & 0x0F) + carry > 0x0F) flags |= FLAG_HALFCARRY;
+    if(left + right + carry > 0xFF)                   flags |= FLAG_CARRY;
+    return flags;
+}
+
+static constexpr u8 sub_flags(u8 left, u8 right, u8 carry){
+    u8 flags = (u8)(left - right - carry) == 0 ? (FLAG_ZERO | FLAG_SUB) : FLAG_SUB;
+    if((left & 0x0F) < (right & 0x0F) + carry) flags |= FLAG_HALFCARRY;
+    if(left < right + carry)                   flags |= FLAG_CARRY;
+    return flags;
+}
+
+static constexpr u8 inc_flags(u8 value){ // Without the carry, INC keeps it.
+    u8 flags = (u8)(value + 1) == 0 ? FLAG_ZERO : 0;
+    if((value & 0x0F) == 0x0F) flags |= FLAG_HALFCARRY;
+    return flags;
+}
+
+static constexpr u8 dec_flags(u8 value){ // Without the carry, DEC keeps it.
+    u8 flags = (u8)(value - 1) == 0 ? (FLAG_ZERO | FLAG_SUB) : FLAG_SUB;
+    if((value & 0x0F) == 0) flags |= FLAG_HALFCARRY;
+    return flags;
+}
+
+struct DaaResult{
+    u8 A;
+    u8 flags;
+};
+
+static constexpr DaaResult daa_result(u8 A, u8 flags){
+    if (!(flags & FLAG_SUB)) {  // after an addition, adjust if (half-)carry occurred or if result is out of bounds
+        if (flags & FLAG_CARRY || A > 0x99) {
+            A += 0x60;
+            flags |= FLAG_CARRY;
+        }
+        if((A & 0x0F) > 9 || flags & FLAG_HALFCARRY){
+            A += 6;
+        }
+    } else {  // after a subtraction, only adjust if (half-)carry occurred
+        if (flags & FLAG_CARRY){
+            A -= 0x60;
+        }
+        if (flags & FLAG_HALFCARRY){
+            A -= 0x6;
+        }
+    }
+
+    flags &= ~(FLAG_HALFCARRY | FLAG_ZERO);
+    if(A == 0) flags |= FLAG_ZERO;
+    return {A, flags};
 }
 
-void update_joypad(CPU *cpu, const bool *input){
-    if(!(read_memory_cpu(cpu, 0xFF00) & 0x10)){ // Dpad selected.
-        u8 in = read_memory_cpu(cpu, 0xFF00); // All buttons released.
-        in |= 0x0F;
-        if(input[SDL_SCANCODE_DOWN])  in &= ~0x08;
-        if(input[SDL_SCANCODE_UP])    in &= ~0x04;
-        if(input[SDL_SCANCODE_LEFT])  in &= ~0x02;
-        if(input[SDL_SCANCODE_RIGHT]) in &= ~0x01; 
+#if ALU_FLAG_TABLES
 
-        write_memory_cpu(cpu, 0xFF00, in);
+// 128KB for ADD/ADC and SUB/SBC/CP plus 2KB for the rest. The results are a single add or substraction,
+// storing them too would double the size.
+struct AluTables{
+    u8 add[2][256][256]; // [carry][left][right]
+    u8 sub[2][256][256];
+    u8 inc[256];
+    u8 dec[256];
+    DaaResult daa[8][256]; // [N, H and C flags][A]
+};
+
+static constexpr AluTables build_alu_tables(){
+    AluTables tables = {};
+    for(u32 carry = 0; carry < 2; carry++){
+        for(u32 left = 0; left < 256; left++){
+            for(u32 right = 0; right < 256; right++){
+                tables.add[carry][left][right] = add_flags(left, right, carry);
+                tables.sub[carry][left][right] = sub_flags(left, right, carry);
+            }
+        }
     }
-    else if(!(read_memory_cpu(cpu, 0xFF00) & 0x20)){ // Buttons selected.
-        u8 in = read_memory_cpu(cpu, 0xFF00); // All buttons released.
-        in |= 0x0F;
-        if(input[SDL_SCANCODE_RETURN]) in &= ~0x08;
-        if(input[SDL_SCANCODE_RSHIFT]) in &= ~0x04;
-        if(input[SDL_SCANCODE_X])      in &= ~0x02;
-        if(input[SDL_SCANCODE_Z])      in &= ~0x01; 
-
-        write_memory_cpu(cpu, 0xFF00, in);
+    for(u32 value = 0; value < 256; value++){
+        tables.inc[value] = inc_flags(value);
+        tables.dec[value] = dec_flags(value);
     }
+    for(u32 flags = 0; flags < 8; flags++){
+        for(u32 A = 0; A < 256; A++){
+            tables.daa[flags][A] = daa_result(A, flags << 4);
+        }
+    }
+    return tables;
 }
 
-u8 fetch(CPU *cpu){
-    u8 byte = read_memory_cpu(cpu, cpu->PC);
-    cpu->PC++;
-    return byte;
+static constexpr AluTables alu_tables = build_alu_tables();
+
+#define ADD_FLAGS(left, right, carry) alu_tables.add[carry][left][right]
+#define SUB_FLAGS(left, right, carry) alu_tables.sub[carry][left][right]
+#define INC_FLAGS(value)              alu_tables.inc[value]
+#define DEC_FLAGS(value)              alu_tables.dec[value]
+#define DAA_RESULT(A, flags)          alu_tables.daa[((flags) >> 4) & 0x07][A]
+
+#else
+
+#define ADD_FLAGS(left, right, carry) add_flags(left, right, carry)
+#define SUB_FLAGS(left, right, carry) sub_flags(left, right, carry)
+#define INC_FLAGS(value)              inc_flags(value)
+#define DEC_FLAGS(value)              dec_flags(value)
+#define DAA_RESULT(A, flags)          daa_result(A, flags)
+
+#endif
+
+// Computes the flags left by the last 8-bit arithmetic operation. Everything that reads or changes only
+// some of the flags has to go through here first.
+u8 get_flags(CPU *cpu){
+    if(cpu->lazy_flags == LAZY_FLAGS_NONE) return cpu->flags;
+
+    u8 left  = cpu->lazy_left;
+    u8 right = cpu->lazy_right;
+    u8 carry = cpu->lazy_carry;
+    u8 flags = 0;
+
+    switch(cpu->lazy_flags){
+        case LAZY_FLAGS_NONE: break;
+        case LAZY_FLAGS_ADD:  flags = ADD_FLAGS(left, right, carry); break;
+        case LAZY_FLAGS_SUB:  flags = SUB_FLAGS(left, right, carry); break;
+        case LAZY_FLAGS_INC:  flags = INC_FLAGS(left) | (carry << 4); break;
+        case LAZY_FLAGS_DEC:  flags = DEC_FLAGS(left) | (carry << 4); break;
+    }
+
+    cpu->flags = flags;
+    cpu->lazy_flags = LAZY_FLAGS_NONE;
+    return flags;
+}
+
+// Carry flag without computing the rest. ADC, SBC, INC and DEC need it when the last operation is still pending.
+static u8 get_carry(CPU *cpu){
+    switch(cpu->lazy_flags){
+        case LAZY_FLAGS_NONE: return (cpu->flags & FLAG_CARRY) >> 4;
+        case LAZY_FLAGS_ADD:  return cpu->lazy_left + cpu->lazy_right + cpu->lazy_carry > 0xFF;
+        case LAZY_FLAGS_SUB:  return cpu->lazy_left < cpu->lazy_right + cpu->lazy_carry;
+        case LAZY_FLAGS_INC:
+        case LAZY_FLAGS_DEC:  return cpu->lazy_carry;
+    }
+    return 0;
 }
 
+static u8 defer_flags(CPU *cpu, LazyFlags operation, u8 left, u8 right, u8 carry, u8 result){
+    cpu->lazy_flags  = operation;
+    cpu->lazy_left   = left;
+    cpu->lazy_right  = right;
+    cpu->lazy_carry  = carry;
+    return result;
+}
 
 void set_flag(CPU *cpu, Flag flag){
-    cpu->flags = cpu->flags | flag;
+    cpu->flags = get_flags(cpu) | flag;
 }
 
 void unset_flag(CPU *cpu, Flag flag){
-    cpu->flags = cpu->flags & ~(flag);
+    cpu->flags = get_flags(cpu) & ~(flag);
 }
 
-static u8 sum_and_set_flags(CPU *cpu, u8 summand_left, u8 summand_right, bool add_carry = false, b32 check_carry = false, bool check_zero = false){
+u8 sum_and_set_flags(CPU *cpu, u8 summand_left, u8 summand_right, bool add_carry, b32 check_carry, bool check_zero){
     u8 carry;
-    add_carry ? carry = ((cpu->flags & FLAG_CARRY) >> 4) : carry = 0;
+    add_carry ? carry = get_carry(cpu) : carry = 0;
 
     u16 result = (u16)summand_left + (u16)summand_right + carry;
-    
+
+    // ADD and INC set the zero flag and can wait. The 16-bit additions keep it, so they're computed right away.
     if(check_zero){
-        if(u8(result) == 0)     
-            set_flag(cpu, FLAG_ZERO);
-        else
-            unset_flag(cpu, FLAG_ZERO);
+        if(check_carry) return defer_flags(cpu, LAZY_FLAGS_ADD, summand_left, summand_right, carry, (u8)result);
+        assert(summand_right == 1 && !add_carry);
+        return defer_flags(cpu, LAZY_FLAGS_INC, summand_left, 1, get_carry(cpu), (u8)result);
     }
 
     unset_flag(cpu, FLAG_SUB);
@@ -185,86 +413,27 @@ static u8 sum_and_set_flags(CPU *cpu, u8 summand_left, u8 summand_right, bool ad
 }
 
 u8 sum_and_set_flags_adc(CPU *cpu, u8 summand_left, u8 summand_right){
-    u8 carry = (cpu->flags & FLAG_CARRY) >> 4;
-    u16 result = (u16)summand_left + (u16)summand_right + carry;
-                            
-    if(u8(result) == 0)     
-        set_flag(cpu, FLAG_ZERO);
-    else
-        unset_flag(cpu, FLAG_ZERO);
-
-    unset_flag(cpu, FLAG_SUB);
-
-    u8 nibble_left_summand     = cpu->A          & 0x0F;
-    u8 nibble_right_summand    = summand_right   & 0x0F;
-    if((nibble_left_summand + nibble_right_summand + carry) > 0x0F) 
-        set_flag(cpu, FLAG_HALFCARRY);
-    else
-        unset_flag(cpu, FLAG_HALFCARRY);
-
-    if(result > 0xFF) 
-        set_flag(cpu, FLAG_CARRY);
-    else
-        unset_flag(cpu, FLAG_CARRY);
-
-    return (u8)result;
+    u8 carry = get_carry(cpu);
+    u8 result = summand_left + summand_right + carry;
+    return defer_flags(cpu, LAZY_FLAGS_ADD, summand_left, summand_right, carry, result);
 }
 
 static u8 substract_and_set_flags(CPU *cpu, u8 minuend, u8 sustrahend, b32 check_carry = false, bool check_zero = false){
     u8 result = minuend - sustrahend;
 
-    if(check_zero){
-        if(result == 0)     
-            set_flag(cpu, FLAG_ZERO);
-        else
-            unset_flag(cpu, FLAG_ZERO);
-    }
-
-    set_flag(cpu, FLAG_SUB);
-  
-    u8 nibble_minuend    = minuend    & 0x0F;
-    u8 nibble_sustrahend = sustrahend & 0x0F;
-
-    if(nibble_sustrahend > nibble_minuend) 
-        set_flag(cpu, FLAG_HALFCARRY);
-    else
-        unset_flag(cpu, FLAG_HALFCARRY);
-
-    if(check_carry){
-        if(minuend < sustrahend) 
-            set_flag(cpu, FLAG_CARRY);
-        else
-            unset_flag(cpu, FLAG_CARRY);
-    }
+    // SUB, CP and DEC are the only users and all of them set the zero flag.
+    assert(check_zero);
+    if(check_carry)
+        return defer_flags(cpu, LAZY_FLAGS_SUB, minuend, sustrahend, 0, result);
 
-    return result;
+    assert(sustrahend == 1);
+    return defer_flags(cpu, LAZY_FLAGS_DEC, minuend, 1, get_carry(cpu), result);
 }
 
 static u8 substract_and_set_flags_sbc(CPU *cpu, u8 minuend, u8 sustrahend){
-    u8 carry = (cpu->flags & FLAG_CARRY) >> 4;
+    u8 carry = get_carry(cpu);
     u8 result = minuend - (sustrahend + carry);
-
-    if(result == 0)     
-        set_flag(cpu, FLAG_ZERO);
-    else
-        unset_flag(cpu, FLAG_ZERO);
-
-    set_flag(cpu, FLAG_SUB);
-  
-    u8 nibble_minuend    = (minuend    & 0x0F);
-    u8 nibble_sustrahend = (sustrahend & 0x0F);
-
-    if(nibble_sustrahend > nibble_minuend - carry) 
-        set_flag(cpu, FLAG_HALFCARRY);
-    else
-        unset_flag(cpu, FLAG_HALFCARRY);
-
-    if(minuend < sustrahend + carry) 
-        set_flag(cpu, FLAG_CARRY);
-    else
-        unset_flag(cpu, FLAG_CARRY);
-
-    return result;
+    return defer_flags(cpu, LAZY_FLAGS_SUB, minuend, sustrahend, carry, result);
 }
 
 u8 pop_stack(CPU *cpu){
@@ -283,10 +452,17 @@ u8 push_stack(CPU *cpu, u8 value){
 
 
 static void print_cpu(CPU *cpu){
-    bool zero   = cpu->flags & FLAG_ZERO;
-    bool half   = cpu->flags & FLAG_HALFCARRY;
-    bool sub    = cpu->flags & FLAG_SUB;
-    bool carry  = cpu->flags & FLAG_CARRY;
+    if(!cpu->fp){ // Only opened when debugging, every instance would write to the same file.
+        fopen_s(&cpu->fp, "Log" , "w" );
+        if( !cpu->fp ){
+            printf("File could not be opened\n" );
+            assert(false)
+        }
+    }
+    bool zero   = get_flags(cpu) & FLAG_ZERO;
+    bool half   = get_flags(cpu) & FLAG_HALFCARRY;
+    bool sub    = get_flags(cpu) & FLAG_SUB;
+    bool carry  = get_flags(cpu) & FLAG_CARRY;
     u8 DIV      = read_memory_cpu(cpu, 0xFF04);
     u8 LCDC     = read_memory_cpu(cpu, 0xFF40);
     u8 LY       = read_memory_cpu(cpu, 0xFF44);
@@ -306,10 +482,28 @@ static void print_cpu(CPU *cpu){
 }
 
 
-static void go_to_next_instruction(CPU *cpu){
+// Keeps following the current block while the program counter stays on it, otherwise looks up the block
+// that starts at the program counter.
+static void decode_next_instruction(CPU *cpu){
+    const DecodedInstruction *next = NULL;
+    if(cpu->decoded){
+        next = cpu->decoded + 1;
+        if(next >= cpu->block->instructions + cpu->block->instruction_count || next->address != cpu->PC){
+            next = NULL;
+        }
+    }
+
+    if(!next){
+        cpu->block = get_basic_block(cpu->block_cache, cpu->memory, cpu->PC);
+        next = cpu->block ? cpu->block->instructions : NULL;
+    }
+    cpu->decoded = next;
+}
+
+void go_to_next_instruction(CPU *cpu){
     //print_cpu(cpu);
 
-    assert(cpu->PC != 0x39);
+    if(cpu->block_cache) decode_next_instruction(cpu);
     cpu->opcode = fetch(cpu);
     cpu->machine_cycle = 0; 
     cpu->fetched_next_instruction = true;
@@ -321,2214 +515,1005 @@ static void go_to_next_instruction(CPU *cpu){
 }
 
 
-static u8 immr8;
 
-static union{
-    u16 imm;
-    struct{
-        u8 imm_low;
-        u8 imm_high;
-    };
+// Every instruction is split into the micro-steps it executes on each of its machine cycles.
+// run_cpu calls exactly one micro-step per machine cycle, looked up in a table indexed by the
+// opcode, so there is no decoding left in the hot path. A step that skips ahead (untaken
+// conditional jumps, calls and returns) sets machine_cycle to the step before the one it
+// wants to run next, the same way the instructions did before.
+struct OpcodeTable{
+    OpcodeSteps base[256];
+    OpcodeSteps extended[256]; // Opcodes prefixed with 0xCB
 };
-static u8 dest;
-static u8 src;
 
-static u8 mem_value;
-static bool sign;
+static u8 get_opcode_r16(CPU *cpu){
+    return (cpu->opcode & 0x30) >> 4;
+}
 
+static u8 get_opcode_dest_r8(CPU *cpu){
+    return (cpu->opcode & 0x38) >> 3;
+}
 
-void run_cpu(CPU *cpu){
-    if(cpu->fetched_next_instruction) cpu->fetched_next_instruction = false;
-    if(cpu->do_first_fetch){
-        cpu->machine_cycle = 0;
-        cpu->opcode = fetch(cpu);
-        cpu->do_first_fetch = false;
-        // return 4;
-    }
-    cpu->machine_cycle++;
-    if(!cpu->is_extended){
-        //cpu->was_extended = false;
-        switch(cpu->opcode & 0xC0){
-        case 0x00:{
-            switch(cpu->opcode){
-                case 0x00:{  // NOP
-                    go_to_next_instruction(cpu);
+static u8 get_opcode_src_r8(CPU *cpu){
+    return cpu->opcode & 0x07;
+}
 
-                    break;
-                }
+static u8 get_opcode_bit(CPU *cpu){
+    return (cpu->opcode & 0x38) >> 3;
+}
 
-                case 0x01:
-                case 0x11:
-                case 0x21:
-                case 0x31:{ // LD r16, imm16
-                    
-                    if(cpu->machine_cycle == 1){
-                        imm_low = fetch(cpu);
-                    }
-                    else if(cpu->machine_cycle == 2){
-                        imm_high = fetch(cpu);
-                    }
-                    else if(cpu->machine_cycle == 3){
-                        imm = (imm_high << 8) | imm_low;
-                        u8 reg = cpu->opcode & 0x30;
-                        reg >>= 4;
-                        if(reg <= 2)
-                            *cpu->wide_register_map[reg] = imm;
-                        else if(reg == 3)
-                            cpu->SP = imm;
-
-                        go_to_next_instruction(cpu);
-                    }
+static void set_zero_flag_from(CPU *cpu, u8 value){
+    if(value == 0)
+        set_flag(cpu, FLAG_ZERO);
+    else
+        unset_flag(cpu, FLAG_ZERO);
+}
 
-                    break;
-                }
+// Shared micro-steps
 
-                case 0x02:
-                case 0x12:{ // LD [r16], A.    Only BC and DE.
-                    
-                    if(cpu->machine_cycle == 1){
-                        u8 reg = cpu->opcode & 0x30;
-                        reg >>= 4;
-                        assert(reg <= 1);
-                        write_memory_cpu(cpu, *cpu->wide_register_map[reg], cpu->A);
-                    }
-                    else if(cpu->machine_cycle == 2){
-                        go_to_next_instruction(cpu);
-                    }
+static void next_instruction(CPU *cpu){
+    go_to_next_instruction(cpu);
+}
 
-                    break;
-                }
+static void next_extended_instruction(CPU *cpu){
+    go_to_next_instruction(cpu);
+    cpu->is_extended = false;
+}
 
+static void idle(CPU *){
+}
 
-                
-                case 0x22:{ // LD [HL+], A
-                    
-                    if(cpu->machine_cycle == 1){
-                        write_memory_cpu(cpu, cpu->HL, cpu->A);
-                        cpu->HL++;
-                    }
-                    else if(cpu->machine_cycle == 2){
-                        go_to_next_instruction(cpu);
-                    }
-                    break;
-                }
+static void fetch_imm_low(CPU *cpu){
+    cpu->imm_low = fetch(cpu);
+}
 
-                case 0x32:{ // LD [HL-], A
-                    
-                    if(cpu->machine_cycle == 1){
-                        write_memory_cpu(cpu, cpu->HL, cpu->A);
-                        cpu->HL--;
-                    }
-                    else if(cpu->machine_cycle == 2){
-                        go_to_next_instruction(cpu);
-                    }
-                    break;
-                }
+static void fetch_imm_high(CPU *cpu){
+    cpu->imm_high = fetch(cpu);
+}
 
-                case 0x0A:
-                case 0x1A:{ // LD A, [r16]   only for BC and DE
-                    
-                    if(cpu->machine_cycle == 1){
-                        u8 reg = cpu->opcode & 0x30;
-                        reg >>= 4;
-                        assert(reg <= 1);
-                        mem_value = read_memory_cpu(cpu, *cpu->wide_register_map[reg]);
-                    }
-                    else if(cpu->machine_cycle == 2){
-                        cpu->A = mem_value;
-
-                        go_to_next_instruction(cpu);
-                    }
+static void fetch_immr8(CPU *cpu){
+    cpu->immr8 = fetch(cpu);
+}
 
-                    break;
-                }
+static void read_hl(CPU *cpu){
+    cpu->mem_value = read_memory_cpu(cpu, cpu->HL);
+}
 
-                case 0x2A:{ // LD A, [HL+]
-                    
-                    if(cpu->machine_cycle == 1){
-                        mem_value = read_memory_cpu(cpu, cpu->HL);
-                        cpu->HL++;
-                    }
-                    else if(cpu->machine_cycle == 2){
-                        cpu->A = mem_value;
-
-                        go_to_next_instruction(cpu);
-                    }
-                    break;
-                }
+static void ld_a_mem_value(CPU *cpu){
+    cpu->A = cpu->mem_value;
+    go_to_next_instruction(cpu);
+}
 
-                case 0x3A:{  // LD A, [HL+]
-                    
-                    if(cpu->machine_cycle == 1){
-                        mem_value = read_memory_cpu(cpu, cpu->HL);
-                        cpu->HL--;
-                    }
-                    else if(cpu->machine_cycle == 2){
-                        cpu->A = mem_value;
-
-                        go_to_next_instruction(cpu);
-                    }
-                    break;
-                }
+static void unimplemented(CPU *cpu){
+    printf("Opcode %X not implemented\n", cpu->opcode);
+    assert(false);
+}
 
-                case 0x08:{ // LD [a16], SP
-                    
-                    if(cpu->machine_cycle == 1){
-                    imm_low = fetch(cpu);
-                    }
-                    else if(cpu->machine_cycle == 2){
-                    imm_high = fetch(cpu);
-                    }
-                    else if(cpu->machine_cycle == 3){
-                    imm = imm = (imm_high << 8) | imm_low;
-                    write_memory_cpu(cpu, imm, cpu->SP & 0x00FF);
-                    imm++;
-                    }
-                    else if(cpu->machine_cycle == 4){
-                    write_memory_cpu(cpu, imm, (cpu->SP & 0xFF00) >> 8);
-                    }
-                    else if(cpu->machine_cycle == 5){
-                        go_to_next_instruction(cpu);
-                    }
+// 16-bit loads and arithmetic
 
-                    break;
-                }
+static void ld_r16_imm16(CPU *cpu){
+    cpu->imm = (cpu->imm_high << 8) | cpu->imm_low;
+    u8 reg = get_opcode_r16(cpu);
+    if(reg <= 2)
+        *cpu->wide_register_map[reg] = cpu->imm;
+    else if(reg == 3)
+        cpu->SP = cpu->imm;
 
-                case 0x03:
-                case 0x13:
-                case 0x23:{ // INC r16   for BC, DE, and HL
-                    
-                    if(cpu->machine_cycle == 1){
-                        u8 reg = cpu->opcode & 0x30;
-                        reg >>= 4;
-                        assert(reg <= 2);
-
-                        (*cpu->wide_register_map[reg])++;
-                    }
-                    else if(cpu->machine_cycle == 2){
-                        go_to_next_instruction(cpu);
-                    }
-                    break;
-                }
+    go_to_next_instruction(cpu);
+}
 
-                case 0x33:{ // INC SP
-                    
-                    if(cpu->machine_cycle == 1){
-                        cpu->SP++;
-                    }
-                    else if(cpu->machine_cycle == 2){
-                        go_to_next_instruction(cpu);
-                    }
-                    break;
-                }
+static void ld_memr16_a(CPU *cpu){ // Only BC and DE.
+    u8 reg = get_opcode_r16(cpu);
+    assert(reg <= 1);
+    write_memory_cpu(cpu, *cpu->wide_register_map[reg], cpu->A);
+}
 
-                case 0x0B:
-                case 0x1B:
-                case 0x2B:{ // DEC r16   for BC, DE, and HL
-                    
-                    if(cpu->machine_cycle == 1){
-                        u8 reg = cpu->opcode & 0x30;
-                        reg >>= 4;
-                        assert(reg <= 2);
-
-                        (*cpu->wide_register_map[reg])--;
-                    }
-                    else if(cpu->machine_cycle == 2){
-                        go_to_next_instruction(cpu);
-                    }
-                    break;
-                }
+static void ld_hli_a(CPU *cpu){
+    write_memory_cpu(cpu, cpu->HL, cpu->A);
+    cpu->HL++;
+}
 
-                case 0x3B:{ // DEC SP
-                    
-                    if(cpu->machine_cycle == 1){
-                        cpu->SP--;
-                    }
-                    else if(cpu->machine_cycle == 2){
-                        go_to_next_instruction(cpu);
-                    }
-                    break;
-                }
+static void ld_hld_a(CPU *cpu){
+    write_memory_cpu(cpu, cpu->HL, cpu->A);
+    cpu->HL--;
+}
 
-                case 0x09:
-                case 0x19:
-                case 0x29:{ // ADD HL, r16  for BC, DE and HL.
-                    
-                    if(cpu->machine_cycle == 1){
-                        u8 reg = cpu->opcode & 0x30;
-                        reg >>= 4;
-                        assert(reg <= 2);
-
-                        u8 reg_low = ((*cpu->wide_register_map[reg]) & 0x00FF);
-                        cpu->L = sum_and_set_flags(cpu, cpu->L, reg_low, false, true, false);
-                    }
-                    else if(cpu->machine_cycle == 2){
-                        u8 reg = cpu->opcode & 0x30;
-                        reg >>= 4;
-                        u8 reg_high = ((*cpu->wide_register_map[reg]) & 0xFF00) >> 8;
-                        u8 carry = (cpu->flags & FLAG_CARRY) >> 4;
-                        cpu->H =  sum_and_set_flags(cpu, cpu->H, reg_high, true, true, false);
-
-                        go_to_next_instruction(cpu);
-                    }
-                    break;
-                }
+static void ld_a_memr16_read(CPU *cpu){ // Only BC and DE.
+    u8 reg = get_opcode_r16(cpu);
+    assert(reg <= 1);
+    cpu->mem_value = read_memory_cpu(cpu, *cpu->wide_register_map[reg]);
+}
 
-                case 0x39:{ // ADD HL, SP
-                    
-                    if(cpu->machine_cycle == 1){
-                        u8 reg_low = ((cpu->SP) & 0x00FF);
-                        cpu->L = sum_and_set_flags(cpu, cpu->L, reg_low, false, true, false);
-                    }
-                    else if(cpu->machine_cycle == 2){
-                        u8 reg_high = ((cpu->SP) & 0xFF00) >> 8;
-                        u8 carry = (cpu->flags & FLAG_CARRY) >> 4;
-                        cpu->H =  sum_and_set_flags(cpu, cpu->H, reg_high, true, true, false);
-
-                        go_to_next_instruction(cpu);
-                    }
-                    break;
-                }
+static void ld_a_hli_read(CPU *cpu){
+    cpu->mem_value = read_memory_cpu(cpu, cpu->HL);
+    cpu->HL++;
+}
 
-                case 0x04:
-                case 0x14:
-                case 0x24:
-                case 0x0C:
-                case 0x1C:
-                case 0x2C:
-                case 0x3C:{ // INC r8, for B,C,D,E,H,L
-                    u8 reg = cpu->opcode & 0x38;
-                    reg >>= 3;
-                    assert(reg <= 7);
-
-                    if(reg < 6)
-                        (*cpu->register_map[reg]) = sum_and_set_flags(cpu, (*cpu->register_map[reg]), 1, false, false, true);
-                    else if(reg == 7){
-                        cpu->A = sum_and_set_flags(cpu, cpu->A, 1, false, false, true);
-                    }
-
-                    go_to_next_instruction(cpu);
+static void ld_a_hld_read(CPU *cpu){
+    cpu->mem_value = read_memory_cpu(cpu, cpu->HL);
+    cpu->HL--;
+}
 
-                    break;
-                }
-                
-                case 0x34:{ // INC [HL]
-                    
-                    if(cpu->machine_cycle == 1){
-                        mem_value = read_memory_cpu(cpu, cpu->HL);
-                    }
-                    else if(cpu->machine_cycle == 2){
-                        mem_value = sum_and_set_flags(cpu, mem_value, 1, false, false, true);
-                        write_memory_cpu(cpu, cpu->HL, mem_value);
-                    }
-                    else if(cpu->machine_cycle == 3){
-                        go_to_next_instruction(cpu);
-                    }
+static void ld_a16_sp_low(CPU *cpu){
+    cpu->imm = (cpu->imm_high << 8) | cpu->imm_low;
+    write_memory_cpu(cpu, cpu->imm, cpu->SP & 0x00FF);
+    cpu->imm++;
+}
 
-                    break;
-                }
+static void ld_a16_sp_high(CPU *cpu){
+    write_memory_cpu(cpu, cpu->imm, (cpu->SP & 0xFF00) >> 8);
+}
 
-                case 0x05:
-                case 0x15:
-                case 0x25:
-                case 0x0D:
-                case 0x1D:
-                case 0x2D:
-                case 0x3D:{ // DEC r8, for B,C,D,E,H,L
-                    u8 reg = cpu->opcode & 0x38;
-                    reg >>= 3;
-                    assert(reg <= 7);
-
-                    if(reg < 6)
-                        (*cpu->register_map[reg]) = substract_and_set_flags(cpu, (*cpu->register_map[reg]), 1, false, true);
-                    else if(reg == 7){
-                        cpu->A = substract_and_set_flags(cpu, cpu->A, 1, false, true);
-                    }
-
-                    go_to_next_instruction(cpu);
+static void inc_r16(CPU *cpu){ // BC, DE and HL
+    u8 reg = get_opcode_r16(cpu);
+    assert(reg <= 2);
+    (*cpu->wide_register_map[reg])++;
+}
 
-                    break;
-                }
+static void inc_sp(CPU *cpu){
+    cpu->SP++;
+}
 
-                case 0x35:{ // DEC [HL]
-                    
-                    if(cpu->machine_cycle == 1){
-                        mem_value = read_memory_cpu(cpu, cpu->HL);
-                    }
-                    else if(cpu->machine_cycle == 2){
-                        mem_value = substract_and_set_flags(cpu, mem_value, 1, false, true);
-                        write_memory_cpu(cpu, cpu->HL, mem_value);
-                    }
-                    else if(cpu->machine_cycle == 3){
-                        go_to_next_instruction(cpu);
-                    }
+static void dec_r16(CPU *cpu){ // BC, DE and HL
+    u8 reg = get_opcode_r16(cpu);
+    assert(reg <= 2);
+    (*cpu->wide_register_map[reg])--;
+}
 
-                    break;
-                }
+static void dec_sp(CPU *cpu){
+    cpu->SP--;
+}
 
-                case 0x06:
-                case 0x16:
-                case 0x26:
-                case 0x0E:
-                case 0x1E:
-                case 0x2E:
-                case 0x3E:{ // LD r8, imm8
-                    
-                    if(cpu->machine_cycle == 1){
-                        immr8 = fetch(cpu);    
-                    }
-                    else if(cpu->machine_cycle == 2){
-                        u8 reg = cpu->opcode & 0x38;
-                        reg >>= 3;
-                        assert(reg <= 7);
-
-                        if(reg < 6){
-                            (*cpu->register_map[reg]) = immr8;
-                        }
-                        else if(reg == 7){
-                            cpu->A = immr8;
-                        }
-
-
-                        go_to_next_instruction(cpu);
-                    }
+static void add_hl_r16_low(CPU *cpu){ // BC, DE and HL
+    u8 reg = get_opcode_r16(cpu);
+    assert(reg <= 2);
+    u8 reg_low = ((*cpu->wide_register_map[reg]) & 0x00FF);
+    cpu->L = sum_and_set_flags(cpu, cpu->L, reg_low, false, true, false);
+}
 
-                    break;
-                }
+static void add_hl_r16_high(CPU *cpu){
+    u8 reg = get_opcode_r16(cpu);
+    u8 reg_high = ((*cpu->wide_register_map[reg]) & 0xFF00) >> 8;
+    cpu->H = sum_and_set_flags(cpu, cpu->H, reg_high, true, true, false);
 
-                case 0x36:{ // LD [HL], imm8
-                    
-                    if(cpu->machine_cycle == 1){
-                        immr8 = fetch(cpu);    
-                    }
-                    else if(cpu->machine_cycle == 2){
-                        write_memory_cpu(cpu, cpu->HL, immr8);
+    go_to_next_instruction(cpu);
+}
 
-                    }else if(cpu->machine_cycle == 3){
-                        go_to_next_instruction(cpu);
-                    }
+static void add_hl_sp_low(CPU *cpu){
+    u8 reg_low = ((cpu->SP) & 0x00FF);
+    cpu->L = sum_and_set_flags(cpu, cpu->L, reg_low, false, true, false);
+}
 
-                    break;
-                }
+static void add_hl_sp_high(CPU *cpu){
+    u8 reg_high = ((cpu->SP) & 0xFF00) >> 8;
+    cpu->H = sum_and_set_flags(cpu, cpu->H, reg_high, true, true, false);
 
-                case 0x07:{ // RLCA
-                    u8 previous_bit_7 = (cpu->A & 0x80) >> 7;
-                    previous_bit_7 ? set_flag(cpu, FLAG_CARRY) : unset_flag(cpu, FLAG_CARRY);
-                    cpu->A <<= 1;
-                    cpu->A = (cpu->A & (~(0x01))) | previous_bit_7;
+    go_to_next_instruction(cpu);
+}
 
-                    unset_flag(cpu, FLAG_ZERO);
-                    unset_flag(cpu, FLAG_SUB);
-                    unset_flag(cpu, FLAG_HALFCARRY);
+// 8-bit increments, decrements and loads
 
-                    go_to_next_instruction(cpu);
-                    break;
-                }
+static void inc_r8(CPU *cpu){ // B,C,D,E,H,L and A
+    u8 reg = get_opcode_dest_r8(cpu);
+    assert(reg <= 7);
 
-                case 0x0F:{ // RRCA
-                    u8 previous_bit_0 = (cpu->A & 0x01);
-                    previous_bit_0 ? set_flag(cpu, FLAG_CARRY) : unset_flag(cpu, FLAG_CARRY);
-                    cpu->A >>= 1;
-                    cpu->A = (cpu->A & (~(0x80))) | (previous_bit_0 << 7);
+    if(reg < 6)
+        (*cpu->register_map[reg]) = sum_and_set_flags(cpu, (*cpu->register_map[reg]), 1, false, false, true);
+    else if(reg == 7)
+        cpu->A = sum_and_set_flags(cpu, cpu->A, 1, false, false, true);
 
-                    unset_flag(cpu, FLAG_ZERO);
-                    unset_flag(cpu, FLAG_SUB);
-                    unset_flag(cpu, FLAG_HALFCARRY);
+    go_to_next_instruction(cpu);
+}
 
-                    go_to_next_instruction(cpu);
+static void inc_memhl(CPU *cpu){
+    cpu->mem_value = sum_and_set_flags(cpu, cpu->mem_value, 1, false, false, true);
+    write_memory_cpu(cpu, cpu->HL, cpu->mem_value);
+}
 
-                    break;
-                }
+static void dec_r8(CPU *cpu){ // B,C,D,E,H,L and A
+    u8 reg = get_opcode_dest_r8(cpu);
+    assert(reg <= 7);
 
-                case 0x17:{ // RLA
-                    u8 previous_bit_7 = (cpu->A & 0x80) >> 7;
-                    
-                    cpu->A <<= 1;
-                    cpu->A = (cpu->A & (~(0x01))) | ((cpu->flags & FLAG_CARRY) >> 4);
+    if(reg < 6)
+        (*cpu->register_map[reg]) = substract_and_set_flags(cpu, (*cpu->register_map[reg]), 1, false, true);
+    else if(reg == 7)
+        cpu->A = substract_and_set_flags(cpu, cpu->A, 1, false, true);
 
-                    previous_bit_7 ? set_flag(cpu, FLAG_CARRY) : unset_flag(cpu, FLAG_CARRY);
+    go_to_next_instruction(cpu);
+}
 
-                    unset_flag(cpu, FLAG_ZERO);
-                    unset_flag(cpu, FLAG_SUB);
-                    unset_flag(cpu, FLAG_HALFCARRY);
+static void dec_memhl(CPU *cpu){
+    cpu->mem_value = substract_and_set_flags(cpu, cpu->mem_value, 1, false, true);
+    write_memory_cpu(cpu, cpu->HL, cpu->mem_value);
+}
 
-                    go_to_next_instruction(cpu);
+static void ld_r8_imm8(CPU *cpu){
+    u8 reg = get_opcode_dest_r8(cpu);
+    assert(reg <= 7);
 
-                    break;
-                }
+    if(reg < 6)
+        (*cpu->register_map[reg]) = cpu->immr8;
+    else if(reg == 7)
+        cpu->A = cpu->immr8;
 
-                case 0x1F:{ // RRA
-                    u8 previous_bit_0 = (cpu->A & 0x01);
-                    
-                    cpu->A >>= 1;
-                    cpu->A = (cpu->A & (~(0x80))) | ((cpu->flags & FLAG_CARRY) << 3);
+    go_to_next_instruction(cpu);
+}
 
-                    previous_bit_0 ? set_flag(cpu, FLAG_CARRY) : unset_flag(cpu, FLAG_CARRY);
+static void ld_memhl_imm8(CPU *cpu){
+    write_memory_cpu(cpu, cpu->HL, cpu->immr8);
+}
 
-                    unset_flag(cpu, FLAG_ZERO);
-                    unset_flag(cpu, FLAG_SUB);
-                    unset_flag(cpu, FLAG_HALFCARRY);
+static void ld_r8_r8(CPU *cpu){
+    u8 dest = get_opcode_dest_r8(cpu);
+    u8 src  = get_opcode_src_r8(cpu);
+    assert(dest != 6);
+    assert(src  != 6);
+    (*cpu->register_map[dest]) = (*cpu->register_map[src]);
+    go_to_next_instruction(cpu);
+}
 
-                    go_to_next_instruction(cpu);
+static void ld_memhl_r8(CPU *cpu){
+    write_memory_cpu(cpu, cpu->HL, *cpu->register_map[get_opcode_src_r8(cpu)]);
+}
 
-                    break;
-                }
+static void ld_r8_memhl(CPU *cpu){
+    *cpu->register_map[get_opcode_dest_r8(cpu)] = cpu->mem_value;
+    go_to_next_instruction(cpu);
+}
 
-                case 0x27:{ // DAA
-                    if (!(cpu->flags & FLAG_SUB)) {  // after an addition, adjust if (half-)carry occurred or if result is out of bounds
-                        if (cpu->flags & FLAG_CARRY || cpu->A > 0x99) { 
-                            cpu->A += 0x60;
-                            set_flag(cpu, FLAG_CARRY);
-                        }
-                        if((cpu->A & 0x0F) > 9 || cpu->flags & FLAG_HALFCARRY){
-                            cpu->A += 6;
-                        }
-                    } else {  // after a subtraction, only adjust if (half-)carry occurred
-                        if (cpu->flags & FLAG_CARRY){
-                            cpu->A -= 0x60; 
-                        }
-                        if (cpu->flags & FLAG_HALFCARRY){ 
-                            cpu->A -= 0x6; 
-                        }
-                    }
-
-                    unset_flag(cpu, FLAG_HALFCARRY);
-
-                    if(cpu->A == 0)     
-                        set_flag(cpu, FLAG_ZERO);
-                    else
-                        unset_flag(cpu, FLAG_ZERO);
-
-                    go_to_next_instruction(cpu);
+static void halt(CPU *cpu){
+    cpu->halt = true;
+    go_to_next_instruction(cpu);
+}
 
-                    break;
-                }
+// Accumulator and flag instructions
 
-                case 0x2F:{ // CPL
-                    cpu->A = ~cpu->A;
+static void rlca(CPU *cpu){
+    u8 previous_bit_7 = (cpu->A & 0x80) >> 7;
+    previous_bit_7 ? set_flag(cpu, FLAG_CARRY) : unset_flag(cpu, FLAG_CARRY);
+    cpu->A <<= 1;
+    cpu->A = (cpu->A & (~(0x01))) | previous_bit_7;
 
-                    set_flag(cpu, FLAG_HALFCARRY);
-                    set_flag(cpu, FLAG_SUB);
+    unset_flag(cpu, FLAG_ZERO);
+    unset_flag(cpu, FLAG_SUB);
+    unset_flag(cpu, FLAG_HALFCARRY);
 
-                    go_to_next_instruction(cpu);
+    go_to_next_instruction(cpu);
+}
 
-                    break;
-                }
+static void rrca(CPU *cpu){
+    u8 previous_bit_0 = (cpu->A & 0x01);
+    previous_bit_0 ? set_flag(cpu, FLAG_CARRY) : unset_flag(cpu, FLAG_CARRY);
+    cpu->A >>= 1;
+    cpu->A = (cpu->A & (~(0x80))) | (previous_bit_0 << 7);
 
-                case 0x37:{ // SCF
-                    set_flag(cpu, FLAG_CARRY);
+    unset_flag(cpu, FLAG_ZERO);
+    unset_flag(cpu, FLAG_SUB);
+    unset_flag(cpu, FLAG_HALFCARRY);
 
-                    unset_flag(cpu, FLAG_HALFCARRY);
-                    unset_flag(cpu, FLAG_SUB);
+    go_to_next_instruction(cpu);
+}
 
-                    go_to_next_instruction(cpu);
-                    break;
-                }
+static void rla(CPU *cpu){
+    u8 previous_bit_7 = (cpu->A & 0x80) >> 7;
 
-                case 0x3F:{ // CCF
-                    (cpu->flags & FLAG_CARRY) ? unset_flag(cpu, FLAG_CARRY) : set_flag(cpu, FLAG_CARRY);
+    cpu->A <<= 1;
+    cpu->A = (cpu->A & (~(0x01))) | ((get_flags(cpu) & FLAG_CARRY) >> 4);
 
-                    unset_flag(cpu, FLAG_HALFCARRY);
-                    unset_flag(cpu, FLAG_SUB);
+    previous_bit_7 ? set_flag(cpu, FLAG_CARRY) : unset_flag(cpu, FLAG_CARRY);
 
-                    go_to_next_instruction(cpu);
+    unset_flag(cpu, FLAG_ZERO);
+    unset_flag(cpu, FLAG_SUB);
+    unset_flag(cpu, FLAG_HALFCARRY);
 
-                    break;
-                }
+    go_to_next_instruction(cpu);
+}
 
-                case 0x18:{ // JR imm8
-                    
-                    if(cpu->machine_cycle == 1){
-                        immr8 = fetch(cpu);    
-                    }
-                    else if(cpu->machine_cycle == 2){
-                        // bool sign = immr8 & 0x80;
-                        // immr8  = sum_and_set_flags(cpu, immr8, cpu->PCL, true, true);
-                        // i8 adj = 0;
-                        // if((cpu->flags & FLAG_CARRY) && !sign){
-                        //     adj = 1;
-                        // }
-                        // else if(!(cpu->flags & FLAG_CARRY) && sign){
-                        //     adj = -1;
-                        // }
-
-                        // mem_value = cpu->PCH + adj;
-
-
-                        i8 imm8s = (i8)immr8;
-                        u16 target = (mem_value << 8) | immr8;
-                        cpu->PC += imm8s;
-
-                    }else if(cpu->machine_cycle == 3){
-                        go_to_next_instruction(cpu);
-                    }
+static void rra(CPU *cpu){
+    u8 previous_bit_0 = (cpu->A & 0x01);
 
-                    break;
-                }
+    cpu->A >>= 1;
+    cpu->A = (cpu->A & (~(0x80))) | ((get_flags(cpu) & FLAG_CARRY) << 3);
 
-                case 0x20:{ // JR NZ, imm8
-                    
-                    if(cpu->machine_cycle == 1){
-                        immr8 = fetch(cpu);    
-                    }
-                    else if(cpu->machine_cycle == 2){
-                        if(!(cpu->flags & FLAG_ZERO)){
-                            i8 imm8s = (i8)immr8;
-                            u16 target = cpu->PC + imm8s;
-                            cpu->PC = target;
-                        }
-                        else{
-                            go_to_next_instruction(cpu);    
-                        }
-
-                    }else if(cpu->machine_cycle == 3){
-                        go_to_next_instruction(cpu);
-                    }
+    previous_bit_0 ? set_flag(cpu, FLAG_CARRY) : unset_flag(cpu, FLAG_CARRY);
 
-                    break;
-                }
+    unset_flag(cpu, FLAG_ZERO);
+    unset_flag(cpu, FLAG_SUB);
+    unset_flag(cpu, FLAG_HALFCARRY);
 
-                case 0x30:{ // JR NC, imm8
-                    
-                    if(cpu->machine_cycle == 1){
-                        immr8 = fetch(cpu);    
-                    }
-                    else if(cpu->machine_cycle == 2){
-                        if(!(cpu->flags & FLAG_CARRY)){
-                            i8 imm8s = (i8)immr8;
-                            u16 target = cpu->PC + imm8s;
-                            cpu->PC = target;
-                        }
-                        else{
-                            go_to_next_instruction(cpu);    
-                        }
-
-                    }else if(cpu->machine_cycle == 3){
-                        go_to_next_instruction(cpu);
-                    }
+    go_to_next_instruction(cpu);
+}
 
-                    break;
-                }
+static void daa(CPU *cpu){
+    DaaResult result = DAA_RESULT(cpu->A, get_flags(cpu));
+    cpu->A = result.A;
+    cpu->flags = result.flags;
 
-                case 0x28:{ // JR Z, imm8
-                    
-                    if(cpu->machine_cycle == 1){
-                        immr8 = fetch(cpu);    
-                    }
-                    else if(cpu->machine_cycle == 2){
-                        if((cpu->flags & FLAG_ZERO)){
-                            i8 imm8s = (i8)immr8;
-                            u16 target = cpu->PC  + imm8s;
-                            cpu->PC = target;
-                        }
-                        else{
-                            go_to_next_instruction(cpu);    
-                        }
-
-                    }else if(cpu->machine_cycle == 3){
-                        go_to_next_instruction(cpu);
-                    }
+    go_to_next_instruction(cpu);
+}
 
-                    break;
-                }
+static void cpl(CPU *cpu){
+    cpu->A = ~cpu->A;
 
-                case 0x38:{ // JR C, imm8
-                    
-                    if(cpu->machine_cycle == 1){
-                        immr8 = fetch(cpu);    
-                    }
-                    else if(cpu->machine_cycle == 2){
-                        if((cpu->flags & FLAG_CARRY)){
-                            i8 imm8s = (i8)immr8;
-                            u16 target = cpu->PC + imm8s;
-                            cpu->PC = target;
-                        }
-                        else{
-                            go_to_next_instruction(cpu);    
-                        }
-
-                    }else if(cpu->machine_cycle == 3){
-                        go_to_next_instruction(cpu);
-                    }
+    set_flag(cpu, FLAG_HALFCARRY);
+    set_flag(cpu, FLAG_SUB);
 
-                    break;
-                }
+    go_to_next_instruction(cpu);
+}
 
-                // TODO
-                 case 0x10:{ // STOP
-                     
-                     
-                     break;
-                 }
+static void scf(CPU *cpu){
+    set_flag(cpu, FLAG_CARRY);
 
-                default:{
-                    printf("Opcode %X not implemented\n", cpu->opcode);
-                    assert(false);
-                    break;
-                }
+    unset_flag(cpu, FLAG_HALFCARRY);
+    unset_flag(cpu, FLAG_SUB);
 
-                
-            }                
-            break;
-        }
+    go_to_next_instruction(cpu);
+}
 
-        case 0x40:{ // LD r8, r8 instructions
-            
-            if(cpu->machine_cycle == 1){
-                dest = (cpu->opcode & 0x38) >> 3;
-                src  = (cpu->opcode & 0x07);
+static void ccf(CPU *cpu){
+    (get_flags(cpu) & FLAG_CARRY) ? unset_flag(cpu, FLAG_CARRY) : set_flag(cpu, FLAG_CARRY);
 
-                assert(dest <= 7);
-                assert(src <= 7);
+    unset_flag(cpu, FLAG_HALFCARRY);
+    unset_flag(cpu, FLAG_SUB);
 
-                if(dest == 6 && src == 6){
-                    cpu->halt = true;
-                    go_to_next_instruction(cpu);
-                }
-                else if(dest == 6 && src != 6){ // LD [HL], r8
-                    write_memory_cpu(cpu, cpu->HL, *cpu->register_map[src]);
-                }
-                else if(dest != 6 && src == 6){ // LD r8, [HL]
-                    mem_value = read_memory_cpu(cpu, cpu->HL);
-                }
-                else{
-                    assert(dest != 6);
-                    assert(src  != 6);
-                    (*cpu->register_map[dest]) = (*cpu->register_map[src]);
-                    go_to_next_instruction(cpu); 
-                }
-            }
-            else if(cpu->machine_cycle == 2){
-                if(dest != 6 && src == 6){ // LD r8, [HL]
-                    *cpu->register_map[dest] = mem_value;
-                }
+    go_to_next_instruction(cpu);
+}
 
-                go_to_next_instruction(cpu);
-            }
-            break;
-        }
+// TODO
+static void stop(CPU *cpu){
+    cpu->machine_cycle = 0; // Stay on this step until STOP is implemented.
+}
 
-        case 0x80:{
-            switch(cpu->opcode & 0x38){
-                case 0x00:{ // ADD A, r
-                    if(cpu->machine_cycle == 1){
-                        u8 reg  = (cpu->opcode & 0x07);
-                        assert(reg <= 7 && reg >= 0);
-
-                        if(reg != 6){
-                            cpu->A = sum_and_set_flags(cpu, cpu->A, *cpu->register_map[reg], false, true, true);
-                            go_to_next_instruction(cpu);
-                        }
-                        else if (reg == 6){ // ADD A, [HL]
-                            mem_value = read_memory_cpu(cpu, cpu->HL);
-                        }
-
-                    }
-                    else if(cpu->machine_cycle == 2){
-                        // ADD A, [HL]
-                        cpu->A = sum_and_set_flags(cpu, cpu->A, mem_value, false, true, true);
-                        
-                        go_to_next_instruction(cpu);
-                    }
-                    break;
-                }
+// Relative jumps
 
-                case 0x08:{ // ADC A, r
-                    if(cpu->machine_cycle == 1){
-                        u8 reg  = (cpu->opcode & 0x07);
-                        assert(reg <= 7 && reg >= 0);
+static void jr(CPU *cpu){
+    i8 imm8s = (i8)cpu->immr8;
+    cpu->PC += imm8s;
+}
 
-                        if(reg != 6){
-                            cpu->A = sum_and_set_flags_adc(cpu, cpu->A, *cpu->register_map[reg]);
+static void jump_relative_if(CPU *cpu, bool condition){
+    if(condition){
+        i8 imm8s = (i8)cpu->immr8;
+        u16 target = cpu->PC + imm8s;
+        cpu->PC = target;
+    }
+    else{
+        go_to_next_instruction(cpu);
+    }
+}
 
-                            go_to_next_instruction(cpu);
-                        }
-                        else if (reg == 6){ // ADC A, [HL]
-                            mem_value = read_memory_cpu(cpu, cpu->HL);
-                        }
+static void jr_nz(CPU *cpu){ jump_relative_if(cpu, !(get_flags(cpu) & FLAG_ZERO)); }
+static void jr_nc(CPU *cpu){ jump_relative_if(cpu, !(get_flags(cpu) & FLAG_CARRY)); }
+static void jr_z(CPU *cpu) { jump_relative_if(cpu,  (get_flags(cpu) & FLAG_ZERO)); }
+static void jr_c(CPU *cpu) { jump_relative_if(cpu,  (get_flags(cpu) & FLAG_CARRY)); }
 
-                    }
-                    else if(cpu->machine_cycle == 2){
-                        // ADC A, [HL]
-                        cpu->A = sum_and_set_flags_adc(cpu, cpu->A, mem_value);
-                        
-                        go_to_next_instruction(cpu);
-                    }
+// 8-bit arithmetic and logic on the accumulator
 
-                    break;
-                }
+static void alu_add(CPU *cpu, u8 value){
+    cpu->A = sum_and_set_flags(cpu, cpu->A, value, false, true, true);
+}
 
-                case 0x10:{ // SUB A, r
-                    if(cpu->machine_cycle == 1){
-                        u8 reg  = (cpu->opcode & 0x07);
-                        assert(reg <= 7 && reg >= 0);
-
-                        if(reg != 6){
-                            cpu->A = substract_and_set_flags(cpu, cpu->A, *cpu->register_map[reg], true, true);
-                            go_to_next_instruction(cpu);
-                        }
-                        else if (reg == 6){ // SUB A, [HL]
-                            mem_value = read_memory_cpu(cpu, cpu->HL);
-                        }
-
-                    }
-                    else if(cpu->machine_cycle == 2){
-                        // SUB A, [HL]
-                        cpu->A = substract_and_set_flags(cpu, cpu->A, mem_value, true, true);
-                        
-                        go_to_next_instruction(cpu);
-                    }
-                    break;
-                }
+static void alu_adc(CPU *cpu, u8 value){
+    cpu->A = sum_and_set_flags_adc(cpu, cpu->A, value);
+}
 
-                case 0x18:{ // SBC A, r
-                    if(cpu->machine_cycle == 1){
-                        u8 reg  = (cpu->opcode & 0x07);
-                        assert(reg <= 7 && reg >= 0);
-
-                        if(reg != 6){
-                            cpu->A = substract_and_set_flags_sbc(cpu, cpu->A, *cpu->register_map[reg]);
-                            go_to_next_instruction(cpu);
-                        }
-                        else if (reg == 6){ // SBC A, [HL]
-                            mem_value = read_memory_cpu(cpu, cpu->HL);
-                        }
-
-                    }
-                    else if(cpu->machine_cycle == 2){
-                        // SBC A, [HL]
-                        cpu->A = substract_and_set_flags_sbc(cpu, cpu->A, mem_value);
-                        
-                        go_to_next_instruction(cpu);
-                    }
+static void alu_sub(CPU *cpu, u8 value){
+    cpu->A = substract_and_set_flags(cpu, cpu->A, value, true, true);
+}
 
-                    break;
-                }
+static void alu_sbc(CPU *cpu, u8 value){
+    cpu->A = substract_and_set_flags_sbc(cpu, cpu->A, value);
+}
 
-                case 0x20:{ // AND A, r
-                    if(cpu->machine_cycle == 1){
-                        u8 reg  = (cpu->opcode & 0x07);
-                        assert(reg <= 7 && reg >= 0);
-
-                        if(reg != 6){
-                            cpu->A = cpu->A & (*cpu->register_map[reg]);
-                            
-                            cpu->A == 0 ? set_flag(cpu, FLAG_ZERO) : unset_flag(cpu, FLAG_ZERO);
-                            unset_flag(cpu, FLAG_CARRY);
-                            unset_flag(cpu, FLAG_SUB);
-                            set_flag(cpu, FLAG_HALFCARRY);
-                                
-                            go_to_next_instruction(cpu);
-                        }
-                        else if (reg == 6){ // AND A, [HL]
-                            mem_value = read_memory_cpu(cpu, cpu->HL);
-                        }
-
-                    }
-                    else if(cpu->machine_cycle == 2){
-                        // AND A, [HL]
-                        cpu->A = cpu->A & mem_value;
-                            
-                        cpu->A == 0 ? set_flag(cpu, FLAG_ZERO) : unset_flag(cpu, FLAG_ZERO);
-                        unset_flag(cpu, FLAG_CARRY);
-                        unset_flag(cpu, FLAG_SUB);
-                        set_flag(cpu, FLAG_HALFCARRY);
-                        
-                        go_to_next_instruction(cpu);
-                    }
+static void alu_and(CPU *cpu, u8 value){
+    cpu->A = cpu->A & value;
 
-                    break;
-                }
+    cpu->A == 0 ? set_flag(cpu, FLAG_ZERO) : unset_flag(cpu, FLAG_ZERO);
+    unset_flag(cpu, FLAG_CARRY);
+    unset_flag(cpu, FLAG_SUB);
+    set_flag(cpu, FLAG_HALFCARRY);
+}
 
-                case 0x28:{ // XOR A, r
-                    if(cpu->machine_cycle == 1){
-                        u8 reg  = (cpu->opcode & 0x07);
-                        assert(reg <= 7 && reg >= 0);
-
-                        if(reg != 6){
-                            cpu->A = cpu->A ^ (*cpu->register_map[reg]);
-                            
-                            cpu->A == 0 ? set_flag(cpu, FLAG_ZERO) : unset_flag(cpu, FLAG_ZERO);
-                            unset_flag(cpu, FLAG_CARRY);
-                            unset_flag(cpu, FLAG_SUB);
-                            unset_flag(cpu, FLAG_HALFCARRY);
-                                
-                            go_to_next_instruction(cpu);
-                        }
-                        else if (reg == 6){ // XOR A, [HL]
-                            mem_value = read_memory_cpu(cpu, cpu->HL);
-                        }
-
-                    }
-                    else if(cpu->machine_cycle == 2){
-                        // XOR A, [HL]
-                        cpu->A = cpu->A ^ mem_value;
-                            
-                        cpu->A == 0 ? set_flag(cpu, FLAG_ZERO) : unset_flag(cpu, FLAG_ZERO);
-                        unset_flag(cpu, FLAG_CARRY);
-                        unset_flag(cpu, FLAG_SUB);
-                        unset_flag(cpu, FLAG_HALFCARRY);
-                        
-                        go_to_next_instruction(cpu);
-                    }
+static void alu_xor(CPU *cpu, u8 value){
+    cpu->A = cpu->A ^ value;
 
-                    break;
-                }
+    cpu->A == 0 ? set_flag(cpu, FLAG_ZERO) : unset_flag(cpu, FLAG_ZERO);
+    unset_flag(cpu, FLAG_CARRY);
+    unset_flag(cpu, FLAG_SUB);
+    unset_flag(cpu, FLAG_HALFCARRY);
+}
 
-                case 0x30:{ // OR A, r
-                    if(cpu->machine_cycle == 1){
-                        u8 reg  = (cpu->opcode & 0x07);
-                        assert(reg <= 7 && reg >= 0);
-
-                        if(reg != 6){
-                            cpu->A = cpu->A | (*cpu->register_map[reg]);
-                            
-                            cpu->A == 0 ? set_flag(cpu, FLAG_ZERO) : unset_flag(cpu, FLAG_ZERO);
-                            unset_flag(cpu, FLAG_CARRY);
-                            unset_flag(cpu, FLAG_SUB);
-                            unset_flag(cpu, FLAG_HALFCARRY);
-                                
-                            go_to_next_instruction(cpu);
-                        }
-                        else if (reg == 6){ // OR A, [HL]
-                            mem_value = read_memory_cpu(cpu, cpu->HL);
-                        }
-
-                    }
-                    else if(cpu->machine_cycle == 2){
-                        // OR A, [HL]
-                        cpu->A = cpu->A | mem_value;
-                            
-                        cpu->A == 0 ? set_flag(cpu, FLAG_ZERO) : unset_flag(cpu, FLAG_ZERO);
-                        unset_flag(cpu, FLAG_CARRY);
-                        unset_flag(cpu, FLAG_SUB);
-                        unset_flag(cpu, FLAG_HALFCARRY);
-                        
-                        go_to_next_instruction(cpu);
-                    }
+static void alu_or(CPU *cpu, u8 value){
+    cpu->A = cpu->A | value;
 
-                    break;
-                }
+    cpu->A == 0 ? set_flag(cpu, FLAG_ZERO) : unset_flag(cpu, FLAG_ZERO);
+    unset_flag(cpu, FLAG_CARRY);
+    unset_flag(cpu, FLAG_SUB);
+    unset_flag(cpu, FLAG_HALFCARRY);
+}
 
-                case 0x38:{ // CP A, r
-                    if(cpu->machine_cycle == 1){
-                        u8 reg  = (cpu->opcode & 0x07);
-                        assert(reg <= 7 && reg >= 0);
-
-                        if(reg != 6){
-                            substract_and_set_flags(cpu, cpu->A, *cpu->register_map[reg], true, true);
-                            go_to_next_instruction(cpu);
-                        }
-                        else if (reg == 6){ // CP A, [HL]
-                            mem_value = read_memory_cpu(cpu, cpu->HL);
-                        }
-
-                    }
-                    else if(cpu->machine_cycle == 2){
-                        // CP A, [HL]
-                        substract_and_set_flags(cpu, cpu->A, mem_value, true, true);
-                        
-                        go_to_next_instruction(cpu);
-                    }
+static void alu_cp(CPU *cpu, u8 value){
+    substract_and_set_flags(cpu, cpu->A, value, true, true);
+}
 
-                    break;
-                }
+typedef void (*ALUOperation)(CPU *cpu, u8 value);
 
-                default:{
-                    printf("Opcode %X not implemented\n", cpu->opcode);
-                    assert(false);
-                    break;
-                }
-            }
+// Indexed by bits 3-5 of the opcode.
+static const ALUOperation alu_operations[8] = {alu_add, alu_adc, alu_sub, alu_sbc, alu_and, alu_xor, alu_or, alu_cp};
 
-            break;
-        }
+static void alu_a_r8(CPU *cpu){
+    u8 reg = get_opcode_src_r8(cpu);
+    assert(reg != 6);
+    alu_operations[get_opcode_dest_r8(cpu)](cpu, *cpu->register_map[reg]);
+    go_to_next_instruction(cpu);
+}
 
-        case 0xC0:{
-            switch(cpu->opcode){
-                case 0xC6:{ // ADD A, imm8
-                    if(cpu->machine_cycle == 1){
-                        immr8 = fetch(cpu);
-                    }
-                    else if(cpu->machine_cycle == 2){
-                        cpu->A = sum_and_set_flags(cpu, cpu->A, immr8, false, true, true);     
-                        go_to_next_instruction(cpu);
-                    }
+static void alu_a_memhl(CPU *cpu){
+    alu_operations[get_opcode_dest_r8(cpu)](cpu, cpu->mem_value);
+    go_to_next_instruction(cpu);
+}
 
-                    break;
-                }
+static void alu_a_imm8(CPU *cpu){
+    alu_operations[get_opcode_dest_r8(cpu)](cpu, cpu->immr8);
+    go_to_next_instruction(cpu);
+}
 
-                case 0xCE:{ // ADC A, imm8
-                    if(cpu->machine_cycle == 1){
-                        immr8 = fetch(cpu);
-                    }
-                    else if(cpu->machine_cycle == 2){
-                        cpu->A = sum_and_set_flags_adc(cpu, cpu->A, immr8);   
+// Returns, jumps and calls
 
-                        go_to_next_instruction(cpu);
-                    }
+static void ret_if(CPU *cpu, bool condition){
+    if(!condition) cpu->machine_cycle = 4; // Will be 5 next cycle
+}
 
-                    break;
-                }
+static void ret_nz_check(CPU *cpu){ ret_if(cpu, !(get_flags(cpu) & FLAG_ZERO)); }
+static void ret_z_check(CPU *cpu) { ret_if(cpu,  (get_flags(cpu) & FLAG_ZERO)); }
+static void ret_nc_check(CPU *cpu){ ret_if(cpu, !(get_flags(cpu) & FLAG_CARRY)); }
+static void ret_c_check(CPU *cpu) { ret_if(cpu,  (get_flags(cpu) & FLAG_CARRY)); }
 
-                case 0xD6:{ // SUB A, imm8
-                    if(cpu->machine_cycle == 1){
-                        immr8 = fetch(cpu);
-                    }
-                    else if(cpu->machine_cycle == 2){
-                        cpu->A = substract_and_set_flags(cpu, cpu->A, immr8, true, true);     
-                        go_to_next_instruction(cpu);
-                    }
+static void pop_imm_low(CPU *cpu){
+    cpu->imm_low = pop_stack(cpu);
+}
 
-                    break;
-                }
+static void pop_imm_high(CPU *cpu){
+    cpu->imm_high = pop_stack(cpu);
+}
 
-                case 0xDE:{ // SBC A, imm8
-                    if(cpu->machine_cycle == 1){
-                        immr8 = fetch(cpu);
-                    }
-                    else if(cpu->machine_cycle == 2){
-                        cpu->A = substract_and_set_flags_sbc(cpu, cpu->A, immr8);     
-                        go_to_next_instruction(cpu);
-                    }
+static void jump_to_imm(CPU *cpu){
+    cpu->imm = (cpu->imm_high << 8) | (cpu->imm_low);
+    cpu->PC = cpu->imm;
+}
 
-                    break;
-                }
+static void reti_jump(CPU *cpu){
+    jump_to_imm(cpu);
+    cpu->scheduled_ei = true;
+}
 
-                case 0xE6:{ // AND A, imm8
-                    if(cpu->machine_cycle == 1){
-                        immr8 = fetch(cpu);
-                    }
-                    else if(cpu->machine_cycle == 2){
-                        cpu->A = cpu->A & immr8;
+static void return_from_interrupt_routine(CPU *cpu){
+    go_to_next_instruction(cpu);
+    cpu->is_extended = cpu->was_extended;
+    cpu->was_extended = false;
+}
 
-                        cpu->A == 0 ? set_flag(cpu, FLAG_ZERO) : unset_flag(cpu, FLAG_ZERO);
-                        unset_flag(cpu, FLAG_CARRY);
-                        unset_flag(cpu, FLAG_SUB);
-                        set_flag(cpu, FLAG_HALFCARRY);
+static void jump_if(CPU *cpu, bool condition){
+    cpu->imm_high = fetch(cpu);
+    if(!condition){
+        cpu->machine_cycle = 3;
+    }
+}
 
-                        go_to_next_instruction(cpu);
-                    }
+static void jp_nz_fetch(CPU *cpu){ jump_if(cpu, !(get_flags(cpu) & FLAG_ZERO)); }
+static void jp_z_fetch(CPU *cpu) { jump_if(cpu,  (get_flags(cpu) & FLAG_ZERO)); }
+static void jp_nc_fetch(CPU *cpu){ jump_if(cpu, !(get_flags(cpu) & FLAG_CARRY)); }
+static void jp_c_fetch(CPU *cpu) { jump_if(cpu,  (get_flags(cpu) & FLAG_CARRY)); }
 
-                    break;
-                }
+static void jp_hl(CPU *cpu){
+    cpu->PC = cpu->HL;
+    go_to_next_instruction(cpu);
+}
 
-                case 0xEE:{ // XOR A, imm8
-                    if(cpu->machine_cycle == 1){
-                        immr8 = fetch(cpu);
-                    }
-                    else if(cpu->machine_cycle == 2){
-                        cpu->A = cpu->A ^ immr8;
-                        
-                        cpu->A == 0 ? set_flag(cpu, FLAG_ZERO) : unset_flag(cpu, FLAG_ZERO);
-                        unset_flag(cpu, FLAG_CARRY);
-                        unset_flag(cpu, FLAG_SUB);
-                        unset_flag(cpu, FLAG_HALFCARRY);
-
-                        go_to_next_instruction(cpu);
-                    }
+static void call_if(CPU *cpu, bool condition){
+    cpu->imm_high = fetch(cpu);
+    if(!condition){
+        cpu->machine_cycle = 5;
+    }
+}
 
-                    break;
-                }
+static void call_nz_fetch(CPU *cpu){ call_if(cpu, !(get_flags(cpu) & FLAG_ZERO)); }
+static void call_z_fetch(CPU *cpu) { call_if(cpu,  (get_flags(cpu) & FLAG_ZERO)); }
+static void call_nc_fetch(CPU *cpu){ call_if(cpu, !(get_flags(cpu) & FLAG_CARRY)); }
+static void call_c_fetch(CPU *cpu) { call_if(cpu,  (get_flags(cpu) & FLAG_CARRY)); }
 
-                case 0xF6:{ // OR A, imm8
-                    if(cpu->machine_cycle == 1){
-                        immr8 = fetch(cpu);
-                    }
-                    else if(cpu->machine_cycle == 2){
-                        cpu->A = cpu->A | immr8;
-                        
-                        cpu->A == 0 ? set_flag(cpu, FLAG_ZERO) : unset_flag(cpu, FLAG_ZERO);
-                        unset_flag(cpu, FLAG_CARRY);
-                        unset_flag(cpu, FLAG_SUB);
-                        unset_flag(cpu, FLAG_HALFCARRY);
-
-                        go_to_next_instruction(cpu);
-                    }
+static void push_pch(CPU *cpu){
+    assert(cpu->SP > 0);
+    write_memory_cpu(cpu, cpu->SP, cpu->PCH);
+    cpu->SP--;
+}
 
-                    break;
-                }
+static void call_push_pcl(CPU *cpu){
+    write_memory_cpu(cpu, cpu->SP, cpu->PCL);
+    cpu->imm = (cpu->imm_high << 8) | (cpu->imm_low);
+    cpu->PC = cpu->imm;
+}
 
-                case 0xFE:{ // CP A, imm8
-                    if(cpu->machine_cycle == 1){
-                        immr8 = fetch(cpu);
-                    }
-                    else if(cpu->machine_cycle == 2){
-                        substract_and_set_flags(cpu, cpu->A, immr8, true, true);  
+static void rst_push_pcl(CPU *cpu){
+    write_memory_cpu(cpu, cpu->SP, cpu->PCL);
+    u8 target = (cpu->opcode & 0x38) >> 3;
+    u16 address = target * 0x08;
+    cpu->PC = address;
+}
 
-                        go_to_next_instruction(cpu);
-                    }
+// Stack
 
-                    break;
-                }
+static void pop_r16_low(CPU *cpu){
+    cpu->imm_low = read_memory_cpu(cpu, cpu->SP);
+    cpu->SP++;
+}
 
-                case 0xC0:{ // RET NZ
-                    if(cpu->machine_cycle == 1){
-                        if(cpu->flags & FLAG_ZERO) cpu->machine_cycle = 4; // Will be 5 next cycle
-                    }
-                    else if(cpu->machine_cycle == 2){
-                        imm_low = pop_stack(cpu);
-                    }
-                    else if(cpu->machine_cycle == 3){
-                        imm_high = pop_stack(cpu);
-                    }
-                    else if(cpu->machine_cycle == 4){
-                        imm = (imm_high << 8) | (imm_low);
-                        cpu->PC = imm;
-                    }
-                    else if(cpu->machine_cycle == 5){
-                        go_to_next_instruction(cpu);
-                        cpu->is_extended = cpu->was_extended;
-                        cpu->was_extended = false;
-                    }
+static void pop_r16_high(CPU *cpu){
+    assert(cpu->SP > 0);
+    cpu->imm_high = read_memory_cpu(cpu, cpu->SP);
+    cpu->SP++;
+}
 
-                    break;
-                }
+static void pop_r16(CPU *cpu){
+    u8 target = get_opcode_r16(cpu);
+    *(cpu->wide_register_map[target]) = (cpu->imm_high << 8) | cpu->imm_low;
+    if(cpu->opcode == 0xF1){
+        *(cpu->wide_register_map[target]) &= 0xFFF0;
+        cpu->lazy_flags = LAZY_FLAGS_NONE;
+    }
+    go_to_next_instruction(cpu);
+}
 
-                case 0xC8:{ // RET Z
-                    if(cpu->machine_cycle == 1){
-                        if(!(cpu->flags & FLAG_ZERO)) cpu->machine_cycle = 4; // Will be 5 next cycle
-                    }
-                    else if(cpu->machine_cycle == 2){
-                        imm_low = pop_stack(cpu);
-                    }
-                    else if(cpu->machine_cycle == 3){
-                        imm_high = pop_stack(cpu);
-                    }
-                    else if(cpu->machine_cycle == 4){
-                        imm = (imm_high << 8) | (imm_low);
-                        cpu->PC = imm;
-                    }
-                    else if(cpu->machine_cycle == 5){
-                        go_to_next_instruction(cpu);
-                        cpu->is_extended = cpu->was_extended;
-                        cpu->was_extended = false;
-                    }
+static void push_r16_high(CPU *cpu){
+    assert(cpu->SP > 0);
+    u8 src = get_opcode_r16(cpu);
+    write_memory_cpu(cpu, cpu->SP, (u8)((*(cpu->wide_register_map[src]) & 0xFF00) >> 8));
+    cpu->SP--;
+}
 
-                    break;
-                }
+static void push_r16_low(CPU *cpu){
+    u8 src = get_opcode_r16(cpu);
+    if(cpu->opcode == 0xF5) get_flags(cpu);
+    write_memory_cpu(cpu, cpu->SP, (u8)((*(cpu->wide_register_map[src]) & 0x00FF)));
+}
 
-                case 0xD0:{ // RET NC
-                    if(cpu->machine_cycle == 1){
-                        if(cpu->flags & FLAG_CARRY) cpu->machine_cycle = 4; // Will be 5 next cycle
-                    }
-                    else if(cpu->machine_cycle == 2){
-                        imm_low = pop_stack(cpu);
-                    }
-                    else if(cpu->machine_cycle == 3){
-                        imm_high = pop_stack(cpu);
-                    }
-                    else if(cpu->machine_cycle == 4){
-                        imm = (imm_high << 8) | (imm_low);
-                        cpu->PC = imm;
-                    }
-                    else if(cpu->machine_cycle == 5){
-                        go_to_next_instruction(cpu);
-                        cpu->is_extended = cpu->was_extended;
-                        cpu->was_extended = false;
-                    }
+// High RAM and absolute loads
 
-                    break;
-                }
+static void prefix_cb(CPU *cpu){
+    cpu->is_extended = true;
+    go_to_next_instruction(cpu);
+}
 
-                case 0xD8:{ // RET C
-                    if(cpu->machine_cycle == 1){
-                        if(!(cpu->flags & FLAG_CARRY)) cpu->machine_cycle = 4; // Will be 5 next cycle
-                    }
-                    else if(cpu->machine_cycle == 2){
-                        imm_low = pop_stack(cpu);
-                    }
-                    else if(cpu->machine_cycle == 3){
-                        imm_high = pop_stack(cpu);
-                    }
-                    else if(cpu->machine_cycle == 4){
-                        imm = (imm_high << 8) | (imm_low);
-                        cpu->PC = imm;
-                    }
-                    else if(cpu->machine_cycle == 5){
-                        go_to_next_instruction(cpu);
-                        cpu->is_extended = cpu->was_extended;
-                        cpu->was_extended = false;
-                    }
+static void ldh_c_a(CPU *cpu){
+    u16 address = 0xFF00 + cpu->C;
+    write_memory_cpu(cpu, address, cpu->A);
+}
 
-                    break;
-                }
+static void ldh_imm8_a(CPU *cpu){
+    u16 address = 0xFF00 + cpu->immr8;
+    write_memory_cpu(cpu, address, cpu->A);
+}
 
-                case 0xC9:{ // RET
-                    if(cpu->machine_cycle == 1){
-                        imm_low = pop_stack(cpu);
-                    }
-                    else if(cpu->machine_cycle == 2){
-                        imm_high = pop_stack(cpu);
-                    }
-                    else if(cpu->machine_cycle == 3){
-                        imm = (imm_high << 8) | (imm_low);
-                        cpu->PC = imm;
-                    }
-                    else if(cpu->machine_cycle == 4){
-                        go_to_next_instruction(cpu);
-                    }
+static void ld_imm16_a(CPU *cpu){
+    write_memory_cpu(cpu, cpu->imm, cpu->A);
+}
 
-                    break;
-                }
+static void ldh_a_c_read(CPU *cpu){
+    u16 address = 0xFF00 + cpu->C;
+    cpu->mem_value = read_memory_cpu(cpu, address);
+}
 
-                case 0xD9:{ // RETI
-                    if(cpu->machine_cycle == 1){
-                        imm_low = pop_stack(cpu);
-                    }
-                    else if(cpu->machine_cycle == 2){
-                        imm_high = pop_stack(cpu);
-                    }
-                    else if(cpu->machine_cycle == 3){
-                        imm = (imm_high << 8) | (imm_low);
-                        cpu->PC = imm;
-                        cpu->scheduled_ei = true;
-                    }
-                    else if(cpu->machine_cycle == 4){
-                        go_to_next_instruction(cpu);
-                        cpu->is_extended = cpu->was_extended;
-                        cpu->was_extended = false;
-                    }
+static void ldh_a_imm8_read(CPU *cpu){
+    u16 address = 0xFF00 + cpu->immr8;
+    cpu->mem_value = read_memory_cpu(cpu, address);
+}
 
-                    break;
-                }
+static void ld_a_imm16_read(CPU *cpu){
+    cpu->mem_value = read_memory_cpu(cpu, cpu->imm);
+}
 
-                case 0xC2:{ // JP NZ, imm16
-                    if(cpu->machine_cycle == 1){
-                        imm_low = fetch(cpu);;
-                    }
-                    else if(cpu->machine_cycle == 2){
-                        imm_high = fetch(cpu);
-                        if((cpu->flags & FLAG_ZERO)){
-                            cpu->machine_cycle = 3;
-                        }
-                    }
-                    else if(cpu->machine_cycle == 3){
-                        imm = (imm_high << 8) | (imm_low);
-                        cpu->PC = imm;
-                    }
-                    else if(cpu->machine_cycle == 4){
-                        go_to_next_instruction(cpu);
-                    }
-                    break;
-                }
+// Stack pointer arithmetic
 
-                case 0xCA:{ // JP Z, imm16
-                    if(cpu->machine_cycle == 1){
-                        imm_low = fetch(cpu);;
-                    }
-                    else if(cpu->machine_cycle == 2){
-                        imm_high = fetch(cpu);
-                        if(!(cpu->flags & FLAG_ZERO)){
-                            cpu->machine_cycle = 3;
-                        }
-                    }
-                    else if(cpu->machine_cycle == 3){
-                        imm = (imm_high << 8) | (imm_low);
-                        cpu->PC = imm;
-                    }
-                    else if(cpu->machine_cycle == 4){
-                        go_to_next_instruction(cpu);
-                    }
+static void add_sp_e_flags(CPU *cpu){
+    sum_and_set_flags(cpu, cpu->SPL, cpu->immr8, false, true);
+}
 
-                    break;
-                }
+static void add_sp_e(CPU *cpu){
+    unset_flag(cpu, FLAG_ZERO);
 
-                case 0xD2:{ // JP NC, imm16
-                    if(cpu->machine_cycle == 1){
-                        imm_low = fetch(cpu);;
-                    }
-                    else if(cpu->machine_cycle == 2){
-                        imm_high = fetch(cpu);
-                        if((cpu->flags & FLAG_CARRY)){
-                            cpu->machine_cycle = 3;
-                        }
-                    }
-                    else if(cpu->machine_cycle == 3){
-                        imm = (imm_high << 8) | (imm_low);
-                        cpu->PC = imm;
-                    }
-                    else if(cpu->machine_cycle == 4){
-                        go_to_next_instruction(cpu);
-                    }
-                    break;
-                }
+    i8 imm8s = (i8)cpu->immr8;
+    cpu->SP += imm8s;
+    go_to_next_instruction(cpu);
+}
 
-                case 0xDA:{ // JP C, imm16
-                    if(cpu->machine_cycle == 1){
-                        imm_low = fetch(cpu);;
-                    }
-                    else if(cpu->machine_cycle == 2){
-                        imm_high = fetch(cpu);
-                        if(!(cpu->flags & FLAG_CARRY)){
-                            cpu->machine_cycle = 3;
-                        }
-                    }
-                    else if(cpu->machine_cycle == 3){
-                        imm = (imm_high << 8) | (imm_low);
-                        cpu->PC = imm;
-                    }
-                    else if(cpu->machine_cycle == 4){
-                        go_to_next_instruction(cpu);
-                    }
+static void ld_hl_sp_e(CPU *cpu){
+    unset_flag(cpu, FLAG_ZERO);
 
-                    break;
-                }
+    i8 imm8s = (i8)cpu->immr8;
+    cpu->HL = cpu->SP + imm8s;
+    go_to_next_instruction(cpu);
+}
 
-                case 0xC3:{ // JP imm16
-                    if(cpu->machine_cycle == 1){
-                        imm_low = fetch(cpu);;
-                    }
-                    else if(cpu->machine_cycle == 2){
-                        imm_high = fetch(cpu);
-                    }
-                    else if(cpu->machine_cycle == 3){
-                        imm = (imm_high << 8) | (imm_low);
-                        cpu->PC = imm;
-                    }
-                    else if(cpu->machine_cycle == 4){
-                        go_to_next_instruction(cpu);
-                    }
+static void ld_sp_hl(CPU *cpu){
+    cpu->SP = cpu->HL;
+}
 
-                    break;
-                }
+static void di(CPU *cpu){
+    cpu->IME = false;
+    cpu->scheduled_ei = false;
+    go_to_next_instruction(cpu);
+}
 
-                case 0xE9:{ // JP HL
-                    cpu->PC = cpu->HL;
-                    go_to_next_instruction(cpu);
+static void ei(CPU *cpu){
+    cpu->scheduled_ei = true;
+    go_to_next_instruction(cpu);
+}
 
-                    break;
-                }
+// Opcodes prefixed with 0xCB
 
-                case 0xC4:{ // CALL NZ, imm16
-                    if(cpu->machine_cycle == 1){
-                        imm_low = fetch(cpu);;
-                    }
-                    else if(cpu->machine_cycle == 2){
-                        imm_high = fetch(cpu);
-                        if(cpu->flags & FLAG_ZERO){
-                            cpu->machine_cycle = 5;
-                        }
-                    }
-                    else if(cpu->machine_cycle == 3){
-                        cpu->SP--;
-                    }
-                    else if(cpu->machine_cycle == 4){
-                        assert(cpu->SP > 0);
-                        write_memory_cpu(cpu, cpu->SP, cpu->PCH);
-                        cpu->SP--;
-                    }
-                    else if(cpu->machine_cycle == 5){
-                        write_memory_cpu(cpu, cpu->SP, cpu->PCL);
-                        imm = (imm_high << 8) | (imm_low);
-                        cpu->PC = imm;
-                    }
-                    else if(cpu->machine_cycle == 6){
-                        go_to_next_instruction(cpu);
-                    }
+static u8 rotate_left_circular(CPU *cpu, u8 value){
+    u8 previous_bit_7 = (value & 0x80) >> 7;
+    previous_bit_7 ? set_flag(cpu, FLAG_CARRY) : unset_flag(cpu, FLAG_CARRY);
+    value <<= 1;
+    value = (value & (~(0x01))) | previous_bit_7;
 
-                    break;
-                }
+    set_zero_flag_from(cpu, value);
+    unset_flag(cpu, FLAG_SUB);
+    unset_flag(cpu, FLAG_HALFCARRY);
+    return value;
+}
 
-                case 0xCC:{ // CALL Z, imm16
-                    if(cpu->machine_cycle == 1){
-                        imm_low = fetch(cpu);;
-                    }
-                    else if(cpu->machine_cycle == 2){
-                        imm_high = fetch(cpu);
-                        if(!(cpu->flags & FLAG_ZERO)){
-                            cpu->machine_cycle = 5;
-                        }
-                    }
-                    else if(cpu->machine_cycle == 3){
-                        cpu->SP--;
-                    }
-                    else if(cpu->machine_cycle == 4){
-                        assert(cpu->SP > 0);
-                        write_memory_cpu(cpu, cpu->SP, cpu->PCH);
-                        cpu->SP--;
-                    }
-                    else if(cpu->machine_cycle == 5){
-                        write_memory_cpu(cpu, cpu->SP, cpu->PCL);
-                        imm = (imm_high << 8) | (imm_low);
-                        cpu->PC = imm;
-                    }
-                    else if(cpu->machine_cycle == 6){
-                        go_to_next_instruction(cpu);
-                    }
+static u8 rotate_right_circular(CPU *cpu, u8 value){
+    u8 previous_bit_0 = (value & 0x01);
+    previous_bit_0 ? set_flag(cpu, FLAG_CARRY) : unset_flag(cpu, FLAG_CARRY);
+    value >>= 1;
+    value = (value & (~(0x80))) | (previous_bit_0 << 7);
 
-                    break;
-                }
+    set_zero_flag_from(cpu, value);
+    unset_flag(cpu, FLAG_SUB);
+    unset_flag(cpu, FLAG_HALFCARRY);
+    return value;
+}
 
-                case 0xD4:{ // CALL NC, imm16
-                    if(cpu->machine_cycle == 1){
-                        imm_low = fetch(cpu);;
-                    }
-                    else if(cpu->machine_cycle == 2){
-                        imm_high = fetch(cpu);
-                        if(cpu->flags & FLAG_CARRY){
-                            cpu->machine_cycle = 5;
-                        }
-                    }
-                    else if(cpu->machine_cycle == 3){
-                        cpu->SP--;
-                    }
-                    else if(cpu->machine_cycle == 4){
-                        assert(cpu->SP > 0);
-                        write_memory_cpu(cpu, cpu->SP, cpu->PCH);
-                        cpu->SP--;
-                    }
-                    else if(cpu->machine_cycle == 5){
-                        write_memory_cpu(cpu, cpu->SP, cpu->PCL);
-                        imm = (imm_high << 8) | (imm_low);
-                        cpu->PC = imm;
-                    }
-                    else if(cpu->machine_cycle == 6){
-                        go_to_next_instruction(cpu);
-                    }
+static u8 rotate_left(CPU *cpu, u8 value){
+    u8 previous_bit_7 = (value & 0x80) >> 7;
 
-                    break;
-                }
+    value <<= 1;
+    value = (value & (~(0x01))) | ((get_flags(cpu) & FLAG_CARRY) >> 4);
 
-                case 0xDC:{ // CALL C, imm16
-                    if(cpu->machine_cycle == 1){
-                        imm_low = fetch(cpu);;
-                    }
-                    else if(cpu->machine_cycle == 2){
-                        imm_high = fetch(cpu);
-                        if(!(cpu->flags & FLAG_CARRY)){
-                            cpu->machine_cycle = 5;
-                        }
-                    }
-                    else if(cpu->machine_cycle == 3){
-                        cpu->SP--;
-                    }
-                    else if(cpu->machine_cycle == 4){
-                        assert(cpu->SP > 0);
-                        write_memory_cpu(cpu, cpu->SP, cpu->PCH);
-                        cpu->SP--;
-                    }
-                    else if(cpu->machine_cycle == 5){
-                        write_memory_cpu(cpu, cpu->SP, cpu->PCL);
-                        imm = (imm_high << 8) | (imm_low);
-                        cpu->PC = imm;
-                    }
-                    else if(cpu->machine_cycle == 6){
-                        go_to_next_instruction(cpu);
-                    }
+    previous_bit_7 ? set_flag(cpu, FLAG_CARRY) : unset_flag(cpu, FLAG_CARRY);
 
-                    break;
-                }
+    set_zero_flag_from(cpu, value);
+    unset_flag(cpu, FLAG_SUB);
+    unset_flag(cpu, FLAG_HALFCARRY);
+    return value;
+}
 
-                case 0xCD:{ // CALL imm16
-                    if(cpu->machine_cycle == 1){
-                        imm_low = fetch(cpu);;
-                    }
-                    else if(cpu->machine_cycle == 2){
-                        imm_high = fetch(cpu);
-                    }
-                    else if(cpu->machine_cycle == 3){
-                        cpu->SP--;
-                    }
-                    else if(cpu->machine_cycle == 4){
-                        assert(cpu->SP > 0);
-                        write_memory_cpu(cpu, cpu->SP, cpu->PCH);
-                        cpu->SP--;
-                    }
-                    else if(cpu->machine_cycle == 5){
-                        write_memory_cpu(cpu, cpu->SP, cpu->PCL);
-                        imm = (imm_high << 8) | (imm_low);
-                        cpu->PC = imm;
-                    }
-                    else if(cpu->machine_cycle == 6){
-                        go_to_next_instruction(cpu);
-                    }
+static u8 rotate_right(CPU *cpu, u8 value){
+    u8 previous_bit_0 = (value & 0x01);
 
-                    break;
-                }
+    value >>= 1;
+    value = (value & (~(0x80))) | ((get_flags(cpu) & FLAG_CARRY) << 3);
 
-                case 0xC7:
-                case 0xD7:
-                case 0xE7:
-                case 0xF7:
-                case 0xCF:
-                case 0xDF:
-                case 0xEF:
-                case 0xFF:{ // RST
-                    if(cpu->machine_cycle == 1){
-                        cpu->SP--;
-                    }
-                    else if(cpu->machine_cycle == 2){
-                        assert(cpu->SP > 0);
-                        write_memory_cpu(cpu, cpu->SP, cpu->PCH);
-                        cpu->SP--;
-                    }
-                    else if(cpu->machine_cycle == 3){
-                        write_memory_cpu(cpu, cpu->SP, cpu->PCL);
-                        u8 target = (cpu->opcode & 0x38) >> 3;
-                        u16 address = target * 0x08;
-                        cpu->PC = address;
-                    }
-                    else if(cpu->machine_cycle == 4){
-                        go_to_next_instruction(cpu);
-                    }
+    previous_bit_0 ? set_flag(cpu, FLAG_CARRY) : unset_flag(cpu, FLAG_CARRY);
 
-                    break;
-                }
+    set_zero_flag_from(cpu, value);
+    unset_flag(cpu, FLAG_SUB);
+    unset_flag(cpu, FLAG_HALFCARRY);
+    return value;
+}
 
-                case 0xC1:
-                case 0xD1:
-                case 0xE1:
-                case 0xF1:{ // POP r16
-                    if(cpu->machine_cycle == 1){
-                        imm_low = read_memory_cpu(cpu, cpu->SP);
-                        cpu->SP++;
-                    }
-                    else if(cpu->machine_cycle == 2){
-                        assert(cpu->SP > 0);
-                        imm_high = read_memory_cpu(cpu, cpu->SP);
-                        cpu->SP++;
-                    }
-                    else if(cpu->machine_cycle == 3){
-                        u8 target = (cpu->opcode & 0x30) >> 4;
-                        *(cpu->wide_register_map[target]) = (imm_high << 8) | imm_low;
-                        if(cpu->opcode == 0xF1){
-                            *(cpu->wide_register_map[target]) &= 0xFFF0;
-                        }
-                        go_to_next_instruction(cpu);
-                    }
+static u8 shift_left_arithmetic(CPU *cpu, u8 value){
+    u8 previous_bit_7 = (value & 0x80) >> 7;
+    previous_bit_7 ? set_flag(cpu, FLAG_CARRY) : unset_flag(cpu, FLAG_CARRY);
+    value <<= 1;
 
-                    break;
-                }
+    set_zero_flag_from(cpu, value);
+    unset_flag(cpu, FLAG_SUB);
+    unset_flag(cpu, FLAG_HALFCARRY);
+    return value;
+}
 
-                case 0xC5:
-                case 0xD5:
-                case 0xE5:
-                case 0xF5:{ // PUSH r16
-                    if(cpu->machine_cycle == 1){
-                        cpu->SP--;
-                    }
-                    else if(cpu->machine_cycle == 2){
-                        assert(cpu->SP > 0);
-                        u8 src = (cpu->opcode & 0x30) >> 4;
-                        write_memory_cpu(cpu, cpu->SP, (u8)((*(cpu->wide_register_map[src]) & 0xFF00) >> 8));
-                        cpu->SP--;
-                    }
-                    else if(cpu->machine_cycle == 3){
-                        u8 src = (cpu->opcode & 0x30) >> 4;
-                        write_memory_cpu(cpu, cpu->SP, (u8)((*(cpu->wide_register_map[src]) & 0x00FF)));
-                    }
-                    else if(cpu->machine_cycle == 4){
-                        go_to_next_instruction(cpu);
-                    }
+static u8 shift_right_arithmetic(CPU *cpu, u8 value){
+    u8 previous_bit_0 = value & 0x01;
+    previous_bit_0 ? set_flag(cpu, FLAG_CARRY) : unset_flag(cpu, FLAG_CARRY);
 
-                    break;
-                }
+    u8 bit_7 = value & 0x80;
+    value >>= 1;
+    value |= bit_7;
 
-                case 0xCB:{
-                    cpu->is_extended = true;
-                    go_to_next_instruction(cpu);
-                    break;
-                }
+    set_zero_flag_from(cpu, value);
+    unset_flag(cpu, FLAG_SUB);
+    unset_flag(cpu, FLAG_HALFCARRY);
+    return value;
+}
 
-                case 0xE2:{ // LDH [C], A
-                    if(cpu->machine_cycle == 1){
-                        u16 address = 0xFF00 + cpu->C;
-                        write_memory_cpu(cpu, address, cpu->A);
-                    }
-                    else if(cpu->machine_cycle == 2){
-                        go_to_next_instruction(cpu);
-                    }
+static u8 swap(CPU *cpu, u8 value){
+    u8 upper_nibble = value & 0xF0;
+    u8 lower_nibble = value & 0x0F;
 
-                    break;
-                } 
-
-                case 0xE0:{ // LDH [imm8], A
-                    if(cpu->machine_cycle == 1){
-                        immr8 = fetch(cpu);
-                    }
-                    else if(cpu->machine_cycle == 2){
-                        u16 address = 0xFF00 + immr8;
-                        write_memory_cpu(cpu, address, cpu->A);
-                    }
-                    else if(cpu->machine_cycle == 3){
-                        go_to_next_instruction(cpu);
-                    }
-                        
-                    break;
-                }
+    value = (upper_nibble >> 4) | (lower_nibble << 4);
 
-                case 0xEA:{ // LDH [imm16], A
-                    if(cpu->machine_cycle == 1){
-                        imm_low = fetch(cpu);
-                    }
-                    else if(cpu->machine_cycle == 2){
-                        imm_high = fetch(cpu);
-                    }
-                    else if(cpu->machine_cycle == 3){
-                        write_memory_cpu(cpu, imm, cpu->A);
-                    }
-                    else if(cpu->machine_cycle == 4){
-                        go_to_next_instruction(cpu);
-                    }
-                        
-                    break;
-                }
+    set_zero_flag_from(cpu, value);
+    unset_flag(cpu, FLAG_CARRY);
+    unset_flag(cpu, FLAG_SUB);
+    unset_flag(cpu, FLAG_HALFCARRY);
+    return value;
+}
 
-                case 0xF2:{ // LDH A, [C]
-                    if(cpu->machine_cycle == 1){
-                        u16 address = 0xFF00 + cpu->C;
-                        mem_value = read_memory_cpu(cpu, address);
-                    }
-                    else if(cpu->machine_cycle == 2){
-                        cpu->A = mem_value;
-                        go_to_next_instruction(cpu);
-                    }
+static u8 shift_right_logical(CPU *cpu, u8 value){
+    u8 previous_bit_0 = value & 0x01;
+    previous_bit_0 ? set_flag(cpu, FLAG_CARRY) : unset_flag(cpu, FLAG_CARRY);
 
-                    break;
-                } 
-
-                case 0xF0:{ // LDH A, [imm8]
-                    if(cpu->machine_cycle == 1){
-                        immr8 = fetch(cpu);
-                    }
-                    else if(cpu->machine_cycle == 2){
-                        u16 address = 0xFF00 + immr8;
-                        mem_value = read_memory_cpu(cpu, address);
-                    }
-                    else if(cpu->machine_cycle == 3){
-                        cpu->A = mem_value;
-                        go_to_next_instruction(cpu);
-                    }
-                        
-                    break;
-                }
+    value >>= 1;
 
-                case 0xFA:{ // LDH A, [imm16]
-                    if(cpu->machine_cycle == 1){
-                        imm_low = fetch(cpu);
-                    }
-                    else if(cpu->machine_cycle == 2){
-                        imm_high = fetch(cpu);
-                    }
-                    else if(cpu->machine_cycle == 3){
-                        mem_value = read_memory_cpu(cpu, imm);
-                    }
-                    else if(cpu->machine_cycle == 4){
-                        cpu->A = mem_value;
-                        go_to_next_instruction(cpu);
-                    }
-                        
-                    break;
-                }
+    set_zero_flag_from(cpu, value);
+    unset_flag(cpu, FLAG_SUB);
+    unset_flag(cpu, FLAG_HALFCARRY);
+    return value;
+}
 
-                case 0xE8:{ // ADD SP, e
-                    if(cpu->machine_cycle == 1){
-                        immr8 = fetch(cpu);
-                        // sign = immr8 & 0x80;
-                    }
-                    else if(cpu->machine_cycle == 2){
-                        sum_and_set_flags(cpu, cpu->SPL, immr8, false, true);
-                    }
-                    else if(cpu->machine_cycle == 3){
-                        
-                        // i8 adj = 0;
-                        // if((cpu->flags & FLAG_CARRY) && !sign){
-                        //     adj = 1;
-                        // }
-                        // else if(!(cpu->flags & FLAG_CARRY) && sign){
-                        //     adj = -1;
-                        // }
-                        // mem_value = cpu->SPH + adj + ((cpu->flags & FLAG_CARRY) >> 4);   
-                    }
-                    else if(cpu->machine_cycle == 4){
-                        unset_flag(cpu, FLAG_ZERO);
-
-                        i8 imm8s = (i8)immr8;
-                        cpu->SP += imm8s;
-                        go_to_next_instruction(cpu);
-                    }
-                    break;
-                }
+typedef u8 (*ShiftOperation)(CPU *cpu, u8 value);
 
-                case 0xF8:{ // LD HL, SP+e
-                    if(cpu->machine_cycle == 1){
-                        immr8 = fetch(cpu);
-                    }
-                    else if(cpu->machine_cycle == 2){
-                        sum_and_set_flags(cpu, cpu->SPL, immr8, false, true);
-                    }
-                    else if(cpu->machine_cycle == 3){
-                        unset_flag(cpu, FLAG_ZERO);
-
-                        i8 imm8s = (i8)immr8;
-                        cpu->HL = cpu->SP + imm8s;
-                        go_to_next_instruction(cpu);
-                    }
-                    break;
-                }
+// Indexed by bits 3-5 of the prefixed opcode.
+static const ShiftOperation shift_operations[8] = {
+    rotate_left_circular, rotate_right_circular, rotate_left, rotate_right,
+    shift_left_arithmetic, shift_right_arithmetic, swap, shift_right_logical
+};
 
-                case 0xF9:{ // LD SP, HL
-                    if(cpu->machine_cycle == 1){
-                        cpu->SP = cpu->HL;
-                    }
-                    else if(cpu->machine_cycle == 2){
-                        go_to_next_instruction(cpu);
-                    }
+static void cb_shift_r8(CPU *cpu){
+    u8 *reg = cpu->register_map[get_opcode_src_r8(cpu)];
+    *reg = shift_operations[get_opcode_dest_r8(cpu)](cpu, *reg);
 
-                    break;
-                }
+    go_to_next_instruction(cpu);
+    cpu->is_extended = false;
+}
 
-                case 0xF3:{ // DI
-                    cpu->IME = false;
-                    cpu->scheduled_ei = false;
-                    go_to_next_instruction(cpu);
-                    break;
-                }
+static void cb_shift_memhl(CPU *cpu){
+    cpu->mem_value = shift_operations[get_opcode_dest_r8(cpu)](cpu, cpu->mem_value);
+    write_memory_cpu(cpu, cpu->HL, cpu->mem_value);
+}
 
-                case 0xFB:{ // EI
-                    cpu->scheduled_ei = true;
-                    go_to_next_instruction(cpu);
-                    break;
-                }
-                
-                default:{
-                    printf("Opcode %X not implemented\n", cpu->opcode);
-                    assert(false);
-                    break;
-                }
+static void test_bit(CPU *cpu, u8 value){
+    value & (1 << get_opcode_bit(cpu)) ? unset_flag(cpu, FLAG_ZERO) : set_flag(cpu, FLAG_ZERO);
 
-            }
-            
+    unset_flag(cpu, FLAG_SUB);
+    set_flag(cpu, FLAG_HALFCARRY);
+}
 
-            break;
-        }
+static void cb_bit_r8(CPU *cpu){
+    test_bit(cpu, *cpu->register_map[get_opcode_src_r8(cpu)]);
 
-        default:{
-            printf("Opcode %X not implemented\n", cpu->opcode);
-            assert(false);
-            break;
-        }
+    go_to_next_instruction(cpu);
+    cpu->is_extended = false;
+}
+
+static void cb_bit_memhl(CPU *cpu){
+    test_bit(cpu, cpu->mem_value);
+
+    write_memory_cpu(cpu, cpu->HL, cpu->mem_value);
+    go_to_next_instruction(cpu);
+    cpu->is_extended = false;
+}
+
+static void cb_res_r8(CPU *cpu){
+    (*cpu->register_map[get_opcode_src_r8(cpu)]) &= ~(1 << get_opcode_bit(cpu));
+
+    go_to_next_instruction(cpu);
+    cpu->is_extended = false;
+}
+
+static void cb_res_memhl(CPU *cpu){
+    cpu->mem_value &= ~(1 << get_opcode_bit(cpu));
+    write_memory_cpu(cpu, cpu->HL, cpu->mem_value);
+}
+
+static void cb_set_r8(CPU *cpu){
+    (*cpu->register_map[get_opcode_src_r8(cpu)]) |= (1 << get_opcode_bit(cpu));
+
+    go_to_next_instruction(cpu);
+    cpu->is_extended = false;
+}
+
+static void cb_set_memhl(CPU *cpu){
+    cpu->mem_value |= (1 << get_opcode_bit(cpu));
+    write_memory_cpu(cpu, cpu->HL, cpu->mem_value);
+}
+
+// Opcode tables
+
+static constexpr OpcodeSteps micro_steps(MicroStep s0, MicroStep s1 = NULL, MicroStep s2 = NULL, MicroStep s3 = NULL, MicroStep s4 = NULL, MicroStep s5 = NULL){
+    OpcodeSteps entry = {{s0, s1, s2, s3, s4, s5}, 0};
+    for(int i = 0; i < MAX_MICRO_STEPS; i++){
+        if(entry.steps[i]) entry.cycles++;
+        else entry.steps[i] = unimplemented;
     }
+    return entry;
+}
+
+static constexpr OpcodeTable build_opcode_table(){
+    OpcodeTable table = {};
+    for(int i = 0; i < 256; i++){
+        table.base[i] = micro_steps(unimplemented);
     }
-    else{ // Opcodes prefixed with 0xCB
-        switch(cpu->opcode & 0xC0){
-            case 0x00:{
-                switch(cpu->opcode & 0x38){
-                    case 0x00:{ // RLC r
-                        if(cpu->machine_cycle == 1){
-                            u8 reg = cpu->opcode & 0x07;
-                            if(reg != 6){
-                                u8 previous_bit_7 = (*(cpu->register_map[reg]) & 0x80) >> 7;
-                                previous_bit_7 ? set_flag(cpu, FLAG_CARRY) : unset_flag(cpu, FLAG_CARRY);
-                                *(cpu->register_map[reg]) <<= 1;
-                                *(cpu->register_map[reg]) = (*(cpu->register_map[reg]) & (~(0x01))) | previous_bit_7;
-
-                                if(*(cpu->register_map[reg]) == 0)
-                                    set_flag(cpu, FLAG_ZERO);
-                                else
-                                    unset_flag(cpu, FLAG_ZERO);    
-                                unset_flag(cpu, FLAG_SUB);
-                                unset_flag(cpu, FLAG_HALFCARRY);
-
-                                go_to_next_instruction(cpu);
-                                cpu->is_extended = false;
-                            }
-                            else{
-                                mem_value = read_memory_cpu(cpu, cpu->HL);
-                            }
-                        
-                        }
-                        else if(cpu->machine_cycle == 2){
-                            u8 previous_bit_7 = (mem_value & 0x80) >> 7;
-                            previous_bit_7 ? set_flag(cpu, FLAG_CARRY) : unset_flag(cpu, FLAG_CARRY);
-                            mem_value <<= 1;
-                            mem_value = (mem_value & (~(0x01))) | previous_bit_7;
-
-                            if(mem_value == 0)
-                                set_flag(cpu, FLAG_ZERO);
-                            else
-                                unset_flag(cpu, FLAG_ZERO);    
-
-                            unset_flag(cpu, FLAG_SUB);
-                            unset_flag(cpu, FLAG_HALFCARRY); 
-
-                            write_memory_cpu(cpu, cpu->HL, mem_value);
-                        }
-                        else if(cpu->machine_cycle == 3){
-                            go_to_next_instruction(cpu);
-                            cpu->is_extended = false;
-                        }
-
-                        break;
-                    }
-
-                    case 0x08:{ // RRC r
-                        if(cpu->machine_cycle == 1){
-                            u8 reg = cpu->opcode & 0x07;
-                            if(reg != 6){
-                                u8 previous_bit_0 = (*(cpu->register_map[reg]) & 0x01);
-                                previous_bit_0 ? set_flag(cpu, FLAG_CARRY) : unset_flag(cpu, FLAG_CARRY);
-                                *(cpu->register_map[reg]) >>= 1;
-                                *(cpu->register_map[reg]) = (*(cpu->register_map[reg]) & (~(0x80))) | (previous_bit_0 << 7);
-
-                                if(*(cpu->register_map[reg]) == 0)
-                                    set_flag(cpu, FLAG_ZERO);
-                                else
-                                    unset_flag(cpu, FLAG_ZERO); 
-
-                                unset_flag(cpu, FLAG_SUB);
-                                unset_flag(cpu, FLAG_HALFCARRY);
-
-                                go_to_next_instruction(cpu);
-                                cpu->is_extended = false;
-                            }
-                            else{
-                                mem_value = read_memory_cpu(cpu, cpu->HL);
-                            }
-                        
-                        }
-                        else if(cpu->machine_cycle == 2){
-                            u8 previous_bit_0 = (mem_value & 0x01);
-                            previous_bit_0 ? set_flag(cpu, FLAG_CARRY) : unset_flag(cpu, FLAG_CARRY);
-                            mem_value >>= 1;
-                            mem_value = (mem_value & (~(0x80))) | (previous_bit_0 << 7);
-
-                            if(mem_value == 0)
-                                set_flag(cpu, FLAG_ZERO);
-                            else
-                                unset_flag(cpu, FLAG_ZERO); 
-
-                            unset_flag(cpu, FLAG_SUB);
-                            unset_flag(cpu, FLAG_HALFCARRY);
-
-                            write_memory_cpu(cpu, cpu->HL, mem_value);
-                        }
-                        else if(cpu->machine_cycle == 3){
-                            go_to_next_instruction(cpu);
-                            cpu->is_extended = false;
-                        }
-
-                        break;
-                    }
-
-                    case 0x10:{ // RL r
-                        if(cpu->machine_cycle == 1){
-                            u8 reg = cpu->opcode & 0x07;
-                            if(reg != 6){
-                                u8 previous_bit_7 = (*(cpu->register_map[reg]) & 0x80) >> 7;
-                                
-                                *(cpu->register_map[reg]) <<= 1;
-                                *(cpu->register_map[reg]) = (*(cpu->register_map[reg]) & (~(0x01))) | ((cpu->flags & FLAG_CARRY) >> 4);
-
-                                previous_bit_7 ? set_flag(cpu, FLAG_CARRY) : unset_flag(cpu, FLAG_CARRY);
-
-                                if(*(cpu->register_map[reg]) == 0)
-                                    set_flag(cpu, FLAG_ZERO);
-                                else
-                                    unset_flag(cpu, FLAG_ZERO); 
-
-                                unset_flag(cpu, FLAG_SUB);
-                                unset_flag(cpu, FLAG_HALFCARRY);
-
-                                go_to_next_instruction(cpu);
-                                cpu->is_extended = false;
-                            }
-                            else{
-                                mem_value = read_memory_cpu(cpu, cpu->HL);
-                            }
-                        
-                        }
-                        else if(cpu->machine_cycle == 2){
-                            u8 previous_bit_7 = (mem_value & 0x80) >> 7;
-                                
-                            mem_value <<= 1;
-                            mem_value = (mem_value & (~(0x01))) | ((cpu->flags & FLAG_CARRY) >> 4);
-
-                            previous_bit_7 ? set_flag(cpu, FLAG_CARRY) : unset_flag(cpu, FLAG_CARRY);
-
-                            if(mem_value == 0)
-                                set_flag(cpu, FLAG_ZERO);
-                            else
-                                unset_flag(cpu, FLAG_ZERO); 
-
-                            unset_flag(cpu, FLAG_SUB);
-                            unset_flag(cpu, FLAG_HALFCARRY);
-
-                            write_memory_cpu(cpu, cpu->HL, mem_value);
-                        }
-                        else if(cpu->machine_cycle == 3){
-                            go_to_next_instruction(cpu);
-                            cpu->is_extended = false;
-                        }
-
-                        break;
-                    }
-
-                    case 0x18:{ // RR r
-                        if(cpu->machine_cycle == 1){
-                            u8 reg = cpu->opcode & 0x07;
-                            if(reg != 6){
-                                u8 previous_bit_0 = (*(cpu->register_map[reg]) & 0x01);
-                    
-                                *(cpu->register_map[reg]) >>= 1;
-                                *(cpu->register_map[reg]) = (*(cpu->register_map[reg]) & (~(0x80))) | ((cpu->flags & FLAG_CARRY) << 3);
-
-                                previous_bit_0 ? set_flag(cpu, FLAG_CARRY) : unset_flag(cpu, FLAG_CARRY);
-
-                                if(*(cpu->register_map[reg]) == 0)
-                                    set_flag(cpu, FLAG_ZERO);
-                                else
-                                    unset_flag(cpu, FLAG_ZERO); 
-
-                                unset_flag(cpu, FLAG_SUB);
-                                unset_flag(cpu, FLAG_HALFCARRY);
-
-                                go_to_next_instruction(cpu);
-                                cpu->is_extended = false;
-                            }
-                            else{
-                                mem_value = read_memory_cpu(cpu, cpu->HL);
-                            }
-                        
-                        }
-                        else if(cpu->machine_cycle == 2){
-                            u8 previous_bit_0 = (mem_value & 0x01);
-                    
-                            mem_value >>= 1;
-                            mem_value = (mem_value & (~(0x80))) | ((cpu->flags & FLAG_CARRY) << 3);
-
-                            previous_bit_0 ? set_flag(cpu, FLAG_CARRY) : unset_flag(cpu, FLAG_CARRY);
-
-                            if(mem_value == 0)
-                                set_flag(cpu, FLAG_ZERO);
-                            else
-                                unset_flag(cpu, FLAG_ZERO); 
-                                
-                            unset_flag(cpu, FLAG_SUB);
-                            unset_flag(cpu, FLAG_HALFCARRY);
-
-                            write_memory_cpu(cpu, cpu->HL, mem_value);
-                        }
-                        else if(cpu->machine_cycle == 3){
-                            go_to_next_instruction(cpu);
-                            cpu->is_extended = false;
-                        }
-
-                        break;
-                    }
-
-                    case 0x20:{ // SLA r
-                        if(cpu->machine_cycle == 1){
-                            u8 reg = cpu->opcode & 0x07;
-                            if(reg != 6){
-                                u8 previous_bit_7 = (*(cpu->register_map[reg]) & 0x80) >> 7;
-                                previous_bit_7 ? set_flag(cpu, FLAG_CARRY) : unset_flag(cpu, FLAG_CARRY);
-                                *(cpu->register_map[reg]) <<= 1;
-
-                                if(*(cpu->register_map[reg]) == 0)
-                                    set_flag(cpu, FLAG_ZERO);
-                                else
-                                    unset_flag(cpu, FLAG_ZERO); 
-
-                                unset_flag(cpu, FLAG_SUB);
-                                unset_flag(cpu, FLAG_HALFCARRY);
-
-                                go_to_next_instruction(cpu);
-                                cpu->is_extended = false;
-                            }
-                            else{
-                                mem_value = read_memory_cpu(cpu, cpu->HL);
-                            }
-                        
-                        }
-                        else if(cpu->machine_cycle == 2){
-                            u8 previous_bit_7 = (mem_value & 0x80) >> 7;
-                            previous_bit_7 ? set_flag(cpu, FLAG_CARRY) : unset_flag(cpu, FLAG_CARRY);
-                            mem_value <<= 1;
-
-                            if(mem_value == 0)
-                                set_flag(cpu, FLAG_ZERO);
-                            else
-                                unset_flag(cpu, FLAG_ZERO); 
-
-                            unset_flag(cpu, FLAG_SUB);
-                            unset_flag(cpu, FLAG_HALFCARRY);
-
-                            write_memory_cpu(cpu, cpu->HL, mem_value);
-                        }
-                        else if(cpu->machine_cycle == 3){
-                            go_to_next_instruction(cpu);
-                            cpu->is_extended = false;
-                        }
-
-                        break;
-                    }
-
-                    case 0x28:{ // SRA r
-                        if(cpu->machine_cycle == 1){
-                            u8 reg = cpu->opcode & 0x07;
-                            if(reg != 6){
-                                u8 previous_bit_0 = *(cpu->register_map[reg]) & 0x01;
-                                previous_bit_0 ? set_flag(cpu, FLAG_CARRY) : unset_flag(cpu, FLAG_CARRY);
-
-                                u8 bit_7 = *(cpu->register_map[reg]) & 0x80;
-                                *(cpu->register_map[reg]) >>= 1;
-                                *(cpu->register_map[reg]) |= bit_7;
-
-                                if(*(cpu->register_map[reg]) == 0)
-                                    set_flag(cpu, FLAG_ZERO);
-                                else
-                                    unset_flag(cpu, FLAG_ZERO); 
-
-                                unset_flag(cpu, FLAG_SUB);
-                                unset_flag(cpu, FLAG_HALFCARRY);
-
-                                go_to_next_instruction(cpu);
-                                cpu->is_extended = false;
-                            }
-                            else{
-                                mem_value = read_memory_cpu(cpu, cpu->HL);
-                            }
-                        
-                        }
-                        else if(cpu->machine_cycle == 2){
-                            u8 previous_bit_0 = mem_value & 0x01;
-                            previous_bit_0 ? set_flag(cpu, FLAG_CARRY) : unset_flag(cpu, FLAG_CARRY);
-                            
-                            u8 bit_7 = mem_value & 0x80;
-                            mem_value >>= 1;
-                            mem_value |= bit_7;
-
-                            if(mem_value == 0)
-                                set_flag(cpu, FLAG_ZERO);
-                            else
-                                unset_flag(cpu, FLAG_ZERO); 
-
-                            unset_flag(cpu, FLAG_SUB);
-                            unset_flag(cpu, FLAG_HALFCARRY);
-
-                            write_memory_cpu(cpu, cpu->HL, mem_value);
-                        }
-                        else if(cpu->machine_cycle == 3){
-                            go_to_next_instruction(cpu);
-                            cpu->is_extended = false;
-                        }
-
-                        break;
-                    }
-
-                    case 0x30:{ // SWAP r
-                        if(cpu->machine_cycle == 1){
-                            u8 reg = cpu->opcode & 0x07;
-                            if(reg != 6){
-                                u8 upper_nibble = *(cpu->register_map[reg]) & 0xF0;
-                                u8 lower_nibble = *(cpu->register_map[reg]) & 0x0F;
-
-                                *(cpu->register_map[reg]) = (upper_nibble >> 4) | (lower_nibble << 4);
-
-                                if(*(cpu->register_map[reg]) == 0)
-                                    set_flag(cpu, FLAG_ZERO);
-                                else
-                                    unset_flag(cpu, FLAG_ZERO); 
-
-                                unset_flag(cpu, FLAG_CARRY);
-                                unset_flag(cpu, FLAG_SUB);
-                                unset_flag(cpu, FLAG_HALFCARRY);
-
-                                go_to_next_instruction(cpu);
-                                cpu->is_extended = false;
-                            }
-                            else{
-                                mem_value = read_memory_cpu(cpu, cpu->HL);
-                            }
-                        
-                        }
-                        else if(cpu->machine_cycle == 2){
-                            u8 upper_nibble = mem_value & 0xF0;
-                            u8 lower_nibble = mem_value & 0x0F;
-
-                            mem_value = (upper_nibble >> 4) | (lower_nibble << 4);
-
-                            if(mem_value == 0)
-                                set_flag(cpu, FLAG_ZERO);
-                            else
-                                unset_flag(cpu, FLAG_ZERO); 
-
-                            unset_flag(cpu, FLAG_CARRY);
-                            unset_flag(cpu, FLAG_SUB);
-                            unset_flag(cpu, FLAG_HALFCARRY);
-
-                            write_memory_cpu(cpu, cpu->HL, mem_value);
-                        }
-                        else if(cpu->machine_cycle == 3){
-                            go_to_next_instruction(cpu);
-                            cpu->is_extended = false;
-                        }
-
-                        break;
-                    }
-
-                    case 0x38:{ // SRL r
-                        if(cpu->machine_cycle == 1){
-                            u8 reg = cpu->opcode & 0x07;
-                            if(reg != 6){
-                                u8 previous_bit_0 = *(cpu->register_map[reg]) & 0x01;
-                                previous_bit_0 ? set_flag(cpu, FLAG_CARRY) : unset_flag(cpu, FLAG_CARRY);
-
-                                *(cpu->register_map[reg]) >>= 1;
-
-                                if(*(cpu->register_map[reg]) == 0)
-                                    set_flag(cpu, FLAG_ZERO);
-                                else
-                                    unset_flag(cpu, FLAG_ZERO); 
-
-                                unset_flag(cpu, FLAG_SUB);
-                                unset_flag(cpu, FLAG_HALFCARRY);
-
-                                go_to_next_instruction(cpu);
-                                cpu->is_extended = false;
-                            }
-                            else{
-                                mem_value = read_memory_cpu(cpu, cpu->HL);
-                            }
-                        
-                        }
-                        else if(cpu->machine_cycle == 2){
-                            u8 previous_bit_0 = mem_value & 0x01;
-                            previous_bit_0 ? set_flag(cpu, FLAG_CARRY) : unset_flag(cpu, FLAG_CARRY);
-                            
-                            mem_value >>= 1;
-
-                            if(mem_value == 0)
-                                set_flag(cpu, FLAG_ZERO);
-                            else
-                                unset_flag(cpu, FLAG_ZERO); 
-
-                            unset_flag(cpu, FLAG_SUB);
-                            unset_flag(cpu, FLAG_HALFCARRY);
-
-                            write_memory_cpu(cpu, cpu->HL, mem_value);
-                        }
-                        else if(cpu->machine_cycle == 3){
-                            go_to_next_instruction(cpu);
-                            cpu->is_extended = false;
-                        }
-
-                        break;
-                    }
-                    default:{
-                        printf("Opcode %X not implemented\n", cpu->opcode);
-                        assert(false);
-                        break;
-                    }
-                }
-                break;
-            }
 
-            case 0x40:{ // Bit instructions
-                if(cpu->machine_cycle == 1){
-                    u8 reg = cpu->opcode & 0x07;
-                    u8 bit = (cpu->opcode & 0x38) >> 3;
-                    if(reg != 6){
-                        (*(cpu->register_map[reg])) & (1 << bit) ? unset_flag(cpu, FLAG_ZERO) : set_flag(cpu, FLAG_ZERO);
-
-                        unset_flag(cpu, FLAG_SUB);
-                        set_flag(cpu, FLAG_HALFCARRY);
-
-                        go_to_next_instruction(cpu);
-                        cpu->is_extended = false;
-                    }
-                    else{
-                        mem_value = read_memory_cpu(cpu, cpu->HL);
-                    }
-                    
-                }
-                else if(cpu->machine_cycle == 2){
-                    u8 bit = (cpu->opcode & 0x38) >> 3;
-                    mem_value & (1 << bit) ? unset_flag(cpu, FLAG_ZERO) : set_flag(cpu, FLAG_ZERO);
+    OpcodeSteps *base = table.base;
+    base[0x00] = micro_steps(next_instruction); // NOP
+    base[0x10] = micro_steps(stop);
 
-                    unset_flag(cpu, FLAG_SUB);
-                    set_flag(cpu, FLAG_HALFCARRY);
+    for(int reg = 0; reg < 4; reg++){
+        u8 r16 = reg << 4;
+        base[0x01 | r16] = micro_steps(fetch_imm_low, fetch_imm_high, ld_r16_imm16); // LD r16, imm16
+    }
+    base[0x02] = micro_steps(ld_memr16_a, next_instruction); // LD [BC], A
+    base[0x12] = micro_steps(ld_memr16_a, next_instruction); // LD [DE], A
+    base[0x22] = micro_steps(ld_hli_a, next_instruction);    // LD [HL+], A
+    base[0x32] = micro_steps(ld_hld_a, next_instruction);    // LD [HL-], A
+    base[0x0A] = micro_steps(ld_a_memr16_read, ld_a_mem_value); // LD A, [BC]
+    base[0x1A] = micro_steps(ld_a_memr16_read, ld_a_mem_value); // LD A, [DE]
+    base[0x2A] = micro_steps(ld_a_hli_read, ld_a_mem_value);    // LD A, [HL+]
+    base[0x3A] = micro_steps(ld_a_hld_read, ld_a_mem_value);    // LD A, [HL-]
+    base[0x08] = micro_steps(fetch_imm_low, fetch_imm_high, ld_a16_sp_low, ld_a16_sp_high, next_instruction); // LD [a16], SP
+
+    for(int reg = 0; reg < 3; reg++){
+        u8 r16 = reg << 4;
+        base[0x03 | r16] = micro_steps(inc_r16, next_instruction); // INC r16
+        base[0x0B | r16] = micro_steps(dec_r16, next_instruction); // DEC r16
+        base[0x09 | r16] = micro_steps(add_hl_r16_low, add_hl_r16_high); // ADD HL, r16
+    }
+    base[0x33] = micro_steps(inc_sp, next_instruction); // INC SP
+    base[0x3B] = micro_steps(dec_sp, next_instruction); // DEC SP
+    base[0x39] = micro_steps(add_hl_sp_low, add_hl_sp_high); // ADD HL, SP
+
+    for(int reg = 0; reg < 8; reg++){
+        u8 r8 = reg << 3;
+        if(reg == 6){
+            base[0x34] = micro_steps(read_hl, inc_memhl, next_instruction);     // INC [HL]
+            base[0x35] = micro_steps(read_hl, dec_memhl, next_instruction);     // DEC [HL]
+            base[0x36] = micro_steps(fetch_immr8, ld_memhl_imm8, next_instruction); // LD [HL], imm8
+        }
+        else{
+            base[0x04 | r8] = micro_steps(inc_r8); // INC r8
+            base[0x05 | r8] = micro_steps(dec_r8); // DEC r8
+            base[0x06 | r8] = micro_steps(fetch_immr8, ld_r8_imm8); // LD r8, imm8
+        }
+    }
 
-                    write_memory_cpu(cpu, cpu->HL, mem_value);
-                    go_to_next_instruction(cpu);
-                    cpu->is_extended = false;
-                }
+    base[0x07] = micro_steps(rlca);
+    base[0x0F] = micro_steps(rrca);
+    base[0x17] = micro_steps(rla);
+    base[0x1F] = micro_steps(rra);
+    base[0x27] = micro_steps(daa);
+    base[0x2F] = micro_steps(cpl);
+    base[0x37] = micro_steps(scf);
+    base[0x3F] = micro_steps(ccf);
+
+    base[0x18] = micro_steps(fetch_immr8, jr, next_instruction);    // JR imm8
+    base[0x20] = micro_steps(fetch_immr8, jr_nz, next_instruction); // JR NZ, imm8
+    base[0x30] = micro_steps(fetch_immr8, jr_nc, next_instruction); // JR NC, imm8
+    base[0x28] = micro_steps(fetch_immr8, jr_z, next_instruction);  // JR Z, imm8
+    base[0x38] = micro_steps(fetch_immr8, jr_c, next_instruction);  // JR C, imm8
+
+    // LD r8, r8 instructions
+    for(int opcode = 0x40; opcode < 0x80; opcode++){
+        u8 dest = (opcode & 0x38) >> 3;
+        u8 src  = (opcode & 0x07);
+        if(dest == 6 && src == 6)
+            base[opcode] = micro_steps(halt);
+        else if(dest == 6)
+            base[opcode] = micro_steps(ld_memhl_r8, next_instruction);
+        else if(src == 6)
+            base[opcode] = micro_steps(read_hl, ld_r8_memhl);
+        else
+            base[opcode] = micro_steps(ld_r8_r8);
+    }
 
-                break;
-            }
+    // ADD, ADC, SUB, SBC, AND, XOR, OR and CP
+    for(int opcode = 0x80; opcode < 0xC0; opcode++){
+        if((opcode & 0x07) == 6)
+            base[opcode] = micro_steps(read_hl, alu_a_memhl);
+        else
+            base[opcode] = micro_steps(alu_a_r8);
+    }
+    for(int opcode = 0xC6; opcode <= 0xFE; opcode += 0x08){
+        base[opcode] = micro_steps(fetch_immr8, alu_a_imm8);
+    }
 
-            case 0x80:{ // RES instructions
-                if(cpu->machine_cycle == 1){
-                    u8 reg = cpu->opcode & 0x07;
-                    u8 bit = (cpu->opcode & 0x38) >> 3;
-                    if(reg != 6){
-                        (*(cpu->register_map[reg])) &= ~(1 << bit);
-
-                        go_to_next_instruction(cpu);
-                        cpu->is_extended = false;
-                    }
-                    else{
-                        mem_value = read_memory_cpu(cpu, cpu->HL);
-                    }
-                    
-                }
-                else if(cpu->machine_cycle == 2){
-                    u8 bit = (cpu->opcode & 0x38) >> 3;
-                    mem_value &= ~(1 << bit);
+    base[0xC0] = micro_steps(ret_nz_check, pop_imm_low, pop_imm_high, jump_to_imm, return_from_interrupt_routine); // RET NZ
+    base[0xC8] = micro_steps(ret_z_check,  pop_imm_low, pop_imm_high, jump_to_imm, return_from_interrupt_routine); // RET Z
+    base[0xD0] = micro_steps(ret_nc_check, pop_imm_low, pop_imm_high, jump_to_imm, return_from_interrupt_routine); // RET NC
+    base[0xD8] = micro_steps(ret_c_check,  pop_imm_low, pop_imm_high, jump_to_imm, return_from_interrupt_routine); // RET C
+    base[0xC9] = micro_steps(pop_imm_low, pop_imm_high, jump_to_imm, next_instruction);                       // RET
+    base[0xD9] = micro_steps(pop_imm_low, pop_imm_high, reti_jump, return_from_interrupt_routine);           // RETI
+
+    base[0xC2] = micro_steps(fetch_imm_low, jp_nz_fetch, jump_to_imm, next_instruction); // JP NZ, imm16
+    base[0xCA] = micro_steps(fetch_imm_low, jp_z_fetch,  jump_to_imm, next_instruction); // JP Z, imm16
+    base[0xD2] = micro_steps(fetch_imm_low, jp_nc_fetch, jump_to_imm, next_instruction); // JP NC, imm16
+    base[0xDA] = micro_steps(fetch_imm_low, jp_c_fetch,  jump_to_imm, next_instruction); // JP C, imm16
+    base[0xC3] = micro_steps(fetch_imm_low, fetch_imm_high, jump_to_imm, next_instruction); // JP imm16
+    base[0xE9] = micro_steps(jp_hl); // JP HL
+
+    base[0xC4] = micro_steps(fetch_imm_low, call_nz_fetch, dec_sp, push_pch, call_push_pcl, next_instruction); // CALL NZ, imm16
+    base[0xCC] = micro_steps(fetch_imm_low, call_z_fetch,  dec_sp, push_pch, call_push_pcl, next_instruction); // CALL Z, imm16
+    base[0xD4] = micro_steps(fetch_imm_low, call_nc_fetch, dec_sp, push_pch, call_push_pcl, next_instruction); // CALL NC, imm16
+    base[0xDC] = micro_steps(fetch_imm_low, call_c_fetch,  dec_sp, push_pch, call_push_pcl, next_instruction); // CALL C, imm16
+    base[0xCD] = micro_steps(fetch_imm_low, fetch_imm_high, dec_sp, push_pch, call_push_pcl, next_instruction); // CALL imm16
+
+    for(int reg = 0; reg < 4; reg++){
+        u8 r16 = reg << 4;
+        base[0xC1 | r16] = micro_steps(pop_r16_low, pop_r16_high, pop_r16);                   // POP r16
+        base[0xC5 | r16] = micro_steps(dec_sp, push_r16_high, push_r16_low, next_instruction); // PUSH r16
+    }
+    for(int target = 0; target < 8; target++){
+        base[0xC7 | (target << 3)] = micro_steps(dec_sp, push_pch, rst_push_pcl, next_instruction); // RST
+    }
 
-                    write_memory_cpu(cpu, cpu->HL, mem_value);
-                }
-                else if(cpu->machine_cycle == 3){
-                    go_to_next_instruction(cpu);
-                    cpu->is_extended = false;
-                }
+    base[0xCB] = micro_steps(prefix_cb);
 
-                break;
-            }
+    base[0xE2] = micro_steps(ldh_c_a, next_instruction);                                    // LDH [C], A
+    base[0xE0] = micro_steps(fetch_immr8, ldh_imm8_a, next_instruction);                    // LDH [imm8], A
+    base[0xEA] = micro_steps(fetch_imm_low, fetch_imm_high, ld_imm16_a, next_instruction);  // LD [imm16], A
+    base[0xF2] = micro_steps(ldh_a_c_read, ld_a_mem_value);                                 // LDH A, [C]
+    base[0xF0] = micro_steps(fetch_immr8, ldh_a_imm8_read, ld_a_mem_value);                 // LDH A, [imm8]
+    base[0xFA] = micro_steps(fetch_imm_low, fetch_imm_high, ld_a_imm16_read, ld_a_mem_value); // LD A, [imm16]
 
-            case 0xC0:{ // SET instructions
-                if(cpu->machine_cycle == 1){
-                    u8 reg = cpu->opcode & 0x07;
-                    u8 bit = (cpu->opcode & 0x38) >> 3;
-                    if(reg != 6){
-                        (*(cpu->register_map[reg])) |= (1 << bit);
-
-                        go_to_next_instruction(cpu);
-                        cpu->is_extended = false;
-                    }
-                    else{
-                        mem_value = read_memory_cpu(cpu, cpu->HL);
-                    }
-                    
-                }
-                else if(cpu->machine_cycle == 2){
-                    u8 bit = (cpu->opcode & 0x38) >> 3;
-                    mem_value |= (1 << bit);
+    base[0xE8] = micro_steps(fetch_immr8, add_sp_e_flags, idle, add_sp_e); // ADD SP, e
+    base[0xF8] = micro_steps(fetch_immr8, add_sp_e_flags, ld_hl_sp_e);     // LD HL, SP+e
+    base[0xF9] = micro_steps(ld_sp_hl, next_instruction);                  // LD SP, HL
 
-                    write_memory_cpu(cpu, cpu->HL, mem_value);
-                }
-                else if(cpu->machine_cycle == 3){
-                    go_to_next_instruction(cpu);
-                    cpu->is_extended = false;
-                }
+    base[0xF3] = micro_steps(di);
+    base[0xFB] = micro_steps(ei);
 
+    OpcodeSteps *extended = table.extended;
+    for(int opcode = 0; opcode < 256; opcode++){
+        bool memhl = (opcode & 0x07) == 6;
+        switch(opcode & 0xC0){
+            case 0x00:{ // RLC, RRC, RL, RR, SLA, SRA, SWAP and SRL
+                extended[opcode] = memhl ? micro_steps(read_hl, cb_shift_memhl, next_extended_instruction) : micro_steps(cb_shift_r8);
                 break;
             }
-
-            default:{
-                printf("Prefixed Opcode %X not implemented\n", cpu->opcode);
+            case 0x40:{ // BIT
+                extended[opcode] = memhl ? micro_steps(read_hl, cb_bit_memhl) : micro_steps(cb_bit_r8);
+                break;
+            }
+            case 0x80:{ // RES
+                extended[opcode] = memhl ? micro_steps(read_hl, cb_res_memhl, next_extended_instruction) : micro_steps(cb_res_r8);
+                break;
+            }
+            case 0xC0:{ // SET
+                extended[opcode] = memhl ? micro_steps(read_hl, cb_set_memhl, next_extended_instruction) : micro_steps(cb_set_r8);
                 break;
-            } 
+            }
         }
     }
+
+    return table;
+}
+
+static constexpr OpcodeTable opcode_table = build_opcode_table();
+
+const OpcodeSteps* get_opcode_steps(u8 opcode, bool is_extended){
+    return is_extended ? &opcode_table.extended[opcode] : &opcode_table.base[opcode];
+}
+
+void run_cpu(CPU *cpu){
+    if(cpu->fetched_next_instruction) cpu->fetched_next_instruction = false;
+    if(cpu->do_first_fetch){
+        cpu->machine_cycle = 0;
+        cpu->opcode = fetch(cpu);
+        cpu->do_first_fetch = false;
+    }
+    cpu->machine_cycle++;
+    assert(cpu->machine_cycle <= MAX_MICRO_STEPS);
+
+    const OpcodeSteps *entry = cpu->is_extended ? &opcode_table.extended[cpu->opcode] : &opcode_table.base[cpu->opcode];
+    entry->steps[cpu->machine_cycle - 1](cpu);
 }
 
 
 void handle_interrupts(CPU *cpu, PPU *ppu){
     if(cpu->handling_interrupt){
-        static i32 cycle = 0;
+        i32 cycle = cpu->interrupt_cycle;
         cpu->IME = false;
         if(cycle < 2){
 
@@ -2543,7 +1528,12 @@ void handle_interrupts(CPU *cpu, PPU *ppu){
             u16 address = 0;
             switch(cpu->interrupt){
                 case INT_VBLANK:{address = 0x40; break;}
-                case INT_LCD:   {address = 0x48; ppu->stat_interrupt_set = false; break;}
+                case INT_LCD:{
+                    address = 0x48;
+                    ppu->stat_interrupt_set = false;
+                    if(cpu->gameboy) reschedule_ppu(cpu->gameboy); // It can be requested again.
+                    break;
+                }
                 case INT_TIMER: {address = 0x50; break;}
                 case INT_SERIAL:{address = 0x58; break;}
                 case INT_JOYPAD:{address = 0x60; break;}
@@ -2555,63 +1545,30 @@ void handle_interrupts(CPU *cpu, PPU *ppu){
             cycle = 0;
             cpu->handling_interrupt = false;
         } 
-        cycle++;
+        cpu->interrupt_cycle = cycle + 1;
     }
     else{
-        u8 IE = read_memory_cpu(cpu, 0xFFFF);
-        u8 IF = read_memory_cpu(cpu, 0xFF0F);
-
-        if((IE & IF)) {
-            cpu->halt = false;
-        }
-
-        if(cpu->IME && !cpu->handling_interrupt){ // If interrupts are enabled.
-            if((IE & INT_VBLANK) && (IF & INT_VBLANK)){
-                cpu->PC--;
-                unset_interrupt(cpu, INT_VBLANK);
-                cpu->interrupt = INT_VBLANK;
-                cpu->handling_interrupt = true;
-            }
-            else if((IE & INT_LCD) && (IF & INT_LCD)){
-                cpu->PC--;
-                unset_interrupt(cpu, INT_LCD);
-                cpu->interrupt = INT_LCD;
-                cpu->handling_interrupt = true;
-            }
-            else if((IE & INT_TIMER) && (IF & INT_TIMER)){
-                cpu->PC--;
-                unset_interrupt(cpu, INT_TIMER);
-                cpu->interrupt = INT_TIMER;
-                cpu->handling_interrupt = true;
-            }
-            else if((IE & INT_SERIAL) && (IF & INT_SERIAL)){
-                cpu->PC--;
-                unset_interrupt(cpu, INT_SERIAL);
-                cpu->interrupt = INT_TIMER;
-                cpu->handling_interrupt = true;
-            }
-            else if((IE & INT_JOYPAD) && (IF & INT_JOYPAD)){
-                cpu->PC--;
-                unset_interrupt(cpu, INT_JOYPAD);
-                cpu->interrupt = INT_JOYPAD;
-                cpu->handling_interrupt = true;
-            }
+        u8 pending = cpu->pending_interrupts;
+        if(!pending) return;
+
+        cpu->halt = false;
+        if(cpu->IME){ // The lowest bit has the highest priority.
+            cpu->PC--;
+            cpu->interrupt = (Interrupt)(pending & -pending);
+            unset_interrupt(cpu, cpu->interrupt);
+            cpu->handling_interrupt = true;
         }
     }
 }
 
 void set_interrupt(CPU *cpu, Interrupt interrupt){
-    u16 address = 0xFF0F;
-    u8 IF = read_memory_cpu(cpu, address);
-    IF |= interrupt;
-    write_memory_cpu(cpu, address, IF);
+    cpu->memory->data[0xFF0F] |= interrupt;
+    update_pending_interrupts(cpu);
 }
 
 void unset_interrupt(CPU *cpu, Interrupt interrupt){
-    u16 address = 0xFF0F;
-    u8 IF = read_memory_cpu(cpu, address);
-    IF &= ~(interrupt);
-    write_memory_cpu(cpu, address, IF);
+    cpu->memory->data[0xFF0F] &= ~interrupt;
+    update_pending_interrupts(cpu);
 }
 
 void enable_interrupt(CPU *cpu, Interrupt interrupt){
@@ -2628,62 +1585,81 @@ void disable_interrupt(CPU *cpu, Interrupt interrupt){
     write_memory_cpu(cpu, 0xFF0F, IE);
 }
 
-static void increment_tima(CPU *cpu){
-    u8 tima = read_memory_cpu(cpu, 0xFF05);
-    u8 previous_tima = tima;
-    tima++;
-    write_memory_cpu(cpu, 0xFF05, tima);
-    if(tima == 0x00 && previous_tima == 0xFF){
-        set_interrupt(cpu, INT_TIMER);
-        tima = read_memory_cpu(cpu, 0xFF06);
+// Length of a TIMA increment in cycles_delta units.
+static u32 get_timer_period(u8 TAC){
+    switch (TAC & 0x03){
+        case 0x00: return 256 * 4;
+        case 0x01: return 4   * 4;
+        case 0x02: return 16  * 4;
+        case 0x03: return 64  * 4;
     }
+    return 0;
 }
 
-void update_timers(CPU *cpu){
-    cpu->internal_counter += 4;
-    cpu->memory->data[0xFF04] = (cpu->internal_counter & 0xFF00) >> 8;
+// DIV and TIMA are only worked out when something looks at them. TIMA goes up every time cycles_delta
+// reaches a multiple of the period, the timer event runs on the cycle it overflows to request the
+// interrupt. The overflow reloads TIMA from TMA, the increments past it count up from there.
+void sync_timers(CPU *cpu, u64 cycle){
+    assert(cycle >= cpu->timer_cycle);
+    u32 cycles = (u32)(cycle - cpu->timer_cycle);
+    u8 *data = cpu->memory->data;
 
-    u8 TAC = read_memory_cpu(cpu, 0xFF07);
+    u8 TAC = data[0xFF07];
     if(TAC & 0x04){
-        u8 clock = TAC & 0x03;
-        u32 every = 0;
-        switch (clock){
-            case 0x00:{every = 256; break;}
-            case 0x01:{every = 4;   break;}
-            case 0x02:{every = 16;  break;}
-            case 0x03:{every = 64;  break;}
-        }
-
-        if(cpu->cycles_delta % (every*4) == 0){
-            increment_tima(cpu);
+        u32 period = get_timer_period(TAC);
+        u32 tima = data[0xFF05] + ((cpu->cycles_delta % period) + cycles * 4) / period;
+        if(tima > 0xFF){
+            u8 TMA = data[0xFF06];
+            set_interrupt(cpu, INT_TIMER);
+            tima = TMA + (tima - 0x100) % (0x100 - TMA);
         }
-        
+        data[0xFF05] = (u8)tima;
     }
+
+    cpu->cycles_delta += cycles * 4;
+    cpu->internal_counter += cycles * 4;
+    data[0xFF04] = (cpu->internal_counter & 0xFF00) >> 8; // Also undoes a write to DIV, which doesn't reset the counter.
+    cpu->timer_cycle = cycle;
+}
+
+// Machine cycle TIMA overflows on, counting from the last sync_timers. After an overflow TIMA holds TMA,
+// so the next one is 0x100 - TMA increments away. NO_EVENT while the timer is stopped.
+u64 get_timer_overflow_cycle(CPU *cpu){
+    u8 TAC = cpu->memory->data[0xFF07];
+    if(!(TAC & 0x04)) return NO_EVENT;
+
+    u32 period     = get_timer_period(TAC);
+    u32 increments = 0x100 - cpu->memory->data[0xFF05]; // The last one overflows.
+    return cpu->timer_cycle + (increments * period - (cpu->cycles_delta % period)) / 4;
 }
 
+// The whole table is copied on the first machine cycle of the transfer and the bus stays locked
+// for the rest of it. The CPU can't read OAM or write the source until it ends, so only the PPU could
+// tell the difference.
 void handle_DMA_transfer(CPU *cpu){
-    if(cpu->DMA_transfer_in_progress){
-
-        // 4 bytes are transferred at a time because the emulator timestep is 4 machine cycles and
-        // DMA transfers 1 byte per machine cycle.
-        u16 source = cpu->DMA_source + cpu->transferred_bytes;
-        u8 byte0 = read_memory_cpu(cpu, source);
-        u8 byte1 = read_memory_cpu(cpu, source + 1);
-        u8 byte2 = read_memory_cpu(cpu, source + 2);
-        u8 byte3 = read_memory_cpu(cpu, source + 3);
-        
-        u16 destination = 0xFE00 + cpu->transferred_bytes;
-        write_memory_cpu(cpu, destination, byte0);
-        write_memory_cpu(cpu, destination + 1, byte1);
-        write_memory_cpu(cpu, destination + 2, byte2);
-        write_memory_cpu(cpu, destination + 3, byte3);
-
-        cpu->transferred_bytes += 4;
-
-        // 160 is the size of the OAM table, DMA transfer always copies the entire table.
-        if(cpu->transferred_bytes == 160){
-            cpu->DMA_transfer_in_progress = false;
-            cpu->transferred_bytes = 0;
-        } 
+    if(!cpu->DMA_transfer_in_progress) return;
+
+    Memory *memory = cpu->memory;
+    if(cpu->transferred_bytes == 0){
+        set_bus_locked(memory, false); // In case it started over, the source is read like the CPU would.
+        if(cpu->gameboy) ppu_prepare_for_oam_write(&cpu->gameboy->ppu);
+
+        u8 *oam = memory->data + 0xFE00;
+        u8 *page = memory->read_pages[cpu->DMA_source >> 8];
+        if(page){
+            memcpy(oam, page, OAM_SIZE);
+        }
+        else{
+            for(u16 i = 0; i < OAM_SIZE; i++){
+                oam[i] = read_memory_cpu(cpu, cpu->DMA_source + i);
+            }
+        }
+        cpu->transferred_bytes = OAM_SIZE;
+        set_bus_locked(memory, true);
+    }
+    else{
+        cpu->DMA_transfer_in_progress = false;
+        cpu->transferred_bytes = 0;
+        set_bus_locked(memory, false);
     }
 }
\ No newline at end of file
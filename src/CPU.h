@@ -4,6 +4,11 @@
 #include <stdio.h>
 #include "memory.h"
 
+// Flags of the 8-bit ALU and DAA from tables generated at compile time instead of computing them.
+#ifndef ALU_FLAG_TABLES
+#define ALU_FLAG_TABLES 0
+#endif
+
 const i32 NUM_REGISTERS = 8;
 const i32 NUM_WIDE_REGISTERS = 4;
 
@@ -14,6 +19,27 @@ enum Flag {
     FLAG_ZERO      = 0x80
 };
 
+// Operation whose flags haven't been computed yet, see get_flags.
+enum LazyFlags : u8 {
+    LAZY_FLAGS_NONE,
+    LAZY_FLAGS_ADD,
+    LAZY_FLAGS_SUB,
+    LAZY_FLAGS_INC,
+    LAZY_FLAGS_DEC,
+};
+
+// Bits of the pressed buttons, in the order FF00 reads them. The dpad is the lower row.
+enum Button{
+    BUTTON_RIGHT  = 0x01,
+    BUTTON_LEFT   = 0x02,
+    BUTTON_UP     = 0x04,
+    BUTTON_DOWN   = 0x08,
+    BUTTON_A      = 0x10,
+    BUTTON_B      = 0x20,
+    BUTTON_SELECT = 0x40,
+    BUTTON_START  = 0x80,
+};
+
 enum Interrupt{
     INT_VBLANK = 0x01,
     INT_LCD    = 0x02,
@@ -36,6 +62,17 @@ struct CPU{
         u8 instruction;
         u8 data_byte;
     };
+
+    // Operands and memory values carried between the machine cycles of an instruction.
+    u8 immr8;
+    union{
+        u16 imm;
+        struct{
+            u8 imm_low;
+            u8 imm_high;
+        };
+    };
+    u8 mem_value;
     // Registers
     union{
         u16 BC;
@@ -82,7 +119,14 @@ struct CPU{
         };
     };
 
+    // Last 8-bit arithmetic operation. F only holds its flags after get_flags.
+    LazyFlags lazy_flags;
+    u8 lazy_left;
+    u8 lazy_right;
+    u8 lazy_carry; // Carry added or substracted by ADD/SUB, carry kept by INC/DEC.
+
     u16 internal_counter;
+    u64 timer_cycle; // Machine cycle DIV, TIMA and cycles_delta were last brought up to.
 
     Memory *memory;
 
@@ -93,31 +137,57 @@ struct CPU{
     bool scheduled_ei;
     bool is_extended;
     bool handling_interrupt;
+    i32 interrupt_cycle; // Machine cycle of the interrupt dispatch in progress.
     bool halt;
     bool fetched_next_instruction;
     bool was_extended;
     Interrupt interrupt;
+    u8 pending_interrupts; // IE & IF, updated on every write to them.
+    u8 buttons; // Pressed buttons, FF00 is worked out from them when it's read.
     
     bool DMA_transfer_in_progress;
-    u8 transferred_bytes;
+    u8 transferred_bytes; // 0 until the table is copied, then all of it.
     u16 DMA_source;
 
+    // Machine cycles the CPU has run ahead of the rest of the hardware in EXECUTION_INSTRUCTION mode.
+    i32 pending_cycles;
+    struct Gameboy *gameboy;
+
+    struct BlockCache *block_cache; // Instructions are read from memory when this is NULL.
+    struct BasicBlock *block;
+    const struct DecodedInstruction *decoded; // Instruction being executed, if it was found in a block.
+    bool leave_block; // Set when a compiled block has to stop at the next instruction: its code may have changed or the frame ended.
+
     FILE *fp;
 };
 
 struct PPU;
 
+#define MAX_MICRO_STEPS 6 // Machine cycles of the longest instruction.
+#define DMA_MACHINE_CYCLES 40 // OAM DMA moves 4 bytes per machine cycle.
+
+typedef void (*MicroStep)(CPU *cpu);
+
+struct OpcodeSteps{
+    MicroStep steps[MAX_MICRO_STEPS];
+    u8 cycles; // Steps listed, the machine cycles taken when every step runs.
+};
+
 
 void init_cpu(CPU *cpu, Memory *memory);
 void run_cpu(CPU *cpu);
 u8 fetch(CPU *cpu);
+u8 read_memory_cpu(CPU *cpu, u16 address);
+void write_memory_cpu(CPU *cpu, u16 address, u8 value);
 void go_to_next_instruction(CPU *cpu);
+const OpcodeSteps* get_opcode_steps(u8 opcode, bool is_extended);
 
 void set_flag(CPU *cpu, Flag flag);
 void unset_flag(CPU *cpu, Flag flag);
 u8 pop_stack(CPU *cpu);
 u8 push_stack(CPU *cpu, u8 value);
-// u8 sum_and_set_flags(CPU *cpu, u8 summand_left, u8 summand_right, b32 check_carry, bool check_zero);
+u8 get_flags(CPU *cpu);
+u8 sum_and_set_flags(CPU *cpu, u8 summand_left, u8 summand_right, bool add_carry = false, b32 check_carry = false, bool check_zero = false);
 
 void handle_DMA_transfer(CPU *cpu);
 void handle_interrupts(CPU *cpu, PPU *ppu);
@@ -126,6 +196,5 @@ void unset_interrupt(CPU *cpu, Interrupt interrupt);
 void enable_interrupt(CPU *cpu, Interrupt interrupt);
 void disable_interrupt(CPU *cpu, Interrupt interrupt);
 
-void update_timers(CPU *cpu);
-
-void update_joypad(CPU *cpu, const bool *input);
\ No newline at end of file
+void sync_timers(CPU *cpu, u64 cycle);
+u64 get_timer_overflow_cycle(CPU *cpu);
\ No newline at end of file
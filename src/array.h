@@ -71,7 +71,7 @@ T array_pop(Array<T> *array){
 	array->size--;
 	assert(array->size >= 0);
 	value = array->data[array->size];
-	array->data[array->size + 1] = T {};
+	if(array->size + 1 < array->capacity) array->data[array->size + 1] = T {};
 	return value;
 }
 
@@ -125,4 +125,10 @@ void array_clear(Array<T> *array){
 }
 
 // Frees the memory used by the array.
-// void delete_array(Array *array);
+template<typename T>
+void delete_array(Array<T> *array){
+	free(array->data);
+	array->data = NULL;
+	array->size = 0;
+	array->capacity = 0;
+}
@@ -0,0 +1,148 @@
+#include "block_cache.h"
+#include "arena.h"
+
+#define RAM_BLOCK_BANK 0xFFFF
+
+struct InstructionInfo{
+    u8 length[256];
+    bool ends_block[256];
+};
+
+static constexpr InstructionInfo build_instruction_info(){
+    InstructionInfo info = {};
+    for(int i = 0; i < 256; i++){
+        info.length[i] = 1;
+    }
+
+    const u8 two_bytes[] = {
+        0x06, 0x0E, 0x16, 0x1E, 0x26, 0x2E, 0x36, 0x3E, // LD r8, imm8
+        0x18, 0x20, 0x28, 0x30, 0x38,                   // JR
+        0xC6, 0xCE, 0xD6, 0xDE, 0xE6, 0xEE, 0xF6, 0xFE, // ALU A, imm8
+        0xE0, 0xF0, 0xE8, 0xF8, 0xCB
+    };
+    const u8 three_bytes[] = {
+        0x01, 0x11, 0x21, 0x31, 0x08,                   // LD r16, imm16 and LD [a16], SP
+        0xC2, 0xC3, 0xCA, 0xD2, 0xDA,                   // JP
+        0xC4, 0xCC, 0xCD, 0xD4, 0xDC,                   // CALL
+        0xEA, 0xFA
+    };
+    const u8 block_enders[] = {
+        0x10, 0x76,                                     // STOP and HALT
+        0x18, 0x20, 0x28, 0x30, 0x38,                   // JR
+        0xC2, 0xC3, 0xCA, 0xD2, 0xDA, 0xE9,             // JP
+        0xC4, 0xCC, 0xCD, 0xD4, 0xDC,                   // CALL
+        0xC0, 0xC8, 0xC9, 0xD0, 0xD8, 0xD9,             // RET and RETI
+        0xC7, 0xCF, 0xD7, 0xDF, 0xE7, 0xEF, 0xF7, 0xFF, // RST
+        0xD3, 0xDB, 0xDD, 0xE3, 0xE4, 0xEB, 0xEC, 0xED, 0xF4, 0xFC, 0xFD // Illegal
+    };
+
+    for(u8 opcode : two_bytes)    info.length[opcode] = 2;
+    for(u8 opcode : three_bytes)  info.length[opcode] = 3;
+    for(u8 opcode : block_enders) info.ends_block[opcode] = true;
+    return info;
+}
+
+static constexpr InstructionInfo instruction_info = build_instruction_info();
+
+static bool is_cacheable_address(u16 address){
+    return address <= 0x7FFF || (address >= 0xC000 && address <= 0xDFFF) || (address >= 0xFF80 && address <= 0xFFFE);
+}
+
+// Code can't be decoded across the end of a ROM bank or a RAM page since each is invalidated on its own.
+static u16 get_region_end(u16 address){
+    if(address <= 0x3FFF) return 0x4000;
+    if(address <= 0x7FFF) return 0x8000;
+    if(address >= 0xFF80) return 0xFFFF;
+    return (address & 0xFF00) + 0x100;
+}
+
+u16 get_code_bank(Memory *memory, u16 address){
+    if(address <= 0x3FFF) return memory->mbc.ROM_bank0_number;
+    if(address <= 0x7FFF) return memory->mbc.ROM_bank_number;
+    return RAM_BLOCK_BANK;
+}
+
+static u8 read_code_byte(Memory *memory, u16 address){
+    if(address <= 0x7FFF) return read_from_MBC(memory, address);
+    return memory->data[address];
+}
+
+void init_block_cache(BlockCache *cache, Arena *arena){
+    cache->blocks = (BasicBlock*)alloc(arena, sizeof(BasicBlock) * BLOCK_CACHE_SIZE);
+    cache->ram_generation = 0;
+    memset(cache->ram_code_pages, 0, sizeof(cache->ram_code_pages));
+}
+
+void decode_basic_block(BasicBlock *block, Memory *memory, u16 address){
+    block->valid = true;
+    block->start = address;
+    block->bank = get_code_bank(memory, address);
+    block->instruction_count = 0;
+
+    u32 region_end = get_region_end(address);
+    u32 pc = address;
+    while(block->instruction_count < MAX_BLOCK_INSTRUCTIONS){
+        u8 opcode = read_code_byte(memory, pc);
+        u8 length = instruction_info.length[opcode];
+        if(pc + length > region_end) break;
+
+        DecodedInstruction *instruction = &block->instructions[block->instruction_count++];
+        instruction->address = pc;
+        instruction->length = length;
+        for(int i = 0; i < length; i++){
+            instruction->bytes[i] = read_code_byte(memory, pc + i);
+        }
+
+        pc += length;
+        if(instruction_info.ends_block[opcode] || pc >= region_end) break;
+    }
+}
+
+// Index into the BLOCK_CACHE_SIZE entries. The top bits of the address are folded in, so code 4KB apart,
+// like the same routine copied to another part of the ROM, doesn't keep evicting each other.
+u32 get_block_slot(u16 address, u16 bank){
+    return (address ^ (address >> 12) ^ (bank << 7)) & (BLOCK_CACHE_SIZE - 1);
+}
+
+BasicBlock* get_basic_block(BlockCache *cache, Memory *memory, u16 address){
+    if(!is_cacheable_address(address)) return NULL;
+
+    u16 bank = get_code_bank(memory, address);
+    BasicBlock *block = &cache->blocks[get_block_slot(address, bank)];
+
+    bool hit = block->valid && block->start == address && block->bank == bank &&
+               (bank != RAM_BLOCK_BANK || block->generation == cache->ram_generation);
+    if(!hit){
+        decode_basic_block(block, memory, address);
+        block->generation = cache->ram_generation;
+        if(bank == RAM_BLOCK_BANK){
+            cache->ram_code_pages[(address - 0xC000) >> 8] = true;
+            watch_page_writes(memory, address, true);
+        }
+    }
+    if(block->instruction_count == 0) return NULL; // The first instruction crosses a region boundary.
+
+    return block;
+}
+
+void clear_block_cache(BlockCache *cache, Memory *memory){
+    memset(cache->blocks, 0, sizeof(BasicBlock) * BLOCK_CACHE_SIZE);
+    invalidate_ram_blocks(cache, memory);
+}
+
+bool ends_basic_block(u8 opcode){
+    return instruction_info.ends_block[opcode];
+}
+
+bool is_ram_code_page(BlockCache *cache, u16 address){
+    bool is_code_ram = (address >= 0xC000 && address <= 0xDFFF) || (address >= 0xFF80 && address <= 0xFFFE); // Skips the IO registers that share a page with HRAM.
+    return is_code_ram && cache->ram_code_pages[(address - 0xC000) >> 8];
+}
+
+void invalidate_ram_blocks(BlockCache *cache, Memory *memory){
+    cache->ram_generation++;
+    for(u32 i = 0; i < array_size(cache->ram_code_pages); i++){
+        if(cache->ram_code_pages[i]) watch_page_writes(memory, 0xC000 + (i << 8), false);
+    }
+    memset(cache->ram_code_pages, 0, sizeof(cache->ram_code_pages));
+}
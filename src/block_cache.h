@@ -0,0 +1,43 @@
+#pragma once
+
+#include "common.h"
+#include "memory.h"
+
+// Cache of decoded basic blocks. A block is a run of straight-line code that ends at the first
+// instruction that can change the program counter. Blocks in ROM are keyed by the bank they were
+// decoded from, so switching banks never serves stale code. Blocks in WRAM and HRAM are dropped
+// as soon as the CPU writes to a page that holds cached code.
+
+#define BLOCK_CACHE_SIZE 4096 // Must be a power of two.
+#define MAX_BLOCK_INSTRUCTIONS 16
+
+struct DecodedInstruction{
+    u16 address;
+    u8 length;   // In bytes, including the opcode.
+    u8 bytes[3]; // Opcode followed by its operands.
+};
+
+struct BasicBlock{
+    bool valid;
+    u16 start;
+    u16 bank;
+    u32 generation; // Only checked for blocks in RAM.
+    u8 instruction_count;
+    DecodedInstruction instructions[MAX_BLOCK_INSTRUCTIONS];
+};
+
+struct BlockCache{
+    BasicBlock *blocks;
+    u32 ram_generation;
+    bool ram_code_pages[0x40]; // One flag for each 256 byte page from 0xC000 to 0xFFFF.
+};
+
+void init_block_cache(BlockCache *cache, Arena *arena);
+void clear_block_cache(BlockCache *cache, Memory *memory);
+BasicBlock* get_basic_block(BlockCache *cache, Memory *memory, u16 address);
+void decode_basic_block(BasicBlock *block, Memory *memory, u16 address);
+u16 get_code_bank(Memory *memory, u16 address);
+u32 get_block_slot(u16 address, u16 bank);
+bool ends_basic_block(u8 opcode);
+bool is_ram_code_page(BlockCache *cache, u16 address);
+void invalidate_ram_blocks(BlockCache *cache, Memory *memory);
@@ -28,3 +28,11 @@ typedef double f64;
 #define terabytes(value) (gigabytes(value) * 1024)
 
 #define array_size(array) (sizeof(array) / sizeof((array)[0]))
+
+#ifndef _WIN32
+#include <stdio.h>
+static inline int fopen_s(FILE **file, const char *file_name, const char *mode){
+    *file = fopen(file_name, mode);
+    return *file ? 0 : 1;
+}
+#endif
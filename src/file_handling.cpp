@@ -3,6 +3,15 @@
 
 #include "file_handling.h"
 
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 char* text_file_to_string(const char* file_name){
 	FILE *fp;
 	long file_size;
@@ -76,6 +85,98 @@ u8* load_binary_file(const char* file_name, u32 *file_size){
     return buffer;
 }
 
+// Maps the file read only instead of reading it. Every mapping of the same file shares the same
+// physical pages. Returns NULL for empty files.
+u8* map_binary_file(const char* file_name, u32 *file_size){
+    assert(file_size);
+#ifdef _WIN32
+    HANDLE file = CreateFileA(file_name, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if(file == INVALID_HANDLE_VALUE){
+        printf("File could not be opened\n");
+        return NULL;
+    }
+    *file_size = GetFileSize(file, NULL);
+
+    u8 *data = NULL;
+    HANDLE mapping = *file_size ? CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL) : NULL;
+    if(mapping){
+        data = (u8*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+        CloseHandle(mapping); // The view keeps the mapping alive.
+    }
+    CloseHandle(file);
+#else
+    int file = open(file_name, O_RDONLY);
+    if(file < 0){
+        printf("File could not be opened\n");
+        return NULL;
+    }
+    struct stat info;
+    *file_size = fstat(file, &info) == 0 ? (u32)info.st_size : 0;
+
+    u8 *data = NULL;
+    if(*file_size){
+        void *view = mmap(NULL, *file_size, PROT_READ, MAP_SHARED, file, 0);
+        if(view != MAP_FAILED) data = (u8*)view;
+    }
+    close(file); // The mapping stays valid.
+#endif
+    if(!data) printf("Error: Failed to map file %s\n", file_name);
+    return data;
+}
+
+// Maps the file for reading and writing, creating it or growing it to the given size. Changes reach
+// the file even if the program crashes, flush_mapped_file only starts writing them out sooner.
+u8* map_save_file(const char* file_name, u32 size){
+    u8 *data = NULL;
+#ifdef _WIN32
+    HANDLE file = CreateFileA(file_name, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if(file == INVALID_HANDLE_VALUE){
+        printf("File could not be opened\n");
+        return NULL;
+    }
+    HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READWRITE, 0, size, NULL); // Grows the file.
+    if(mapping){
+        data = (u8*)MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, size);
+        CloseHandle(mapping);
+    }
+    CloseHandle(file);
+#else
+    int file = open(file_name, O_RDWR | O_CREAT, 0644);
+    if(file < 0){
+        printf("File could not be opened\n");
+        return NULL;
+    }
+    struct stat info;
+    bool big_enough = fstat(file, &info) == 0 && info.st_size >= size;
+    if(big_enough || ftruncate(file, size) == 0){
+        void *view = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, file, 0);
+        if(view != MAP_FAILED) data = (u8*)view;
+    }
+    close(file);
+#endif
+    if(!data) printf("Error: Failed to map file %s\n", file_name);
+    return data;
+}
+
+// Starts writing the range back to the file without waiting for it. The offset must be a multiple of
+// the page size.
+void flush_mapped_file(u8 *data, u32 offset, u32 size){
+#ifdef _WIN32
+    FlushViewOfFile(data + offset, size);
+#else
+    msync(data + offset, size, MS_ASYNC);
+#endif
+}
+
+void unmap_binary_file(u8 *data, u32 file_size){
+    if(!data) return;
+#ifdef _WIN32
+    UnmapViewOfFile(data);
+#else
+    munmap(data, file_size);
+#endif
+}
+
 bool file_exists(const char * filename)
 {
     FILE *file = NULL;
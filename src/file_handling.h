@@ -4,4 +4,8 @@
 
 char* text_file_to_string(const char* file_name);
 u8* load_binary_file(const char* file_name, u32 *file_size);
+u8* map_binary_file(const char* file_name, u32 *file_size);
+u8* map_save_file(const char* file_name, u32 size);
+void flush_mapped_file(u8 *data, u32 offset, u32 size);
+void unmap_binary_file(u8 *data, u32 file_size);
 bool file_exists(const char * filename);
\ No newline at end of file
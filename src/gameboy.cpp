@@ -1,43 +1,321 @@
 #include "gameboy.h"
 
-void init_gameboy(Gameboy *gmb, SDL_Renderer *renderer, const char *rom_path){
-    assert(renderer);
+// Everything but the memory, which init_gameboy and init_gameboy_from_rom set up from the ROM.
+static void init_hardware(Gameboy *gmb){
     gmb->frame_time = 1000.0f / 59.7f; // Frame time in milliseconds.
-    init_memory(&gmb->memory, rom_path);
     init_cpu(&gmb->cpu, &gmb->memory);
-    init_ppu(&gmb->ppu, &gmb->memory, renderer);
+    init_ppu(&gmb->ppu, &gmb->memory);
+
+    init_block_cache(&gmb->block_cache, &gmb->arena);
+
+    init_scheduler(&gmb->scheduler);
+    gmb->ppu_cycle = 0;
+    schedule_event(&gmb->scheduler, EVENT_PPU, 1);
+
+    gmb->cpu.gameboy = gmb;
+    reschedule_timer(gmb);
+    gmb->cpu.block_cache = &gmb->block_cache;
+    gmb->execution_mode = EXECUTION_MACHINE_CYCLE;
+    gmb->skip_idle_loops = true;
+}
+
+void init_gameboy(Gameboy *gmb, const char *rom_path){
+    init_arena(&gmb->arena, GAMEBOY_ARENA_SIZE);
+    init_memory(&gmb->memory, &gmb->arena, rom_path);
+    init_hardware(gmb);
+}
+
+// The ROM has to outlive the Gameboy, like with init_memory_from_rom.
+void init_gameboy_from_rom(Gameboy *gmb, u8 *rom_data, u32 rom_size){
+    init_arena(&gmb->arena, GAMEBOY_ARENA_SIZE);
+    init_memory_from_rom(&gmb->memory, &gmb->arena, rom_data, rom_size);
+    init_hardware(gmb);
+}
+
+void free_gameboy(Gameboy *gmb){
+    if(gmb->cpu.fp) fclose(gmb->cpu.fp);
+    free_ppu(&gmb->ppu);
+    free_jit(&gmb->jit);
+    free_memory(&gmb->memory);
+    free_arena(&gmb->arena);
+}
+
+// Returns false and keeps the current mode if the JIT can't be used on this machine.
+bool set_execution_mode(Gameboy *gmb, ExecutionMode mode){
+    if(mode == EXECUTION_JIT && !gmb->jit.code){
+        if(!init_jit(&gmb->jit, &gmb->arena)) return false;
+    }
+    gmb->execution_mode = mode;
+    return true;
 }
 
-void run_gameboy(Gameboy *gmb, LARGE_INTEGER starting_time, i64 perf_count_frequency, const bool *input){
+// Ticks the PPU up to the end of the given machine cycle.
+static void sync_ppu(Gameboy *gmb, u64 cycle){
+    if(cycle <= gmb->ppu_cycle) return;
+
     CPU *cpu = &gmb->cpu;
     PPU *ppu = &gmb->ppu;
-    while(!ppu->frame_ready){
-        // Handling interrupts
-        if(cpu->fetched_next_instruction){
-            handle_interrupts(cpu, ppu);
+    bool frame_was_ready = ppu->frame_ready;
+    ppu_run(ppu, cpu, (u32)(cycle - gmb->ppu_cycle));
+    gmb->ppu_cycle = cycle;
+
+    // Frames end on a PPU event, so this is the cycle it ended on. Done here instead of in run_gameboy,
+    // the other modes can run a few cycles past it and the timers count from cycles_delta.
+    if(ppu->frame_ready && !frame_was_ready){
+        cpu->leave_block = true; // A compiled block stops after the instruction, like run_gameboy does.
+        sync_timers(cpu, cycle);
+        cpu->cycles_delta -= cpu->machine_cycles_per_frame;
+        reschedule_timer(gmb);
+    }
+}
+
+static void run_event(Gameboy *gmb, EventType type){
+    CPU *cpu = &gmb->cpu;
+    Scheduler *scheduler = &gmb->scheduler;
+
+    switch(type){
+        case EVENT_TIMER:{
+            sync_timers(cpu, scheduler->cycle); // TIMA overflows on this cycle.
+            reschedule_timer(gmb);
+            break;
+        }
+        case EVENT_DMA:{
+            sync_ppu(gmb, scheduler->cycle - 1); // The PPU ticks after DMA on the same cycle, it may be scanning OAM.
+            handle_DMA_transfer(cpu);
+            if(cpu->DMA_transfer_in_progress) schedule_event(scheduler, EVENT_DMA, scheduler->cycle + DMA_MACHINE_CYCLES - 1);
+            break;
+        }
+        case EVENT_PPU:{
+            sync_ppu(gmb, scheduler->cycle);
+            reschedule_ppu(gmb);
+            break;
         }
+        default: assert(false);
+    }
+}
+
+// Advances everything but the CPU, running the events that come due on the way. The PPU only ticks on
+// its own events and here at the end, in bulk.
+static void run_hardware(Gameboy *gmb, u32 cycles){
+    Scheduler *scheduler = &gmb->scheduler;
+    u64 end = scheduler->cycle + cycles;
+
+    EventType type;
+    while(pop_due_event(scheduler, end, &type)){
+        run_event(gmb, type);
+    }
+    scheduler->cycle = end;
+    sync_ppu(gmb, end);
+}
+
+// Runs the event on the machine cycle the CPU is in. The CPU is ahead of the scheduler by the cycles
+// the hardware still has to catch up.
+void schedule_cpu_event(Gameboy *gmb, EventType type){
+    schedule_event(&gmb->scheduler, type, gmb->scheduler.cycle + gmb->cpu.pending_cycles + 1);
+}
+
+// Moves the timer event to the cycle TIMA overflows on, after TIMA, TAC or the timer phase changed.
+void reschedule_timer(Gameboy *gmb){
+    u64 cycle = get_timer_overflow_cycle(&gmb->cpu);
+    if(cycle == NO_EVENT) cancel_event(&gmb->scheduler, EVENT_TIMER);
+    else                  schedule_event(&gmb->scheduler, EVENT_TIMER, cycle);
+}
+
+// Moves the PPU event to the next tick that has to run on time, after the PPU ticked or the CPU changed
+// something that decides when that is. The PPU has to be caught up.
+void reschedule_ppu(Gameboy *gmb){
+    u32 cycles = ppu_cycles_until_event(&gmb->ppu);
+    if(cycles == 0) cancel_event(&gmb->scheduler, EVENT_PPU);
+    else            schedule_event(&gmb->scheduler, EVENT_PPU, gmb->ppu_cycle + cycles);
+}
+
+void catch_up_hardware(Gameboy *gmb){
+    CPU *cpu = &gmb->cpu;
+    i32 cycles = cpu->pending_cycles;
+    cpu->pending_cycles = 0; // Cleared first, the joypad and DMA go through the CPU memory functions.
+    run_hardware(gmb, cycles);
+}
+
+// Machine cycles from now in which neither the timers nor the PPU can request an interrupt or change
+// what the CPU sees in LY and STAT, and the PPU has nothing to draw.
+static u32 get_idle_cycles(Gameboy *gmb){
+    if(gmb->cpu.DMA_transfer_in_progress) return 0;
+
+    u32 cycles = ppu_idle_cycles(&gmb->ppu);
+    Scheduler *scheduler = &gmb->scheduler;
+    if(is_event_scheduled(scheduler, EVENT_TIMER)){ // Stops before TIMA overflows.
+        u64 timer_cycles = scheduler->deadlines[EVENT_TIMER] - scheduler->cycle - 1;
+        if(timer_cycles < cycles) cycles = (u32)timer_cycles;
+    }
+    return cycles;
+}
+
+// A halted CPU only wakes up for an interrupt, jumps over the cycles where none can come.
+static void fast_forward_halt(Gameboy *gmb){
+    u32 cycles = get_idle_cycles(gmb);
+    if(cycles == 0) return;
+
+    run_hardware(gmb, cycles); // The PPU jumps over them in bulk and the timers catch up on their own.
+    gmb->halt_skipped_cycles += cycles;
+}
+
+// Machine cycles of one pass of a loop that only polls LY or STAT, like "LDH A,(44h); CP n; JR NZ",
+// starting at the instruction that was just fetched. Only loops that leave A and the flags as they
+// are now and jump back again are matched, so skipping whole passes changes nothing but the time.
+static u32 get_polling_loop_cycles(Gameboy *gmb){
+    CPU *cpu = &gmb->cpu;
+    if(!cpu->fetched_next_instruction || cpu->opcode != 0xF0 || cpu->is_extended || cpu->scheduled_ei) return 0;
+
+    u16 address = cpu->PC - 1;
+    BasicBlock *block = get_basic_block(&gmb->block_cache, &gmb->memory, address);
+    if(!block || block->instruction_count < 2) return 0;
+
+    DecodedInstruction *load = &block->instructions[0];
+    if(load->bytes[1] != 0x44 && load->bytes[1] != 0x41) return 0;
 
-        if(!cpu->handling_interrupt && !cpu->halt){
-            run_cpu(cpu);
+    DecodedInstruction *jump = &block->instructions[block->instruction_count - 1];
+    u8 jump_opcode = jump->bytes[0];
+    if(jump_opcode != 0x20 && jump_opcode != 0x28 && jump_opcode != 0x30 && jump_opcode != 0x38) return 0;
+    if((u16)(jump->address + 2 + (i8)jump->bytes[1]) != address) return 0;
+
+    catch_up_hardware(gmb); // LY and STAT have to be up to date, and the skip starts from now.
+    u8 A = gmb->memory.data[0xFF00 + load->bytes[1]];
+    u8 flags = get_flags(cpu);
+    u32 cycles = 3 + 3; // LDH and the taken JR.
+    for(i32 i = 1; i < block->instruction_count - 1; i++){
+        DecodedInstruction *instruction = &block->instructions[i];
+        u8 value = instruction->bytes[1];
+        if(instruction->bytes[0] == 0xE6){ // AND n
+            A &= value;
+            flags = FLAG_HALFCARRY | (A == 0 ? FLAG_ZERO : 0);
+        }
+        else if(instruction->bytes[0] == 0xFE){ // CP n
+            flags = FLAG_SUB | (A == value ? FLAG_ZERO : 0) | ((A & 0x0F) < (value & 0x0F) ? FLAG_HALFCARRY : 0) |
+                    (A < value ? FLAG_CARRY : 0);
+        }
+        else if(instruction->bytes[0] == 0xCB && (value & 0xC7) == 0x47){ // BIT b,A
+            u8 bit = (value >> 3) & 0x07;
+            flags = (flags & FLAG_CARRY) | FLAG_HALFCARRY | (((A >> bit) & 1) ? 0 : FLAG_ZERO);
         }
-        cpu->cycles_delta += 4;
+        else{
+            return 0;
+        }
+        cycles += 2;
+    }
+    if(A != cpu->A || flags != get_flags(cpu)) return 0;
+
+    bool taken = false;
+    switch(jump_opcode){
+        case 0x20:{taken = !(flags & FLAG_ZERO);  break;}
+        case 0x28:{taken = (flags & FLAG_ZERO);   break;}
+        case 0x30:{taken = !(flags & FLAG_CARRY); break;}
+        case 0x38:{taken = (flags & FLAG_CARRY);  break;}
+    }
+    return taken ? cycles : 0;
+}
+
+// The register a polling loop reads can't change before the PPU gets to the end of an idle line, so
+// whole passes of the loop can be skipped until then.
+static void fast_forward_polling_loop(Gameboy *gmb){
+    u32 loop_cycles = get_polling_loop_cycles(gmb);
+    if(loop_cycles == 0) return;
+
+    u32 cycles = get_idle_cycles(gmb) / loop_cycles * loop_cycles;
+    if(cycles == 0) return;
+
+    run_hardware(gmb, cycles);
+    gmb->idle_loop_skipped_cycles += cycles;
+}
+
+static void run_machine_cycle(Gameboy *gmb){
+    CPU *cpu = &gmb->cpu;
+    PPU *ppu = &gmb->ppu;
+
+    // Handling interrupts
+    if(cpu->fetched_next_instruction){
+        handle_interrupts(cpu, ppu);
+    }
+
+    if(!cpu->handling_interrupt && !cpu->halt){
+        run_cpu(cpu);
+    }
+
+    run_hardware(gmb, 1);
+}
+
+// The hardware stays behind the CPU until the CPU touches something it can see or the next event comes
+// due. Only the events can request an interrupt or end the frame, the CPU's own writes to IE and IF
+// update pending_interrupts right away. A halted CPU waits on the hardware.
+static void catch_up_hardware_if_due(Gameboy *gmb){
+    CPU *cpu = &gmb->cpu;
+    Scheduler *scheduler = &gmb->scheduler;
+    if(cpu->halt || scheduler->cycle + cpu->pending_cycles >= scheduler->next_deadline){
+        catch_up_hardware(gmb);
+    }
+}
+
+// Runs the CPU until the end of the current instruction.
+static void execute_instruction(Gameboy *gmb){
+    CPU *cpu = &gmb->cpu;
+    for(i32 step = 0; step < MAX_MICRO_STEPS; step++){ // Bounded so STOP can't hang the frame.
+        run_cpu(cpu);
+        cpu->pending_cycles++;
+        if(cpu->fetched_next_instruction) break;
+    }
+    catch_up_hardware_if_due(gmb);
+}
 
-        update_timers(cpu);
-        update_joypad(cpu, input);
+// Interrupts are only checked between instructions, so this matches the machine cycle mode except
+// for accesses the CPU makes to memory the hardware doesn't see.
+static void run_instruction(Gameboy *gmb){
+    CPU *cpu = &gmb->cpu;
+    PPU *ppu = &gmb->ppu;
+
+    if(cpu->fetched_next_instruction && (cpu->pending_interrupts || cpu->handling_interrupt)){
+        handle_interrupts(cpu, ppu);
+    }
+
+    if(cpu->handling_interrupt || cpu->halt){
+        catch_up_hardware(gmb); // The interrupt dispatch runs in step with the hardware.
+        if(!cpu->handling_interrupt) fast_forward_halt(gmb);
+        run_hardware(gmb, 1);
+        return;
+    }
 
-        handle_DMA_transfer(cpu);
-        
-       
-        ppu_tick(ppu, cpu);
-        ppu_tick(ppu, cpu);
+    if(gmb->skip_idle_loops){
+        fast_forward_polling_loop(gmb);
+    }
+
+    if(gmb->execution_mode == EXECUTION_JIT && run_jit_block(&gmb->jit, cpu)){
+        catch_up_hardware_if_due(gmb);
+        return;
+    }
+    execute_instruction(gmb);
+}
+
+// The buttons are held for the whole frame.
+void run_gameboy(Gameboy *gmb, i64 starting_time, i64 perf_count_frequency, u8 buttons){
+    CPU *cpu = &gmb->cpu;
+    PPU *ppu = &gmb->ppu;
+    cpu->buttons = buttons;
+
+    if(gmb->execution_mode == EXECUTION_INSTRUCTION || gmb->execution_mode == EXECUTION_JIT){
+        while(!ppu->frame_ready){
+            run_instruction(gmb);
+        }
+        catch_up_hardware(gmb); // The frame can end in the middle of an instruction.
+    }
+    else{
+        while(!ppu->frame_ready){
+            run_machine_cycle(gmb);
+        }
     }
 
     // Handle emulator timing
     // while(1){// Busy wait.
-    //    LARGE_INTEGER end_counter;
-    //    QueryPerformanceCounter(&end_counter);
+    //    i64 end_counter = SDL_GetPerformanceCounter();
 
-    //    i64 counter_elapsed = end_counter.QuadPart - starting_time.QuadPart; 
+    //    i64 counter_elapsed = end_counter - starting_time; 
     //    f32 ms_elapsed     = (f32)((1000.0f*(f32)counter_elapsed) / (f32)perf_count_frequency);
     //    if(ms_elapsed >= gmb->frame_time){
     //        //printf("Milliseconds elapsed: \t%f\n", ms_elapsed);
@@ -48,6 +326,6 @@ void run_gameboy(Gameboy *gmb, LARGE_INTEGER starting_time, i64 perf_count_frequ
     
     
     ppu->frame_ready = false;
-    cpu->cycles_delta -= cpu->machine_cycles_per_frame;
+    update_save_ram(&gmb->memory);
     
 }
\ No newline at end of file
@@ -1,19 +1,46 @@
 #pragma once
-#include <windows.h>
 #include "common.h"
 #include "CPU.h"
 #include "ppu.h"
+#include "block_cache.h"
+#include "jit.h"
+#include "scheduler.h"
 
 const i32 WINDOW_WIDTH  = 160;
 const i32 WINDOW_HEIGHT = 144;
 
+#define GAMEBOY_ARENA_SIZE megabytes(1) // Enough for the cartridge RAM and the code caches, the ROM is mapped.
+
+enum ExecutionMode{
+    EXECUTION_MACHINE_CYCLE, // CPU, timers, DMA and PPU advance together every machine cycle.
+    EXECUTION_INSTRUCTION,   // Whole instructions run at once, the rest of the hardware catches up when the CPU touches it.
+    EXECUTION_JIT,           // Same as EXECUTION_INSTRUCTION but ROM code runs as recompiled x86-64 blocks.
+};
+
 struct Gameboy{
     CPU cpu;
     Memory memory;
     PPU ppu;
+    BlockCache block_cache;
+    Jit jit;
+    Scheduler scheduler;
+    u64 ppu_cycle; // Last machine cycle the PPU ticked for, it lags behind between its events.
+    Arena arena; // Memory banks and caches of this instance.
     i32 cycle_count;
     float frame_time;
+
+    ExecutionMode execution_mode;
+    bool skip_idle_loops; // Fast-forwards loops that poll LY or STAT, only in the instruction and JIT modes.
+    u64 halt_skipped_cycles;      // Machine cycles fast-forwarded while the CPU was halted.
+    u64 idle_loop_skipped_cycles; // Machine cycles fast-forwarded in polling loops.
 };
 
-void init_gameboy(Gameboy *gmb, SDL_Renderer *renderer, const char *rom_path);
-void run_gameboy(Gameboy *gmb, LARGE_INTEGER starting_time, i64 perf_count_frequency, const bool *input);
\ No newline at end of file
+void init_gameboy(Gameboy *gmb, const char *rom_path);
+void init_gameboy_from_rom(Gameboy *gmb, u8 *rom_data, u32 rom_size);
+void free_gameboy(Gameboy *gmb);
+bool set_execution_mode(Gameboy *gmb, ExecutionMode mode);
+void run_gameboy(Gameboy *gmb, i64 starting_time, i64 perf_count_frequency, u8 buttons);
+void catch_up_hardware(Gameboy *gmb);
+void schedule_cpu_event(Gameboy *gmb, EventType type);
+void reschedule_timer(Gameboy *gmb);
+void reschedule_ppu(Gameboy *gmb);
\ No newline at end of file
@@ -0,0 +1,979 @@
+#include "jit.h"
+#include "gameboy.h"
+#include "arena.h"
+#include <stddef.h>
+
+#if JIT_SUPPORTED
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+#define MAX_COMPILED_BLOCK_SIZE 16384 // Enough for MAX_BLOCK_INSTRUCTIONS of the longest translations and their exits.
+#define MAX_BLOCK_EXITS (MAX_BLOCK_INSTRUCTIONS * 8)
+#define JIT_PAGE_SIZE 4096
+#define FLAG_TABLE_SIZE 256 // Game Boy flags for every value of AH after lahf, at the start of the code memory.
+
+enum X86Register{
+    RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+    R8,  R9,  R10, R11, R12, R13, R14, R15,
+};
+
+// Argument registers of the platform calling convention.
+#ifdef _WIN32
+#define ARGUMENT_1 RCX
+#define ARGUMENT_2 RDX
+#define ARGUMENT_3 R8
+#else
+#define ARGUMENT_1 RDI
+#define ARGUMENT_2 RSI
+#define ARGUMENT_3 RDX
+#endif
+
+// Condition codes of jcc.
+#define CONDITION_EQUAL           0x4
+#define CONDITION_NOT_EQUAL       0x5
+#define CONDITION_BELOW_OR_EQUAL  0x6
+
+#define CPU_FIELD(field) ((u32)offsetof(CPU, field))
+
+// Compiled code keeps the CPU pointer in rbx, the scheduler in r12 and in r13 the machine cycles left until
+// the next event is due, counted from pending_cycles. Cycles of translated instructions are only added to
+// pending_cycles before calls into the emulator and when the block leaves, in between the compiler knows
+// them, so checking for the next event between instructions is a single comparison.
+
+// Where a block leaves before its end. The stub finishes the instruction boundary the way the interpreter
+// would have left it.
+struct BlockExit{
+    u8 *jump;         // rel32 of the jump to the stub.
+    i32 cycles;       // Machine cycles not added to pending_cycles yet.
+    u16 PC;           // Past the opcode of the next instruction.
+    u8 opcode;
+    bool is_extended; // Between the CB prefix and its opcode.
+    bool refetch;     // The opcode isn't known or the code may have changed, it's fetched like the interpreter does.
+};
+
+struct Emitter{
+    u8 *start;
+    u8 *current;
+    u8 *flag_table;
+    BasicBlock *source; // Copy of the block the interpreted instructions fetch their operands from.
+
+    BlockExit exits[MAX_BLOCK_EXITS];
+    u32 exit_count;
+
+    i32 cycles;          // Machine cycles run since pending_cycles was last updated.
+    bool flags_resolved; // F holds the flags and lazy_flags is LAZY_FLAGS_NONE.
+    bool cpu_synced;     // PC, opcode and decoded are where the interpreter would have them.
+    bool called_out;     // Since the last boundary, memory may have been written or an interrupt requested.
+};
+
+static void emit_u8(Emitter *emitter, u8 value){
+    *emitter->current++ = value;
+}
+
+static void emit_u16(Emitter *emitter, u16 value){
+    memcpy(emitter->current, &value, sizeof(value));
+    emitter->current += sizeof(value);
+}
+
+static void emit_u32(Emitter *emitter, u32 value){
+    memcpy(emitter->current, &value, sizeof(value));
+    emitter->current += sizeof(value);
+}
+
+static void emit_u64(Emitter *emitter, u64 value){
+    memcpy(emitter->current, &value, sizeof(value));
+    emitter->current += sizeof(value);
+}
+
+static void patch_rel32(u8 *field, u8 *target){
+    i32 offset = (i32)(target - (field + 4));
+    memcpy(field, &offset, sizeof(offset));
+}
+
+// Only needed to reach R8 to R15.
+static void emit_rex(Emitter *emitter, u8 reg, u8 rm){
+    u8 rex = 0x40 | ((reg & 8) ? 0x04 : 0) | ((rm & 8) ? 0x01 : 0);
+    if(rex != 0x40) emit_u8(emitter, rex);
+}
+
+// ModRM and displacement of [rbx + offset], the CPU field an instruction works on.
+static void emit_cpu_field(Emitter *emitter, u8 reg, u32 offset){
+    emit_u8(emitter, 0x80 | ((reg & 7) << 3) | RBX);
+    emit_u32(emitter, offset);
+}
+
+// Byte registers are only ever AL, CL and DL, which need no REX prefix.
+static void emit_load_u8(Emitter *emitter, u8 reg, u32 offset){
+    emit_u8(emitter, 0x8A); emit_cpu_field(emitter, reg, offset);                          // mov r8, [rbx + offset]
+}
+
+static void emit_store_u8(Emitter *emitter, u8 reg, u32 offset){
+    emit_u8(emitter, 0x88); emit_cpu_field(emitter, reg, offset);                          // mov [rbx + offset], r8
+}
+
+static void emit_store_u16(Emitter *emitter, u8 reg, u32 offset){
+    emit_u8(emitter, 0x66); emit_u8(emitter, 0x89); emit_cpu_field(emitter, reg, offset);  // mov [rbx + offset], r16
+}
+
+static void emit_store_imm8(Emitter *emitter, u32 offset, u8 value){
+    emit_u8(emitter, 0xC6); emit_cpu_field(emitter, 0, offset); emit_u8(emitter, value);   // mov byte [rbx + offset], imm8
+}
+
+static void emit_store_imm16(Emitter *emitter, u32 offset, u16 value){
+    emit_u8(emitter, 0x66); emit_u8(emitter, 0xC7); emit_cpu_field(emitter, 0, offset);    // mov word [rbx + offset], imm16
+    emit_u16(emitter, value);
+}
+
+static void emit_store_pointer(Emitter *emitter, u32 offset, const void *pointer){
+    emit_u8(emitter, 0x48); emit_u8(emitter, 0xB8); emit_u64(emitter, (u64)(uintptr_t)pointer); // mov rax, pointer
+    emit_u8(emitter, 0x48); emit_u8(emitter, 0x89); emit_cpu_field(emitter, RAX, offset);       // mov [rbx + offset], rax
+}
+
+static void emit_load_zero_extended_u8(Emitter *emitter, u8 reg, u32 offset){
+    emit_rex(emitter, reg, 0);
+    emit_u8(emitter, 0x0F); emit_u8(emitter, 0xB6); emit_cpu_field(emitter, reg, offset);  // movzx r32, byte [rbx + offset]
+}
+
+static void emit_load_zero_extended_u16(Emitter *emitter, u8 reg, u32 offset){
+    emit_rex(emitter, reg, 0);
+    emit_u8(emitter, 0x0F); emit_u8(emitter, 0xB7); emit_cpu_field(emitter, reg, offset);  // movzx r32, word [rbx + offset]
+}
+
+static void emit_mov_imm32(Emitter *emitter, u8 reg, u32 value){
+    emit_rex(emitter, 0, reg);
+    emit_u8(emitter, 0xB8 | (reg & 7)); emit_u32(emitter, value);                         // mov r32, imm32
+}
+
+// ADD, OR, ADC, SBB, AND, SUB, XOR or CMP of a CPU field and an immediate, by the x86 opcode extension.
+static void emit_field_op_imm8(Emitter *emitter, u8 extension, u32 offset, u8 value){
+    emit_u8(emitter, 0x80); emit_cpu_field(emitter, extension, offset); emit_u8(emitter, value); // op byte [rbx + offset], imm8
+}
+
+static void emit_count_cycles(Emitter *emitter){
+    if(emitter->cycles == 0) return;
+    emit_u8(emitter, 0x81); emit_cpu_field(emitter, 0, CPU_FIELD(pending_cycles));         // add dword [rbx + pending_cycles], cycles
+    emit_u32(emitter, (u32)emitter->cycles);
+    emitter->cycles = 0;
+}
+
+// Calls function(cpu, ...), the other arguments have to be in place already.
+static void emit_call(Emitter *emitter, void *function){
+    emit_u8(emitter, 0x48); emit_u8(emitter, 0x89); emit_u8(emitter, 0xC0 | (RBX << 3) | ARGUMENT_1); // mov argument, rbx
+    emit_u8(emitter, 0x48); emit_u8(emitter, 0xB8); emit_u64(emitter, (u64)(uintptr_t)function);    // mov rax, function
+    emit_u8(emitter, 0xFF); emit_u8(emitter, 0xD0);                                                   // call rax
+}
+
+// r13 = next_deadline - cycle - pending_cycles, or 0 when the event is already due. A CPU on its own, like
+// in the opcode tests, has no scheduler and never has an event coming up. Taken again after every call into
+// the emulator, the hardware may have caught up and scheduled something else. Keeps RAX, which holds the
+// value read from memory.
+static void emit_load_cycle_budget(Emitter *emitter){
+    emit_u8(emitter, 0x4D); emit_u8(emitter, 0x85); emit_u8(emitter, 0xE4);                           // test r12, r12
+    emit_u8(emitter, 0x75);                                                                           // jne scheduler
+    u8 *scheduler = emitter->current;
+    emit_u8(emitter, 0);
+    emit_u8(emitter, 0x49); emit_u8(emitter, 0xC7); emit_u8(emitter, 0xC5); emit_u32(emitter, 0xFFFFFFFF); // mov r13, -1
+    emit_u8(emitter, 0xEB);                                                                           // jmp done
+    u8 *done = emitter->current;
+    emit_u8(emitter, 0);
+    *scheduler = (u8)(emitter->current - (scheduler + 1));
+
+    emit_u8(emitter, 0x4D); emit_u8(emitter, 0x8B); emit_u8(emitter, 0xAC); emit_u8(emitter, 0x24); // mov r13, [r12 + next_deadline]
+    emit_u32(emitter, (u32)offsetof(Scheduler, next_deadline));
+    emit_u8(emitter, 0x48); emit_u8(emitter, 0x63); emit_cpu_field(emitter, RCX, CPU_FIELD(pending_cycles)); // movsxd rcx, [rbx + pending_cycles]
+    emit_u8(emitter, 0x49); emit_u8(emitter, 0x03); emit_u8(emitter, 0x8C); emit_u8(emitter, 0x24); // add rcx, [r12 + cycle]
+    emit_u32(emitter, (u32)offsetof(Scheduler, cycle));
+    emit_u8(emitter, 0x49); emit_u8(emitter, 0x29); emit_u8(emitter, 0xCD);                           // sub r13, rcx
+    emit_u8(emitter, 0x73); emit_u8(emitter, 0x03);                                                   // jae skip
+    emit_u8(emitter, 0x45); emit_u8(emitter, 0x31); emit_u8(emitter, 0xED);                           // xor r13d, r13d
+    *done = (u8)(emitter->current - (done + 1));
+}
+
+static void emit_prologue(Emitter *emitter){
+    emit_u8(emitter, 0x53);                                                    // push rbx
+    emit_u8(emitter, 0x41); emit_u8(emitter, 0x54);                            // push r12
+    emit_u8(emitter, 0x41); emit_u8(emitter, 0x55);                            // push r13
+#ifdef _WIN32
+    emit_u8(emitter, 0x48); emit_u8(emitter, 0x83); emit_u8(emitter, 0xEC); emit_u8(emitter, 0x20); // sub rsp, 32
+#endif
+    emit_u8(emitter, 0x48); emit_u8(emitter, 0x89); emit_u8(emitter, 0xC0 | (ARGUMENT_1 << 3) | RBX);       // mov rbx, argument 1
+    emit_u8(emitter, 0x49); emit_u8(emitter, 0x89); emit_u8(emitter, 0xC0 | ((ARGUMENT_2 & 7) << 3) | (R12 & 7)); // mov r12, argument 2
+    emit_load_cycle_budget(emitter);
+}
+
+static void emit_epilogue(Emitter *emitter){
+#ifdef _WIN32
+    emit_u8(emitter, 0x48); emit_u8(emitter, 0x83); emit_u8(emitter, 0xC4); emit_u8(emitter, 0x20); // add rsp, 32
+#endif
+    emit_u8(emitter, 0x41); emit_u8(emitter, 0x5D);                            // pop r13
+    emit_u8(emitter, 0x41); emit_u8(emitter, 0x5C);                            // pop r12
+    emit_u8(emitter, 0x5B);                                                    // pop rbx
+    emit_u8(emitter, 0xC3);                                                    // ret
+}
+
+// Jumps to a stub that leaves the block at the instruction starting at address, the jump is unconditional
+// without a condition.
+static void emit_exit(Emitter *emitter, const BlockExit *exit, i32 condition = -1){
+    assert(emitter->exit_count < MAX_BLOCK_EXITS);
+    if(condition < 0){
+        emit_u8(emitter, 0xE9);                                                // jmp stub
+    }
+    else{
+        emit_u8(emitter, 0x0F); emit_u8(emitter, 0x80 | (u8)condition);        // jcc stub
+    }
+    BlockExit *entry = &emitter->exits[emitter->exit_count++];
+    *entry = *exit;
+    entry->jump = emitter->current;
+    emit_u32(emitter, 0);
+}
+
+static void emit_exit_stub(Emitter *emitter, BlockExit *exit, u8 *epilogue){
+    patch_rel32(exit->jump, emitter->current);
+    emitter->cycles = exit->cycles;
+    emit_count_cycles(emitter);
+
+    emit_u8(emitter, 0x48); emit_u8(emitter, 0xC7); emit_cpu_field(emitter, 0, CPU_FIELD(decoded)); // mov qword [rbx + decoded], 0
+    emit_u32(emitter, 0);
+    if(exit->refetch){
+        emit_store_imm16(emitter, CPU_FIELD(PC), exit->PC - 1);
+        emit_call(emitter, (void*)go_to_next_instruction);
+    }
+    else{
+        emit_store_imm16(emitter, CPU_FIELD(PC), exit->PC);
+        emit_store_imm8(emitter, CPU_FIELD(opcode), exit->opcode);
+    }
+    if(exit->is_extended) emit_store_imm8(emitter, CPU_FIELD(is_extended), 1);
+
+    emit_u8(emitter, 0xE9);                                                    // jmp epilogue
+    emit_u32(emitter, 0);
+    patch_rel32(emitter->current - 4, epilogue);
+}
+
+// Between instructions, where the interpreter catches up the hardware once an event is due and takes
+// interrupts. The block leaves there and lets run_instruction do both.
+static void emit_instruction_boundary(Emitter *emitter, u16 PC, u8 opcode, bool is_extended){
+    BlockExit exit = {};
+    exit.cycles = emitter->cycles;
+    exit.PC = PC;
+    exit.opcode = opcode;
+    exit.is_extended = is_extended;
+
+    if(emitter->called_out){
+        // The MBC or cached code was written to, or the frame ended.
+        emit_field_op_imm8(emitter, 7, CPU_FIELD(leave_block), 0);            // cmp byte [rbx + leave_block], 0
+        BlockExit refetch = exit;
+        refetch.refetch = true;
+        emit_exit(emitter, &refetch, CONDITION_NOT_EQUAL);
+
+        // An interrupt requested by the hardware that caught up or by a write to IE or IF.
+        emit_field_op_imm8(emitter, 7, CPU_FIELD(pending_interrupts), 0);     // cmp byte [rbx + pending_interrupts], 0
+        emit_u8(emitter, 0x74);                                                // je skip
+        u8 *skip = emitter->current;
+        emit_u8(emitter, 0);
+        emit_field_op_imm8(emitter, 7, CPU_FIELD(IME), 0);                    // cmp byte [rbx + IME], 0
+        emit_exit(emitter, &exit, CONDITION_NOT_EQUAL);
+        *skip = (u8)(emitter->current - (skip + 1));
+        emitter->called_out = false;
+    }
+
+    emit_u8(emitter, 0x49); emit_u8(emitter, 0x81); emit_u8(emitter, 0xFD);   // cmp r13, cycles
+    emit_u32(emitter, (u32)emitter->cycles);
+    emit_exit(emitter, &exit, CONDITION_BELOW_OR_EQUAL);
+}
+
+// Flags left lazy by the interpreter are worked out before an instruction that keeps some of them.
+static void emit_resolve_flags(Emitter *emitter){
+    if(emitter->flags_resolved) return;
+
+    emit_field_op_imm8(emitter, 7, CPU_FIELD(lazy_flags), LAZY_FLAGS_NONE);   // cmp byte [rbx + lazy_flags], 0
+    emit_u8(emitter, 0x74);                                                    // je skip
+    u8 *skip = emitter->current;
+    emit_u8(emitter, 0);
+    emit_call(emitter, (void*)get_flags);
+    *skip = (u8)(emitter->current - (skip + 1));
+    emitter->flags_resolved = true;
+}
+
+// Stores AL as F. Instructions that set every flag drop whatever the interpreter left lazy.
+static void emit_store_flags(Emitter *emitter){
+    emit_store_u8(emitter, RAX, CPU_FIELD(flags));
+    if(!emitter->flags_resolved){
+        emit_store_imm8(emitter, CPU_FIELD(lazy_flags), LAZY_FLAGS_NONE);
+        emitter->flags_resolved = true;
+    }
+}
+
+// AL = zero, half carry and carry from AH after a lahf. The half carry is the x86 auxiliary carry, which
+// comes from bit 3 like on the Game Boy.
+static void emit_flags_from_ah(Emitter *emitter){
+    emit_u8(emitter, 0x0F); emit_u8(emitter, 0xB6); emit_u8(emitter, 0xC4);   // movzx eax, ah
+    emit_u8(emitter, 0x48); emit_u8(emitter, 0x8D); emit_u8(emitter, 0x0D);   // lea rcx, [rip + flag_table]
+    emit_u32(emitter, 0);
+    patch_rel32(emitter->current - 4, emitter->flag_table);
+    emit_u8(emitter, 0x8A); emit_u8(emitter, 0x04); emit_u8(emitter, 0x01);   // mov al, [rcx + rax]
+}
+
+// Carry flag into the x86 carry for ADC, SBC, RLA and RRA. F has to be resolved.
+static void emit_load_carry(Emitter *emitter){
+    emit_load_u8(emitter, RCX, CPU_FIELD(flags));
+    emit_u8(emitter, 0xC0); emit_u8(emitter, 0xE9); emit_u8(emitter, 0x05);   // shr cl, 5
+}
+
+// Keeps the carry of F in AL for INC, DEC and BIT, which don't change it.
+static void emit_keep_carry(Emitter *emitter){
+    emit_load_u8(emitter, RCX, CPU_FIELD(flags));
+    emit_u8(emitter, 0x80); emit_u8(emitter, 0xE1); emit_u8(emitter, 0x10);   // and cl, 10h
+    emit_u8(emitter, 0x08); emit_u8(emitter, 0xC8);                            // or al, cl
+}
+
+static u32 get_register_offset(u8 reg){
+    switch(reg){
+        case 0: return CPU_FIELD(B);
+        case 1: return CPU_FIELD(C);
+        case 2: return CPU_FIELD(D);
+        case 3: return CPU_FIELD(E);
+        case 4: return CPU_FIELD(H);
+        case 5: return CPU_FIELD(L);
+        case 7: return CPU_FIELD(A);
+    }
+    assert(false); // [HL] isn't a register.
+    return 0;
+}
+
+static u32 get_wide_register_offset(u8 reg){
+    switch(reg){
+        case 0: return CPU_FIELD(BC);
+        case 1: return CPU_FIELD(DE);
+        case 2: return CPU_FIELD(HL);
+        case 3: return CPU_FIELD(SP);
+    }
+    assert(false);
+    return 0;
+}
+
+// Calls read_memory_cpu or write_memory_cpu on the given machine cycle of the instruction, with pending_cycles
+// where the interpreter would have it. The address and value have to be in their argument registers.
+static void emit_memory_access(Emitter *emitter, void *function, i32 cycle){
+    emitter->cycles += cycle;
+    emit_count_cycles(emitter);
+    emit_call(emitter, function);
+    emit_load_cycle_budget(emitter);
+    emitter->cycles = -cycle; // The instruction adds all of its cycles at the end.
+    emitter->called_out = true;
+}
+
+static void emit_read(Emitter *emitter, i32 cycle){
+    emit_memory_access(emitter, (void*)read_memory_cpu, cycle);
+}
+
+static void emit_write(Emitter *emitter, i32 cycle){
+    emit_memory_access(emitter, (void*)write_memory_cpu, cycle);
+}
+
+// ADD, ADC, SUB, SBC, AND, XOR, OR or CP of A and DL, by bits 3-5 of the opcode.
+static void emit_alu(Emitter *emitter, u8 operation){
+    static const u8 x86_operations[8] = {0x00, 0x10, 0x28, 0x18, 0x20, 0x30, 0x08, 0x38}; // op r/m8, r8
+
+    bool uses_carry = operation == 1 || operation == 3;
+    if(uses_carry) emit_load_carry(emitter);
+    emit_load_u8(emitter, RAX, CPU_FIELD(A));
+    emit_u8(emitter, x86_operations[operation]); emit_u8(emitter, 0xD0);     // op al, dl
+    emit_u8(emitter, 0x9F);                                                    // lahf
+    if(operation != 7) emit_store_u8(emitter, RAX, CPU_FIELD(A));
+    emit_flags_from_ah(emitter);
+
+    switch(operation){
+        case 2: case 3: case 7:{ // SUB, SBC and CP
+            emit_u8(emitter, 0x0C); emit_u8(emitter, FLAG_SUB);                // or al, FLAG_SUB
+            break;
+        }
+        case 4:{ // AND
+            emit_u8(emitter, 0x24); emit_u8(emitter, FLAG_ZERO);               // and al, FLAG_ZERO
+            emit_u8(emitter, 0x0C); emit_u8(emitter, FLAG_HALFCARRY);          // or al, FLAG_HALFCARRY
+            break;
+        }
+        case 5: case 6:{ // XOR and OR
+            emit_u8(emitter, 0x24); emit_u8(emitter, FLAG_ZERO);               // and al, FLAG_ZERO
+            break;
+        }
+    }
+    emit_store_flags(emitter);
+}
+
+static void emit_inc_dec_r8(Emitter *emitter, u32 offset, bool decrement){
+    emit_resolve_flags(emitter);
+    emit_load_u8(emitter, RAX, offset);
+    emit_u8(emitter, 0xFE); emit_u8(emitter, decrement ? 0xC8 : 0xC0);        // inc al or dec al
+    emit_u8(emitter, 0x9F);                                                    // lahf
+    emit_store_u8(emitter, RAX, offset);
+    emit_flags_from_ah(emitter);
+    emit_u8(emitter, 0x24); emit_u8(emitter, FLAG_ZERO | FLAG_HALFCARRY);     // and al, Z and H
+    if(decrement){
+        emit_u8(emitter, 0x0C); emit_u8(emitter, FLAG_SUB);                    // or al, FLAG_SUB
+    }
+    emit_keep_carry(emitter);
+    emit_store_flags(emitter);
+}
+
+// ADD HL, r16. H and C come from bits 11 and 15, worked out from the carries into bits 12 and 16 of the sum.
+static void emit_add_hl(Emitter *emitter, u32 offset){
+    emit_resolve_flags(emitter);
+    emit_load_zero_extended_u16(emitter, RAX, CPU_FIELD(HL));
+    emit_load_zero_extended_u16(emitter, RCX, offset);
+    emit_u8(emitter, 0x8D); emit_u8(emitter, 0x14); emit_u8(emitter, 0x08);   // lea edx, [rax + rcx]
+    emit_store_u16(emitter, RDX, CPU_FIELD(HL));
+    emit_u8(emitter, 0x31); emit_u8(emitter, 0xC8);                            // xor eax, ecx
+    emit_u8(emitter, 0x31); emit_u8(emitter, 0xD0);                            // xor eax, edx
+    emit_u8(emitter, 0x89); emit_u8(emitter, 0xC1);                            // mov ecx, eax
+    emit_u8(emitter, 0xC1); emit_u8(emitter, 0xE8); emit_u8(emitter, 0x07);   // shr eax, 7
+    emit_u8(emitter, 0x83); emit_u8(emitter, 0xE0); emit_u8(emitter, FLAG_HALFCARRY); // and eax, FLAG_HALFCARRY
+    emit_u8(emitter, 0xC1); emit_u8(emitter, 0xE9); emit_u8(emitter, 0x0C);   // shr ecx, 12
+    emit_u8(emitter, 0x83); emit_u8(emitter, 0xE1); emit_u8(emitter, FLAG_CARRY); // and ecx, FLAG_CARRY
+    emit_u8(emitter, 0x09); emit_u8(emitter, 0xC8);                            // or eax, ecx
+    emit_load_u8(emitter, RCX, CPU_FIELD(flags));
+    emit_u8(emitter, 0x80); emit_u8(emitter, 0xE1); emit_u8(emitter, FLAG_ZERO); // and cl, FLAG_ZERO
+    emit_u8(emitter, 0x08); emit_u8(emitter, 0xC8);                            // or al, cl
+    emit_store_flags(emitter);
+}
+
+// RLC, RRC, RL, RR, SLA, SRA, SWAP and SRL of AL by bits 3-5 of the prefixed opcode, or RLCA, RRCA, RLA and
+// RRA when the zero flag is always cleared. Leaves the result in AL and the flags in CL.
+static void emit_shift(Emitter *emitter, u8 operation, bool set_zero){
+    static const u8 x86_shifts[8] = {0xC0, 0xC8, 0xD0, 0xD8, 0xE0, 0xF8, 0, 0xE8}; // rol, ror, rcl, rcr, shl, sar, -, shr
+
+    if(operation == 6){
+        emit_u8(emitter, 0xC0); emit_u8(emitter, 0xC0); emit_u8(emitter, 0x04); // rol al, 4
+        emit_u8(emitter, 0x31); emit_u8(emitter, 0xC9);                        // xor ecx, ecx
+        emit_u8(emitter, 0x84); emit_u8(emitter, 0xC0);                        // test al, al
+    }
+    else{
+        emit_u8(emitter, 0xD0); emit_u8(emitter, x86_shifts[operation]);      // op al, 1
+        emit_u8(emitter, 0x0F); emit_u8(emitter, 0x92); emit_u8(emitter, 0xC1); // setc cl
+        emit_u8(emitter, 0xC0); emit_u8(emitter, 0xE1); emit_u8(emitter, 0x04); // shl cl, 4
+        if(set_zero){
+            emit_u8(emitter, 0x84); emit_u8(emitter, 0xC0);                    // test al, al
+        }
+    }
+    if(set_zero){
+        emit_u8(emitter, 0x0F); emit_u8(emitter, 0x94); emit_u8(emitter, 0xC2); // setz dl
+        emit_u8(emitter, 0xC0); emit_u8(emitter, 0xE2); emit_u8(emitter, 0x07); // shl dl, 7
+        emit_u8(emitter, 0x08); emit_u8(emitter, 0xD1);                        // or cl, dl
+    }
+}
+
+static void emit_shift_r8(Emitter *emitter, u32 offset, u8 operation, bool set_zero){
+    bool uses_carry = operation == 2 || operation == 3;
+    if(uses_carry){
+        emit_resolve_flags(emitter);
+        emit_load_carry(emitter);
+    }
+    emit_load_u8(emitter, RAX, offset);
+    emit_shift(emitter, operation, set_zero);
+    emit_store_u8(emitter, RAX, offset);
+    emit_u8(emitter, 0x88); emit_u8(emitter, 0xC8);                            // mov al, cl
+    emit_store_flags(emitter);
+}
+
+// Translates the instruction into x86-64 that works on the CPU fields directly. Returns false for the ones
+// left to their micro-steps.
+static bool emit_native_instruction(Emitter *emitter, const DecodedInstruction *instruction){
+    u8 opcode = instruction->bytes[0];
+    u8 imm8 = instruction->bytes[1];
+    u16 imm16 = instruction->bytes[1] | (instruction->bytes[2] << 8);
+    u8 dest = (opcode >> 3) & 0x07;
+    u8 src = opcode & 0x07;
+    u8 r16 = (opcode >> 4) & 0x03;
+
+    if(opcode == 0x00){ // NOP
+    }
+    else if(opcode >= 0x40 && opcode < 0x80 && opcode != 0x76){ // LD r8, r8 and the loads through [HL]
+        if(src == 6){
+            emit_load_zero_extended_u16(emitter, ARGUMENT_2, CPU_FIELD(HL));
+            emit_read(emitter, 0);
+            emit_store_u8(emitter, RAX, get_register_offset(dest));
+        }
+        else if(dest == 6){
+            emit_load_zero_extended_u16(emitter, ARGUMENT_2, CPU_FIELD(HL));
+            emit_load_zero_extended_u8(emitter, ARGUMENT_3, get_register_offset(src));
+            emit_write(emitter, 0);
+        }
+        else if(dest != src){
+            emit_load_u8(emitter, RAX, get_register_offset(src));
+            emit_store_u8(emitter, RAX, get_register_offset(dest));
+        }
+    }
+    else if(opcode >= 0x80 && opcode < 0xC0){ // ALU A, r8 and ALU A, [HL]
+        if(dest == 1 || dest == 3) emit_resolve_flags(emitter);
+        if(src == 6){
+            emit_load_zero_extended_u16(emitter, ARGUMENT_2, CPU_FIELD(HL));
+            emit_read(emitter, 0);
+            emit_u8(emitter, 0x88); emit_u8(emitter, 0xC2);                    // mov dl, al
+        }
+        else{
+            emit_load_u8(emitter, RDX, get_register_offset(src));
+        }
+        emit_alu(emitter, dest);
+    }
+    else if((opcode & 0xC7) == 0xC6){ // ALU A, imm8
+        if(dest == 1 || dest == 3) emit_resolve_flags(emitter);
+        emit_u8(emitter, 0xB2); emit_u8(emitter, imm8);                        // mov dl, imm8
+        emit_alu(emitter, dest);
+    }
+    else if((opcode & 0xC7) == 0x06){ // LD r8, imm8 and LD [HL], imm8
+        if(dest == 6){
+            emit_load_zero_extended_u16(emitter, ARGUMENT_2, CPU_FIELD(HL));
+            emit_mov_imm32(emitter, ARGUMENT_3, imm8);
+            emit_write(emitter, 1);
+        }
+        else{
+            emit_store_imm8(emitter, get_register_offset(dest), imm8);
+        }
+    }
+    else if((opcode & 0xC6) == 0x04 && dest != 6){ // INC r8 and DEC r8
+        emit_inc_dec_r8(emitter, get_register_offset(dest), opcode & 0x01);
+    }
+    else if((opcode & 0xCF) == 0x01){ // LD r16, imm16
+        emit_store_imm16(emitter, get_wide_register_offset(r16), imm16);
+    }
+    else if((opcode & 0xC7) == 0x03){ // INC r16 and DEC r16
+        emit_u8(emitter, 0x66); emit_u8(emitter, 0xFF);                        // inc or dec word [rbx + r16]
+        emit_cpu_field(emitter, (opcode & 0x08) ? 1 : 0, get_wide_register_offset(r16));
+    }
+    else if((opcode & 0xCF) == 0x09){ // ADD HL, r16
+        emit_add_hl(emitter, get_wide_register_offset(r16));
+    }
+    else if(opcode == 0x02 || opcode == 0x12 || opcode == 0x22 || opcode == 0x32){ // LD [BC], A to LD [HL-], A
+        emit_load_zero_extended_u16(emitter, ARGUMENT_2, get_wide_register_offset(r16 == 1 ? 1 : (r16 == 0 ? 0 : 2)));
+        emit_load_zero_extended_u8(emitter, ARGUMENT_3, CPU_FIELD(A));
+        emit_write(emitter, 0);
+        if(opcode == 0x22 || opcode == 0x32){
+            emit_u8(emitter, 0x66); emit_u8(emitter, 0xFF);                    // inc or dec word [rbx + HL]
+            emit_cpu_field(emitter, opcode == 0x32 ? 1 : 0, CPU_FIELD(HL));
+        }
+    }
+    else if(opcode == 0x0A || opcode == 0x1A || opcode == 0x2A || opcode == 0x3A){ // LD A, [BC] to LD A, [HL-]
+        emit_load_zero_extended_u16(emitter, ARGUMENT_2, get_wide_register_offset(r16 == 1 ? 1 : (r16 == 0 ? 0 : 2)));
+        emit_read(emitter, 0);
+        emit_store_u8(emitter, RAX, CPU_FIELD(A));
+        if(opcode == 0x2A || opcode == 0x3A){
+            emit_u8(emitter, 0x66); emit_u8(emitter, 0xFF);                    // inc or dec word [rbx + HL]
+            emit_cpu_field(emitter, opcode == 0x3A ? 1 : 0, CPU_FIELD(HL));
+        }
+    }
+    else if(opcode == 0x07 || opcode == 0x0F || opcode == 0x17 || opcode == 0x1F){ // RLCA, RRCA, RLA and RRA
+        emit_shift_r8(emitter, CPU_FIELD(A), dest, false);
+    }
+    else if(opcode == 0x2F){ // CPL
+        emit_resolve_flags(emitter);
+        emit_u8(emitter, 0xF6); emit_cpu_field(emitter, 2, CPU_FIELD(A));     // not byte [rbx + A]
+        emit_field_op_imm8(emitter, 1, CPU_FIELD(flags), FLAG_SUB | FLAG_HALFCARRY); // or byte [rbx + flags], N and H
+    }
+    else if(opcode == 0x37 || opcode == 0x3F){ // SCF and CCF
+        emit_resolve_flags(emitter);
+        emit_load_u8(emitter, RAX, CPU_FIELD(flags));
+        if(opcode == 0x37){
+            emit_u8(emitter, 0x24); emit_u8(emitter, FLAG_ZERO);               // and al, FLAG_ZERO
+            emit_u8(emitter, 0x0C); emit_u8(emitter, FLAG_CARRY);              // or al, FLAG_CARRY
+        }
+        else{
+            emit_u8(emitter, 0x24); emit_u8(emitter, FLAG_ZERO | FLAG_CARRY);  // and al, Z and C
+            emit_u8(emitter, 0x34); emit_u8(emitter, FLAG_CARRY);              // xor al, FLAG_CARRY
+        }
+        emit_store_flags(emitter);
+    }
+    else if(opcode == 0xE0 || opcode == 0xEA){ // LDH [imm8], A and LD [imm16], A
+        emit_mov_imm32(emitter, ARGUMENT_2, opcode == 0xE0 ? 0xFF00 + imm8 : imm16);
+        emit_load_zero_extended_u8(emitter, ARGUMENT_3, CPU_FIELD(A));
+        emit_write(emitter, opcode == 0xE0 ? 1 : 2);
+    }
+    else if(opcode == 0xF0 || opcode == 0xFA){ // LDH A, [imm8] and LD A, [imm16]
+        emit_mov_imm32(emitter, ARGUMENT_2, opcode == 0xF0 ? 0xFF00 + imm8 : imm16);
+        emit_read(emitter, opcode == 0xF0 ? 1 : 2);
+        emit_store_u8(emitter, RAX, CPU_FIELD(A));
+    }
+    else if(opcode == 0xE2 || opcode == 0xF2){ // LDH [C], A and LDH A, [C]
+        emit_load_zero_extended_u8(emitter, ARGUMENT_2, CPU_FIELD(C));
+        emit_rex(emitter, 0, ARGUMENT_2);
+        emit_u8(emitter, 0x81); emit_u8(emitter, 0xC8 | (ARGUMENT_2 & 7)); emit_u32(emitter, 0xFF00); // or argument 2, 0xFF00
+        if(opcode == 0xE2){
+            emit_load_zero_extended_u8(emitter, ARGUMENT_3, CPU_FIELD(A));
+            emit_write(emitter, 0);
+        }
+        else{
+            emit_read(emitter, 0);
+            emit_store_u8(emitter, RAX, CPU_FIELD(A));
+        }
+    }
+    else if(opcode == 0xF9){ // LD SP, HL
+        emit_load_zero_extended_u16(emitter, RAX, CPU_FIELD(HL));
+        emit_store_u16(emitter, RAX, CPU_FIELD(SP));
+    }
+    else{
+        return false;
+    }
+
+    emitter->cycles += get_opcode_steps(opcode, false)->cycles;
+    emitter->cpu_synced = false;
+    return true;
+}
+
+// The opcode after the CB prefix, only the ones on registers.
+static bool emit_native_extended_instruction(Emitter *emitter, u8 opcode){
+    u8 reg = opcode & 0x07;
+    u8 bit = (opcode >> 3) & 0x07;
+    if(reg == 6) return false;
+
+    u32 offset = get_register_offset(reg);
+    switch(opcode & 0xC0){
+        case 0x00:{ // RLC, RRC, RL, RR, SLA, SRA, SWAP and SRL
+            emit_shift_r8(emitter, offset, bit, true);
+            break;
+        }
+        case 0x40:{ // BIT
+            emit_resolve_flags(emitter);
+            emit_u8(emitter, 0xF6); emit_cpu_field(emitter, 0, offset); emit_u8(emitter, 1 << bit); // test byte [rbx + r8], bit
+            emit_u8(emitter, 0x0F); emit_u8(emitter, 0x94); emit_u8(emitter, 0xC0); // setz al
+            emit_u8(emitter, 0xC0); emit_u8(emitter, 0xE0); emit_u8(emitter, 0x07); // shl al, 7
+            emit_u8(emitter, 0x0C); emit_u8(emitter, FLAG_HALFCARRY);              // or al, FLAG_HALFCARRY
+            emit_keep_carry(emitter);
+            emit_store_flags(emitter);
+            break;
+        }
+        case 0x80:{ // RES
+            emit_field_op_imm8(emitter, 4, offset, (u8)~(1 << bit));              // and byte [rbx + r8], ~bit
+            break;
+        }
+        case 0xC0:{ // SET
+            emit_field_op_imm8(emitter, 1, offset, (u8)(1 << bit));               // or byte [rbx + r8], bit
+            break;
+        }
+    }
+
+    emitter->cycles += get_opcode_steps(opcode, true)->cycles;
+    emitter->cpu_synced = false;
+    return true;
+}
+
+// Puts PC, the opcode and decoded where the micro-steps of the instruction expect them, after translated code
+// that doesn't keep them up to date.
+static void emit_sync_cpu(Emitter *emitter, u32 index, u16 PC, u8 opcode, bool is_extended){
+    if(emitter->cpu_synced) return;
+
+    emit_store_imm16(emitter, CPU_FIELD(PC), PC);
+    emit_store_imm8(emitter, CPU_FIELD(opcode), opcode);
+    if(is_extended) emit_store_imm8(emitter, CPU_FIELD(is_extended), 1);
+    emit_store_pointer(emitter, CPU_FIELD(block), emitter->source);
+    emit_store_pointer(emitter, CPU_FIELD(decoded), &emitter->source->instructions[index]);
+    emitter->cpu_synced = true;
+}
+
+// Instructions without a translation call their micro-steps one after the other.
+static void emit_steps(Emitter *emitter, const OpcodeSteps *entry){
+    for(int i = 0; i < entry->cycles; i++){
+        emit_count_cycles(emitter);
+        emit_call(emitter, (void*)entry->steps[i]);
+        emitter->cycles = 1;
+    }
+    emit_load_cycle_budget(emitter);
+    emitter->flags_resolved = false;
+    emitter->called_out = true;
+}
+
+// JR and JP to an immediate address. Returns false for the other branches.
+static bool emit_native_jump(Emitter *emitter, const BasicBlock *block, const DecodedInstruction *instruction, u8 *loop){
+    u8 opcode = instruction->bytes[0];
+    bool relative = (opcode & 0xE7) == 0x20 || opcode == 0x18;
+    bool absolute = (opcode & 0xE7) == 0xC2 || opcode == 0xC3;
+    if(!relative && !absolute) return false;
+
+    u16 next = instruction->address + instruction->length;
+    u16 target = relative ? (u16)(next + (i8)instruction->bytes[1]) : (u16)(instruction->bytes[1] | (instruction->bytes[2] << 8));
+    bool conditional = opcode != 0x18 && opcode != 0xC3;
+
+    if(conditional){
+        static const u8 masks[4] = {FLAG_ZERO, FLAG_ZERO, FLAG_CARRY, FLAG_CARRY}; // NZ, Z, NC and C
+        u8 condition = (opcode >> 3) & 0x03;
+        emit_resolve_flags(emitter);
+        emit_u8(emitter, 0xF6); emit_cpu_field(emitter, 0, CPU_FIELD(flags)); emit_u8(emitter, masks[condition]); // test byte [rbx + flags], mask
+
+        BlockExit not_taken = {};
+        not_taken.cycles = emitter->cycles + (relative ? 2 : 3);
+        not_taken.PC = next + 1;
+        not_taken.refetch = true;
+        emit_exit(emitter, &not_taken, (condition & 1) ? CONDITION_EQUAL : CONDITION_NOT_EQUAL);
+    }
+    emitter->cycles += relative ? 3 : 4;
+
+    // Loops back to the start of the block stay in compiled code until the block has to leave anyway.
+    // Loops polling LY or STAT go back to run_instruction, which can skip them.
+    const DecodedInstruction *first = &block->instructions[0];
+    bool polls_lcd = first->bytes[0] == 0xF0 && (first->bytes[1] == 0x44 || first->bytes[1] == 0x41);
+    if(loop && target == first->address && !polls_lcd){
+        emit_instruction_boundary(emitter, target + 1, first->bytes[0], false);
+        i32 cycles = emitter->cycles;
+        emit_count_cycles(emitter);
+        emit_u8(emitter, 0x49); emit_u8(emitter, 0x81); emit_u8(emitter, 0xED); emit_u32(emitter, (u32)cycles); // sub r13, cycles
+        emitter->cpu_synced = false;
+        emit_sync_cpu(emitter, 0, target + 1, first->bytes[0], false); // Where the first instruction expects it.
+        emit_u8(emitter, 0xE9);                                                // jmp loop
+        emit_u32(emitter, 0);
+        patch_rel32(emitter->current - 4, loop);
+    }
+    else{
+        BlockExit taken = {};
+        taken.cycles = emitter->cycles;
+        taken.PC = target + 1;
+        taken.refetch = true;
+        emit_exit(emitter, &taken);
+    }
+    emitter->cycles = 0;
+    return true;
+}
+
+// Branches decide how many cycles they take, so they go through run_cpu like in the interpreter.
+static void run_branch(CPU *cpu){
+    for(i32 step = 0; step < MAX_MICRO_STEPS; step++){
+        run_cpu(cpu);
+        cpu->pending_cycles++;
+        if(cpu->fetched_next_instruction) break;
+    }
+}
+
+// Instructions left to the interpreter.
+static bool is_interpreted_only(u8 opcode){
+    switch(opcode){
+        case 0x10: case 0x76:                                    // STOP and HALT
+        case 0xD3: case 0xDB: case 0xDD: case 0xE3: case 0xE4:   // Illegal
+        case 0xEB: case 0xEC: case 0xED: case 0xF4: case 0xFC: case 0xFD:
+            return true;
+    }
+    return false;
+}
+
+static void build_flag_table(u8 *table){
+    for(u32 ah = 0; ah < FLAG_TABLE_SIZE; ah++){
+        u8 flags = 0;
+        if(ah & 0x40) flags |= FLAG_ZERO;      // ZF
+        if(ah & 0x10) flags |= FLAG_HALFCARRY; // AF
+        if(ah & 0x01) flags |= FLAG_CARRY;     // CF
+        table[ah] = flags;
+    }
+}
+
+// Code memory is only ever writable or executable. Compiling makes the pages the block can end up
+// in writable and gives them back to execution once it's done.
+static void protect_code(Jit *jit, u32 offset, u32 size, bool writable){
+    u32 start = offset & ~(JIT_PAGE_SIZE - 1);
+    u32 end = (offset + size + JIT_PAGE_SIZE - 1) & ~(JIT_PAGE_SIZE - 1);
+    if(end > jit->code_size) end = jit->code_size;
+#ifdef _WIN32
+    DWORD old_protection;
+    VirtualProtect(jit->code + start, end - start, writable ? PAGE_READWRITE : PAGE_EXECUTE_READ, &old_protection);
+    if(!writable) FlushInstructionCache(GetCurrentProcess(), jit->code + start, end - start);
+#else
+    mprotect(jit->code + start, end - start, writable ? (PROT_READ | PROT_WRITE) : (PROT_READ | PROT_EXEC));
+#endif
+}
+
+static JitFunction compile_block(Jit *jit, BasicBlock *block){
+    u32 max_size = sizeof(BasicBlock) + MAX_COMPILED_BLOCK_SIZE;
+    if(jit->code_used + max_size > jit->code_size){
+        flush_jit(jit);
+    }
+
+    u32 count = block->instruction_count;
+    if(count > jit->max_block_instructions) count = jit->max_block_instructions;
+
+    u32 compiled = 0;
+    while(compiled < count && !is_interpreted_only(block->instructions[compiled].bytes[0])){
+        compiled++;
+    }
+    if(compiled == 0) return NULL;
+
+    protect_code(jit, jit->code_used, max_size, true);
+
+    // Cut at the last compiled instruction, so the interpreter never follows it out of the block.
+    BasicBlock *source = (BasicBlock*)(jit->code + jit->code_used);
+    *source = *block;
+    source->instruction_count = (u8)compiled;
+
+    Emitter emitter = {};
+    emitter.start = (u8*)source + ((sizeof(BasicBlock) + 15) & ~15);
+    emitter.current = emitter.start;
+    emitter.flag_table = jit->code;
+    emitter.source = source;
+    emitter.cpu_synced = true;
+
+    emit_prologue(&emitter);
+    u8 *loop = emitter.current;
+
+    bool ends_with_branch = false;
+    for(u32 i = 0; i < compiled; i++){
+        DecodedInstruction *instruction = &block->instructions[i];
+        u8 opcode = instruction->bytes[0];
+        u16 PC = instruction->address + 1;
+
+        if(i > 0) emit_instruction_boundary(&emitter, PC, opcode, false);
+
+        if(ends_basic_block(opcode) && emit_native_jump(&emitter, block, instruction, compiled == block->instruction_count ? loop : NULL)){
+            ends_with_branch = true;
+        }
+        else if(ends_basic_block(opcode)){
+            emit_sync_cpu(&emitter, i, PC, opcode, false);
+            emit_count_cycles(&emitter);
+            emit_call(&emitter, (void*)run_branch);
+            ends_with_branch = true;
+        }
+        else if(opcode == 0xCB){
+            u8 extended_opcode = instruction->bytes[1];
+            emitter.cycles += get_opcode_steps(opcode, false)->cycles;
+            emitter.cpu_synced = false;
+            emit_instruction_boundary(&emitter, PC + 1, extended_opcode, true); // The interpreter can take an interrupt between the prefix and the opcode.
+            if(!emit_native_extended_instruction(&emitter, extended_opcode)){
+                emit_sync_cpu(&emitter, i, PC + 1, extended_opcode, true);
+                emit_steps(&emitter, get_opcode_steps(extended_opcode, true));
+            }
+        }
+        else if(!emit_native_instruction(&emitter, instruction)){
+            emit_sync_cpu(&emitter, i, PC, opcode, false);
+            emit_steps(&emitter, get_opcode_steps(opcode, false));
+        }
+    }
+
+    // Past the last instruction the next opcode has to be fetched like the interpreter does, unless the
+    // micro-steps of the last instruction did it already.
+    if(!ends_with_branch && !emitter.cpu_synced){
+        DecodedInstruction *last = &block->instructions[compiled - 1];
+        BlockExit exit = {};
+        exit.cycles = emitter.cycles;
+        exit.PC = last->address + last->length + 1;
+        exit.refetch = true;
+        if(compiled < block->instruction_count){ // Known unless the code changed.
+            if(emitter.called_out){
+                emit_field_op_imm8(&emitter, 7, CPU_FIELD(leave_block), 0); // cmp byte [rbx + leave_block], 0
+                emit_exit(&emitter, &exit, CONDITION_NOT_EQUAL);
+            }
+            exit.refetch = false;
+            exit.opcode = block->instructions[compiled].bytes[0];
+        }
+        emit_exit(&emitter, &exit);
+        emitter.cycles = 0;
+    }
+    emit_count_cycles(&emitter);
+
+    u8 *epilogue = emitter.current;
+    emit_epilogue(&emitter);
+    for(u32 i = 0; i < emitter.exit_count; i++){
+        emit_exit_stub(&emitter, &emitter.exits[i], epilogue);
+    }
+
+    u32 size = (u32)(emitter.current - (u8*)source);
+    assert(size <= max_size);
+    protect_code(jit, jit->code_used, max_size, false);
+    jit->code_used += (size + 15) & ~15;
+    jit->compiled_blocks++;
+    return (JitFunction)(void*)emitter.start;
+}
+
+bool init_jit(Jit *jit, Arena *arena){
+    jit->code_size = JIT_CODE_SIZE;
+    // Mapped writable while blocks are compiled and executable while they run, never both.
+#ifdef _WIN32
+    jit->code = (u8*)VirtualAlloc(NULL, jit->code_size, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+#else
+    void *code = mmap(NULL, jit->code_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    jit->code = code == MAP_FAILED ? NULL : (u8*)code;
+#endif
+    if(!jit->code){
+        printf("Could not allocate memory for the JIT\n");
+        return false;
+    }
+    build_flag_table(jit->code);
+    protect_code(jit, 0, jit->code_size, false);
+
+    jit->blocks = (JitBlock*)alloc(arena, sizeof(JitBlock) * BLOCK_CACHE_SIZE);
+    jit->max_block_instructions = MAX_BLOCK_INSTRUCTIONS;
+    flush_jit(jit);
+    return true;
+}
+
+void free_jit(Jit *jit){
+    if(!jit->code) return;
+#ifdef _WIN32
+    VirtualFree(jit->code, 0, MEM_RELEASE);
+#else
+    munmap(jit->code, jit->code_size);
+#endif
+    jit->code = NULL;
+}
+
+void flush_jit(Jit *jit){
+    memset(jit->blocks, 0, sizeof(JitBlock) * BLOCK_CACHE_SIZE);
+    jit->code_used = FLAG_TABLE_SIZE;
+    jit->compiled_blocks = 0;
+}
+
+// Runs the compiled block for the instruction whose opcode was just fetched. Returns false when the
+// code there can't be compiled and the interpreter has to run it instead.
+bool run_jit_block(Jit *jit, CPU *cpu){
+    if(cpu->do_first_fetch){ // Same as run_cpu, the first fetch shares the cycle of the first step.
+        cpu->machine_cycle = 0;
+        cpu->opcode = fetch(cpu);
+        cpu->do_first_fetch = false;
+        cpu->fetched_next_instruction = true;
+    }
+    if(!cpu->fetched_next_instruction || cpu->is_extended) return false;
+
+    u16 address = cpu->PC - 1;
+    if(address > 0x7FFF) return false; // Code in RAM can modify itself, leave it to the interpreter.
+
+    u16 bank = get_code_bank(cpu->memory, address);
+    JitBlock *block = &jit->blocks[get_block_slot(address, bank)];
+    if(!block->valid || block->start != address || block->bank != bank){
+        BasicBlock decoded;
+        decode_basic_block(&decoded, cpu->memory, address);
+        if(decoded.instruction_count == 0) return false;
+
+        JitFunction code = compile_block(jit, &decoded); // Can flush every block, so fill the entry after.
+        block->valid = true;
+        block->start = address;
+        block->bank = bank;
+        block->opcode = decoded.instructions[0].bytes[0];
+        block->code = code;
+    }
+    if(!block->code || block->opcode != cpu->opcode) return false;
+
+    Scheduler *scheduler = cpu->gameboy ? &cpu->gameboy->scheduler : NULL;
+    cpu->leave_block = false;
+    block->code(cpu, scheduler);
+
+    // Without a block cache the last interpreted instruction keeps pointing at the copy in the code memory.
+    if((u8*)cpu->block >= jit->code && (u8*)cpu->block < jit->code + jit->code_size){
+        cpu->block = NULL;
+        cpu->decoded = NULL;
+    }
+    return true;
+}
+
+#else
+
+bool init_jit(Jit *jit, Arena *arena){
+    printf("The JIT is only available on x86-64\n");
+    return false;
+}
+
+void free_jit(Jit *jit){
+}
+
+void flush_jit(Jit *jit){
+}
+
+bool run_jit_block(Jit *jit, CPU *cpu){
+    return false;
+}
+
+#endif
@@ -0,0 +1,45 @@
+#pragma once
+
+#include "common.h"
+#include "CPU.h"
+#include "block_cache.h"
+#include "scheduler.h"
+
+// Recompiles basic blocks of ROM code into x86-64. Loads, register moves, the ALU and the CB opcodes on
+// registers are translated to code that works on the CPU fields directly, memory goes through the same
+// functions the interpreter uses and the rest still calls its micro-steps. Branches at the end of a
+// block run through run_cpu since they decide their own length at runtime. Blocks leave at the
+// instruction boundary where the interpreter would catch up the hardware or take an interrupt, and
+// after the CPU writes to the MBC, so compiled code behaves exactly like EXECUTION_INSTRUCTION.
+#if defined(__x86_64__) || defined(_M_X64)
+#define JIT_SUPPORTED 1
+#else
+#define JIT_SUPPORTED 0
+#endif
+
+#define JIT_CODE_SIZE megabytes(4)
+
+typedef void (*JitFunction)(CPU *cpu, Scheduler *scheduler);
+
+struct JitBlock{
+    bool valid;
+    u16 start;
+    u16 bank;
+    u8 opcode;
+    JitFunction code;
+};
+
+struct Jit{
+    u8 *code;
+    u32 code_size;
+    u32 code_used;
+    JitBlock *blocks; // BLOCK_CACHE_SIZE entries, indexed the same way as the block cache.
+
+    u32 max_block_instructions;
+    u32 compiled_blocks;
+};
+
+bool init_jit(Jit *jit, Arena *arena);
+void free_jit(Jit *jit);
+void flush_jit(Jit *jit);
+bool run_jit_block(Jit *jit, CPU *cpu);
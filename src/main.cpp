@@ -1,5 +1,6 @@
 #include <stdio.h>
-#include <windows.h>
+#include <string.h>
+#include <stdlib.h>
 
 #include "common.h"
 #include "gameboy.h"
@@ -7,6 +8,21 @@
 
 #include "SDL3/SDL.h"
 
+// Button a key is bound to, 0 for the rest.
+static u8 get_button(SDL_Scancode key){
+    switch(key){
+        case SDL_SCANCODE_RIGHT:  return BUTTON_RIGHT;
+        case SDL_SCANCODE_LEFT:   return BUTTON_LEFT;
+        case SDL_SCANCODE_UP:     return BUTTON_UP;
+        case SDL_SCANCODE_DOWN:   return BUTTON_DOWN;
+        case SDL_SCANCODE_Z:      return BUTTON_A;
+        case SDL_SCANCODE_X:      return BUTTON_B;
+        case SDL_SCANCODE_RSHIFT: return BUTTON_SELECT;
+        case SDL_SCANCODE_RETURN: return BUTTON_START;
+        default: return 0;
+    }
+}
+
 int main(int argc, const char **argv){
     if(argc < 1){
         printf("No ROM path provided\n");
@@ -31,18 +47,34 @@ int main(int argc, const char **argv){
         return 0;
     }
 
-    const bool *input = SDL_GetKeyboardState(NULL);
+    SDL_Texture *framebuffer = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGB24, SDL_TEXTUREACCESS_STREAMING, WINDOW_WIDTH, WINDOW_HEIGHT);
+    if (!framebuffer) {
+        printf("Error creating the framebuffer: %s", SDL_GetError());
+        return 0;
+    }
 
-	LARGE_INTEGER perf_count_frequency_result;
-    QueryPerformanceFrequency(&perf_count_frequency_result);
-    i64 perf_count_frequency = perf_count_frequency_result.QuadPart;
+    u8 buttons = 0; // Latched from the key events.
 
-    LARGE_INTEGER last_counter;
-    QueryPerformanceCounter(&last_counter);
+    i64 perf_count_frequency = SDL_GetPerformanceFrequency();
+    i64 last_counter = SDL_GetPerformanceCounter();
 
     init_global_arena(megabytes(5));
 	Gameboy *gmb = (Gameboy*)alloc(sizeof(Gameboy));
-	init_gameboy(gmb, renderer, argv[1]); // First argument is the rom path.
+	init_gameboy(gmb, argv[1]); // First argument is the rom path.
+    if(argc > 2 && strcmp(argv[2], "--fast") == 0){
+        set_execution_mode(gmb, EXECUTION_INSTRUCTION);
+    }
+    else if(argc > 2 && strcmp(argv[2], "--jit") == 0){
+        if(!set_execution_mode(gmb, EXECUTION_JIT)){
+            set_execution_mode(gmb, EXECUTION_INSTRUCTION);
+        }
+    }
+    for(i32 i = 2; i < argc; i++){
+        if(strcmp(argv[i], "--no-idle-skip") == 0) gmb->skip_idle_loops = false;
+        if(strcmp(argv[i], "--no-fast-scanlines") == 0) gmb->ppu.fast_scanlines = false;
+        if(strcmp(argv[i], "--save-flush") == 0 && i + 1 < argc) gmb->memory.mbc.save_flush_interval = atoi(argv[i + 1]); // In frames.
+    }
+    load_save_ram(&gmb->memory, argv[1]);
 
 	b32 is_running = true;
     while (is_running) { // Main loop
@@ -53,22 +85,34 @@ int main(int argc, const char **argv){
             if (e.type == SDL_EVENT_QUIT) {
                 is_running = false;
             }
+            else if (e.type == SDL_EVENT_KEY_DOWN) {
+                buttons |= get_button(e.key.scancode);
+            }
+            else if (e.type == SDL_EVENT_KEY_UP) {
+                buttons &= ~get_button(e.key.scancode);
+            }
         }
 
-        run_gameboy(gmb, last_counter, perf_count_frequency, input);
+        run_gameboy(gmb, last_counter, perf_count_frequency, buttons);
 
-        SDL_RenderPresent(renderer);
+        i32 pitch;
+        u8 *pixels;
+        SDL_LockTexture(framebuffer, NULL, (void**)&pixels, &pitch);
+        memcpy(pixels, gmb->ppu.frame, BUFFER_SIZE);
+        SDL_UnlockTexture(framebuffer);
 
-        LARGE_INTEGER end_counter;
+        SDL_RenderTexture(renderer, framebuffer, NULL, NULL);
+        SDL_RenderPresent(renderer);
 
-        QueryPerformanceCounter(&end_counter);
+        i64 end_counter = SDL_GetPerformanceCounter();
 
         last_counter = end_counter;
 
         
     }
 
-    fclose(gmb->cpu.fp);
+    free_gameboy(gmb);
+    SDL_DestroyTexture(framebuffer);
     SDL_DestroyWindow(window);
     SDL_DestroyRenderer(renderer);
     SDL_Quit();
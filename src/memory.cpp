@@ -12,70 +12,174 @@
 #define ROM_BANK_SIZE 16
 #define RAM_BANK_SIZE 8
 
-static void init_mbc_one(Memory *memory, u8 *rom_data){
+static void update_mbc_banks(Memory *memory){
     MBC *mbc = &memory->mbc;
-    
-    u8 value = rom_data[ROM_SIZE_LOC];
-    assert(value != 0);
+    mbc->rom_bank0 = memory->data; // Bank 0 is copied there.
+    if(mbc->mapper == MAPPER_NONE){
+        mbc->rom_bank = memory->data + ROM_BANKS_STARTING_ADDRESS;
+        mbc->ram_bank = NULL;
+        return;
+    }
 
-    u32 rom_size = 32 * (1 << value);
-    mbc->one.used_rom_banks = rom_size / ROM_BANK_SIZE; 
-    assert(mbc->one.used_rom_banks <= MBC_ONE_ROM_BANKS);
+    // The bank numbers wrap around the size of the cartridge, like the unconnected upper bits would.
+    if(mbc->rom_bank_count && mbc->ROM_bank0_number % mbc->rom_bank_count){
+        mbc->rom_bank0 = mbc->rom_banks[mbc->ROM_bank0_number % mbc->rom_bank_count];
+    }
+    mbc->rom_bank = mbc->rom_bank_count ? mbc->rom_banks[mbc->ROM_bank_number % mbc->rom_bank_count] : NULL;
 
-    switch(value){
-        case 0x00:{
-            assert(mbc->type != MBC_ONE_RAM && mbc->type != MBC_ONE_RAM_BATTERY);
-            break;
+    u8 RAM_bank_number = mbc->RAM_bank_number;
+    if(mbc->mapper == MAPPER_ONE && !mbc->mode) RAM_bank_number = 0; // Mode 0 only banks the ROM.
+    mbc->ram_bank = NULL;
+    if(mbc->RAM_enable && mbc->ram_bank_count && !(mbc->mapper == MAPPER_THREE && RAM_bank_number >= 0x08)){
+        mbc->ram_bank = mbc->ram_banks[RAM_bank_number % mbc->ram_bank_count];
+    }
+}
+
+// Derives where the CPU accesses the pages [first, last] from the MBC and PPU state.
+static void map_pages(Memory *memory, u32 first, u32 last){
+    MBC *mbc = &memory->mbc;
+    for(u32 page = first; page <= last; page++){
+        u8 *data = memory->data + (page << 8);
+        u8 *read = data;
+        u8 *write = data;
+
+        if(page <= 0x7F){ // Writes set the MBC registers.
+            write = NULL;
+            if(page <= 0x3F) read = mbc->rom_bank0 ? mbc->rom_bank0 + (page << 8) : NULL;
+            else             read = mbc->rom_bank ? mbc->rom_bank + ((page - 0x40) << 8) : NULL;
         }
-        case 0x01:{mbc->one.used_ram_banks = 1 ;break;}
-        case 0x02:{mbc->one.used_ram_banks = 1 ;break;}
-        case 0x03:{mbc->one.used_ram_banks = 4 ;break;}
-        case 0x04:{mbc->one.used_ram_banks = 16 ;break;}
-        case 0x05:{mbc->one.used_ram_banks = 8 ;break;}
-
-        default:{
-            printf("Unsupported value for RAM banks %X\n", value);
-            assert(false);
-            break;
+        else if(page <= 0x9F){
+            if(memory->is_vram_locked) read = write = NULL;
+            if(memory->is_vram_watched || page <= 0x97) write = NULL; // The PPU keeps the tiles decoded.
+        }
+        else if(page <= 0xBF){
+            read = write = mbc->ram_bank ? mbc->ram_bank + ((page - 0xA0) << 8) : NULL;
+            if(mbc->save_data) write = NULL; // Writes mark the save pages to flush.
+        }
+        else if(page == 0xFE){ // Only reads are blocked while the PPU scans OAM.
+            write = NULL; // The PPU keeps the sprites of each line.
+            if(memory->is_oam_locked) read = NULL;
         }
+        else if(page == 0xFF){ // IO registers, DIV and TIMA are worked out on reads.
+            read = write = NULL;
+        }
+
+        if(memory->is_bus_locked && page < 0xFF) read = write = NULL;
+        if(memory->watched_pages[page]) write = NULL;
+        memory->read_pages[page] = read;
+        memory->write_pages[page] = write;
     }
-    assert(mbc->one.used_ram_banks <= MBC_ONE_RAM_BANKS);
+}
 
-    memcpy(memory->data, rom_data, kilobytes(ROM_BANK_SIZE));
-    mbc->one.used_rom_banks--;
-    for(int i = 0; i < mbc->one.used_rom_banks; i++){
-        mbc->one.rom_banks[i] = (u8*)alloc(kilobytes(ROM_BANK_SIZE));
-        u8 *bank = mbc->one.rom_banks[i];
+static Mapper get_mapper(MBCType type){
+    switch(type){
+        case MBC_NONE: return MAPPER_NONE;
 
-        u8 *data = rom_data + (ROM_BANKS_STARTING_ADDRESS * (i + 1));
-        memcpy(bank, data, kilobytes(ROM_BANK_SIZE));
-    }
+        case MBC_ONE:
+        case MBC_ONE_RAM:
+        case MBC_ONE_RAM_BATTERY: return MAPPER_ONE;
+
+        case MBC_THREE_TIMER_BATTERY:
+        case MBC_THREE_TIMER_RAM_BATTERY:
+        case MBC_THREE:
+        case MBC_THREE_RAM:
+        case MBC_THREE_RAM_BATTERY: return MAPPER_THREE;
 
-    for(int i = 0; i < mbc->one.used_ram_banks; i++){
-        mbc->one.ram_banks[i] = (u8*)alloc(kilobytes(RAM_BANK_SIZE));
+        case MBC_FIVE:
+        case MBC_FIVE_RAM:
+        case MBC_FIVE_RAM_BATTERY:
+        case MBC_FIVE_RUMBLE:
+        case MBC_FIVE_RUMBLE_RAM:
+        case MBC_FIVE_RUMBLE_RAM_BATTERY: return MAPPER_FIVE;
     }
+    return MAPPER_UNKNOWN;
 }
 
-void init_memory(Memory *memory, const char *rom_path){
-    memset(memory->data, 0, array_size(memory->data));
+static void init_mbc(Memory *memory, Arena *arena, u8 *rom_data, u32 file_size){
+    MBC *mbc = &memory->mbc;
+    MBCType type = mbc->type;
+    mbc->has_ram = type == MBC_ONE_RAM || type == MBC_ONE_RAM_BATTERY || type == MBC_THREE_TIMER_RAM_BATTERY ||
+                   type == MBC_THREE_RAM || type == MBC_THREE_RAM_BATTERY || type == MBC_FIVE_RAM ||
+                   type == MBC_FIVE_RAM_BATTERY || type == MBC_FIVE_RUMBLE_RAM || type == MBC_FIVE_RUMBLE_RAM_BATTERY;
+    mbc->has_battery = type == MBC_ONE_RAM_BATTERY || type == MBC_THREE_TIMER_BATTERY || type == MBC_THREE_TIMER_RAM_BATTERY ||
+                       type == MBC_THREE_RAM_BATTERY || type == MBC_FIVE_RAM_BATTERY || type == MBC_FIVE_RUMBLE_RAM_BATTERY;
+    mbc->has_rumble = type == MBC_FIVE_RUMBLE || type == MBC_FIVE_RUMBLE_RAM || type == MBC_FIVE_RUMBLE_RAM_BATTERY;
+
+    u8 value = rom_data[ROM_SIZE_LOC];
+    if(value > 0x08){
+        printf("Unsupported value for ROM size %X\n", value);
+        assert(false);
+        value = 0;
+    }
+    mbc->rom_bank_count = 2 << value; // 32 KiB << value
+
+    mbc->ram_bank_count = 0;
+    if(mbc->has_ram){
+        switch(rom_data[RAM_SIZE_LOC]){
+            case 0x00:{mbc->ram_bank_count = 0 ;break;}
+            case 0x01:{mbc->ram_bank_count = 1 ;break;} // 2 KiB, a whole bank is simpler.
+            case 0x02:{mbc->ram_bank_count = 1 ;break;}
+            case 0x03:{mbc->ram_bank_count = 4 ;break;}
+            case 0x04:{mbc->ram_bank_count = 16 ;break;}
+            case 0x05:{mbc->ram_bank_count = 8 ;break;}
+
+            default:{
+                printf("Unsupported value for RAM banks %X\n", rom_data[RAM_SIZE_LOC]);
+                assert(false);
+                break;
+            }
+        }
+    }
+
+    memcpy(memory->data, rom_data, kilobytes(ROM_BANK_SIZE));
+    mbc->rom_banks = (u8**)alloc(arena, sizeof(u8*) * mbc->rom_bank_count);
+    for(u32 i = 0; i < mbc->rom_bank_count; i++){ // The banks point into the ROM, nothing writes to them.
+        u32 offset = ROM_BANKS_STARTING_ADDRESS * i;
+        mbc->rom_banks[i] = offset + kilobytes(ROM_BANK_SIZE) <= file_size ? rom_data + offset : NULL; // Truncated ROM.
+    }
+
+    if(mbc->ram_bank_count){
+        mbc->ram_banks = (u8**)alloc(arena, sizeof(u8*) * mbc->ram_bank_count);
+        for(u32 i = 0; i < mbc->ram_bank_count; i++){
+            mbc->ram_banks[i] = (u8*)alloc(arena, kilobytes(RAM_BANK_SIZE));
+            memset(mbc->ram_banks[i], 0, kilobytes(RAM_BANK_SIZE));
+        }
+    }
+}
 
+// The ROM is mapped instead of read, instances running the same ROM share its memory.
+void init_memory(Memory *memory, Arena *arena, const char *rom_path){
     u32 rom_size;
-    u8 *rom_data = load_binary_file(rom_path, &rom_size);
+    u8 *rom_data = map_binary_file(rom_path, &rom_size);
     assert(rom_data);
+
+    init_memory_from_rom(memory, arena, rom_data, rom_size);
+    memory->is_rom_mapped = true;
+}
+
+// The banks point into rom_data, it has to outlive the memory.
+void init_memory_from_rom(Memory *memory, Arena *arena, u8 *rom_data, u32 rom_size){
+    memset(memory->data, 0, array_size(memory->data));
+    memory->rom = rom_data;
+    memory->rom_size = rom_size;
+    memory->is_rom_mapped = false;
+
+    memset(&memory->mbc, 0, sizeof(memory->mbc));
     u8 cartridge_type = rom_data[CARTRIDGE_TYPE_LOC];
     memory->mbc.type = (MBCType)cartridge_type;
+    memory->mbc.mapper = get_mapper(memory->mbc.type);
+    memory->mbc.save_flush_interval = DEFAULT_SAVE_FLUSH_INTERVAL;
 
-    switch(memory->mbc.type){
-        case MBC_NONE:{
-            memcpy(memory->data, rom_data, rom_size);
+    switch(memory->mbc.mapper){
+        case MAPPER_NONE:{
+            memcpy(memory->data, rom_data, rom_size < 0x8000 ? rom_size : 0x8000);
             break;
         }
 
-        case MBC_ONE:
-        case MBC_ONE_RAM:
-        case MBC_ONE_RAM_BATTERY:{
-            init_mbc_one(memory, rom_data);
-
+        case MAPPER_ONE:
+        case MAPPER_THREE:
+        case MAPPER_FIVE:{
+            init_mbc(memory, arena, rom_data, rom_size);
             break;
         }
 
@@ -86,100 +190,229 @@ void init_memory(Memory *memory, const char *rom_path){
     memory->mbc.ROM_bank_number = 0x01;
     memory->is_vram_locked = false;
     memory->is_oam_locked = false;
-    free(rom_data);
+    memory->is_bus_locked = false;
+    memory->is_vram_watched = false;
+
+    update_mbc_banks(memory);
+    memset(memory->watched_pages, 0, sizeof(memory->watched_pages));
+    map_pages(memory, 0x00, 0xFF);
+}
+
+void free_memory(Memory *memory){
+    MBC *mbc = &memory->mbc;
+    if(mbc->save_data){
+        flush_save_ram(memory);
+        unmap_binary_file(mbc->save_data, mbc->save_size);
+        mbc->save_data = NULL;
+    }
+    if(memory->is_rom_mapped) unmap_binary_file(memory->rom, memory->rom_size);
+    memory->rom = NULL;
+    memory->is_rom_mapped = false;
 }
 
 void set_MBC_registers(Memory *memory, u16 address, u8 value){
-    switch(memory->mbc.type){
-        case MBC_ONE:
-        case MBC_ONE_RAM:
-        case MBC_ONE_RAM_BATTERY:{
+    MBC *mbc = &memory->mbc;
+    switch(mbc->mapper){
+        case MAPPER_ONE:{
             if(address >= 0x0000 && address <= 0x1FFF){
-                if(value & 0x0A)
-                    memory->mbc.RAM_enable = true;
-                else
-                    memory->mbc.RAM_enable = false;
+                mbc->RAM_enable = (value & 0x0F) == 0x0A;
             }
             else if(address >= 0x2000 && address <= 0x3FFF){
-                if(value == 0x00) 
-                    memory->mbc.ROM_bank_number = 0x01;
-                else
-                    memory->mbc.ROM_bank_number = value & 0x1F;
+                u8 low_bits = value & 0x1F;
+                if(low_bits == 0x00) low_bits = 0x01; // Only these 5 bits are checked, so 0x20, 0x40 and 0x60 map the next bank.
+                mbc->ROM_bank_number = (mbc->ROM_bank_number & 0x60) | low_bits;
             }
             else if(address >= 0x4000 && address <= 0x5FFF){
-                memory->mbc.RAM_bank_number = value & 0x03;
+                mbc->RAM_bank_number = value & 0x03;
+                mbc->ROM_bank_number = (mbc->ROM_bank_number & 0x1F) | (mbc->RAM_bank_number << 5);
             }
             else if(address >= 0x6000 && address <= 0x7FFF){
-                memory->mbc.one.mode = value & 0x01;
+                mbc->mode = value & 0x01;
             }
+            mbc->ROM_bank0_number = mbc->mode ? mbc->RAM_bank_number << 5 : 0; // Mode 1 banks 0x0000 and the RAM too.
+            break;
+        }
 
+        case MAPPER_THREE:{
+            if(address >= 0x0000 && address <= 0x1FFF){ // Also enables the clock registers.
+                mbc->RAM_enable = (value & 0x0F) == 0x0A;
+            }
+            else if(address >= 0x2000 && address <= 0x3FFF){
+                mbc->ROM_bank_number = value & 0x7F;
+                if(mbc->ROM_bank_number == 0x00) mbc->ROM_bank_number = 0x01;
+            }
+            else if(address >= 0x4000 && address <= 0x5FFF){
+                mbc->RAM_bank_number = value & 0x0F;
+            }
+            // 0x6000-0x7FFF latches the clock, it doesn't run so the registers already hold the latched values.
+            break;
+        }
+
+        case MAPPER_FIVE:{
+            if(address >= 0x0000 && address <= 0x1FFF){
+                mbc->RAM_enable = (value & 0x0F) == 0x0A;
+            }
+            else if(address >= 0x2000 && address <= 0x2FFF){ // Bank 0 can be mapped too.
+                mbc->ROM_bank_number = (mbc->ROM_bank_number & 0x100) | value;
+            }
+            else if(address >= 0x3000 && address <= 0x3FFF){
+                mbc->ROM_bank_number = (mbc->ROM_bank_number & 0xFF) | ((value & 0x01) << 8);
+            }
+            else if(address >= 0x4000 && address <= 0x5FFF){
+                mbc->RAM_bank_number = value & (mbc->has_rumble ? 0x07 : 0x0F); // Bit 3 drives the rumble motor.
+            }
             break;
         }
 
         default:
             printf("Mapper type does not support banking\n");
+            return;
     }
+
+    bool was_enabled = mbc->ram_bank != NULL;
+    u8 *rom_bank0 = mbc->rom_bank0;
+    u8 *rom_bank = mbc->rom_bank;
+    u8 *ram_bank = mbc->ram_bank;
+    update_mbc_banks(memory);
+    if(was_enabled && !mbc->RAM_enable) flush_save_ram(memory); // Games disable the RAM once they are done saving.
+    if(mbc->rom_bank0 != rom_bank0) map_pages(memory, 0x00, 0x3F);
+    if(mbc->rom_bank != rom_bank) map_pages(memory, 0x40, 0x7F);
+    if(mbc->ram_bank != ram_bank) map_pages(memory, 0xA0, 0xBF);
+}
+
+// The MBC3 clock register selected instead of a RAM bank, NULL if there's none.
+static u8* get_rtc_register(MBC *mbc){
+    if(mbc->mapper != MAPPER_THREE || !mbc->RAM_enable) return NULL;
+    if(mbc->RAM_bank_number < 0x08 || mbc->RAM_bank_number > 0x0C) return NULL;
+    return &mbc->rtc[mbc->RAM_bank_number - 0x08];
 }
 
 u8 read_from_MBC(Memory *memory, u16 address){
-    switch(memory->mbc.type){
-        case MBC_NONE:{
-            return memory->data[address];
-        }
-        case MBC_ONE:
-        case MBC_ONE_RAM:
-        case MBC_ONE_RAM_BATTERY:{
-            MBC *mbc = &memory->mbc;
-            if(address >= 0x0000 && address <= 0x3FFF){
-                return memory->data[address];
-            }
-            else if(address >= 0x4000 && address <= 0x7FFF){
-                return mbc->one.rom_banks[mbc->ROM_bank_number - 1][address - 0x4000];
-            }
+    if(address <= 0x3FFF){
+        u8 *bank0 = memory->mbc.rom_bank0;
+        return bank0 ? bank0[address] : 0xFF;
+    }
 
-            break;
-        }
+    u8 *bank = memory->mbc.rom_bank;
+    return bank ? bank[address - 0x4000] : 0xFF;
+}
 
-        default:
-            printf("Mapper type does not support rom banking\n");
+void write_to_mbc_RAM(Memory *memory, u16 address, u8 value){
+    MBC *mbc = &memory->mbc;
+    u8 *bank = mbc->ram_bank;
+    if(bank){
+        bank[address - 0xA000] = value;
+        if(mbc->save_data){
+            u32 offset = (u32)(bank - mbc->save_data) + (address - 0xA000);
+            mbc->dirty_save_pages |= 1u << (offset / SAVE_PAGE_SIZE);
+        }
+        return;
     }
+
+    u8 *rtc = get_rtc_register(&memory->mbc);
+    if(rtc) *rtc = value;
 }
 
-void write_to_mbc_RAM(Memory *memory, u16 address, u8 value){
-    switch(memory->mbc.type){
-        case MBC_ONE:
-        case MBC_ONE_RAM:
-        case MBC_ONE_RAM_BATTERY:{
-            MBC *mbc = &memory->mbc;
-            if(mbc->RAM_enable){
-                mbc->one.ram_banks[mbc->RAM_bank_number][address - 0xA000] = value;
-            }
+u8 read_ram_from_MBC(Memory *memory, u16 address){
+    u8 *bank = memory->mbc.ram_bank;
+    if(bank) return bank[address - 0xA000];
 
-            break;
-        }
+    u8 *rtc = get_rtc_register(&memory->mbc);
+    return rtc ? *rtc : 0xFF; // Nothing drives the bus without cartridge RAM.
+}
 
-        default:
-            printf("Mapper type does not support ram banking write\n");
+void set_vram_locked(Memory *memory, bool locked){
+    if(memory->is_vram_locked == locked) return;
+    memory->is_vram_locked = locked;
+    map_pages(memory, 0x80, 0x9F);
+}
+
+void set_oam_locked(Memory *memory, bool locked){
+    if(memory->is_oam_locked == locked) return;
+    memory->is_oam_locked = locked;
+    map_pages(memory, 0xFE, 0xFE);
+}
+
+void set_bus_locked(Memory *memory, bool locked){
+    if(memory->is_bus_locked == locked) return;
+    memory->is_bus_locked = locked;
+    map_pages(memory, 0x00, 0xFE);
+}
+
+void set_vram_watched(Memory *memory, bool watched){
+    if(memory->is_vram_watched == watched) return;
+    memory->is_vram_watched = watched;
+    map_pages(memory, 0x80, 0x9F);
+}
+
+void watch_page_writes(Memory *memory, u16 address, bool watched){
+    u8 page = address >> 8;
+    if(memory->watched_pages[page] == watched) return;
+    memory->watched_pages[page] = watched;
+    map_pages(memory, page, page);
+}
+
+// Maps the RAM of battery backed cartridges to a .sav file next to the ROM, so it persists without
+// ever writing out the whole file.
+bool load_save_ram(Memory *memory, const char *rom_path){
+    MBC *mbc = &memory->mbc;
+    if(!mbc->has_battery || !mbc->ram_bank_count) return false;
+
+    char save_path[512];
+    u32 length = (u32)strlen(rom_path);
+    if(length + 5 > sizeof(save_path)) return false;
+    memcpy(save_path, rom_path, length + 1);
+
+    char *extension = strrchr(save_path, '.');
+    if(extension && !strchr(extension, '/') && !strchr(extension, '\\')) *extension = '\0';
+    strcat(save_path, ".sav");
+
+    u32 size = mbc->ram_bank_count * kilobytes(RAM_BANK_SIZE);
+    assert(size <= SAVE_PAGE_SIZE * 32); // One dirty bit per page.
+    u8 *data = map_save_file(save_path, size);
+    if(!data) return false;
+
+    mbc->save_data = data;
+    mbc->save_size = size;
+    mbc->dirty_save_pages = 0;
+    mbc->frames_since_flush = 0;
+    for(u32 i = 0; i < mbc->ram_bank_count; i++){
+        mbc->ram_banks[i] = data + i * kilobytes(RAM_BANK_SIZE);
     }
+    update_mbc_banks(memory);
+    map_pages(memory, 0xA0, 0xBF);
+    return true;
 }
 
-u8 read_ram_from_MBC(Memory *memory, u16 address){
-    switch(memory->mbc.type){
-        case MBC_ONE:
-        case MBC_ONE_RAM:
-        case MBC_ONE_RAM_BATTERY:{
-            MBC *mbc = &memory->mbc;
-            if(mbc->RAM_enable){
-                return mbc->one.ram_banks[mbc->RAM_bank_number][address - 0xA000];
-            }
-            else{
-                return 0xFF;
-            }
+// Starts writing the pages changed since the last flush back to the .sav file.
+void flush_save_ram(Memory *memory){
+    MBC *mbc = &memory->mbc;
+    if(!mbc->save_data || !mbc->dirty_save_pages) return;
 
-            break;
+    u32 page_count = (mbc->save_size + SAVE_PAGE_SIZE - 1) / SAVE_PAGE_SIZE;
+    u32 page = 0;
+    while(page < page_count){
+        if(!(mbc->dirty_save_pages & (1u << page))){
+            page++;
+            continue;
         }
+        u32 first = page;
+        while(page < page_count && (mbc->dirty_save_pages & (1u << page))) page++;
 
-        default:
-            printf("Mapper type does not support ram banking read\n");
+        u32 offset = first * SAVE_PAGE_SIZE;
+        u32 end = page * SAVE_PAGE_SIZE;
+        if(end > mbc->save_size) end = mbc->save_size;
+        flush_mapped_file(mbc->save_data, offset, end - offset);
     }
-}
\ No newline at end of file
+    mbc->dirty_save_pages = 0;
+    mbc->frames_since_flush = 0;
+}
+
+// Called once per frame.
+void update_save_ram(Memory *memory){
+    MBC *mbc = &memory->mbc;
+    if(!mbc->save_data || !mbc->save_flush_interval) return;
+
+    mbc->frames_since_flush++;
+    if(mbc->frames_since_flush >= mbc->save_flush_interval) flush_save_ram(memory);
+}
@@ -1,54 +1,119 @@
 #pragma once
 
 #include "common.h"
+#include "arena.h"
 #include <string.h>
 
 static const i32 MEMORY_SIZE = 0x10000;
 
 
+// Cartridge type byte of the ROM header.
 enum MBCType{
     MBC_NONE    = 0x00,
     MBC_ONE     = 0x01,
     MBC_ONE_RAM = 0x02,
     MBC_ONE_RAM_BATTERY = 0x03,
+    MBC_THREE_TIMER_BATTERY     = 0x0F,
+    MBC_THREE_TIMER_RAM_BATTERY = 0x10,
+    MBC_THREE         = 0x11,
+    MBC_THREE_RAM     = 0x12,
+    MBC_THREE_RAM_BATTERY = 0x13,
+    MBC_FIVE          = 0x19,
+    MBC_FIVE_RAM      = 0x1A,
+    MBC_FIVE_RAM_BATTERY = 0x1B,
+    MBC_FIVE_RUMBLE   = 0x1C,
+    MBC_FIVE_RUMBLE_RAM = 0x1D,
+    MBC_FIVE_RUMBLE_RAM_BATTERY = 0x1E,
 };
 
-#define MBC_ONE_ROM_BANKS 32
-#define MBC_ONE_RAM_BANKS 4
+// Chip behind the cartridge types, the registers only depend on this.
+enum Mapper{
+    MAPPER_NONE,
+    MAPPER_ONE,
+    MAPPER_THREE,
+    MAPPER_FIVE,
+    MAPPER_UNKNOWN,
+};
+
+#define MBC_RTC_REGISTERS 5 // Seconds, minutes, hours, day low and day high.
 
 struct MBC{
     MBCType type;
+    Mapper mapper;
+    bool has_ram;
+    bool has_battery;
+    bool has_rumble;
+
     bool RAM_enable;
-    u8 ROM_bank_number;
-    u8 RAM_bank_number;
-    union{
-        struct{
-            bool has_ram;
-            bool has_battery;
-            bool mode;
-            u8 used_rom_banks;
-            u8 used_ram_banks;
-
-            u8 *rom_banks[MBC_ONE_ROM_BANKS];
-            u8 *ram_banks[MBC_ONE_RAM_BANKS];
-        }one;
-    };
+    u16 ROM_bank_number;
+    u16 ROM_bank0_number; // Only MBC1 in mode 1 maps another bank at 0x0000.
+    u8 RAM_bank_number;   // On MBC3 8 to 0xC select a clock register instead. On MBC1 also ROM bank bits 5-6.
+    bool mode;            // MBC1 banking mode.
+
+    // Banks mapped at 0x0000, 0x4000 and 0xA000, updated when the registers change. NULL reads as 0xFF
+    // and ignores writes.
+    u8 *rom_bank0;
+    u8 *rom_bank;
+    u8 *ram_bank;
+
+    // Every bank of the cartridge, allocated for its size. The ROM banks point into the ROM file.
+    u8 **rom_banks;
+    u8 **ram_banks;
+    u16 rom_bank_count;
+    u8 ram_bank_count;
+
+    u8 rtc[MBC_RTC_REGISTERS]; // Kept but not advanced, the clock doesn't run.
+
+    // Battery backed RAM mapped from the .sav file by load_save_ram, the RAM banks point into it.
+    u8 *save_data;
+    u32 save_size;
+    u32 dirty_save_pages;    // One bit for each SAVE_PAGE_SIZE bytes written since the last flush.
+    u32 save_flush_interval; // Frames between flushes, 0 only flushes when the RAM is disabled or freed.
+    u32 frames_since_flush;
 };
 
+#define SAVE_PAGE_SIZE 4096 // Flushed as a unit, the page size of the OS.
+#define DEFAULT_SAVE_FLUSH_INTERVAL 60
+
+#define MEMORY_PAGE_COUNT 256 // Pages of 256 bytes.
+#define OAM_SIZE 160
+
 struct Memory{
     MBC mbc;
+    u8 *rom;
+    u32 rom_size;
+    bool is_rom_mapped; // Unmapped by free_memory.
 
     u8 data[MEMORY_SIZE];
     bool is_vram_locked;
     bool is_oam_locked;
+    bool is_bus_locked; // OAM DMA is running, the CPU only reaches the IO registers and HRAM.
+    bool is_vram_watched; // Writes to VRAM take the slow path, the PPU has to see them first.
+
+    // Where the CPU reads and writes each page. NULL sends the access through the checks in the CPU
+    // memory functions, for IO, locked VRAM, tile data, OAM, the bus, MBC registers and pages holding cached code.
+    u8 *read_pages[MEMORY_PAGE_COUNT];
+    u8 *write_pages[MEMORY_PAGE_COUNT];
+    bool watched_pages[MEMORY_PAGE_COUNT]; // Writes always take the slow path.
 };
 
-void init_memory(Memory *memory, const char *rom_path);
+void init_memory(Memory *memory, Arena *arena, const char *rom_path);
+void init_memory_from_rom(Memory *memory, Arena *arena, u8 *rom_data, u32 rom_size);
+void free_memory(Memory *memory);
+bool load_save_ram(Memory *memory, const char *rom_path);
+void flush_save_ram(Memory *memory);
+void update_save_ram(Memory *memory);
 
 u8 read_from_MBC(Memory *memory, u16 address);
 void set_MBC_registers(Memory *memory, u16 address, u8 value);
 void write_to_mbc_RAM(Memory *memory, u16 address, u8 value);
 u8 read_ram_from_MBC(Memory *memory, u16 address);
 
+void set_vram_locked(Memory *memory, bool locked);
+void set_oam_locked(Memory *memory, bool locked);
+void set_bus_locked(Memory *memory, bool locked);
+void set_vram_watched(Memory *memory, bool watched);
+void watch_page_writes(Memory *memory, u16 address, bool watched);
+
 
 
@@ -64,25 +64,42 @@ void set_stat_ppu_mode(PPU *ppu, u8 mode){
     write_memory_ppu(ppu, 0xFF41, stat);
 }
 
-void init_ppu(PPU *ppu, Memory *memory, SDL_Renderer *renderer){
-    ppu->renderer = renderer;
-    ppu->framebuffer = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGB24, SDL_TEXTUREACCESS_STREAMING, 160, 144);
+// Decodes again the row of the tile that holds the address.
+void ppu_update_tile_row(PPU *ppu, u16 address){
+    assert(address >= 0x8000 && address <= 0x97FF);
+    u32 tile = (address - 0x8000) / 16;
+    u32 row  = (address & 0xF) / 2;
+    u16 row_address = address & ~1;
+    u8 low  = ppu->memory->data[row_address];
+    u8 high = ppu->memory->data[row_address + 1];
+
+    for(int i = 0; i < 8; i++){
+        u8 color = (((high >> i) & 0x1) << 1) | ((low >> i) & 0x1);
+        ppu->tiles.rows[tile][row][7 - i] = color;
+        ppu->tiles.flipped_rows[tile][row][i] = color;
+    }
+}
+
+void init_ppu(PPU *ppu, Memory *memory){
     ppu->current_pos = 0;
-    assert(ppu->framebuffer);
 
     ppu->memory = memory;
 
     ppu->mode = MODE_OAM_SCAN;
+    ppu->lcd_was_enabled = false;
     ppu->tile_fetch_state = TILE_FETCH_TILE_INDEX;
     ppu->fifo_state = FIFO_DUMMY;
 
     ppu->sprites_processed = 0;
     ppu->sprites        = make_array<Sprite>(40);
     ppu->sprites_active = make_array<Sprite>(10);
+    ppu->oam_entries_scanned = 0;
+    ppu->line_sprites_height = 0;
+    ppu->sprite_lookup_count = 0;
 
-    ppu->bg_fifo     = make_array<Pixel>(8);
-    ppu->sprite_fifo = make_array<Pixel>(8);
-    ppu->sprite_mixing_fifo = make_array<Pixel>(8);
+    ppu->bg_fifo     = {};
+    ppu->sprite_fifo = {};
+    ppu->sprite_mixing_fifo = {};
 
     ppu->colors[0] = Color{255,255,255}; // White
     ppu->colors[1] = Color{0xAA,0xAA,0xAA}; // Light gray
@@ -101,48 +118,182 @@ void init_ppu(PPU *ppu, Memory *memory, SDL_Renderer *renderer){
     ppu->check_sprites = true;
     ppu->pop_for_scroll = false;
     ppu->scroll_count = 0;
+    ppu->fast_scanlines = true;
+    ppu->drawing_whole_line = false;
+    ppu->scanline_kernel = get_best_scanline_kernel();
+
+    for(u32 address = 0x8000; address <= 0x97FF; address += 2){
+        ppu_update_tile_row(ppu, address);
+    }
 
     set_stat_ppu_mode(ppu, 2);
 }
 
-static void sort_objects_by_x_position(Array<Sprite> *sprites){
-    if(sprites->size <= 1) return;
-    for(int i = 0; i < sprites->size - 1; i++){
-        Sprite spr = array_get(sprites, i);
-        Sprite spr_next = array_get(sprites, i + 1);
+static void fifo_push(PixelFIFO *fifo, Pixel pixel){
+    assert(fifo->size < PIXEL_FIFO_SIZE);
+    fifo->pixels[fifo->size++] = pixel;
+}
+
+// The slot above the one popped is cleared, the popped one keeps its pixel.
+static Pixel fifo_pop(PixelFIFO *fifo){
+    assert(fifo->size != 0);
+    fifo->size--;
+    Pixel pixel = fifo->pixels[fifo->size];
+    if(fifo->size + 1 < PIXEL_FIFO_SIZE) fifo->pixels[fifo->size + 1] = Pixel{};
+    return pixel;
+}
+
+// The fetched row from the tile cache, unless tile_low and tile_high are not what VRAM holds at the
+// fetch address, like when the data was disabled or changed between the two fetches.
+static const u8 *get_fetched_row(PPU *ppu, bool x_flip, u8 *decoded){
+    u16 address = ppu->tile_address;
+    u8 *data = ppu->memory->data;
+    if(address >= 0x8000 && address <= 0x97FF && !(address & 1) && data[address] == ppu->tile_low && data[address + 1] == ppu->tile_high){
+        u32 tile = (address - 0x8000) / 16;
+        u32 row  = (address & 0xF) / 2;
+        return x_flip ? ppu->tiles.flipped_rows[tile][row] : ppu->tiles.rows[tile][row];
+    }
+
+    for(int i = 0; i < 8; i++){
+        u8 color = (((ppu->tile_high >> i) & 0x1) << 1) | ((ppu->tile_low >> i) & 0x1);
+        decoded[x_flip ? i : 7 - i] = color;
+    }
+    return decoded;
+}
+
+static void sort_objects_by_x_position(Sprite *sprites, u32 count){
+    if(count <= 1) return;
+    for(u32 i = 0; i < count - 1; i++){
+        Sprite spr = sprites[i];
+        Sprite spr_next = sprites[i + 1];
 
         if(spr.x_position > spr_next.x_position){
-            array_set(sprites, i, spr_next);
-            array_set(sprites, i + 1, spr);
+            sprites[i] = spr_next;
+            sprites[i + 1] = spr;
+        }
+    }
+}
+
+static Sprite read_oam_entry(PPU *ppu, u32 entry){
+    u16 address = ppu->oam_initial_address + entry * ppu->oam_offset;
+    Sprite sprite;
+    sprite.y_position = read_memory_ppu(ppu, address);
+    sprite.x_position = read_memory_ppu(ppu, address + 1);
+    sprite.tile_index = read_memory_ppu(ppu, address + 2);
+    sprite.attributes = read_memory_ppu(ppu, address + 3);
+    return sprite;
+}
+
+static u8 get_sprite_height(PPU *ppu){
+    return (read_lcdc(ppu) & LCDC_OBJ_SIZE) ? 16 : 8;
+}
+
+// Adds the sprites on the line from the entries the OAM scan went by since the last time.
+static void scan_oam_entries(PPU *ppu, u32 end){
+    u8 sprite_height = get_sprite_height(ppu);
+    for(u32 entry = ppu->oam_entries_scanned; entry < end; entry++){
+        Sprite sprite = read_oam_entry(ppu, entry);
+        if(sprite.x_position > 0 && (get_LY(ppu) + 16) >= sprite.y_position && (get_LY(ppu) + 16) < (sprite.y_position + sprite_height) && ppu->sprites.size < 40){
+            array_add(&ppu->sprites, sprite);
+        }
+    }
+    ppu->oam_entries_scanned = end;
+}
+
+// Adds the entries the ticks of the OAM scan so far read, before OAM or LCDC change.
+static void catch_up_oam_scan(PPU *ppu){
+    scan_oam_entries(ppu, (ppu->current_oam_address - ppu->oam_initial_address) / ppu->oam_offset);
+}
+
+static void build_line_sprites(PPU *ppu, u8 sprite_height){
+    memset(ppu->line_sprite_counts, 0, sizeof(ppu->line_sprite_counts));
+    for(u32 entry = 0; entry < OAM_ENTRIES; entry++){
+        Sprite sprite = read_oam_entry(ppu, entry);
+        if(sprite.x_position == 0) continue;
+
+        for(i32 line = sprite.y_position - 16; line < sprite.y_position - 16 + sprite_height; line++){
+            if(line < 0 || line >= VISIBLE_LINES) continue;
+            ppu->line_sprites[line][ppu->line_sprite_counts[line]++] = sprite;
+        }
+    }
+    for(u32 line = 0; line < VISIBLE_LINES; line++){
+        sort_objects_by_x_position(ppu->line_sprites[line], ppu->line_sprite_counts[line]);
+    }
+    ppu->line_sprites_height = sprite_height;
+}
+
+// End of the OAM scan. The sprites come from the lists of each line unless the scan already added some.
+static void finish_oam_scan(PPU *ppu){
+    u8 LY = get_LY(ppu);
+    u8 sprite_height = get_sprite_height(ppu);
+    if(ppu->oam_entries_scanned == 0 && ppu->sprites.size == 0 && LY < VISIBLE_LINES){
+        if(ppu->line_sprites_height != sprite_height) build_line_sprites(ppu, sprite_height);
+        for(u32 i = 0; i < ppu->line_sprite_counts[LY]; i++){
+            array_add(&ppu->sprites, ppu->line_sprites[LY][i]);
         }
     }
+    else{
+        scan_oam_entries(ppu, OAM_ENTRIES);
+        sort_objects_by_x_position(ppu->sprites.data, ppu->sprites.size);
+    }
+    ppu->oam_entries_scanned = 0;
+}
+
+// Sprites past the capacity of sprites_active are never looked at.
+static u32 get_sprite_lookup_count(PPU *ppu){
+    return ppu->sprites.size < ppu->sprites_active.capacity ? ppu->sprites.size : ppu->sprites_active.capacity;
+}
+
+static void build_sprite_lookup(PPU *ppu){
+    u32 count = get_sprite_lookup_count(ppu);
+    memset(ppu->first_sprite_at_x, 0xFF, sizeof(ppu->first_sprite_at_x));
+    for(i32 i = count - 1; i >= 0; i--){
+        ppu->first_sprite_at_x[ppu->sprites.data[i].x_position] = i;
+    }
+    ppu->sprite_lookup_count = count;
 }
 
 static void check_if_sprite_is_in_current_position(PPU *ppu){
-    if(ppu->check_sprites){
-        for(int i = 0; i < ppu->sprites.size; i++){
-            Sprite sprite = array_get(&ppu->sprites, i);
-            i32 sprite_x_corrected = sprite.x_position - 8 /*+ (get_SCX(ppu) % 8)*/;
-            if(sprite_x_corrected >= 0){
-                if(sprite_x_corrected == ppu->pixel_count){
-                    array_add(&ppu->sprites_active, sprite);
+    if(!ppu->check_sprites) return;
+    ppu->check_sprites = false;
+    if(ppu->sprites.size == 0) return;
 
-                    ppu->stop_fifos = true;
-                    ppu->tile_fetch_state = TILE_FETCH_SPRITE_INDEX;
-                    break;
-                }
+    // Past the first pixel only the first sprite starting at it can be found.
+    if(ppu->pixel_count > 0){
+        if(get_sprite_lookup_count(ppu) != ppu->sprite_lookup_count) build_sprite_lookup(ppu);
+
+        assert((u32)ppu->pixel_count + 8 < array_size(ppu->first_sprite_at_x));
+        u8 index = ppu->first_sprite_at_x[ppu->pixel_count + 8];
+        if(index != 0xFF){
+            array_add(&ppu->sprites_active, ppu->sprites.data[index]);
+
+            ppu->stop_fifos = true;
+            ppu->tile_fetch_state = TILE_FETCH_SPRITE_INDEX;
+        }
+        return;
+    }
+
+    for(u32 i = 0; i < ppu->sprites.size; i++){
+        Sprite sprite = array_get(&ppu->sprites, i);
+        i32 sprite_x_corrected = sprite.x_position - 8 /*+ (get_SCX(ppu) % 8)*/;
+        if(sprite_x_corrected >= 0){
+            if(sprite_x_corrected == ppu->pixel_count){
+                array_add(&ppu->sprites_active, sprite);
+
+                ppu->stop_fifos = true;
+                ppu->tile_fetch_state = TILE_FETCH_SPRITE_INDEX;
+                break;
             }
-            else if(sprite_x_corrected < 0 && sprite_x_corrected >= -7){
-                if(sprite_x_corrected == (i32)(ppu->pixel_count - (8 - sprite.x_position))){
-                    array_add(&ppu->sprites_active, sprite);
+        }
+        else if(sprite_x_corrected < 0 && sprite_x_corrected >= -7){
+            if(sprite_x_corrected == (i32)(ppu->pixel_count - (8 - sprite.x_position))){
+                array_add(&ppu->sprites_active, sprite);
 
-                    ppu->stop_fifos = true;
-                    ppu->tile_fetch_state = TILE_FETCH_SPRITE_INDEX;
-                }
+                ppu->stop_fifos = true;
+                ppu->tile_fetch_state = TILE_FETCH_SPRITE_INDEX;
             }
-            if(i == ppu->sprites_active.capacity - 1) break;
         }
-        ppu->check_sprites = false;
+        if(i == ppu->sprites_active.capacity - 1) break;
     }
 }
 
@@ -157,9 +308,9 @@ static void push_to_screen(PPU *ppu){
 
     switch(ppu->fifo_state){
         case FIFO_DUMMY:{
-            array_pop(&ppu->bg_fifo);
+            fifo_pop(&ppu->bg_fifo);
             if(ppu->sprite_fifo.size > 0)
-                array_pop(&ppu->sprite_fifo);
+                fifo_pop(&ppu->sprite_fifo);
         
             if(ppu->bg_fifo.size == 0) {
                 ppu->fifo_state = FIFO_PUSH;
@@ -174,9 +325,9 @@ static void push_to_screen(PPU *ppu){
 
         case FIFO_SCROLL:{
             if(!ppu->LY_equals_WY)
-                array_pop(&ppu->bg_fifo);
+                fifo_pop(&ppu->bg_fifo);
             if(ppu->sprite_fifo.size > 0)
-                array_pop(&ppu->sprite_fifo);
+                fifo_pop(&ppu->sprite_fifo);
 
             ppu->scroll_count++;
             if(ppu->scroll_count == ppu->scroll_amount){
@@ -188,14 +339,14 @@ static void push_to_screen(PPU *ppu){
         case FIFO_PUSH:{
             if(ppu->stop_fifos) return;
             u32 offset = 3;
-            Pixel bg_pixel = array_pop(&ppu->bg_fifo);
+            Pixel bg_pixel = fifo_pop(&ppu->bg_fifo);
             u16 bg_palette_address = 0xFF47;
             u8 palette = read_memory_ppu(ppu, bg_palette_address);
             u8 bg_color_ids[4] = {(palette & 0x3), ((palette & 0xC) >> 2), ((palette & 0x30) >> 4), ((palette & 0xC0) >> 6)};
 
             Color color;
             if(ppu->sprite_fifo.size > 0 ){
-                Pixel sp_pixel = array_pop(&ppu->sprite_fifo);
+                Pixel sp_pixel = fifo_pop(&ppu->sprite_fifo);
                 if(sp_pixel.color == 0 || (sp_pixel.bg_priority && bg_pixel.color != 0)){
 
                     color = ppu->colors[bg_color_ids[bg_pixel.color]];
@@ -237,7 +388,7 @@ static void push_to_screen(PPU *ppu){
             if(ppu->LY_equals_WY && ((get_WX(ppu)-7) == ppu->pixel_count) && (read_lcdc(ppu) & LCDC_WINDOW_ENABLE)){
                 ppu->render_window = true;
                 ppu->tile_fetch_state = TILE_FETCH_TILE_INDEX;
-                array_clear(&ppu->bg_fifo);
+                ppu->bg_fifo.size = 0;
             }
             break;
         }
@@ -247,16 +398,132 @@ static void push_to_screen(PPU *ppu){
 
 
 
-void ppu_render(PPU *ppu){
-    i32 pitch;
-    u8 *pixels;
+// The platform layer shows ppu->frame once run_gameboy returns.
+void ppu_finish_frame(PPU *ppu){
+    memcpy(ppu->frame, ppu->buffer, BUFFER_SIZE);
+    memset(ppu->buffer, 0, BUFFER_SIZE);
+}
 
-    SDL_LockTexture(ppu->framebuffer, NULL, (void**)&pixels, &pitch);
-    memcpy(pixels, ppu->buffer, BUFFER_SIZE);
-    SDL_UnlockTexture(ppu->framebuffer);
+// Machine cycles the PPU can skip because its ticks wouldn't change anything but the dot counter and
+// the OAM scan position: the rest of a mode once STAT and the STAT interrupt are settled, or any time
+// while the LCD stays off. FIFO lines have something to do on every tick. The tick that ends the mode
+// always runs normally, and so does the LYC check at dot 4.
+u32 ppu_idle_cycles(PPU *ppu){
+    if(!(read_lcdc(ppu) & LCDC_LCD_PPU_ENABLE)){
+        return ppu->lcd_was_enabled ? 0 : 114;
+    }
 
-    SDL_RenderTexture(ppu->renderer, ppu->framebuffer, NULL, NULL);
-    memset(ppu->buffer, 0, BUFFER_SIZE);
+    u8 stat = read_memory_ppu(ppu, 0xFF41);
+    bool LYC_LY = get_LY(ppu) == get_LYC(ppu) && get_LY(ppu) != 0;
+    if(((stat & LCDSTAT_LYC_LY) != 0) != LYC_LY) return 0; // LYC changed since the last tick.
+
+    u32 end_dot; // Where the dot counter is at the start of the tick that ends the mode.
+    switch(ppu->mode){
+        case MODE_OAM_SCAN:{
+            if((stat & LCDSTAT_PPU_MODE) != 2) return 0;
+            if((stat & LCDSTAT_MODE_2) && !ppu->stat_interrupt_set) return 0;
+            if(get_LY(ppu) == get_WY(ppu) && !ppu->LY_equals_WY) return 0;
+            if(!ppu->memory->is_oam_locked) return 0;
+            if(ppu->cycles <= 4) return 0; // The LYC interrupt is checked at the start of the line.
+            end_dot = 78;
+            break;
+        }
+        case MODE_DRAW:{
+            if(!ppu->drawing_whole_line || (stat & LCDSTAT_PPU_MODE) != 3) return 0;
+            end_dot = ppu->draw_end_cycle - 2;
+            break;
+        }
+        case MODE_HBLANK:{
+            if((stat & LCDSTAT_PPU_MODE) != 0) return 0;
+            if((stat & LCDSTAT_MODE_0) && !ppu->stat_interrupt_set) return 0;
+            end_dot = 454;
+            break;
+        }
+        case MODE_VBLANK:{
+            if((stat & LCDSTAT_PPU_MODE) != 1) return 0;
+            if((stat & LCDSTAT_MODE_1) && !ppu->stat_interrupt_set) return 0;
+            if(ppu->cycles <= 4) return 0;
+            end_dot = 454;
+            break;
+        }
+        default: return 0;
+    }
+
+    // Two ticks of 2 dots per machine cycle, neither of them can be the one that ends the mode.
+    if(ppu->cycles >= end_dot) return 0;
+    return (end_dot - ppu->cycles) / 4;
+}
+
+static void ppu_skip_idle_cycles(PPU *ppu, u32 cycles){
+    assert(cycles <= ppu_idle_cycles(ppu));
+    if(read_lcdc(ppu) & LCDC_LCD_PPU_ENABLE){
+        ppu->cycles += cycles * 4;
+        if(ppu->mode == MODE_OAM_SCAN) ppu->current_oam_address += cycles * 2 * ppu->oam_offset;
+    }
+}
+
+// Machine cycles until the PPU has to run on time again: the tick that ends the OAM scan, mode 3 or the
+// line, the LYC check at dot 4, or one that can request a STAT interrupt. What the ticks before it change
+// is only seen through registers the CPU syncs on, so they can run late and in bulk. 0 while the LCD stays
+// off. Only holds until the CPU writes to an LCD register or the STAT interrupt is handled.
+u32 ppu_cycles_until_event(PPU *ppu){
+    if(!(read_lcdc(ppu) & LCDC_LCD_PPU_ENABLE)){
+        return ppu->lcd_was_enabled ? 1 : 0;
+    }
+
+    u8 stat = read_memory_ppu(ppu, 0xFF41);
+    bool can_request = !ppu->stat_interrupt_set;
+    bool check_LYC = can_request && (stat & LCDSTAT_LYC_INT) && get_LY(ppu) == get_LYC(ppu) && ppu->cycles <= 4;
+
+    u32 dot; // Where the dot counter is at the start of that tick.
+    switch(ppu->mode){
+        case MODE_OAM_SCAN:{
+            if(can_request && (stat & LCDSTAT_MODE_2)) dot = ppu->cycles;
+            else if(check_LYC)                         dot = 4;
+            else                                       dot = 78;
+            break;
+        }
+        case MODE_DRAW:{
+            if(ppu->drawing_whole_line)      dot = ppu->draw_end_cycle - 2;
+            else if(stat & LCDSTAT_MODE_0)   dot = ppu->cycles; // The FIFO can run out of pixels on any tick.
+            else                             dot = 454;
+            break;
+        }
+        case MODE_HBLANK:{
+            if(can_request && (stat & LCDSTAT_MODE_0)) dot = ppu->cycles;
+            else                                       dot = 454;
+            break;
+        }
+        case MODE_VBLANK:{
+            if(can_request && (stat & LCDSTAT_MODE_1)) dot = ppu->cycles;
+            else if(check_LYC)                         dot = 4;
+            else                                       dot = 454;
+            break;
+        }
+        default: dot = ppu->cycles;
+    }
+    return (dot - ppu->cycles) / 4 + 1;
+}
+
+// Advances the PPU by whole machine cycles, jumping over the idle stretches in between.
+void ppu_run(PPU *ppu, CPU *cpu, u32 cycles){
+    while(cycles > 0){
+        u32 idle = ppu_idle_cycles(ppu);
+        if(idle > 0){
+            if(idle > cycles) idle = cycles;
+            ppu_skip_idle_cycles(ppu, idle);
+            cycles -= idle;
+            continue;
+        }
+        ppu_tick(ppu, cpu);
+        ppu_tick(ppu, cpu);
+        cycles--;
+    }
+}
+
+void free_ppu(PPU *ppu){
+    delete_array(&ppu->sprites);
+    delete_array(&ppu->sprites_active);
 }
 
 void set_LYC_LY(PPU *ppu){
@@ -271,8 +538,419 @@ void unset_LYC_LY(PPU *ppu){
     write_memory_ppu(ppu, 0xFF41, stat);
 }
 
+// Fetches and pushes the pixels of two dots of the line being drawn.
+static void draw_dots(PPU *ppu){
+    switch(ppu->tile_fetch_state){
+        case TILE_FETCH_TILE_INDEX:{
+            u32 offset;
+            u16 address;
+            if(ppu->render_window){
+                offset = (ppu->window_tile_x) + (32 * (ppu->window_line_counter / 8));
+                (read_lcdc(ppu) & LCDC_WIN_TILEMAP) ? address = 0x9C00 : address = 0x9800;
+            }
+            else{
+                offset = ((ppu->tile_x + (get_SCX(ppu) / 8)) & 0x1F) + (32 * (((get_LY(ppu) + get_SCY(ppu)) & 0xFF) / 8));
+                (read_lcdc(ppu) & LCDC_BG_TILEMAP) ? address = 0x9C00 : address = 0x9800;
+            }
+            ppu->tile_index = read_memory_ppu(ppu, address + offset); 
+            ppu->tile_fetch_state = TILE_FETCH_TILE_LOW;
+            break;
+        }
+        case TILE_FETCH_TILE_LOW:{
+            if((read_lcdc(ppu) & LCDC_BG_WIN_TILEDATA)){ // $8000 addressing mode
+                u32 offset;
+                if(ppu->render_window  && (read_lcdc(ppu) & LCDC_WINDOW_ENABLE)){
+                    offset = 2 * (ppu->window_line_counter % 8); 
+                }
+                else{
+                    offset = 2 * ((get_LY(ppu) + get_SCY(ppu)) % 8); 
+                }
+                u16 address = 0x8000 + (ppu->tile_index * 16) + offset; 
+                ppu->tile_low = read_memory_ppu(ppu, address);
+                ppu->tile_address = address;
+            }
+            else{ // $8800 addressing mode
+                u32 offset;
+                if(ppu->render_window && (read_lcdc(ppu) & LCDC_WINDOW_ENABLE)){
+                    offset = 2 * (ppu->window_line_counter % 8); 
+                }
+                else{
+                    offset = 2 * ((get_LY(ppu) + get_SCY(ppu)) % 8); 
+                }
+                u16 address;
+                if(offset > 127){
+                    offset -= 128;
+                    address = 0x8800 + ((i8)ppu->tile_index * 16) + offset; 
+                }
+                else{
+                    address = 0x9000 + ((i8)ppu->tile_index * 16) + offset;
+                }
+                ppu->tile_low = read_memory_ppu(ppu, address);
+                ppu->tile_address = address;
+            }
+            if(!(read_lcdc(ppu) & LCDC_BG_WIN_ENABLE)){
+                ppu->tile_low = 0x00;
+            }
+
+            ppu->tile_fetch_state = TILE_FETCH_TILE_HIGH;
+            break;
+        }
+        case TILE_FETCH_TILE_HIGH:{
+            if((read_lcdc(ppu) & LCDC_BG_WIN_TILEDATA)){ // $8000 addressing mode
+                u32 offset;
+                if(ppu->render_window && (read_lcdc(ppu) & LCDC_WINDOW_ENABLE)){
+                    offset = 2 * (ppu->window_line_counter % 8); 
+                }
+                else{
+                    offset = 2 * ((get_LY(ppu) + get_SCY(ppu)) % 8); 
+                } 
+                u16 address = 0x8000 + (ppu->tile_index * 16) + offset + 1; 
+                ppu->tile_high = read_memory_ppu(ppu, address);
+            }
+            else{ // $8800 addressing mode
+                u32 offset;
+                if(ppu->render_window && (read_lcdc(ppu) & LCDC_WINDOW_ENABLE)){
+                    offset = 2 * (ppu->window_line_counter % 8); 
+                }
+                else{
+                    offset = 2 * ((get_LY(ppu) + get_SCY(ppu)) % 8); 
+                }
+                u16 address;
+                if(offset > 127){
+                    offset -= 128;
+                    address = 0x8800 + ((i8)ppu->tile_index * 16) + offset; 
+                }
+                else{
+                    address = 0x9000 + ((i8)ppu->tile_index * 16) + offset;
+                }
+                ppu->tile_high = read_memory_ppu(ppu, address + 1);
+            }
+            if(!(read_lcdc(ppu) & LCDC_BG_WIN_ENABLE)){
+                ppu->tile_high = 0x00;
+            }
+
+            if(ppu->bg_fifo.size == 0 ){ // Background FIFO is empty so we can push a row of pixels.
+                u8 decoded[8];
+                const u8 *row = get_fetched_row(ppu, false, decoded);
+                for(int i = 0; i < 8; i++){
+                    Pixel pixel = {};
+                    pixel.color = row[7 - i];
+                    fifo_push(&ppu->bg_fifo, pixel);
+                }
+
+                ppu->tile_fetch_state = TILE_FETCH_TILE_INDEX;
+                ppu->tile_x++;
+            }
+            else{
+                ppu->tile_fetch_state = TILE_FETCH_PUSH_FIFO;
+            }
+            if(ppu->do_dummy_fetch){
+                ppu->do_dummy_fetch = false;
+                ppu->tile_fetch_state = TILE_FETCH_TILE_INDEX;
+                ppu->tile_x--;
+                ppu->skip_fifo = true;
+            }
+            break;
+        }
+        case TILE_FETCH_PUSH_FIFO:{ // If pixels could not be pushed during tile high fetch we keep trying until it succeeds when the FIFO is empty.
+            if(ppu->bg_fifo.size == 0){ // Background FIFO is empty so we can push a row of pixels.
+                u8 decoded[8];
+                const u8 *row = get_fetched_row(ppu, false, decoded);
+                for(int i = 0; i < 8; i++){
+                    Pixel pixel = {};
+                    pixel.color = row[7 - i];
+                    fifo_push(&ppu->bg_fifo, pixel);
+                }
+
+                if(ppu->pop_for_scroll){
+                    ppu->bg_fifo.size -= ppu->scroll_amount + 1;
+                    ppu->pop_for_scroll = false;
+                }
+
+                ppu->tile_fetch_state =  TILE_FETCH_TILE_INDEX;
+                ppu->tile_x++;
+                if(ppu->render_window && (read_lcdc(ppu) & LCDC_WINDOW_ENABLE)) ppu->window_tile_x++;
+            }
+            break;
+        }
+        // SPRITE FETCHING
+        case TILE_FETCH_SPRITE_INDEX:{
+            if((read_lcdc(ppu) & LCDC_OBJ_SIZE)){
+                ppu->sprite = array_get(&ppu->sprites_active, ppu->sprites_processed);
+                ppu->tile_index = ppu->sprite.tile_index;
+
+                u8 LY = get_LY(ppu);
+                if(LY < ppu->sprite.y_position - 8){
+                    ppu->tile_index &= ~(0x01);
+                    if((ppu->sprite.attributes & ATTRIBUTE_Y_FLIP))
+                        ppu->tile_index |= (0x01);
+                }
+                else{
+                    ppu->tile_index |= (0x01);
+                    if((ppu->sprite.attributes & ATTRIBUTE_Y_FLIP))
+                        ppu->tile_index &= ~(0x01);
+                }
+
+                ppu->tile_fetch_state = TILE_FETCH_SPRITE_LOW;
+            }
+            else{
+                ppu->sprite = array_get(&ppu->sprites_active, ppu->sprites_processed);
+                ppu->tile_index = ppu->sprite.tile_index;
+                ppu->tile_fetch_state = TILE_FETCH_SPRITE_LOW;
+            }
+            break;
+        }
+        case TILE_FETCH_SPRITE_LOW:{
+            if((read_lcdc(ppu) & LCDC_OBJ_ENABLE)){
+                if((ppu->sprite.attributes & ATTRIBUTE_Y_FLIP)){
+                    u32 offset; 
+                    if(ppu->sprite.y_position % 8){
+                        offset = 14 - (2 * (16 - (ppu->sprite.y_position - (get_LY(ppu) + get_SCY(ppu))))); 
+                    }
+                    else{
+                        offset = 14 - (2 * ((get_LY(ppu) + get_SCY(ppu)) % 8)); 
+                    }
+                    
+                    u16 address = 0x8000 + (ppu->tile_index * 16) + offset; // Sprites always use $8000 addressing mode.
+                    ppu->tile_low = read_memory_ppu(ppu, address);
+                    ppu->tile_address = address;
+                }
+                else{
+                    u32 offset;
+                    if(ppu->sprite.y_position % 8){
+                        offset = 2 * (16 - (ppu->sprite.y_position - (get_LY(ppu) + get_SCY(ppu)))); 
+                    }
+                    else{
+                        offset = 2 * ((get_LY(ppu) + get_SCY(ppu)) % 8); 
+                    }
+                    
+                    u16 address = 0x8000 + (ppu->tile_index * 16) + offset; // Sprites always use $8000 addressing mode.
+                    ppu->tile_low = read_memory_ppu(ppu, address);
+                    ppu->tile_address = address;
+                }
+            }
+            else{
+                ppu->tile_low = 0x00; // Transparent.
+            }
+            ppu->tile_fetch_state = TILE_FETCH_SPRITE_HIGH;
+            break;
+        }
+        case TILE_FETCH_SPRITE_HIGH:{
+            if((read_lcdc(ppu) & LCDC_OBJ_ENABLE)){
+                if((ppu->sprite.attributes & ATTRIBUTE_Y_FLIP)){
+                    u32 offset; 
+                    if(ppu->sprite.y_position % 8){
+                        offset = 14 - (2 * (16 - (ppu->sprite.y_position - (get_LY(ppu) + get_SCY(ppu))))); 
+                    }
+                    else{
+                        offset = 14 - (2 * ((get_LY(ppu) + get_SCY(ppu)) % 8)); 
+                    }
+                   
+                   
+                    u16 address = 0x8000 + (ppu->tile_index * 16) + offset + 1; // Sprites always use $8000 addressing mode.
+                    ppu->tile_high = read_memory_ppu(ppu, address);
+                }
+                else{
+                    u32 offset;
+                    if(ppu->sprite.y_position % 8){
+                        offset = 2 * (16 - (ppu->sprite.y_position - (get_LY(ppu) + get_SCY(ppu)))); 
+                    }
+                    else{
+                        offset = 2 * ((get_LY(ppu) + get_SCY(ppu)) % 8); 
+                    }
+                    u16 address = 0x8000 + (ppu->tile_index * 16) + offset + 1; // Sprites always use $8000 addressing mode.
+                    ppu->tile_high = read_memory_ppu(ppu, address);
+                }
+            }
+            else{
+                ppu->tile_high = 0x00; // Transparent.
+            }
+            ppu->tile_fetch_state = TILE_FETCH_SPRITE_PUSH;
+            break;
+        }
+        case TILE_FETCH_SPRITE_PUSH:{
+            u8 decoded[8];
+            const u8 *row = get_fetched_row(ppu, ppu->sprite.attributes & ATTRIBUTE_X_FLIP, decoded);
+            for(int i = 0; i < 8; i++){
+                Pixel pixel = {};
+                pixel.color = row[7 - i];
+                pixel.bg_priority = (ppu->sprite.attributes & ATTRIBUTE_PRIORITY) >> 7;
+                pixel.palette     = (ppu->sprite.attributes & ATTRIBUTE_PALETTE) >> 3;
+                fifo_push(&ppu->sprite_mixing_fifo, pixel);
+            }
+                
+                i32 sprite_x_corrected = (i32)(ppu->sprite.x_position) - 8;
+                if(sprite_x_corrected >= 0){
+                    if(ppu->sprite_fifo.size == 0){
+                        ppu->sprite_fifo = ppu->sprite_mixing_fifo;
+                    }
+                    else{
+                        // When there is already pixel data in the pixel fifo we mix them.
+                        ppu->sprite_fifo.size = 8; // Bad
+                        for(u32 i = 0; i < ppu->sprite_fifo.size; i++){
+                            u8 current_color = ppu->sprite_fifo.pixels[i].color;
+                            assert(current_color <= 3);
+                            Pixel pixel = ppu->sprite_mixing_fifo.pixels[i];
+                            if(current_color == 0){
+                                ppu->sprite_fifo.pixels[i] = pixel;
+                            }
+                        }
+                    }
+                }
+                else if(sprite_x_corrected < 0){
+                    
+                    u8 clipping_offset =  8 - (ppu->sprite.x_position);
+                    for(int i = 0; i < clipping_offset; i++){
+                        fifo_pop(&ppu->sprite_mixing_fifo);
+                    }
+
+                    if(ppu->sprite_fifo.size == 0){
+                        for(int i = 0; i <  8 - clipping_offset; i++){
+                            Pixel pixel = ppu->sprite_mixing_fifo.pixels[i];
+                            fifo_push(&ppu->sprite_fifo, pixel);                                    
+                        }
+                    }
+                    else{
+                        ppu->sprite_fifo.size = 8; // Bad
+                       for(int i = 0; i < 8 - clipping_offset - 1; i++){
+                           u8 current_color = ppu->sprite_fifo.pixels[ppu->sprite_fifo.size - i - 1].color;
+                           assert(current_color <= 3);
+                           Pixel pixel = fifo_pop(&ppu->sprite_mixing_fifo);
+                           if(current_color == 0){
+                               ppu->sprite_fifo.pixels[ppu->sprite_fifo.size - i - 1] = pixel;
+                           }
+                       }
+                    }
+                }
+
+            ppu->sprite_mixing_fifo.size = 0;
+            ppu->sprites_processed++; 
+
+            if(ppu->sprites_processed < ppu->sprites_active.size){
+                ppu->tile_fetch_state = TILE_FETCH_SPRITE_INDEX;    
+                        
+            }
+            else if(ppu->sprites_processed == ppu->sprites_active.size){
+                ppu->stop_fifos = false;
+                ppu->tile_fetch_state = TILE_FETCH_TILE_INDEX;
+                ppu->fetching_sprite = false;
+                ppu->sprites_processed = 0;
+                array_clear(&ppu->sprites_active);
+            }
+            
+            break;
+        }
+    }
+
+    check_if_sprite_is_in_current_position(ppu);
+    push_to_screen(ppu);
+    check_if_sprite_is_in_current_position(ppu);
+    push_to_screen(ppu);
+}
+
+// Lines the FIFO would draw from the background alone, starting from its state at the start of a line.
+// The LCD being turned off halfway through a line can leave it in any other state.
+static bool can_draw_whole_line(PPU *ppu){
+    if(ppu->sprites.size > 0 || ppu->sprites_active.size > 0) return false;
+
+    i32 window_start = get_WX(ppu) - 7; // Pixel the FIFO switches to the window at.
+    if(ppu->LY_equals_WY && (read_lcdc(ppu) & LCDC_WINDOW_ENABLE) && window_start >= 1 && window_start <= 160) return false;
+
+    return ppu->pixel_count == 0 && ppu->tile_x == 0 && ppu->do_dummy_fetch && !ppu->render_window &&
+           ppu->tile_fetch_state == TILE_FETCH_TILE_INDEX && ppu->fifo_state == FIFO_DUMMY && !ppu->stop_fifos &&
+           ppu->bg_fifo.size == 0 && ppu->sprite_fifo.size == 0 && ppu->scroll_count == 0 &&
+           ppu->pop_for_scroll == (ppu->scroll_amount > 0);
+}
+
+#define LINE_TILES 21 // The 160 pixels of a line can start partway into a tile.
+
+// Draws the line the way the FIFO does. It drops one pixel more than SCX % 8 when scrolling.
+static void render_background_line(PPU *ppu){
+    u8 lcdc = read_lcdc(ppu);
+    u8 palette = read_memory_ppu(ppu, 0xFF47);
+    u8 y = get_LY(ppu) + get_SCY(ppu);
+    u16 tilemap = ((lcdc & LCDC_BG_TILEMAP) ? 0x9C00 : 0x9800) + 32 * (y / 8);
+    u32 x = (get_SCX(ppu) & ~7) + ppu->scroll_amount + (ppu->scroll_amount > 0);
+
+    u8 rows[2 * LINE_TILES] = {};
+    if(lcdc & LCDC_BG_WIN_ENABLE){
+        for(u32 i = 0; i < LINE_TILES; i++){
+            u8 tile_index = read_memory_ppu(ppu, tilemap + ((x / 8 + i) & 0x1F));
+            u16 address = (lcdc & LCDC_BG_WIN_TILEDATA) ? 0x8000 + tile_index * 16 : 0x9000 + (i8)tile_index * 16;
+            address += 2 * (y % 8);
+            rows[2 * i]     = read_memory_ppu(ppu, address);
+            rows[2 * i + 1] = read_memory_ppu(ppu, address + 1);
+        }
+    }
+    u8 shades[8 * LINE_TILES];
+    decode_tile_rows(ppu->scanline_kernel, rows, LINE_TILES, palette, shades);
+
+    u8 *pixel = ppu->buffer + ppu->current_pos;
+    for(i32 i = 0; i < 160; i++){
+        Color rgb = ppu->colors[shades[x % 8 + i]];
+        pixel[0] = rgb.r;
+        pixel[1] = rgb.g;
+        pixel[2] = rgb.b;
+        pixel += 3;
+    }
+    ppu->current_pos += 160 * 3;
+
+    // What the FIFO leaves behind.
+    ppu->do_dummy_fetch = false;
+    ppu->skip_fifo = true;
+    ppu->pop_for_scroll = false;
+    ppu->check_sprites = ppu->scroll_amount == 0 || ppu->scroll_amount % 2; // Otherwise the last pixel is pushed halfway through a tick.
+}
+
+static void end_draw(PPU *ppu){
+    ppu->drawing_whole_line = false;
+    set_vram_watched(ppu->memory, false);
+    ppu->bg_fifo.size = 0;
+    ppu->sprite_fifo.size = 0;
+    ppu->mode = MODE_HBLANK;
+    ppu->tile_fetch_state = TILE_FETCH_TILE_INDEX;
+    ppu->fifo_state = FIFO_DUMMY;
+        
+    set_vram_locked(ppu->memory, false);
+    set_oam_locked(ppu->memory, false);
+    ppu->tile_x = 0;
+    ppu->pixel_count = 0;
+    ppu->sprites_processed = 0;
+        
+    array_clear(&ppu->sprites); // Clear the list of sprites for the current scanline.
+
+    ppu->stat_interrupt_set = false;
+
+    if(ppu->render_window){
+        ppu->window_line_counter++;
+    }
+    ppu->render_window = false;
+    ppu->window_tile_x = 0;
+
+    ppu->scroll_count = 0;
+}
+
+// The CPU is about to write to VRAM or an LCD register. A line that was going to be drawn in one go
+// goes back to the FIFO, which first catches up with the dots that already went by.
+void ppu_prepare_for_write(PPU *ppu){
+    catch_up_oam_scan(ppu); // LCDC has the sprite height.
+
+    if(!ppu->drawing_whole_line) return;
+    ppu->drawing_whole_line = false;
+    set_vram_watched(ppu->memory, false);
+
+    for(u32 cycle = 80; cycle < ppu->cycles; cycle += 2){
+        draw_dots(ppu);
+    }
+}
+
+// The CPU or DMA is about to write to OAM.
+void ppu_prepare_for_oam_write(PPU *ppu){
+    catch_up_oam_scan(ppu);
+    ppu->line_sprites_height = 0;
+}
+
 void ppu_tick(PPU *ppu, CPU *cpu){
-    static bool once = false;
     if(read_lcdc(ppu) & LCDC_LCD_PPU_ENABLE){
 
         if(get_LY(ppu) == get_LYC(ppu)){
@@ -302,22 +980,7 @@ void ppu_tick(PPU *ppu, CPU *cpu){
                      ppu->stat_interrupt_set = true;
                      set_interrupt(cpu, INT_LCD);
                  }
-                ppu->memory->is_oam_locked = true;
-                
-                Sprite sprite;
-                sprite.y_position = read_memory_ppu(ppu, ppu->current_oam_address);
-                sprite.x_position = read_memory_ppu(ppu, ppu->current_oam_address + 1);
-                sprite.tile_index = read_memory_ppu(ppu, ppu->current_oam_address + 2);
-                sprite.attributes = read_memory_ppu(ppu, ppu->current_oam_address + 3);
-
-                u8 sprite_height = 8;
-                if(read_lcdc(ppu) & LCDC_OBJ_SIZE){
-                    sprite_height = 16;
-                }
-                if(sprite.x_position > 0 && (get_LY(ppu) + 16) >= sprite.y_position && (get_LY(ppu) + 16) < (sprite.y_position + sprite_height) && ppu->sprites.size < 40){
-                    array_add(&ppu->sprites, sprite);
-                }
-               
+                set_oam_locked(ppu->memory, true);
 
                 ppu->current_oam_address += ppu->oam_offset;
                 ppu->cycles += 2;
@@ -325,361 +988,36 @@ void ppu_tick(PPU *ppu, CPU *cpu){
                 assert(ppu->cycles <= 80);
                 if(ppu->cycles == 80){
                     ppu->mode = MODE_DRAW;
+                    finish_oam_scan(ppu);
+                    build_sprite_lookup(ppu);
                     ppu->current_oam_address = ppu->oam_initial_address;
-                    sort_objects_by_x_position(&ppu->sprites);
 
                     ppu->scroll_amount = get_SCX(ppu) % 8;
                     if(ppu->scroll_amount > 0) ppu->pop_for_scroll = true;
+
+                    // The FIFO takes 172 dots on these lines, plus the pixels it drops for SCX % 8 in whole ticks.
+                    if(ppu->fast_scanlines && can_draw_whole_line(ppu)){
+                        ppu->drawing_whole_line = true;
+                        ppu->draw_end_cycle = 80 + 172 + (ppu->scroll_amount & ~1);
+                        set_vram_watched(ppu->memory, true);
+                    }
                 }
                 break;
             }
             case MODE_DRAW:{
                 set_stat_ppu_mode(ppu, 3);
                 // ppu->memory->is_vram_locked = true;
-                switch(ppu->tile_fetch_state){
-                    case TILE_FETCH_TILE_INDEX:{
-                        u32 offset;
-                        u16 address;
-                        if(ppu->render_window){
-                            offset = (ppu->window_tile_x) + (32 * (ppu->window_line_counter / 8));
-                            (read_lcdc(ppu) & LCDC_WIN_TILEMAP) ? address = 0x9C00 : address = 0x9800;
-                        }
-                        else{
-                            offset = ((ppu->tile_x + (get_SCX(ppu) / 8)) & 0x1F) + (32 * (((get_LY(ppu) + get_SCY(ppu)) & 0xFF) / 8));
-                            (read_lcdc(ppu) & LCDC_BG_TILEMAP) ? address = 0x9C00 : address = 0x9800;
-                        }
-                        ppu->tile_index = read_memory_ppu(ppu, address + offset); 
-                        ppu->tile_fetch_state = TILE_FETCH_TILE_LOW;
-                        break;
-                    }
-                    case TILE_FETCH_TILE_LOW:{
-                        if((read_lcdc(ppu) & LCDC_BG_WIN_TILEDATA)){ // $8000 addressing mode
-                            u32 offset;
-                            if(ppu->render_window  && (read_lcdc(ppu) & LCDC_WINDOW_ENABLE)){
-                                offset = 2 * (ppu->window_line_counter % 8); 
-                            }
-                            else{
-                                offset = 2 * ((get_LY(ppu) + get_SCY(ppu)) % 8); 
-                            }
-                            u16 address = 0x8000 + (ppu->tile_index * 16) + offset; 
-                            ppu->tile_low = read_memory_ppu(ppu, address);
-                        }
-                        else{ // $8800 addressing mode
-                            u32 offset;
-                            if(ppu->render_window && (read_lcdc(ppu) & LCDC_WINDOW_ENABLE)){
-                                offset = 2 * (ppu->window_line_counter % 8); 
-                            }
-                            else{
-                                offset = 2 * ((get_LY(ppu) + get_SCY(ppu)) % 8); 
-                            }
-                            u16 address;
-                            if(offset > 127){
-                                offset -= 128;
-                                address = 0x8800 + ((i8)ppu->tile_index * 16) + offset; 
-                            }
-                            else{
-                                address = 0x9000 + ((i8)ppu->tile_index * 16) + offset;
-                            }
-                            ppu->tile_low = read_memory_ppu(ppu, address);
-                        }
-                        if(!(read_lcdc(ppu) & LCDC_BG_WIN_ENABLE)){
-                            ppu->tile_low = 0x00;
-                        }
-
-                        ppu->tile_fetch_state = TILE_FETCH_TILE_HIGH;
-                        break;
-                    }
-                    case TILE_FETCH_TILE_HIGH:{
-                        if((read_lcdc(ppu) & LCDC_BG_WIN_TILEDATA)){ // $8000 addressing mode
-                            u32 offset;
-                            if(ppu->render_window && (read_lcdc(ppu) & LCDC_WINDOW_ENABLE)){
-                                offset = 2 * (ppu->window_line_counter % 8); 
-                            }
-                            else{
-                                offset = 2 * ((get_LY(ppu) + get_SCY(ppu)) % 8); 
-                            } 
-                            u16 address = 0x8000 + (ppu->tile_index * 16) + offset + 1; 
-                            ppu->tile_high = read_memory_ppu(ppu, address);
-                        }
-                        else{ // $8800 addressing mode
-                            u32 offset;
-                            if(ppu->render_window && (read_lcdc(ppu) & LCDC_WINDOW_ENABLE)){
-                                offset = 2 * (ppu->window_line_counter % 8); 
-                            }
-                            else{
-                                offset = 2 * ((get_LY(ppu) + get_SCY(ppu)) % 8); 
-                            }
-                            u16 address;
-                            if(offset > 127){
-                                offset -= 128;
-                                address = 0x8800 + ((i8)ppu->tile_index * 16) + offset; 
-                            }
-                            else{
-                                address = 0x9000 + ((i8)ppu->tile_index * 16) + offset;
-                            }
-                            ppu->tile_high = read_memory_ppu(ppu, address + 1);
-                        }
-                        if(!(read_lcdc(ppu) & LCDC_BG_WIN_ENABLE)){
-                            ppu->tile_high = 0x00;
-                        }
-
-                        if(ppu->bg_fifo.size == 0 ){ // Background FIFO is empty so we can push a row of pixels.
-                            for(int i = 0; i < 8; i++){
-                                Pixel pixel;
-                                u8 color_low  = (ppu->tile_low  >> i) & 0x1;
-                                u8 color_high = (ppu->tile_high >> i) & 0x1; 
-                                pixel.color   = (color_high << 1) | color_low;
-                                array_add(&ppu->bg_fifo, pixel);
-                            }
-
-                            ppu->tile_fetch_state = TILE_FETCH_TILE_INDEX;
-                            ppu->tile_x++;
-                        }
-                        else{
-                            ppu->tile_fetch_state = TILE_FETCH_PUSH_FIFO;
-                        }
-                        if(ppu->do_dummy_fetch){
-                            ppu->do_dummy_fetch = false;
-                            ppu->tile_fetch_state = TILE_FETCH_TILE_INDEX;
-                            ppu->tile_x--;
-                            ppu->skip_fifo = true;
-                        }
-                        break;
-                    }
-                    case TILE_FETCH_PUSH_FIFO:{ // If pixels could not be pushed during tile high fetch we keep trying until it succeeds when the FIFO is empty.
-                        if(ppu->bg_fifo.size == 0){ // Background FIFO is empty so we can push a row of pixels.
-                            for(int i = 0; i < 8; i++){
-                                Pixel pixel;
-                                u8 color_low  = (ppu->tile_low  >> i) & 0x1;
-                                u8 color_high = (ppu->tile_high >> i) & 0x1; 
-                                pixel.color   = (color_high << 1) | color_low;
-                                array_add(&ppu->bg_fifo, pixel);
-                            }
-
-                            if(ppu->pop_for_scroll){
-                                ppu->bg_fifo.size -= ppu->scroll_amount + 1;
-                                ppu->pop_for_scroll = false;
-                            }
-
-                            ppu->tile_fetch_state =  TILE_FETCH_TILE_INDEX;
-                            ppu->tile_x++;
-                            if(ppu->render_window && (read_lcdc(ppu) & LCDC_WINDOW_ENABLE)) ppu->window_tile_x++;
-                        }
-                        break;
-                    }
-                    // SPRITE FETCHING
-                    case TILE_FETCH_SPRITE_INDEX:{
-                        if((read_lcdc(ppu) & LCDC_OBJ_SIZE)){
-                            ppu->sprite = array_get(&ppu->sprites_active, ppu->sprites_processed);
-                            ppu->tile_index = ppu->sprite.tile_index;
-
-                            u8 LY = get_LY(ppu);
-                            if(LY < ppu->sprite.y_position - 8){
-                                ppu->tile_index &= ~(0x01);
-                                if((ppu->sprite.attributes & ATTRIBUTE_Y_FLIP))
-                                    ppu->tile_index |= (0x01);
-                            }
-                            else{
-                                ppu->tile_index |= (0x01);
-                                if((ppu->sprite.attributes & ATTRIBUTE_Y_FLIP))
-                                    ppu->tile_index &= ~(0x01);
-                            }
-
-                            ppu->tile_fetch_state = TILE_FETCH_SPRITE_LOW;
-                        }
-                        else{
-                            ppu->sprite = array_get(&ppu->sprites_active, ppu->sprites_processed);
-                            ppu->tile_index = ppu->sprite.tile_index;
-                            ppu->tile_fetch_state = TILE_FETCH_SPRITE_LOW;
-                        }
-                        break;
-                    }
-                    case TILE_FETCH_SPRITE_LOW:{
-                        if((read_lcdc(ppu) & LCDC_OBJ_ENABLE)){
-                            if((ppu->sprite.attributes & ATTRIBUTE_Y_FLIP)){
-                                u32 offset; 
-                                if(ppu->sprite.y_position % 8){
-                                    offset = 14 - (2 * (16 - (ppu->sprite.y_position - (get_LY(ppu) + get_SCY(ppu))))); 
-                                }
-                                else{
-                                    offset = 14 - (2 * ((get_LY(ppu) + get_SCY(ppu)) % 8)); 
-                                }
-                                
-                                u16 address = 0x8000 + (ppu->tile_index * 16) + offset; // Sprites always use $8000 addressing mode.
-                                ppu->tile_low = read_memory_ppu(ppu, address);
-                            }
-                            else{
-                                u32 offset;
-                                if(ppu->sprite.y_position % 8){
-                                    offset = 2 * (16 - (ppu->sprite.y_position - (get_LY(ppu) + get_SCY(ppu)))); 
-                                }
-                                else{
-                                    offset = 2 * ((get_LY(ppu) + get_SCY(ppu)) % 8); 
-                                }
-                                
-                                u16 address = 0x8000 + (ppu->tile_index * 16) + offset; // Sprites always use $8000 addressing mode.
-                                ppu->tile_low = read_memory_ppu(ppu, address);
-                            }
-                        }
-                        else{
-                            ppu->tile_low = 0x00; // Transparent.
-                        }
-                        ppu->tile_fetch_state = TILE_FETCH_SPRITE_HIGH;
-                        break;
-                    }
-                    case TILE_FETCH_SPRITE_HIGH:{
-                        if((read_lcdc(ppu) & LCDC_OBJ_ENABLE)){
-                            if((ppu->sprite.attributes & ATTRIBUTE_Y_FLIP)){
-                                u32 offset; 
-                                if(ppu->sprite.y_position % 8){
-                                    offset = 14 - (2 * (16 - (ppu->sprite.y_position - (get_LY(ppu) + get_SCY(ppu))))); 
-                                }
-                                else{
-                                    offset = 14 - (2 * ((get_LY(ppu) + get_SCY(ppu)) % 8)); 
-                                }
-                               
-                               
-                                u16 address = 0x8000 + (ppu->tile_index * 16) + offset + 1; // Sprites always use $8000 addressing mode.
-                                ppu->tile_high = read_memory_ppu(ppu, address);
-                            }
-                            else{
-                                u32 offset;
-                                if(ppu->sprite.y_position % 8){
-                                    offset = 2 * (16 - (ppu->sprite.y_position - (get_LY(ppu) + get_SCY(ppu)))); 
-                                }
-                                else{
-                                    offset = 2 * ((get_LY(ppu) + get_SCY(ppu)) % 8); 
-                                }
-                                u16 address = 0x8000 + (ppu->tile_index * 16) + offset + 1; // Sprites always use $8000 addressing mode.
-                                ppu->tile_high = read_memory_ppu(ppu, address);
-                            }
-                        }
-                        else{
-                            ppu->tile_high = 0x00; // Transparent.
-                        }
-                        ppu->tile_fetch_state = TILE_FETCH_SPRITE_PUSH;
-                        break;
-                    }
-                    case TILE_FETCH_SPRITE_PUSH:{
-                        if(ppu->sprite.attributes & ATTRIBUTE_X_FLIP){
-                            for(int i = 7; i >= 0; i--){
-                                Pixel pixel;
-                                u8 color_low  = (ppu->tile_low  >> i) & 0x1;
-                                u8 color_high = (ppu->tile_high >> i) & 0x1; 
-                                pixel.color   = (color_high << 1) | color_low;
-                                pixel.bg_priority = (ppu->sprite.attributes & ATTRIBUTE_PRIORITY) >> 7;
-                                pixel.palette     = (ppu->sprite.attributes & ATTRIBUTE_PALETTE) >> 3;
-                                array_add(&ppu->sprite_mixing_fifo, pixel);
-                            }
-                        }
-                        else{
-                            for(int i = 0; i < 8; i++){
-                                Pixel pixel;
-                                u8 color_low  = (ppu->tile_low  >> i) & 0x1;
-                                u8 color_high = (ppu->tile_high >> i) & 0x1; 
-                                pixel.color   = (color_high << 1) | color_low;
-                                pixel.bg_priority = (ppu->sprite.attributes & ATTRIBUTE_PRIORITY) >> 7;
-                                pixel.palette     = (ppu->sprite.attributes & ATTRIBUTE_PALETTE) >> 3;
-                                array_add(&ppu->sprite_mixing_fifo, pixel);
-                            }
-
-                        }
-                            
-                            i32 sprite_x_corrected = (i32)(ppu->sprite.x_position) - 8;
-                            if(sprite_x_corrected >= 0){
-                                if(ppu->sprite_fifo.size == 0){
-                                    array_copy(&ppu->sprite_fifo, &ppu->sprite_mixing_fifo);
-                                }
-                                else{
-                                    // When there is already pixel data in the pixel fifo we mix them.
-                                    ppu->sprite_fifo.size = 8; // Bad
-                                    for(int i = 0; i < ppu->sprite_fifo.size; i++){
-                                        u8 current_color = array_get(&ppu->sprite_fifo, i).color;
-                                        assert(current_color <= 3);
-                                        Pixel pixel = array_get(&ppu->sprite_mixing_fifo, i);
-                                        if(current_color == 0){
-                                            array_set(&ppu->sprite_fifo, i, pixel);
-                                        }
-                                    }
-                                }
-                            }
-                            else if(sprite_x_corrected < 0){
-                                
-                                u8 clipping_offset =  8 - (ppu->sprite.x_position);
-                                for(int i = 0; i < clipping_offset; i++){
-                                    array_pop(&ppu->sprite_mixing_fifo);
-                                }
-
-                                if(ppu->sprite_fifo.size == 0){
-                                    for(int i = 0; i <  8 - clipping_offset; i++){
-                                        Pixel pixel = array_get(&ppu->sprite_mixing_fifo, i);
-                                        array_add(&ppu->sprite_fifo, pixel);                                    
-                                    }
-                                }
-                                else{
-                                    ppu->sprite_fifo.size = 8; // Bad
-                                   for(int i = 0; i < 8 - clipping_offset - 1; i++){
-                                       u8 current_color = array_get(&ppu->sprite_fifo, ppu->sprite_fifo.size - i - 1).color;
-                                       assert(current_color <= 3);
-                                       Pixel pixel = array_pop(&ppu->sprite_mixing_fifo);
-                                       if(current_color == 0){
-                                           array_set(&ppu->sprite_fifo, ppu->sprite_fifo.size - i - 1, pixel);
-                                       }
-                                   }
-                                }
-                            }
-
-                        array_clear(&ppu->sprite_mixing_fifo);
-                        ppu->sprites_processed++; 
-
-                        if(ppu->sprites_processed < ppu->sprites_active.size){
-                            ppu->tile_fetch_state = TILE_FETCH_SPRITE_INDEX;    
-                                    
-                        }
-                        else if(ppu->sprites_processed == ppu->sprites_active.size){
-                            ppu->stop_fifos = false;
-                            ppu->tile_fetch_state = TILE_FETCH_TILE_INDEX;
-                            ppu->fetching_sprite = false;
-                            ppu->sprites_processed = 0;
-                            array_clear(&ppu->sprites_active);
-                        }
-                        
-                        break;
-                    }
+                if(!ppu->drawing_whole_line){
+                    draw_dots(ppu);
                 }
 
-                
-                check_if_sprite_is_in_current_position(ppu);
-                push_to_screen(ppu);
-                check_if_sprite_is_in_current_position(ppu);
-                push_to_screen(ppu);
-                
-
                 ppu->cycles += 2;
-                if(ppu->pixel_count == 160){ 
-                    array_clear(&ppu->bg_fifo);
-                    array_clear(&ppu->sprite_fifo);
-                    ppu->mode = MODE_HBLANK;
-                    ppu->tile_fetch_state = TILE_FETCH_TILE_INDEX;
-                    ppu->fifo_state = FIFO_DUMMY;
-                        
-                    ppu->memory->is_vram_locked = false;
-                    ppu->memory->is_oam_locked  = false;
-                    ppu->tile_x = 0;
-                    ppu->pixel_count = 0;
-                    ppu->sprites_processed = 0;
-                        
-                    array_clear(&ppu->sprites); // Clear the list of sprites for the current scanline.
-                    
-                    ppu->stat_interrupt_set = false;
-                    
-                    if(ppu->render_window){
-                        ppu->window_line_counter++;
-                    }
-                    ppu->render_window = false;
-                    ppu->window_tile_x = 0;
-
-                    ppu->scroll_count = 0;
+                if(ppu->drawing_whole_line && ppu->cycles == ppu->draw_end_cycle){
+                    render_background_line(ppu);
+                    end_draw(ppu);
+                }
+                else if(ppu->pixel_count == 160){ 
+                    end_draw(ppu);
                 }
                 break;
             }
@@ -725,7 +1063,7 @@ void ppu_tick(PPU *ppu, CPU *cpu){
                         ppu->window_line_counter = 0;
                         
                         ppu->frame_ready = true;
-                        ppu_render(ppu);
+                        ppu_finish_frame(ppu);
                     }
                     else{
                         increase_LY(ppu);
@@ -739,26 +1077,28 @@ void ppu_tick(PPU *ppu, CPU *cpu){
 
 
         
-        once = true;
+        ppu->lcd_was_enabled = true;
 
     }
     else{
-        if(!once) return;
+        if(!ppu->lcd_was_enabled) return;
+        catch_up_oam_scan(ppu); // What the scan went by stays.
+        ppu->oam_entries_scanned = 0;
         ppu->current_oam_address = ppu->oam_initial_address;
-        ppu->memory->is_oam_locked  = true;
-        ppu->memory->is_vram_locked = false;
+        set_oam_locked(ppu->memory, true);
+        set_vram_locked(ppu->memory, false);
         ppu->mode = MODE_OAM_SCAN;
         set_stat_ppu_mode(ppu, 0);
         ppu->tile_x = 0;
         ppu->current_pos = 0;
 
-        ppu_render(ppu);
+        ppu_finish_frame(ppu);
         ppu->frame_ready = true;
 
         
         ppu->cycles = 0;
         set_LY(ppu, 0);
 
-        once = false;
+        ppu->lcd_was_enabled = false;
     }
 }
\ No newline at end of file
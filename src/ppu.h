@@ -1,7 +1,7 @@
 #pragma once
 #include "memory.h"
 #include "array.h"
-#include "SDL3/SDL.h"
+#include "scanline.h"
 
 enum PPUMode{
     MODE_OAM_SCAN,
@@ -68,6 +68,15 @@ struct Pixel{
     u8 bg_priority;
 };
 
+#define PIXEL_FIFO_SIZE 8
+
+// Pixels go in and come out at the back. The slots past the size keep older pixels, mixing sprites
+// still reads them.
+struct PixelFIFO{
+    Pixel pixels[PIXEL_FIFO_SIZE];
+    u32 size;
+};
+
 struct Color{
     u8 r;
     u8 g;
@@ -76,14 +85,20 @@ struct Color{
 
 #define BUFFER_SIZE 160 * 3 * 144
 
+#define TILE_COUNT 384 // In 8000-97FF.
+#define OAM_ENTRIES 40
+#define VISIBLE_LINES 144
+
+// The tile data decoded to a color per pixel, from left to right. Updated on every CPU write to the tiles.
+struct TileCache{
+    u8 rows[TILE_COUNT][8][8];
+    u8 flipped_rows[TILE_COUNT][8][8]; // Mirrored on X, for sprites.
+};
+
 struct PPU{
-    SDL_Texture *framebuffer;
-    SDL_Renderer *renderer;
     i32 current_pos;
-    u8 buffer[BUFFER_SIZE];
-
-    u8 *pixels;
-    i32 pitch;
+    u8 buffer[BUFFER_SIZE]; // Frame being drawn.
+    u8 frame[BUFFER_SIZE];  // Last finished frame, RGB24.
 
     PPUMode mode;
     TileFetchState tile_fetch_state;
@@ -102,6 +117,7 @@ struct PPU{
 
     u8 tile_low;
     u8 tile_high;
+    u16 tile_address; // Where tile_low was fetched from, to find its decoded row.
     u8 tile_index;
     u8 tile_x;
     u16 pixel_count;
@@ -109,13 +125,14 @@ struct PPU{
     bool skip_fifo;
     bool frame_ready;
     bool stat_interrupt_set;
+    bool lcd_was_enabled; // The frame is finished once when the LCD is turned off.
 
     bool stop_fifos;
     bool fetching_sprite;
     bool check_sprites;
-    Array<Pixel> bg_fifo;
-    Array<Pixel> sprite_fifo;
-    Array<Pixel> sprite_mixing_fifo;
+    PixelFIFO bg_fifo;
+    PixelFIFO sprite_fifo;
+    PixelFIFO sprite_mixing_fifo;
 
     bool render_window;
     bool LY_equals_WY;
@@ -128,8 +145,34 @@ struct PPU{
 
     u8 sprites_processed;
     Sprite sprite;
+
+    // The OAM scan only finds the sprites of the line at its end, unless OAM or LCDC is about to change
+    // halfway through. Then the entries it went by are added first.
+    u8 oam_entries_scanned;
+    // What the scan would find on each line for OAM as it is, sorted like the scan leaves them. Rebuilt
+    // when OAM or the sprite height changes.
+    Sprite line_sprites[VISIBLE_LINES][OAM_ENTRIES];
+    u8 line_sprite_counts[VISIBLE_LINES];
+    u8 line_sprites_height; // 0 when OAM changed since they were built.
+    // Index in sprites of the first one the lookup reaches at each X, or 0xFF.
+    u8 first_sprite_at_x[256];
+    u32 sprite_lookup_count;
+
+    bool fast_scanlines;     // Lines without sprites, window or changes halfway through are drawn in one go.
+    bool drawing_whole_line; // The FIFO is skipped and the line is drawn when mode 3 ends.
+    u32 draw_end_cycle;
+    ScanlineKernel scanline_kernel; // Decodes the whole lines.
+
+    TileCache tiles;
 };
 struct CPU;
-void init_ppu(PPU *ppu, Memory *memory, SDL_Renderer *renderer);
+void init_ppu(PPU *ppu, Memory *memory);
 void ppu_tick(PPU *ppu, CPU *cpu);
-void ppu_render(PPU *ppu);
\ No newline at end of file
+void ppu_finish_frame(PPU *ppu);
+u32 ppu_idle_cycles(PPU *ppu);
+u32 ppu_cycles_until_event(PPU *ppu);
+void ppu_run(PPU *ppu, CPU *cpu, u32 cycles);
+void ppu_prepare_for_write(PPU *ppu);
+void ppu_prepare_for_oam_write(PPU *ppu);
+void ppu_update_tile_row(PPU *ppu, u16 address);
+void free_ppu(PPU *ppu);
\ No newline at end of file
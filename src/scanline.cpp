@@ -0,0 +1,145 @@
+#include "scanline.h"
+#include <string.h>
+
+#if SCANLINE_SIMD_SUPPORTED
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define TARGET_AVX2
+#else
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+static void decode_tile_rows_scalar(const u8 *rows, u32 count, u8 palette, u8 *shades){
+    for(u32 i = 0; i < count; i++){
+        u8 low  = rows[2 * i];
+        u8 high = rows[2 * i + 1];
+        for(int x = 0; x < 8; x++){
+            u8 bit = 7 - x;
+            u8 color = ((low >> bit) & 0x1) | (((high >> bit) & 0x1) << 1);
+            shades[8 * i + x] = (palette >> (2 * color)) & 0x3;
+        }
+    }
+}
+
+#if SCANLINE_SIMD_SUPPORTED
+
+static bool cpu_has_avx2(){
+#ifdef _MSC_VER
+    int info[4];
+    __cpuid(info, 0);
+    if(info[0] < 7) return false;
+
+    __cpuid(info, 1);
+    bool avx = (info[2] & (1 << 28)) && (info[2] & (1 << 27)); // And the OS uses XSAVE,
+    if(!avx || (_xgetbv(0) & 0x6) != 0x6) return false;         // saving the YMM registers too.
+
+    __cpuidex(info, 7, 0);
+    return info[1] & (1 << 5);
+#else
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+
+// Every pixel is one byte lane, tested against the bit it comes from.
+#define PIXEL_BITS (char)0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01
+
+// Two rows at a time. SSE2 has no byte shuffle, the palette is applied comparing against each color.
+static void decode_tile_rows_sse2(const u8 *rows, u32 count, u8 palette, u8 *shades){
+    const __m128i bits = _mm_setr_epi8(PIXEL_BITS, PIXEL_BITS);
+    const __m128i one  = _mm_set1_epi8(1);
+    const __m128i two  = _mm_set1_epi8(2);
+    __m128i colors[4];
+    __m128i palette_shades[4];
+    for(int color = 0; color < 4; color++){
+        colors[color] = _mm_set1_epi8(color);
+        palette_shades[color] = _mm_set1_epi8((palette >> (2 * color)) & 0x3);
+    }
+
+    u32 i = 0;
+    for(; i + 2 <= count; i += 2){
+        u32 pair;
+        memcpy(&pair, rows + 2 * i, sizeof(pair));
+        __m128i bytes = _mm_cvtsi32_si128((int)pair);
+        bytes = _mm_unpacklo_epi8(bytes, bytes);
+        bytes = _mm_unpacklo_epi16(bytes, bytes);
+        __m128i first  = _mm_unpacklo_epi32(bytes, bytes); // Low and high byte of the first row, 8 times each.
+        __m128i second = _mm_unpackhi_epi32(bytes, bytes);
+        __m128i low  = _mm_unpacklo_epi64(first, second);
+        __m128i high = _mm_unpackhi_epi64(first, second);
+
+        low  = _mm_cmpeq_epi8(_mm_and_si128(low, bits), bits);
+        high = _mm_cmpeq_epi8(_mm_and_si128(high, bits), bits);
+        __m128i pixels = _mm_or_si128(_mm_and_si128(low, one), _mm_and_si128(high, two));
+
+        __m128i result = _mm_setzero_si128();
+        for(int color = 0; color < 4; color++){
+            result = _mm_or_si128(result, _mm_and_si128(_mm_cmpeq_epi8(pixels, colors[color]), palette_shades[color]));
+        }
+        _mm_storeu_si128((__m128i*)(shades + 8 * i), result);
+    }
+    decode_tile_rows_scalar(rows + 2 * i, count - i, palette, shades + 8 * i);
+}
+
+// Four rows at a time, the shuffles work within each half so both halves hold the same 8 bytes.
+TARGET_AVX2 static void decode_tile_rows_avx2(const u8 *rows, u32 count, u8 palette, u8 *shades){
+    const __m256i low_bytes  = _mm256_setr_epi8(0, 0, 0, 0, 0, 0, 0, 0, 2, 2, 2, 2, 2, 2, 2, 2,
+                                                4, 4, 4, 4, 4, 4, 4, 4, 6, 6, 6, 6, 6, 6, 6, 6);
+    const __m256i high_bytes = _mm256_add_epi8(low_bytes, _mm256_set1_epi8(1));
+    const __m256i bits = _mm256_setr_epi8(PIXEL_BITS, PIXEL_BITS, PIXEL_BITS, PIXEL_BITS);
+    const __m256i one  = _mm256_set1_epi8(1);
+    const __m256i two  = _mm256_set1_epi8(2);
+
+    char s0 = palette & 0x3;
+    char s1 = (palette >> 2) & 0x3;
+    char s2 = (palette >> 4) & 0x3;
+    char s3 = (palette >> 6) & 0x3;
+    const __m256i palette_shades = _mm256_setr_epi8(s0, s1, s2, s3, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+                                                    s0, s1, s2, s3, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+
+    u32 i = 0;
+    for(; i + 4 <= count; i += 4){
+        __m256i bytes = _mm256_broadcastq_epi64(_mm_loadl_epi64((const __m128i*)(rows + 2 * i)));
+        __m256i low  = _mm256_shuffle_epi8(bytes, low_bytes);
+        __m256i high = _mm256_shuffle_epi8(bytes, high_bytes);
+
+        low  = _mm256_cmpeq_epi8(_mm256_and_si256(low, bits), bits);
+        high = _mm256_cmpeq_epi8(_mm256_and_si256(high, bits), bits);
+        __m256i pixels = _mm256_or_si256(_mm256_and_si256(low, one), _mm256_and_si256(high, two));
+
+        _mm256_storeu_si256((__m256i*)(shades + 8 * i), _mm256_shuffle_epi8(palette_shades, pixels));
+    }
+    decode_tile_rows_sse2(rows + 2 * i, count - i, palette, shades + 8 * i);
+}
+
+#endif
+
+bool is_scanline_kernel_supported(ScanlineKernel kernel){
+    switch(kernel){
+        case SCANLINE_KERNEL_SCALAR: return true;
+#if SCANLINE_SIMD_SUPPORTED
+        case SCANLINE_KERNEL_SSE2:   return true; // Part of x86-64.
+        case SCANLINE_KERNEL_AVX2:   return cpu_has_avx2();
+#endif
+        default: return false;
+    }
+}
+
+ScanlineKernel get_best_scanline_kernel(){
+    for(i32 kernel = SCANLINE_KERNEL_COUNT - 1; kernel > SCANLINE_KERNEL_SCALAR; kernel--){
+        if(is_scanline_kernel_supported((ScanlineKernel)kernel)) return (ScanlineKernel)kernel;
+    }
+    return SCANLINE_KERNEL_SCALAR;
+}
+
+void decode_tile_rows(ScanlineKernel kernel, const u8 *rows, u32 count, u8 palette, u8 *shades){
+    switch(kernel){
+#if SCANLINE_SIMD_SUPPORTED
+        case SCANLINE_KERNEL_SSE2: decode_tile_rows_sse2(rows, count, palette, shades); return;
+        case SCANLINE_KERNEL_AVX2: decode_tile_rows_avx2(rows, count, palette, shades); return;
+#endif
+        default: decode_tile_rows_scalar(rows, count, palette, shades); return;
+    }
+}
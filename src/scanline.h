@@ -0,0 +1,24 @@
+#pragma once
+#include "common.h"
+
+// Decodes the tiles of a whole background line at once. A tile row is two bytes, the low and the high
+// bitplane, each bit from the highest down is one pixel from left to right. The 2-bit color of every
+// pixel is mapped through a palette like BGP to its shade.
+#if defined(__x86_64__) || defined(_M_X64)
+#define SCANLINE_SIMD_SUPPORTED 1
+#else
+#define SCANLINE_SIMD_SUPPORTED 0
+#endif
+
+enum ScanlineKernel{
+    SCANLINE_KERNEL_SCALAR,
+    SCANLINE_KERNEL_SSE2, // 16 pixels at a time.
+    SCANLINE_KERNEL_AVX2, // 32 pixels at a time.
+    SCANLINE_KERNEL_COUNT
+};
+
+bool is_scanline_kernel_supported(ScanlineKernel kernel);
+ScanlineKernel get_best_scanline_kernel();
+
+// Writes 8 shades for each of the count rows, which are count pairs of low and high bytes.
+void decode_tile_rows(ScanlineKernel kernel, const u8 *rows, u32 count, u8 palette, u8 *shades);
@@ -0,0 +1,58 @@
+#include "scheduler.h"
+
+// There are only a few events, a scan of the deadlines is cheaper than keeping a heap in order.
+static void update_next_deadline(Scheduler *scheduler){
+    u64 next = NO_EVENT;
+    for(i32 i = 0; i < EVENT_COUNT; i++){
+        if(scheduler->deadlines[i] < next) next = scheduler->deadlines[i];
+    }
+    scheduler->next_deadline = next;
+}
+
+void init_scheduler(Scheduler *scheduler){
+    scheduler->cycle = 0;
+    for(i32 i = 0; i < EVENT_COUNT; i++){
+        scheduler->deadlines[i] = NO_EVENT;
+    }
+    scheduler->next_deadline = NO_EVENT;
+}
+
+// Replaces the deadline if the event was already scheduled.
+void schedule_event(Scheduler *scheduler, EventType type, u64 cycle){
+    assert(cycle > scheduler->cycle);
+    u64 old = scheduler->deadlines[type];
+    scheduler->deadlines[type] = cycle;
+    if(cycle < scheduler->next_deadline){
+        scheduler->next_deadline = cycle;
+    }
+    else if(old == scheduler->next_deadline){
+        update_next_deadline(scheduler);
+    }
+}
+
+void cancel_event(Scheduler *scheduler, EventType type){
+    u64 old = scheduler->deadlines[type];
+    scheduler->deadlines[type] = NO_EVENT;
+    if(old == scheduler->next_deadline){
+        update_next_deadline(scheduler);
+    }
+}
+
+bool is_event_scheduled(Scheduler *scheduler, EventType type){
+    return scheduler->deadlines[type] != NO_EVENT;
+}
+
+// Takes the first event due on or before the given cycle and moves the time to it. Returns false and
+// leaves the time alone when there's none.
+bool pop_due_event(Scheduler *scheduler, u64 until, EventType *type){
+    u64 deadline = scheduler->next_deadline;
+    if(deadline > until) return false;
+
+    i32 first = 0;
+    while(scheduler->deadlines[first] != deadline) first++;
+
+    scheduler->cycle = deadline;
+    *type = (EventType)first;
+    cancel_event(scheduler, (EventType)first);
+    return true;
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include "common.h"
+
+// Machine cycle timestamps of the next thing each part of the hardware has to do. The hardware only
+// runs when one of its events is due instead of being ticked every machine cycle.
+
+// Events due on the same machine cycle run in this order.
+enum EventType{
+    EVENT_TIMER,  // TIMA overflows.
+    EVENT_DMA,
+    EVENT_PPU,
+    EVENT_COUNT,
+};
+
+#define NO_EVENT UINT64_MAX
+
+struct Scheduler{
+    u64 cycle;                  // Machine cycles run since power on.
+    u64 deadlines[EVENT_COUNT]; // NO_EVENT when the event isn't scheduled.
+    u64 next_deadline;          // Earliest of the deadlines.
+};
+
+void init_scheduler(Scheduler *scheduler);
+void schedule_event(Scheduler *scheduler, EventType type, u64 cycle);
+void cancel_event(Scheduler *scheduler, EventType type);
+bool is_event_scheduled(Scheduler *scheduler, EventType type);
+bool pop_due_event(Scheduler *scheduler, u64 until, EventType *type);
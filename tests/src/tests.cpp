@@ -1,6 +1,9 @@
 #include <stdio.h>
 #include <string.h>
+#include <stdlib.h>
 #include "gameboy.h"
+#include "arena.h"
+#include "scanline.h"
 
 void show_test_result(const char *test_name, bool result){
 	if(result)
@@ -13,54 +16,88 @@ void check_result(bool *result, bool expression){
 	if(!expression && *result) *result = expression;
 }
 
+static u8 test_rom[0x8000]; // Empty ROM without a mapper, the tests copy their program to address 0.
+static Jit test_jit;
+static Arena test_arena;
+static bool use_jit;
+
+static void init_test_gameboy(Gameboy *gmb){
+	init_memory_from_rom(&gmb->memory, &test_arena, test_rom, sizeof(test_rom));
+	init_cpu(&gmb->cpu, &gmb->memory);
+
+	// The tests expect cleared registers instead of the values left by the boot ROM.
+	gmb->cpu.AF = 0x0000;
+	gmb->cpu.BC = 0x0000;
+	gmb->cpu.DE = 0x0000;
+	gmb->cpu.HL = 0x0000;
+	gmb->cpu.PC = 0x0000;
+
+	if(use_jit) flush_jit(&test_jit);
+}
+
+// Runs one machine cycle in the interpreter. With the JIT, whole instructions run as compiled blocks
+// instead, falling back to the interpreter for the ones the JIT leaves to it.
+static void run_test_cpu(CPU *cpu){
+	if(use_jit && run_jit_block(&test_jit, cpu)) return;
+	run_cpu(cpu);
+}
+
+static u8 read_memory(Memory *memory, u16 address){
+	return memory->data[address];
+}
+
+static void write_memory(Memory *memory, u16 address, u8 value){
+	memory->data[address] = value;
+}
+
 void ld_r16_imm16(){
 	const char *test_name = "LD r16, imm16";
 	bool result = true;
 	{
 		Gameboy gmb = {};
-		init_gameboy(&gmb);
+		init_test_gameboy(&gmb);
 
 		CPU *cpu = &gmb.cpu;
 		u8 mem[3] = {0x01, 0x01, 0xBC};
-		memcpy(cpu->memory, mem, 3);
+		memcpy(cpu->memory->data, mem, 3);
 		while(cpu->PC < 4){
-			run_cpu(cpu);
+			run_test_cpu(cpu);
 		}
 		check_result(&result, cpu->BC == 0xBC01);
 	}
 	{
 		Gameboy gmb = {};
-		init_gameboy(&gmb);
+		init_test_gameboy(&gmb);
 
 		CPU *cpu = &gmb.cpu;
 		u8 mem[3] = {0x11, 0x02, 0xDE};
-		memcpy(cpu->memory, mem, 3);
+		memcpy(cpu->memory->data, mem, 3);
 		while(cpu->PC < 4){
-			run_cpu(cpu);
+			run_test_cpu(cpu);
 		}
 		check_result(&result, cpu->DE == 0xDE02);
 	}
 	{
 		Gameboy gmb = {};
-		init_gameboy(&gmb);
+		init_test_gameboy(&gmb);
 
 		CPU *cpu = &gmb.cpu;
 		u8 mem[3] = {0x21, 0x03, 0xAA};
-		memcpy(cpu->memory, mem, 3);
+		memcpy(cpu->memory->data, mem, 3);
 		while(cpu->PC < 4){
-			run_cpu(cpu);
+			run_test_cpu(cpu);
 		}
 		check_result(&result, cpu->HL == 0xAA03);
 	}
 	{
 		Gameboy gmb = {};
-		init_gameboy(&gmb);
+		init_test_gameboy(&gmb);
 
 		CPU *cpu = &gmb.cpu;
 		u8 mem[3] = {0x31, 0x04, 0xCC};
-		memcpy(cpu->memory, mem, 3);
+		memcpy(cpu->memory->data, mem, 3);
 		while(cpu->PC < 4){
-			run_cpu(cpu);
+			run_test_cpu(cpu);
 		}
 		check_result(&result, cpu->SP == 0xCC04);
 		
@@ -74,16 +111,16 @@ void ld_memr16_a(){
 	bool result = true;
 	{	// LD [BC], A test
 		Gameboy gmb = {};
-		init_gameboy(&gmb);
+		init_test_gameboy(&gmb);
 
 		CPU *cpu = &gmb.cpu;
 		u8 mem[1] = {0x02};
-		memcpy(cpu->memory, mem, 1);
+		memcpy(cpu->memory->data, mem, 1);
 
 		cpu->A = 0x01;
-		cpu->BC = 0x07FF;
+		cpu->BC = 0xC7FF;
 		while(cpu->PC < 2){
-			run_cpu(cpu);
+			run_test_cpu(cpu);
 		}
 		check_result(&result, read_memory(cpu->memory, cpu->BC) == 0x01);
 		check_result(&result, cpu->PC == 0x02);
@@ -91,16 +128,16 @@ void ld_memr16_a(){
 
 	{	// LD [DE], A test
 		Gameboy gmb = {};
-		init_gameboy(&gmb);
+		init_test_gameboy(&gmb);
 
 		CPU *cpu = &gmb.cpu;
 		u8 mem[1] = {0x12};
-		memcpy(cpu->memory, mem, 1);
+		memcpy(cpu->memory->data, mem, 1);
 
 		cpu->A = 0xA0;
 		cpu->DE = 0xFFFF;
 		while(cpu->PC < 2){
-			run_cpu(cpu);
+			run_test_cpu(cpu);
 		}
 		check_result(&result, read_memory(cpu->memory, cpu->DE) == 0xA0);
 		check_result(&result, cpu->PC == 0x02);
@@ -108,17 +145,17 @@ void ld_memr16_a(){
 
 	{ // LD [HL+], A test
 		Gameboy gmb = {};
-		init_gameboy(&gmb);
+		init_test_gameboy(&gmb);
 
 		CPU *cpu = &gmb.cpu;
 		u8 mem[1] = {0x22};
-		memcpy(cpu->memory, mem, 1);
+		memcpy(cpu->memory->data, mem, 1);
 
 		cpu->A = 0xBB;
-		cpu->HL = 0x0AAA;
+		cpu->HL = 0xCAAA;
 		u16 previous_HL = cpu->HL;
 		while(cpu->PC < 2){
-			run_cpu(cpu);
+			run_test_cpu(cpu);
 		}
 		check_result(&result, read_memory(cpu->memory, previous_HL) == 0xBB);
 		check_result(&result, cpu->HL == previous_HL + 1);
@@ -127,17 +164,17 @@ void ld_memr16_a(){
 
 	{  // LD [HL-], A test
 		Gameboy gmb = {};
-		init_gameboy(&gmb);
+		init_test_gameboy(&gmb);
 
 		CPU *cpu = &gmb.cpu;
 		u8 mem[1] = {0x32};
-		memcpy(cpu->memory, mem, 1);
+		memcpy(cpu->memory->data, mem, 1);
 
 		cpu->A = 0xDC;
-		cpu->HL = 0x0AAA;
+		cpu->HL = 0xCAAA;
 		u16 previous_HL = cpu->HL;
 		while(cpu->PC < 2){
-			run_cpu(cpu);
+			run_test_cpu(cpu);
 		}
 		check_result(&result, read_memory(cpu->memory, previous_HL) == 0xDC);
 		check_result(&result, cpu->HL == previous_HL - 1);
@@ -152,16 +189,16 @@ void ld_a_memr16(){
 	bool result = true;
 	{	// LD A, [BC] test
 		Gameboy gmb = {};
-		init_gameboy(&gmb);
+		init_test_gameboy(&gmb);
 
 		CPU *cpu = &gmb.cpu;
 		u8 mem[1] = {0x0A};
-		memcpy(cpu->memory, mem, 1);
+		memcpy(cpu->memory->data, mem, 1);
 
 		cpu->BC = 0x07FF;
 		write_memory(cpu->memory,cpu->BC, 0x01);
 		while(cpu->PC < 2){
-			run_cpu(cpu);
+			run_test_cpu(cpu);
 		}
 		check_result(&result, cpu->A == 0x01);
 		check_result(&result, cpu->PC == 0x02);
@@ -169,16 +206,16 @@ void ld_a_memr16(){
 
 	{	// LD A, [DE] test
 		Gameboy gmb = {};
-		init_gameboy(&gmb);
+		init_test_gameboy(&gmb);
 
 		CPU *cpu = &gmb.cpu;
 		u8 mem[1] = {0x1A};
-		memcpy(cpu->memory, mem, 1);
+		memcpy(cpu->memory->data, mem, 1);
 
 		cpu->DE = 0xFFFF;
 		write_memory(cpu->memory, cpu->DE, 0xA0);
 		while(cpu->PC < 2){
-			run_cpu(cpu);
+			run_test_cpu(cpu);
 		}
 		check_result(&result, cpu->A == 0xA0);
 		check_result(&result, cpu->PC == 0x02);
@@ -186,17 +223,17 @@ void ld_a_memr16(){
 
 	{ // LD A, [HL+] test
 		Gameboy gmb = {};
-		init_gameboy(&gmb);
+		init_test_gameboy(&gmb);
 
 		CPU *cpu = &gmb.cpu;
 		u8 mem[1] = {0x2A};
-		memcpy(cpu->memory, mem, 1);
+		memcpy(cpu->memory->data, mem, 1);
 
 		cpu->HL = 0x0AAA;
 		write_memory(cpu->memory, cpu->HL, 0xBB);
 		u16 previous_HL = cpu->HL;
 		while(cpu->PC < 2){
-			run_cpu(cpu);
+			run_test_cpu(cpu);
 		}
 		check_result(&result, cpu->A == 0xBB);
 		check_result(&result, cpu->HL == previous_HL + 1);
@@ -205,17 +242,17 @@ void ld_a_memr16(){
 
 	{  // LD A, [HL-] test
 		Gameboy gmb = {};
-		init_gameboy(&gmb);
+		init_test_gameboy(&gmb);
 
 		CPU *cpu = &gmb.cpu;
 		u8 mem[1] = {0x3A};
-		memcpy(cpu->memory, mem, 1);
+		memcpy(cpu->memory->data, mem, 1);
 
 		cpu->HL = 0x0AAA;
 		write_memory(cpu->memory, cpu->HL, 0xDC);
 		u16 previous_HL = cpu->HL;
 		while(cpu->PC < 2){
-			run_cpu(cpu);
+			run_test_cpu(cpu);
 		}
 		check_result(&result, cpu->A == 0xDC);
 		check_result(&result, cpu->HL == previous_HL - 1);
@@ -230,15 +267,15 @@ void ld_a16_sp(){
 	bool result = true;
 	{	// LD A, [BC] test
 		Gameboy gmb = {};
-		init_gameboy(&gmb);
+		init_test_gameboy(&gmb);
 
 		CPU *cpu = &gmb.cpu;
 		u8 mem[3] = {0x08, 0x7F, 0xFF};
-		memcpy(cpu->memory, mem, 3);
+		memcpy(cpu->memory->data, mem, 3);
 
 		cpu->SP = 0x1020;
 		while(cpu->PC < 6){
-			run_cpu(cpu);
+			run_test_cpu(cpu);
 		}
 		check_result(&result, read_memory(cpu->memory, 0xFF7F) == 0x20);
 		check_result(&result, read_memory(cpu->memory, 0xFF80) == 0x10);
@@ -252,15 +289,15 @@ void inc_r16(){
 	bool result = true;
 	{	// INC r16
 		Gameboy gmb = {};
-		init_gameboy(&gmb);
+		init_test_gameboy(&gmb);
 
 		CPU *cpu = &gmb.cpu;
 		u8 mem[1] = {0x13};
-		memcpy(cpu->memory, mem, 1);
+		memcpy(cpu->memory->data, mem, 1);
 
 		cpu->DE = 0x05;
 		while(cpu->PC < 2){
-			run_cpu(cpu);
+			run_test_cpu(cpu);
 		}
 		check_result(&result, cpu->DE == 0x06);
 		check_result(&result, cpu->PC == 0x02);
@@ -268,15 +305,15 @@ void inc_r16(){
 
 	{	// INC SP
 		Gameboy gmb = {};
-		init_gameboy(&gmb);
+		init_test_gameboy(&gmb);
 
 		CPU *cpu = &gmb.cpu;
 		u8 mem[1] = {0x33};
-		memcpy(cpu->memory, mem, 1);
+		memcpy(cpu->memory->data, mem, 1);
 
 		cpu->SP = 0x0321;
 		while(cpu->PC < 2){
-			run_cpu(cpu);
+			run_test_cpu(cpu);
 		}
 
 		check_result(&result, cpu->SP == 0x0322);
@@ -291,15 +328,15 @@ void dec_r16(){
 	bool result = true;
 	{	// DEC r16
 		Gameboy gmb = {};
-		init_gameboy(&gmb);
+		init_test_gameboy(&gmb);
 
 		CPU *cpu = &gmb.cpu;
 		u8 mem[1] = {0x1B};
-		memcpy(cpu->memory, mem, 1);
+		memcpy(cpu->memory->data, mem, 1);
 
 		cpu->DE = 0x05;
 		while(cpu->PC < 2){
-			run_cpu(cpu);
+			run_test_cpu(cpu);
 		}
 		check_result(&result, cpu->DE == 0x04);
 		check_result(&result, cpu->PC == 0x02);
@@ -307,15 +344,15 @@ void dec_r16(){
 
 	{	// DEC SP
 		Gameboy gmb = {};
-		init_gameboy(&gmb);
+		init_test_gameboy(&gmb);
 
 		CPU *cpu = &gmb.cpu;
 		u8 mem[1] = {0x3B};
-		memcpy(cpu->memory, mem, 1);
+		memcpy(cpu->memory->data, mem, 1);
 
 		cpu->SP = 0x0321;
 		while(cpu->PC < 2){
-			run_cpu(cpu);
+			run_test_cpu(cpu);
 		}
 
 		check_result(&result, cpu->SP == 0x0320);
@@ -330,37 +367,37 @@ void add_hl_r16(){
 	bool result = true;
 	{	// ADD HL, BC
 		Gameboy gmb = {};
-		init_gameboy(&gmb);
+		init_test_gameboy(&gmb);
 
 		CPU *cpu = &gmb.cpu;
 		u8 mem[1] = {0x09};
-		memcpy(cpu->memory, mem, 1);
+		memcpy(cpu->memory->data, mem, 1);
 
 		cpu->HL = 0xA2;
 		cpu->BC = 0x13;
 		while(cpu->PC < 3){
-			run_cpu(cpu);
+			run_test_cpu(cpu);
 		}
 		check_result(&result, cpu->HL == 0xB5);
-		check_result(&result, !cpu->flags);
+		check_result(&result, !get_flags(cpu));
 		check_result(&result, cpu->PC == 0x03);
 	}
 
 	{	// ADD HL, SP
 		Gameboy gmb = {};
-		init_gameboy(&gmb);
+		init_test_gameboy(&gmb);
 
 		CPU *cpu = &gmb.cpu;
 		u8 mem[1] = {0x39};
-		memcpy(cpu->memory, mem, 1);
+		memcpy(cpu->memory->data, mem, 1);
 
 		cpu->HL = 0xFFFF;
 		cpu->SP = 0x2030;
 		while(cpu->PC < 3){
-			run_cpu(cpu);
+			run_test_cpu(cpu);
 		}
 		check_result(&result, cpu->HL == 0x202F);
-		check_result(&result, (cpu->flags) & (FLAG_CARRY|FLAG_HALFCARRY));
+		check_result(&result, (get_flags(cpu)) & (FLAG_CARRY|FLAG_HALFCARRY));
 		check_result(&result, cpu->PC == 0x03);
 	}
 
@@ -372,72 +409,72 @@ void inc_r8(){
 	bool result = true;
 	{	// INC B
 		Gameboy gmb = {};
-		init_gameboy(&gmb);
+		init_test_gameboy(&gmb);
 
 		CPU *cpu = &gmb.cpu;
 		u8 mem[1] = {0x04};
-		memcpy(cpu->memory, mem, 1);
+		memcpy(cpu->memory->data, mem, 1);
 
 		cpu->BC = 0xAABB;
 		while(cpu->PC < 2){
-			run_cpu(cpu);
+			run_test_cpu(cpu);
 		}
 		check_result(&result, cpu->B == 0xAB);
 		check_result(&result, cpu->BC == 0xABBB);
-		check_result(&result, !cpu->flags);
+		check_result(&result, !get_flags(cpu));
 		check_result(&result, cpu->PC == 0x02);
 	}
 
 	{	// INC E
 		Gameboy gmb = {};
-		init_gameboy(&gmb);
+		init_test_gameboy(&gmb);
 
 		CPU *cpu = &gmb.cpu;
 		u8 mem[1] = {0x1C};
-		memcpy(cpu->memory, mem, 1);
+		memcpy(cpu->memory->data, mem, 1);
 
 		cpu->DE = 0x10FF;
 		while(cpu->PC < 2){
-			run_cpu(cpu);
+			run_test_cpu(cpu);
 		}
 		check_result(&result, cpu->E == 0x00);
 		check_result(&result, cpu->DE == 0x1000);
-		check_result(&result, (cpu->flags) & (FLAG_HALFCARRY|FLAG_ZERO));
+		check_result(&result, (get_flags(cpu)) & (FLAG_HALFCARRY|FLAG_ZERO));
 		check_result(&result, cpu->PC == 0x02);
 	}
 
 	{	// INC L
 		Gameboy gmb = {};
-		init_gameboy(&gmb);
+		init_test_gameboy(&gmb);
 
 		CPU *cpu = &gmb.cpu;
 		u8 mem[1] = {0x2C};
-		memcpy(cpu->memory, mem, 1);
+		memcpy(cpu->memory->data, mem, 1);
 
 		cpu->HL = 0x10FF;
 		while(cpu->PC < 2){
-			run_cpu(cpu);
+			run_test_cpu(cpu);
 		}
 		check_result(&result, cpu->L == 0x00);
 		check_result(&result, cpu->HL == 0x1000);
-		check_result(&result, (cpu->flags) & (FLAG_HALFCARRY|FLAG_ZERO));
+		check_result(&result, (get_flags(cpu)) & (FLAG_HALFCARRY|FLAG_ZERO));
 		check_result(&result, cpu->PC == 0x02);
 	}
 
 	{	// INC A
 		Gameboy gmb = {};
-		init_gameboy(&gmb);
+		init_test_gameboy(&gmb);
 
 		CPU *cpu = &gmb.cpu;
 		u8 mem[1] = {0x3C};
-		memcpy(cpu->memory, mem, 1);
+		memcpy(cpu->memory->data, mem, 1);
 
 		cpu->A = 0xFF;
 		while(cpu->PC < 2){
-			run_cpu(cpu);
+			run_test_cpu(cpu);
 		}
 		check_result(&result, cpu->A == 0x00);
-		check_result(&result, (cpu->flags) & (FLAG_HALFCARRY|FLAG_ZERO));
+		check_result(&result, (get_flags(cpu)) & (FLAG_HALFCARRY|FLAG_ZERO));
 		check_result(&result, cpu->PC == 0x02);
 	}
 
@@ -449,20 +486,20 @@ void inc_memhl(){
 	bool result = true;
 	{	// INC [HL]
 		Gameboy gmb = {};
-		init_gameboy(&gmb);
+		init_test_gameboy(&gmb);
 
 		CPU *cpu = &gmb.cpu;
 		u8 mem[1] = {0x34};
-		memcpy(cpu->memory, mem, 1);
+		memcpy(cpu->memory->data, mem, 1);
 
-		cpu->HL = 0xAABB;
+		cpu->HL = 0xCABB;
 		write_memory(cpu->memory, cpu->HL, 0xFF);
 		u8 previous_mem = read_memory(cpu->memory, cpu->HL);
 		while(cpu->PC < 3){
-			run_cpu(cpu);
+			run_test_cpu(cpu);
 		}
 		check_result(&result, read_memory(cpu->memory, cpu->HL) == u8(previous_mem + 1));
-		check_result(&result, (cpu->flags) & (FLAG_HALFCARRY|FLAG_ZERO));
+		check_result(&result, (get_flags(cpu)) & (FLAG_HALFCARRY|FLAG_ZERO));
 		check_result(&result, cpu->PC == 0x03);
 	}
 
@@ -474,72 +511,72 @@ void dec_r8(){
 	bool result = true;
 	{	// DEC B
 		Gameboy gmb = {};
-		init_gameboy(&gmb);
+		init_test_gameboy(&gmb);
 
 		CPU *cpu = &gmb.cpu;
 		u8 mem[1] = {0x05};
-		memcpy(cpu->memory, mem, 1);
+		memcpy(cpu->memory->data, mem, 1);
 
 		cpu->BC = 0xA5BB;
 		while(cpu->PC < 2){
-			run_cpu(cpu);
+			run_test_cpu(cpu);
 		}
 		check_result(&result, cpu->B == 0xA4);
 		check_result(&result, cpu->BC == 0xA4BB);
-		check_result(&result, (cpu->flags) & (FLAG_SUB));
+		check_result(&result, (get_flags(cpu)) & (FLAG_SUB));
 		check_result(&result, cpu->PC == 0x02);
 	}
 
 	{	// DEC E
 		Gameboy gmb = {};
-		init_gameboy(&gmb);
+		init_test_gameboy(&gmb);
 
 		CPU *cpu = &gmb.cpu;
 		u8 mem[1] = {0x1D};
-		memcpy(cpu->memory, mem, 1);
+		memcpy(cpu->memory->data, mem, 1);
 
 		cpu->DE = 0x1000;
 		while(cpu->PC < 2){
-			run_cpu(cpu);
+			run_test_cpu(cpu);
 		}
 		check_result(&result, cpu->E == 0xFF);
 		check_result(&result, cpu->DE == 0x10FF);
-		check_result(&result, (cpu->flags) & (FLAG_HALFCARRY|FLAG_SUB));
+		check_result(&result, (get_flags(cpu)) & (FLAG_HALFCARRY|FLAG_SUB));
 		check_result(&result, cpu->PC == 0x02);
 	}
 
 	{	// DEC L
 		Gameboy gmb = {};
-		init_gameboy(&gmb);
+		init_test_gameboy(&gmb);
 
 		CPU *cpu = &gmb.cpu;
 		u8 mem[1] = {0x2D};
-		memcpy(cpu->memory, mem, 1);
+		memcpy(cpu->memory->data, mem, 1);
 
 		cpu->HL = 0x10FF;
 		while(cpu->PC < 2){
-			run_cpu(cpu);
+			run_test_cpu(cpu);
 		}
 		check_result(&result, cpu->L == 0xFE);
 		check_result(&result, cpu->HL == 0x10FE);
-		check_result(&result, (cpu->flags) & (FLAG_SUB));
+		check_result(&result, (get_flags(cpu)) & (FLAG_SUB));
 		check_result(&result, cpu->PC == 0x02);
 	}
 
 	{	// DEC A
 		Gameboy gmb = {};
-		init_gameboy(&gmb);
+		init_test_gameboy(&gmb);
 
 		CPU *cpu = &gmb.cpu;
 		u8 mem[1] = {0x3D};
-		memcpy(cpu->memory, mem, 1);
+		memcpy(cpu->memory->data, mem, 1);
 
 		cpu->A = 0x01;
 		while(cpu->PC < 2){
-			run_cpu(cpu);
+			run_test_cpu(cpu);
 		}
 		check_result(&result, cpu->A == 0x00);
-		check_result(&result, (cpu->flags) & (FLAG_ZERO|FLAG_SUB));
+		check_result(&result, (get_flags(cpu)) & (FLAG_ZERO|FLAG_SUB));
 		check_result(&result, cpu->PC == 0x02);
 	}
 
@@ -551,20 +588,20 @@ void dec_memhl(){
 	bool result = true;
 	{	// INC [HL]
 		Gameboy gmb = {};
-		init_gameboy(&gmb);
+		init_test_gameboy(&gmb);
 
 		CPU *cpu = &gmb.cpu;
 		u8 mem[1] = {0x35};
-		memcpy(cpu->memory, mem, 1);
+		memcpy(cpu->memory->data, mem, 1);
 
-		cpu->HL = 0xAABB;
+		cpu->HL = 0xCABB;
 		write_memory(cpu->memory, cpu->HL, 0x00);
 		u8 previous_mem = read_memory(cpu->memory, cpu->HL);
 		while(cpu->PC < 3){
-			run_cpu(cpu);
+			run_test_cpu(cpu);
 		}
 		check_result(&result, read_memory(cpu->memory, cpu->HL) == u8(previous_mem - 1));
-		check_result(&result, (cpu->flags) & (FLAG_HALFCARRY|FLAG_SUB));
+		check_result(&result, (get_flags(cpu)) & (FLAG_HALFCARRY|FLAG_SUB));
 		check_result(&result, cpu->PC == 0x03);
 	}
 
@@ -576,13 +613,13 @@ void ld_r_imm8(){
 	bool result = true;
 	{   // LD B, imm8
 		Gameboy gmb = {};
-		init_gameboy(&gmb);
+		init_test_gameboy(&gmb);
 
 		CPU *cpu = &gmb.cpu;
 		u8 mem[2] = {0x06, 0xBB};
-		memcpy(cpu->memory, mem, 2);
+		memcpy(cpu->memory->data, mem, 2);
 		while(cpu->PC < 4){
-			run_cpu(cpu);
+			run_test_cpu(cpu);
 		}
 		check_result(&result, cpu->B == 0xBB);
 		check_result(&result, cpu->PC == 0x04);
@@ -590,13 +627,13 @@ void ld_r_imm8(){
 
 	{   // LD H, imm8
 		Gameboy gmb = {};
-		init_gameboy(&gmb);
+		init_test_gameboy(&gmb);
 
 		CPU *cpu = &gmb.cpu;
 		u8 mem[2] = {0x26, 0xDD};
-		memcpy(cpu->memory, mem, 2);
+		memcpy(cpu->memory->data, mem, 2);
 		while(cpu->PC < 4){
-			run_cpu(cpu);
+			run_test_cpu(cpu);
 		}
 		check_result(&result, cpu->H == 0xDD);
 		check_result(&result, cpu->PC == 0x04);
@@ -604,13 +641,13 @@ void ld_r_imm8(){
 
 	{   // LD L, imm8
 		Gameboy gmb = {};
-		init_gameboy(&gmb);
+		init_test_gameboy(&gmb);
 
 		CPU *cpu = &gmb.cpu;
 		u8 mem[2] = {0x2E, 0x25};
-		memcpy(cpu->memory, mem, 2);
+		memcpy(cpu->memory->data, mem, 2);
 		while(cpu->PC < 4){
-			run_cpu(cpu);
+			run_test_cpu(cpu);
 		}
 		check_result(&result, cpu->L == 0x25);
 		check_result(&result, cpu->PC == 0x04);
@@ -618,13 +655,13 @@ void ld_r_imm8(){
 
 	{   // LD A, imm8
 		Gameboy gmb = {};
-		init_gameboy(&gmb);
+		init_test_gameboy(&gmb);
 
 		CPU *cpu = &gmb.cpu;
 		u8 mem[2] = {0x3E, 0x5A};
-		memcpy(cpu->memory, mem, 2);
+		memcpy(cpu->memory->data, mem, 2);
 		while(cpu->PC < 4){
-			run_cpu(cpu);
+			run_test_cpu(cpu);
 		}
 		check_result(&result, cpu->A  == 0x5A);
 		check_result(&result, cpu->PC == 0x04);
@@ -638,14 +675,14 @@ void ld_memhl_imm8(){
 	bool result = true;
 	{   // LD [HL], imm8
 		Gameboy gmb = {};
-		init_gameboy(&gmb);
+		init_test_gameboy(&gmb);
 
 		CPU *cpu = &gmb.cpu;
 		u8 mem[2] = {0x36, 0x68};
-		cpu->HL = 0xB2A3;
-		memcpy(cpu->memory, mem, 2);
+		cpu->HL = 0xD2A3;
+		memcpy(cpu->memory->data, mem, 2);
 		while(cpu->PC < 5){
-			run_cpu(cpu);
+			run_test_cpu(cpu);
 		}
 		check_result(&result, read_memory(cpu->memory, cpu->HL)  == 0x68);
 		check_result(&result, cpu->PC == 0x05);
@@ -659,34 +696,34 @@ void rlca(){
 	bool result = true;
 	{   // RLCA.  With carry.
 		Gameboy gmb = {};
-		init_gameboy(&gmb);
+		init_test_gameboy(&gmb);
 
 		CPU *cpu = &gmb.cpu;
 		u8 mem[1] = {0x07};
-		memcpy(cpu->memory, mem, 1);
+		memcpy(cpu->memory->data, mem, 1);
 		cpu->A = 0x80;
 		while(cpu->PC < 2){
-			run_cpu(cpu);
+			run_test_cpu(cpu);
 		}
 		
-		check_result(&result, (cpu->flags & FLAG_CARRY));
+		check_result(&result, (get_flags(cpu) & FLAG_CARRY));
 		check_result(&result, cpu->A  == 0x01);
 		check_result(&result, cpu->PC == 0x02);
 	}
 
 	{   // RLCA.  With no carry.
 		Gameboy gmb = {};
-		init_gameboy(&gmb);
+		init_test_gameboy(&gmb);
 
 		CPU *cpu = &gmb.cpu;
 		u8 mem[1] = {0x07};
-		memcpy(cpu->memory, mem, 1);
+		memcpy(cpu->memory->data, mem, 1);
 		cpu->A = 0x40;
 		while(cpu->PC < 2){
-			run_cpu(cpu);
+			run_test_cpu(cpu);
 		}
 		
-		check_result(&result, !(cpu->flags & FLAG_CARRY));
+		check_result(&result, !(get_flags(cpu) & FLAG_CARRY));
 		check_result(&result, cpu->A  == 0x80);
 		check_result(&result, cpu->PC == 0x02);
 	}
@@ -699,34 +736,34 @@ void rrca(){
 	bool result = true;
 	{   // RRCA.  With carry.
 		Gameboy gmb = {};
-		init_gameboy(&gmb);
+		init_test_gameboy(&gmb);
 
 		CPU *cpu = &gmb.cpu;
 		u8 mem[1] = {0x0F};
-		memcpy(cpu->memory, mem, 1);
+		memcpy(cpu->memory->data, mem, 1);
 		cpu->A = 0x01;
 		while(cpu->PC < 2){
-			run_cpu(cpu);
+			run_test_cpu(cpu);
 		}
 		
-		check_result(&result, (cpu->flags & FLAG_CARRY));
+		check_result(&result, (get_flags(cpu) & FLAG_CARRY));
 		check_result(&result, cpu->A  == 0x80);
 		check_result(&result, cpu->PC == 0x02);
 	}
 
 	{   // RRCA.  With no carry.
 		Gameboy gmb = {};
-		init_gameboy(&gmb);
+		init_test_gameboy(&gmb);
 
 		CPU *cpu = &gmb.cpu;
 		u8 mem[1] = {0x0F};
-		memcpy(cpu->memory, mem, 1);
+		memcpy(cpu->memory->data, mem, 1);
 		cpu->A = 0x02;
 		while(cpu->PC < 2){
-			run_cpu(cpu);
+			run_test_cpu(cpu);
 		}
 		
-		check_result(&result, !(cpu->flags & FLAG_CARRY));
+		check_result(&result, !(get_flags(cpu) & FLAG_CARRY));
 		check_result(&result, cpu->A  == 0x01);
 		check_result(&result, cpu->PC == 0x02);
 	}
@@ -739,36 +776,36 @@ void rla(){
 	bool result = true;
 	{   // RLA.  Previously set carry. 
 		Gameboy gmb = {};
-		init_gameboy(&gmb);
+		init_test_gameboy(&gmb);
 
 		CPU *cpu = &gmb.cpu;
 		u8 mem[1] = {0x17};
-		memcpy(cpu->memory, mem, 1);
+		memcpy(cpu->memory->data, mem, 1);
 		
 		cpu->A = 0x40;
 		cpu->flags |= FLAG_CARRY;
 		while(cpu->PC < 2){
-			run_cpu(cpu);
+			run_test_cpu(cpu);
 		}
 		
-		check_result(&result, !(cpu->flags & FLAG_CARRY));
+		check_result(&result, !(get_flags(cpu) & FLAG_CARRY));
 		check_result(&result, cpu->A  == 0x81);
 		check_result(&result, cpu->PC == 0x02);
 	}
 
 	{   // RLA.  With no previously set carry.
 		Gameboy gmb = {};
-		init_gameboy(&gmb);
+		init_test_gameboy(&gmb);
 
 		CPU *cpu = &gmb.cpu;
 		u8 mem[1] = {0x17};
-		memcpy(cpu->memory, mem, 1);
+		memcpy(cpu->memory->data, mem, 1);
 		cpu->A = 0x80;
 		while(cpu->PC < 2){
-			run_cpu(cpu);
+			run_test_cpu(cpu);
 		}
 		
-		check_result(&result, (cpu->flags & FLAG_CARRY));
+		check_result(&result, (get_flags(cpu) & FLAG_CARRY));
 		check_result(&result, cpu->A  == 0x00);
 		check_result(&result, cpu->PC == 0x02);
 	}
@@ -781,36 +818,36 @@ void rra(){
 	bool result = true;
 	{   // RRA.  Previously set carry. 
 		Gameboy gmb = {};
-		init_gameboy(&gmb);
+		init_test_gameboy(&gmb);
 
 		CPU *cpu = &gmb.cpu;
 		u8 mem[1] = {0x1F};
-		memcpy(cpu->memory, mem, 1);
+		memcpy(cpu->memory->data, mem, 1);
 		
 		cpu->A = 0x02;
 		cpu->flags |= FLAG_CARRY;
 		while(cpu->PC < 2){
-			run_cpu(cpu);
+			run_test_cpu(cpu);
 		}
 		
-		check_result(&result, !(cpu->flags & FLAG_CARRY));
+		check_result(&result, !(get_flags(cpu) & FLAG_CARRY));
 		check_result(&result, cpu->A  == 0x81);
 		check_result(&result, cpu->PC == 0x02);
 	}
 
 	{   // RRA.  With no previously set carry.
 		Gameboy gmb = {};
-		init_gameboy(&gmb);
+		init_test_gameboy(&gmb);
 
 		CPU *cpu = &gmb.cpu;
 		u8 mem[1] = {0x1F};
-		memcpy(cpu->memory, mem, 1);
+		memcpy(cpu->memory->data, mem, 1);
 		cpu->A = 0x01;
 		while(cpu->PC < 2){
-			run_cpu(cpu);
+			run_test_cpu(cpu);
 		}
 		
-		check_result(&result, (cpu->flags & FLAG_CARRY));
+		check_result(&result, (get_flags(cpu) & FLAG_CARRY));
 		check_result(&result, cpu->A  == 0x00);
 		check_result(&result, cpu->PC == 0x02);
 	}
@@ -823,15 +860,15 @@ void daa(){
 	bool result = true;
 	{   
 		Gameboy gmb = {};
-		init_gameboy(&gmb);
+		init_test_gameboy(&gmb);
 
 		CPU *cpu = &gmb.cpu;
 		u8 mem[1] = {0x27};
-		memcpy(cpu->memory, mem, 1);
+		memcpy(cpu->memory->data, mem, 1);
 		
-		cpu->A = sum_and_set_flags(cpu, 0x38, 0x45, true, true);
+		cpu->A = sum_and_set_flags(cpu, 0x38, 0x45, false, true, true);
 		while(cpu->PC < 2){
-			run_cpu(cpu);
+			run_test_cpu(cpu);
 		}
 		
 		check_result(&result, cpu->A  == 0x83);
@@ -840,15 +877,15 @@ void daa(){
 
 	{   
 		Gameboy gmb = {};
-		init_gameboy(&gmb);
+		init_test_gameboy(&gmb);
 
 		CPU *cpu = &gmb.cpu;
 		u8 mem[1] = {0x27};
-		memcpy(cpu->memory, mem, 1);
+		memcpy(cpu->memory->data, mem, 1);
 		
-		cpu->A = sum_and_set_flags(cpu, 0x38, 0x41, true, true);
+		cpu->A = sum_and_set_flags(cpu, 0x38, 0x41, false, true, true);
 		while(cpu->PC < 2){
-			run_cpu(cpu);
+			run_test_cpu(cpu);
 		}
 		
 		check_result(&result, cpu->A  == 0x79);
@@ -857,15 +894,15 @@ void daa(){
 
 	{   
 		Gameboy gmb = {};
-		init_gameboy(&gmb);
+		init_test_gameboy(&gmb);
 
 		CPU *cpu = &gmb.cpu;
 		u8 mem[1] = {0x27};
-		memcpy(cpu->memory, mem, 1);
+		memcpy(cpu->memory->data, mem, 1);
 		
-		cpu->A = sum_and_set_flags(cpu, 0x24, 0x36, true, true);
+		cpu->A = sum_and_set_flags(cpu, 0x24, 0x36, false, true, true);
 		while(cpu->PC < 2){
-			run_cpu(cpu);
+			run_test_cpu(cpu);
 		}
 		
 		check_result(&result, cpu->A  == 0x60);
@@ -880,15 +917,15 @@ void cpl(){
 	bool result = true;
 	{   
 		Gameboy gmb = {};
-		init_gameboy(&gmb);
+		init_test_gameboy(&gmb);
 
 		CPU *cpu = &gmb.cpu;
 		u8 mem[1] = {0x2F};
-		memcpy(cpu->memory, mem, 1);
+		memcpy(cpu->memory->data, mem, 1);
 		
 		cpu->A = 0xAA;
 		while(cpu->PC < 2){
-			run_cpu(cpu);
+			run_test_cpu(cpu);
 		}
 		
 		check_result(&result, cpu->A  == 0x55);
@@ -903,19 +940,19 @@ void scf(){
 	bool result = true;
 	{   
 		Gameboy gmb = {};
-		init_gameboy(&gmb);
+		init_test_gameboy(&gmb);
 
 		CPU *cpu = &gmb.cpu;
 		u8 mem[1] = {0x37};
-		memcpy(cpu->memory, mem, 1);
+		memcpy(cpu->memory->data, mem, 1);
 		
 		while(cpu->PC < 2){
-			run_cpu(cpu);
+			run_test_cpu(cpu);
 		}
 		
-		check_result(&result, (cpu->flags & FLAG_CARRY));
-		check_result(&result, !(cpu->flags & FLAG_SUB));
-		check_result(&result, !(cpu->flags & FLAG_HALFCARRY));
+		check_result(&result, (get_flags(cpu) & FLAG_CARRY));
+		check_result(&result, !(get_flags(cpu) & FLAG_SUB));
+		check_result(&result, !(get_flags(cpu) & FLAG_HALFCARRY));
 		check_result(&result, cpu->PC == 0x02);
 	}
 
@@ -927,20 +964,20 @@ void ccf(){
 	bool result = true;
 	{   
 		Gameboy gmb = {};
-		init_gameboy(&gmb);
+		init_test_gameboy(&gmb);
 
 		CPU *cpu = &gmb.cpu;
 		u8 mem[1] = {0x3F};
-		memcpy(cpu->memory, mem, 1);
+		memcpy(cpu->memory->data, mem, 1);
 		set_flag(cpu, FLAG_CARRY);
-		u8 previous_carry = cpu->flags & FLAG_CARRY;
+		u8 previous_carry = get_flags(cpu) & FLAG_CARRY;
 		while(cpu->PC < 2){
-			run_cpu(cpu);
+			run_test_cpu(cpu);
 		}
 		
-		check_result(&result, (cpu->flags & FLAG_CARRY) == !(previous_carry));
-		check_result(&result, !(cpu->flags & FLAG_SUB));
-		check_result(&result, !(cpu->flags & FLAG_HALFCARRY));
+		check_result(&result, (get_flags(cpu) & FLAG_CARRY) == !(previous_carry));
+		check_result(&result, !(get_flags(cpu) & FLAG_SUB));
+		check_result(&result, !(get_flags(cpu) & FLAG_HALFCARRY));
 		check_result(&result, cpu->PC == 0x02);
 	}
 
@@ -952,30 +989,30 @@ void jr_imm8(){
 	bool result = true;
 	{   
 		Gameboy gmb = {};
-		init_gameboy(&gmb);
+		init_test_gameboy(&gmb);
 
 		CPU *cpu = &gmb.cpu;
 		u8 mem[2] = {0x18, 0x0A};
-		memcpy(cpu->memory, mem, 2);
-		while(cpu->PC < 4){
-			run_cpu(cpu);
-		}
+		memcpy(cpu->memory->data, mem, 2);
+		do{
+			run_test_cpu(cpu);
+		}while(!cpu->fetched_next_instruction);
 		
-		check_result(&result, cpu->PC == 0x0C);
+		check_result(&result, cpu->PC == 0x0D); // Jumped to 0x0C and fetched the opcode there.
 	}
 
 	{   
 		Gameboy gmb = {};
-		init_gameboy(&gmb);
+		init_test_gameboy(&gmb);
 
 		CPU *cpu = &gmb.cpu;
 		u8 mem[2] = {0x18, 0xFF};
-		memcpy(cpu->memory, mem, 2);
-		for(int i = 0; i < 3; i++){
-			run_cpu(cpu);
-		}
+		memcpy(cpu->memory->data, mem, 2);
+		do{
+			run_test_cpu(cpu);
+		}while(!cpu->fetched_next_instruction);
 		
-		check_result(&result, cpu->PC == 0x01);
+		check_result(&result, cpu->PC == 0x02); // Jumped to 0x01 and fetched the opcode there.
 	}
 
 	show_test_result(test_name, result);
@@ -986,15 +1023,15 @@ void ld_r8_r8(){
 	bool result = true;
 	{   
 		Gameboy gmb = {};
-		init_gameboy(&gmb);
+		init_test_gameboy(&gmb);
 
 		CPU *cpu = &gmb.cpu;
 		u8 mem[] = {0x43};
 		cpu->E = 0x45;
 		cpu->B = 0x00;
-		memcpy(cpu->memory, mem, 1);
+		memcpy(cpu->memory->data, mem, 1);
 		while(cpu->PC < 2){
-			run_cpu(cpu);
+			run_test_cpu(cpu);
 		}
 		
 		check_result(&result, cpu->B  == 0x45);
@@ -1003,15 +1040,15 @@ void ld_r8_r8(){
 
 	{   
 		Gameboy gmb = {};
-		init_gameboy(&gmb);
+		init_test_gameboy(&gmb);
 
 		CPU *cpu = &gmb.cpu;
 		u8 mem[] = {0x6F};
 		cpu->A = 0xBB;
 		cpu->L = 0x00;
-		memcpy(cpu->memory, mem, 1);
+		memcpy(cpu->memory->data, mem, 1);
 		while(cpu->PC < 2){
-			run_cpu(cpu);
+			run_test_cpu(cpu);
 		}
 		
 		check_result(&result, cpu->L  == 0xBB);
@@ -1020,15 +1057,15 @@ void ld_r8_r8(){
 
 	{   
 		Gameboy gmb = {};
-		init_gameboy(&gmb);
+		init_test_gameboy(&gmb);
 
 		CPU *cpu = &gmb.cpu;
 		u8 mem[] = {0x79};
 		cpu->A = 0x00;
 		cpu->C = 0x69;
-		memcpy(cpu->memory, mem, 1);
+		memcpy(cpu->memory->data, mem, 1);
 		while(cpu->PC < 2){
-			run_cpu(cpu);
+			run_test_cpu(cpu);
 		}
 		
 		check_result(&result, cpu->A  == 0x69);
@@ -1037,33 +1074,33 @@ void ld_r8_r8(){
 
 	{   
 		Gameboy gmb = {};
-		init_gameboy(&gmb);
+		init_test_gameboy(&gmb);
 
 		CPU *cpu = &gmb.cpu;
 		u8 mem[] = {0x74};
-		cpu->HL = 0x2000;
+		cpu->HL = 0xC000;
 		write_memory(cpu->memory, cpu->HL, 0x00);
-		memcpy(cpu->memory, mem, 1);
+		memcpy(cpu->memory->data, mem, 1);
 		while(cpu->PC < 3){
-			run_cpu(cpu);
+			run_test_cpu(cpu);
 		}
 		
-		check_result(&result, read_memory(cpu->memory, cpu->HL) == 0x20);
+		check_result(&result, read_memory(cpu->memory, cpu->HL) == 0xC0);
 		check_result(&result, cpu->PC == 0x03);
 	}
 
 	{   
 		Gameboy gmb = {};
-		init_gameboy(&gmb);
+		init_test_gameboy(&gmb);
 
 		CPU *cpu = &gmb.cpu;
 		u8 mem[] = {0x7E};
 		cpu->HL = 0x2000;
 		write_memory(cpu->memory, cpu->HL, 0x25);
 		cpu->A = 0x00;
-		memcpy(cpu->memory, mem, 1);
+		memcpy(cpu->memory->data, mem, 1);
 		while(cpu->PC < 3){
-			run_cpu(cpu);
+			run_test_cpu(cpu);
 		}
 		
 		check_result(&result, cpu->A == 0x25);
@@ -1078,54 +1115,54 @@ void add_r8(){
 	bool result = true;
 	{   
 		Gameboy gmb = {};
-		init_gameboy(&gmb);
+		init_test_gameboy(&gmb);
 
 		CPU *cpu = &gmb.cpu;
 		u8 mem[] = {0x80};
 		cpu->A = 0x0F;
 		cpu->B = 0x03;
-		memcpy(cpu->memory, mem, 1);
+		memcpy(cpu->memory->data, mem, 1);
 		while(cpu->PC < 2){
-			run_cpu(cpu);
+			run_test_cpu(cpu);
 		}
 		
-		check_result(&result, (cpu->flags & FLAG_HALFCARRY));
+		check_result(&result, (get_flags(cpu) & FLAG_HALFCARRY));
 		check_result(&result, cpu->A  == 0x12);
 		check_result(&result, cpu->PC == 0x02);
 	}
 
 	{   
 		Gameboy gmb = {};
-		init_gameboy(&gmb);
+		init_test_gameboy(&gmb);
 
 		CPU *cpu = &gmb.cpu;
 		u8 mem[] = {0x87};
 		cpu->A = 0xFF;
-		memcpy(cpu->memory, mem, 1);
+		memcpy(cpu->memory->data, mem, 1);
 		while(cpu->PC < 2){
-			run_cpu(cpu);
+			run_test_cpu(cpu);
 		}
 		
-		check_result(&result, (cpu->flags & FLAG_HALFCARRY|FLAG_CARRY));
+		check_result(&result, (get_flags(cpu) & FLAG_HALFCARRY|FLAG_CARRY));
 		check_result(&result, cpu->A  == 0xFE);
 		check_result(&result, cpu->PC == 0x02);
 	}
 
 	{   
 		Gameboy gmb = {};
-		init_gameboy(&gmb);
+		init_test_gameboy(&gmb);
 
 		CPU *cpu = &gmb.cpu;
 		u8 mem[] = {0x86};
-		memcpy(cpu->memory, mem, 1);
+		memcpy(cpu->memory->data, mem, 1);
 		cpu->A = 0xFF;
-		cpu->HL = 0xAAAA;
+		cpu->HL = 0xCAAA;
 		write_memory(cpu->memory, cpu->HL, 0x01);
 		while(cpu->PC < 3){
-			run_cpu(cpu);
+			run_test_cpu(cpu);
 		}
 		
-		check_result(&result, (cpu->flags & FLAG_HALFCARRY|FLAG_CARRY|FLAG_ZERO));
+		check_result(&result, (get_flags(cpu) & FLAG_HALFCARRY|FLAG_CARRY|FLAG_ZERO));
 		check_result(&result, cpu->A  == 0x00);
 		check_result(&result, cpu->PC == 0x03);
 	}
@@ -1138,57 +1175,57 @@ void adc_r8(){
 	bool result = true;
 	{   
 		Gameboy gmb = {};
-		init_gameboy(&gmb);
+		init_test_gameboy(&gmb);
 
 		CPU *cpu = &gmb.cpu;
 		u8 mem[] = {0x88};
-		memcpy(cpu->memory, mem, 1);
+		memcpy(cpu->memory->data, mem, 1);
 		cpu->A = 0x0F;
 		cpu->B = 0x03;
 		set_flag(cpu, FLAG_CARRY);
 		while(cpu->PC < 2){
-			run_cpu(cpu);
+			run_test_cpu(cpu);
 		}
 		
-		check_result(&result, (cpu->flags & FLAG_HALFCARRY));
+		check_result(&result, (get_flags(cpu) & FLAG_HALFCARRY));
 		check_result(&result, cpu->A  == 0x13);
 		check_result(&result, cpu->PC == 0x02);
 	}
 
 	{   
 		Gameboy gmb = {};
-		init_gameboy(&gmb);
+		init_test_gameboy(&gmb);
 
 		CPU *cpu = &gmb.cpu;
 		u8 mem[] = {0x8F};
-		memcpy(cpu->memory, mem, 1);
+		memcpy(cpu->memory->data, mem, 1);
 		cpu->A = 0xFF;
 		set_flag(cpu, FLAG_CARRY);
 		while(cpu->PC < 2){
-			run_cpu(cpu);
+			run_test_cpu(cpu);
 		}
 		
-		check_result(&result, (cpu->flags & FLAG_HALFCARRY|FLAG_CARRY));
+		check_result(&result, (get_flags(cpu) & FLAG_HALFCARRY|FLAG_CARRY));
 		check_result(&result, cpu->A  == 0xFF);
 		check_result(&result, cpu->PC == 0x02);
 	}
 
 	{   
 		Gameboy gmb = {};
-		init_gameboy(&gmb);
+		init_test_gameboy(&gmb);
 
 		CPU *cpu = &gmb.cpu;
 		u8 mem[] = {0x8E};
-		memcpy(cpu->memory, mem, 1);
+		memcpy(cpu->memory->data, mem, 1);
 		cpu->A = 0xFF;
-		cpu->HL = 0xAAAA;
+		cpu->HL = 0xCAAA;
 		write_memory(cpu->memory, cpu->HL, 0x01);
 		set_flag(cpu, FLAG_CARRY);
 		while(cpu->PC < 3){
-			run_cpu(cpu);
+			run_test_cpu(cpu);
 		}
 		
-		check_result(&result, (cpu->flags & FLAG_HALFCARRY|FLAG_CARRY|FLAG_ZERO));
+		check_result(&result, (get_flags(cpu) & FLAG_HALFCARRY|FLAG_CARRY|FLAG_ZERO));
 		check_result(&result, cpu->A  == 0x01);
 		check_result(&result, cpu->PC == 0x03);
 	}
@@ -1201,55 +1238,55 @@ void sub_r8(){
 	bool result = true;
 	{   
 		Gameboy gmb = {};
-		init_gameboy(&gmb);
+		init_test_gameboy(&gmb);
 
 		CPU *cpu = &gmb.cpu;
 		u8 mem[] = {0x90};
 		cpu->A = 0x00;
 		cpu->B = 0x01;
-		memcpy(cpu->memory, mem, 1);
+		memcpy(cpu->memory->data, mem, 1);
 		while(cpu->PC < 2){
-			run_cpu(cpu);
+			run_test_cpu(cpu);
 		}
 		
-		check_result(&result, (cpu->flags & FLAG_HALFCARRY|FLAG_CARRY|FLAG_SUB));
+		check_result(&result, (get_flags(cpu) & FLAG_HALFCARRY|FLAG_CARRY|FLAG_SUB));
 		check_result(&result, cpu->A  == 0xFF);
 		check_result(&result, cpu->PC == 0x02);
 	}
 
 	{   
 		Gameboy gmb = {};
-		init_gameboy(&gmb);
+		init_test_gameboy(&gmb);
 
 		CPU *cpu = &gmb.cpu;
 		u8 mem[] = {0x95};
 		cpu->A = 0x01;
 		cpu->L = 0x01;
-		memcpy(cpu->memory, mem, 1);
+		memcpy(cpu->memory->data, mem, 1);
 		while(cpu->PC < 2){
-			run_cpu(cpu);
+			run_test_cpu(cpu);
 		}
 		
-		check_result(&result, (cpu->flags & FLAG_ZERO|FLAG_SUB));
+		check_result(&result, (get_flags(cpu) & FLAG_ZERO|FLAG_SUB));
 		check_result(&result, cpu->A  == 0x00);
 		check_result(&result, cpu->PC == 0x02);
 	}
 
 	{   
 		Gameboy gmb = {};
-		init_gameboy(&gmb);
+		init_test_gameboy(&gmb);
 
 		CPU *cpu = &gmb.cpu;
 		u8 mem[] = {0x96};
-		memcpy(cpu->memory, mem, 1);
+		memcpy(cpu->memory->data, mem, 1);
 		cpu->A = 0xFF;
-		cpu->HL = 0xAAAA;
+		cpu->HL = 0xCAAA;
 		write_memory(cpu->memory, cpu->HL, 0x01);
 		while(cpu->PC < 3){
-			run_cpu(cpu);
+			run_test_cpu(cpu);
 		}
 		
-		check_result(&result, (cpu->flags & FLAG_SUB));
+		check_result(&result, (get_flags(cpu) & FLAG_SUB));
 		check_result(&result, cpu->A  == 0xFE);
 		check_result(&result, cpu->PC == 0x03);
 	}
@@ -1262,58 +1299,58 @@ void sbc_r8(){
 	bool result = true;
 	{   
 		Gameboy gmb = {};
-		init_gameboy(&gmb);
+		init_test_gameboy(&gmb);
 
 		CPU *cpu = &gmb.cpu;
 		u8 mem[] = {0x98};
-		memcpy(cpu->memory, mem, 1);
+		memcpy(cpu->memory->data, mem, 1);
 		cpu->A = 0x01;
 		cpu->B = 0x01;
 		set_flag(cpu, FLAG_CARRY);
 		while(cpu->PC < 2){
-			run_cpu(cpu);
+			run_test_cpu(cpu);
 		}
 		
-		check_result(&result, (cpu->flags & FLAG_HALFCARRY|FLAG_CARRY|FLAG_SUB));
+		check_result(&result, (get_flags(cpu) & FLAG_HALFCARRY|FLAG_CARRY|FLAG_SUB));
 		check_result(&result, cpu->A  == 0xFF);
 		check_result(&result, cpu->PC == 0x02);
 	}
 
 	{   
 		Gameboy gmb = {};
-		init_gameboy(&gmb);
+		init_test_gameboy(&gmb);
 
 		CPU *cpu = &gmb.cpu;
 		u8 mem[] = {0x9D};
-		memcpy(cpu->memory, mem, 1);
+		memcpy(cpu->memory->data, mem, 1);
 		cpu->A = 0x02;
 		cpu->L = 0x01;
 		set_flag(cpu, FLAG_CARRY);
 		while(cpu->PC < 2){
-			run_cpu(cpu);
+			run_test_cpu(cpu);
 		}
 		
-		check_result(&result, (cpu->flags & FLAG_ZERO|FLAG_SUB));
+		check_result(&result, (get_flags(cpu) & FLAG_ZERO|FLAG_SUB));
 		check_result(&result, cpu->A  == 0x00);
 		check_result(&result, cpu->PC == 0x02);
 	}
 
 	{   
 		Gameboy gmb = {};
-		init_gameboy(&gmb);
+		init_test_gameboy(&gmb);
 
 		CPU *cpu = &gmb.cpu;
 		u8 mem[] = {0x9E};
-		memcpy(cpu->memory, mem, 1);
+		memcpy(cpu->memory->data, mem, 1);
 		cpu->A = 0xFF;
-		cpu->HL = 0xAAAA;
+		cpu->HL = 0xCAAA;
 		write_memory(cpu->memory, cpu->HL, 0x01);
 		set_flag(cpu, FLAG_CARRY);
 		while(cpu->PC < 3){
-			run_cpu(cpu);
+			run_test_cpu(cpu);
 		}
 		
-		check_result(&result, (cpu->flags & FLAG_SUB));
+		check_result(&result, (get_flags(cpu) & FLAG_SUB));
 		check_result(&result, cpu->A  == 0xFD);
 		check_result(&result, cpu->PC == 0x03);
 	}
@@ -1326,54 +1363,54 @@ void and_r8(){
 	bool result = true;
 	{   
 		Gameboy gmb = {};
-		init_gameboy(&gmb);
+		init_test_gameboy(&gmb);
 
 		CPU *cpu = &gmb.cpu;
 		u8 mem[] = {0xA1};
-		memcpy(cpu->memory, mem, 1);
+		memcpy(cpu->memory->data, mem, 1);
 		cpu->A = 0xAA;
 		cpu->C = 0x22;
 		while(cpu->PC < 2){
-			run_cpu(cpu);
+			run_test_cpu(cpu);
 		}
 		
-		check_result(&result, (cpu->flags & FLAG_HALFCARRY));
+		check_result(&result, (get_flags(cpu) & FLAG_HALFCARRY));
 		check_result(&result, cpu->A  == 0x22);
 		check_result(&result, cpu->PC == 0x02);
 	}
 
 	{   
 		Gameboy gmb = {};
-		init_gameboy(&gmb);
+		init_test_gameboy(&gmb);
 
 		CPU *cpu = &gmb.cpu;
 		u8 mem[] = {0xA7};
-		memcpy(cpu->memory, mem, 1);
+		memcpy(cpu->memory->data, mem, 1);
 		cpu->A = 0x0A;
 		while(cpu->PC < 2){
-			run_cpu(cpu);
+			run_test_cpu(cpu);
 		}
 		
-		check_result(&result, (cpu->flags & FLAG_HALFCARRY));
+		check_result(&result, (get_flags(cpu) & FLAG_HALFCARRY));
 		check_result(&result, cpu->A  == 0x0A);
 		check_result(&result, cpu->PC == 0x02);
 	}
 
 	{   
 		Gameboy gmb = {};
-		init_gameboy(&gmb);
+		init_test_gameboy(&gmb);
 
 		CPU *cpu = &gmb.cpu;
 		u8 mem[] = {0xA6};
-		memcpy(cpu->memory, mem, 1);
+		memcpy(cpu->memory->data, mem, 1);
 		cpu->A = 0xAA;
-		cpu->HL = 0xABAB;
+		cpu->HL = 0xCBAB;
 		write_memory(cpu->memory, cpu->HL, 0x55);
 		while(cpu->PC < 3){
-			run_cpu(cpu);
+			run_test_cpu(cpu);
 		}
 		
-		check_result(&result, (cpu->flags & FLAG_HALFCARRY|FLAG_ZERO));
+		check_result(&result, (get_flags(cpu) & FLAG_HALFCARRY|FLAG_ZERO));
 		check_result(&result, cpu->A  == 0x00);
 		check_result(&result, cpu->PC == 0x03);
 	}
@@ -1386,54 +1423,54 @@ void xor_r8(){
 	bool result = true;
 	{   
 		Gameboy gmb = {};
-		init_gameboy(&gmb);
+		init_test_gameboy(&gmb);
 
 		CPU *cpu = &gmb.cpu;
 		u8 mem[] = {0xAA};
-		memcpy(cpu->memory, mem, 1);
+		memcpy(cpu->memory->data, mem, 1);
 		cpu->A = 0xAA;
 		cpu->D = 0x55;
 		while(cpu->PC < 2){
-			run_cpu(cpu);
+			run_test_cpu(cpu);
 		}
 		
-		check_result(&result, !(cpu->flags));
+		check_result(&result, !(get_flags(cpu)));
 		check_result(&result, cpu->A  == 0xFF);
 		check_result(&result, cpu->PC == 0x02);
 	}
 
 	{   
 		Gameboy gmb = {};
-		init_gameboy(&gmb);
+		init_test_gameboy(&gmb);
 
 		CPU *cpu = &gmb.cpu;
 		u8 mem[] = {0xAF};
-		memcpy(cpu->memory, mem, 1);
+		memcpy(cpu->memory->data, mem, 1);
 		cpu->A = 0x0A;
 		while(cpu->PC < 2){
-			run_cpu(cpu);
+			run_test_cpu(cpu);
 		}
 		
-		check_result(&result, (cpu->flags | FLAG_ZERO));
+		check_result(&result, (get_flags(cpu) | FLAG_ZERO));
 		check_result(&result, cpu->A  == 0x00);
 		check_result(&result, cpu->PC == 0x02);
 	}
 
 	{   
 		Gameboy gmb = {};
-		init_gameboy(&gmb);
+		init_test_gameboy(&gmb);
 
 		CPU *cpu = &gmb.cpu;
 		u8 mem[] = {0xAE};
-		memcpy(cpu->memory, mem, 1);
+		memcpy(cpu->memory->data, mem, 1);
 		cpu->A = 0x00;
-		cpu->HL = 0xABAB;
+		cpu->HL = 0xCBAB;
 		write_memory(cpu->memory, cpu->HL, 0x00);
 		while(cpu->PC < 3){
-			run_cpu(cpu);
+			run_test_cpu(cpu);
 		}
 		
-		check_result(&result, (cpu->flags & FLAG_ZERO));
+		check_result(&result, (get_flags(cpu) & FLAG_ZERO));
 		check_result(&result, cpu->A  == 0x00);
 		check_result(&result, cpu->PC == 0x03);
 	}
@@ -1446,54 +1483,54 @@ void or_r8(){
 	bool result = true;
 	{   
 		Gameboy gmb = {};
-		init_gameboy(&gmb);
+		init_test_gameboy(&gmb);
 
 		CPU *cpu = &gmb.cpu;
 		u8 mem[] = {0xB3};
-		memcpy(cpu->memory, mem, 1);
+		memcpy(cpu->memory->data, mem, 1);
 		cpu->A = 0x0A;
 		cpu->E = 0x55;
 		while(cpu->PC < 2){
-			run_cpu(cpu);
+			run_test_cpu(cpu);
 		}
 		
-		check_result(&result, !(cpu->flags));
+		check_result(&result, !(get_flags(cpu)));
 		check_result(&result, cpu->A  == 0x5F);
 		check_result(&result, cpu->PC == 0x02);
 	}
 
 	{   
 		Gameboy gmb = {};
-		init_gameboy(&gmb);
+		init_test_gameboy(&gmb);
 
 		CPU *cpu = &gmb.cpu;
 		u8 mem[] = {0xB7};
-		memcpy(cpu->memory, mem, 1);
+		memcpy(cpu->memory->data, mem, 1);
 		cpu->A = 0x0A;
 		while(cpu->PC < 2){
-			run_cpu(cpu);
+			run_test_cpu(cpu);
 		}
 		
-		check_result(&result, !(cpu->flags));
+		check_result(&result, !(get_flags(cpu)));
 		check_result(&result, cpu->A  == 0x0A);
 		check_result(&result, cpu->PC == 0x02);
 	}
 
 	{   
 		Gameboy gmb = {};
-		init_gameboy(&gmb);
+		init_test_gameboy(&gmb);
 
 		CPU *cpu = &gmb.cpu;
 		u8 mem[] = {0xAE};
-		memcpy(cpu->memory, mem, 1);
+		memcpy(cpu->memory->data, mem, 1);
 		cpu->A = 0x00;
-		cpu->HL = 0xABAB;
+		cpu->HL = 0xCBAB;
 		write_memory(cpu->memory, cpu->HL, 0x00);
 		while(cpu->PC < 3){
-			run_cpu(cpu);
+			run_test_cpu(cpu);
 		}
 		
-		check_result(&result, (cpu->flags & FLAG_ZERO));
+		check_result(&result, (get_flags(cpu) & FLAG_ZERO));
 		check_result(&result, cpu->A  == 0x00);
 		check_result(&result, cpu->PC == 0x03);
 	}
@@ -1506,55 +1543,55 @@ void cp_r8(){
 	bool result = true;
 	{   
 		Gameboy gmb = {};
-		init_gameboy(&gmb);
+		init_test_gameboy(&gmb);
 
 		CPU *cpu = &gmb.cpu;
 		u8 mem[] = {0xB8};
 		cpu->A = 0x00;
 		cpu->B = 0x01;
-		memcpy(cpu->memory, mem, 1);
+		memcpy(cpu->memory->data, mem, 1);
 		while(cpu->PC < 2){
-			run_cpu(cpu);
+			run_test_cpu(cpu);
 		}
 		
-		check_result(&result, (cpu->flags & FLAG_HALFCARRY|FLAG_CARRY|FLAG_SUB));
+		check_result(&result, (get_flags(cpu) & FLAG_HALFCARRY|FLAG_CARRY|FLAG_SUB));
 		check_result(&result, cpu->A  == 0x00);
 		check_result(&result, cpu->PC == 0x02);
 	}
 
 	{   
 		Gameboy gmb = {};
-		init_gameboy(&gmb);
+		init_test_gameboy(&gmb);
 
 		CPU *cpu = &gmb.cpu;
 		u8 mem[] = {0xBD};
 		cpu->A = 0x01;
 		cpu->L = 0x01;
-		memcpy(cpu->memory, mem, 1);
+		memcpy(cpu->memory->data, mem, 1);
 		while(cpu->PC < 2){
-			run_cpu(cpu);
+			run_test_cpu(cpu);
 		}
 		
-		check_result(&result, (cpu->flags & FLAG_ZERO|FLAG_SUB));
+		check_result(&result, (get_flags(cpu) & FLAG_ZERO|FLAG_SUB));
 		check_result(&result, cpu->A  == 0x01);
 		check_result(&result, cpu->PC == 0x02);
 	}
 
 	{   
 		Gameboy gmb = {};
-		init_gameboy(&gmb);
+		init_test_gameboy(&gmb);
 
 		CPU *cpu = &gmb.cpu;
 		u8 mem[] = {0xBE};
-		memcpy(cpu->memory, mem, 1);
+		memcpy(cpu->memory->data, mem, 1);
 		cpu->A = 0xFF;
-		cpu->HL = 0xAAAA;
+		cpu->HL = 0xCAAA;
 		write_memory(cpu->memory, cpu->HL, 0x01);
 		while(cpu->PC < 3){
-			run_cpu(cpu);
+			run_test_cpu(cpu);
 		}
 		
-		check_result(&result, (cpu->flags & FLAG_SUB));
+		check_result(&result, (get_flags(cpu) & FLAG_SUB));
 		check_result(&result, cpu->A  == 0xFF);
 		check_result(&result, cpu->PC == 0x03);
 	}
@@ -1567,34 +1604,34 @@ void add_imm8(){
 	bool result = true;
 	{   
 		Gameboy gmb = {};
-		init_gameboy(&gmb);
+		init_test_gameboy(&gmb);
 
 		CPU *cpu = &gmb.cpu;
 		u8 mem[] = {0xC6, 0x03};
 		cpu->A = 0x0F;
-		memcpy(cpu->memory, mem, 2);
+		memcpy(cpu->memory->data, mem, 2);
 		while(cpu->PC < 3){
-			run_cpu(cpu);
+			run_test_cpu(cpu);
 		}
 		
-		check_result(&result, (cpu->flags & FLAG_HALFCARRY));
+		check_result(&result, (get_flags(cpu) & FLAG_HALFCARRY));
 		check_result(&result, cpu->A  == 0x12);
 		check_result(&result, cpu->PC == 0x03);
 	}
 
 	{   
 		Gameboy gmb = {};
-		init_gameboy(&gmb);
+		init_test_gameboy(&gmb);
 
 		CPU *cpu = &gmb.cpu;
 		u8 mem[] = {0xC6, 0x02};
 		cpu->A = 0xFF;
-		memcpy(cpu->memory, mem, 2);
+		memcpy(cpu->memory->data, mem, 2);
 		while(cpu->PC < 3){
-			run_cpu(cpu);
+			run_test_cpu(cpu);
 		}
 		
-		check_result(&result, (cpu->flags & FLAG_HALFCARRY|FLAG_CARRY));
+		check_result(&result, (get_flags(cpu) & FLAG_HALFCARRY|FLAG_CARRY));
 		check_result(&result, cpu->A  == 0x01);
 		check_result(&result, cpu->PC == 0x03);
 	}
@@ -1607,37 +1644,37 @@ void adc_imm8(){
 	bool result = true;
 	{   
 		Gameboy gmb = {};
-		init_gameboy(&gmb);
+		init_test_gameboy(&gmb);
 
 		CPU *cpu = &gmb.cpu;
 		u8 mem[] = {0xCE, 0x03};
-		memcpy(cpu->memory, mem, 2);
+		memcpy(cpu->memory->data, mem, 2);
 		cpu->A = 0x0F;
 		cpu->B = 0x03;
 		set_flag(cpu, FLAG_CARRY);
 		while(cpu->PC < 3){
-			run_cpu(cpu);
+			run_test_cpu(cpu);
 		}
 		
-		check_result(&result, (cpu->flags & FLAG_HALFCARRY));
+		check_result(&result, (get_flags(cpu) & FLAG_HALFCARRY));
 		check_result(&result, cpu->A  == 0x13);
 		check_result(&result, cpu->PC == 0x03);
 	}
 
 	{   
 		Gameboy gmb = {};
-		init_gameboy(&gmb);
+		init_test_gameboy(&gmb);
 
 		CPU *cpu = &gmb.cpu;
 		u8 mem[] = {0xCE, 0xFF};
-		memcpy(cpu->memory, mem, 2);
+		memcpy(cpu->memory->data, mem, 2);
 		cpu->A = 0xFF;
 		set_flag(cpu, FLAG_CARRY);
 		while(cpu->PC < 3){
-			run_cpu(cpu);
+			run_test_cpu(cpu);
 		}
 		
-		check_result(&result, (cpu->flags & FLAG_HALFCARRY|FLAG_CARRY));
+		check_result(&result, (get_flags(cpu) & FLAG_HALFCARRY|FLAG_CARRY));
 		check_result(&result, cpu->A  == 0xFF);
 		check_result(&result, cpu->PC == 0x03);
 	}
@@ -1650,34 +1687,34 @@ void sub_imm8(){
 	bool result = true;
 	{   
 		Gameboy gmb = {};
-		init_gameboy(&gmb);
+		init_test_gameboy(&gmb);
 
 		CPU *cpu = &gmb.cpu;
 		u8 mem[] = {0xD6, 0x01};
-		memcpy(cpu->memory, mem, 2);
+		memcpy(cpu->memory->data, mem, 2);
 		cpu->A = 0x00;
 		while(cpu->PC < 3){
-			run_cpu(cpu);
+			run_test_cpu(cpu);
 		}
 		
-		check_result(&result, (cpu->flags & FLAG_HALFCARRY|FLAG_CARRY|FLAG_SUB));
+		check_result(&result, (get_flags(cpu) & FLAG_HALFCARRY|FLAG_CARRY|FLAG_SUB));
 		check_result(&result, cpu->A  == 0xFF);
 		check_result(&result, cpu->PC == 0x03);
 	}
 
 	{   
 		Gameboy gmb = {};
-		init_gameboy(&gmb);
+		init_test_gameboy(&gmb);
 
 		CPU *cpu = &gmb.cpu;
 		u8 mem[] = {0xD6, 0x01};
 		cpu->A = 0x01;
-		memcpy(cpu->memory, mem, 2);
+		memcpy(cpu->memory->data, mem, 2);
 		while(cpu->PC < 3){
-			run_cpu(cpu);
+			run_test_cpu(cpu);
 		}
 		
-		check_result(&result, (cpu->flags & FLAG_ZERO|FLAG_SUB));
+		check_result(&result, (get_flags(cpu) & FLAG_ZERO|FLAG_SUB));
 		check_result(&result, cpu->A  == 0x00);
 		check_result(&result, cpu->PC == 0x03);
 	}
@@ -1691,36 +1728,36 @@ void sbc_imm8(){
 	bool result = true;
 	{   
 		Gameboy gmb = {};
-		init_gameboy(&gmb);
+		init_test_gameboy(&gmb);
 
 		CPU *cpu = &gmb.cpu;
 		u8 mem[] = {0xDE, 0x01};
-		memcpy(cpu->memory, mem, 2);
+		memcpy(cpu->memory->data, mem, 2);
 		cpu->A = 0x01;
 		set_flag(cpu, FLAG_CARRY);
 		while(cpu->PC < 3){
-			run_cpu(cpu);
+			run_test_cpu(cpu);
 		}
 		
-		check_result(&result, (cpu->flags & FLAG_HALFCARRY|FLAG_CARRY|FLAG_SUB));
+		check_result(&result, (get_flags(cpu) & FLAG_HALFCARRY|FLAG_CARRY|FLAG_SUB));
 		check_result(&result, cpu->A  == 0xFF);
 		check_result(&result, cpu->PC == 0x03);
 	}
 
 	{   
 		Gameboy gmb = {};
-		init_gameboy(&gmb);
+		init_test_gameboy(&gmb);
 
 		CPU *cpu = &gmb.cpu;
 		u8 mem[] = {0xDE, 0x01};
-		memcpy(cpu->memory, mem, 2);
+		memcpy(cpu->memory->data, mem, 2);
 		cpu->A = 0x02;
 		set_flag(cpu, FLAG_CARRY);
 		while(cpu->PC < 3){
-			run_cpu(cpu);
+			run_test_cpu(cpu);
 		}
 		
-		check_result(&result, (cpu->flags & FLAG_ZERO|FLAG_SUB));
+		check_result(&result, (get_flags(cpu) & FLAG_ZERO|FLAG_SUB));
 		check_result(&result, cpu->A  == 0x00);
 		check_result(&result, cpu->PC == 0x03);
 	}
@@ -1733,34 +1770,34 @@ void and_imm8(){
 	bool result = true;
 	{   
 		Gameboy gmb = {};
-		init_gameboy(&gmb);
+		init_test_gameboy(&gmb);
 
 		CPU *cpu = &gmb.cpu;
 		u8 mem[] = {0xE6, 0x22};
-		memcpy(cpu->memory, mem, array_size(mem));
+		memcpy(cpu->memory->data, mem, array_size(mem));
 		cpu->A = 0xAA;
 		while(cpu->PC < 3){
-			run_cpu(cpu);
+			run_test_cpu(cpu);
 		}
 		
-		check_result(&result, (cpu->flags & FLAG_HALFCARRY));
+		check_result(&result, (get_flags(cpu) & FLAG_HALFCARRY));
 		check_result(&result, cpu->A  == 0x22);
 		check_result(&result, cpu->PC == 0x03);
 	}
 
 	{   
 		Gameboy gmb = {};
-		init_gameboy(&gmb);
+		init_test_gameboy(&gmb);
 
 		CPU *cpu = &gmb.cpu;
 		u8 mem[] = {0xE6, 0x55};
-		memcpy(cpu->memory, mem, array_size(mem));
+		memcpy(cpu->memory->data, mem, array_size(mem));
 		cpu->A = 0xAA;
 		while(cpu->PC < 3){
-			run_cpu(cpu);
+			run_test_cpu(cpu);
 		}
 		
-		check_result(&result, (cpu->flags & FLAG_HALFCARRY|FLAG_ZERO));
+		check_result(&result, (get_flags(cpu) & FLAG_HALFCARRY|FLAG_ZERO));
 		check_result(&result, cpu->A  == 0x00);
 		check_result(&result, cpu->PC == 0x03);
 	}
@@ -1773,34 +1810,34 @@ void xor_imm8(){
 	bool result = true;
 	{   
 		Gameboy gmb = {};
-		init_gameboy(&gmb);
+		init_test_gameboy(&gmb);
 
 		CPU *cpu = &gmb.cpu;
 		u8 mem[] = {0xEE, 0x55};
-		memcpy(cpu->memory, mem, array_size(mem));
+		memcpy(cpu->memory->data, mem, array_size(mem));
 		cpu->A = 0xAA;
 		while(cpu->PC < 3){
-			run_cpu(cpu);
+			run_test_cpu(cpu);
 		}
 		
-		check_result(&result, !(cpu->flags));
+		check_result(&result, !(get_flags(cpu)));
 		check_result(&result, cpu->A  == 0xFF);
 		check_result(&result, cpu->PC == 0x03);
 	}
 
 	{   
 		Gameboy gmb = {};
-		init_gameboy(&gmb);
+		init_test_gameboy(&gmb);
 
 		CPU *cpu = &gmb.cpu;
 		u8 mem[] = {0xEE, 0x00};
-		memcpy(cpu->memory, mem, array_size(mem));
+		memcpy(cpu->memory->data, mem, array_size(mem));
 		cpu->A = 0x00;
 		while(cpu->PC < 3){
-			run_cpu(cpu);
+			run_test_cpu(cpu);
 		}
 		
-		check_result(&result, (cpu->flags & FLAG_ZERO));
+		check_result(&result, (get_flags(cpu) & FLAG_ZERO));
 		check_result(&result, cpu->A  == 0x00);
 		check_result(&result, cpu->PC == 0x03);
 	}
@@ -1813,34 +1850,34 @@ void or_imm8(){
 	bool result = true;
 	{   
 		Gameboy gmb = {};
-		init_gameboy(&gmb);
+		init_test_gameboy(&gmb);
 
 		CPU *cpu = &gmb.cpu;
 		u8 mem[] = {0xF6, 0x55};
-		memcpy(cpu->memory, mem, array_size(mem));
+		memcpy(cpu->memory->data, mem, array_size(mem));
 		cpu->A = 0x0A;
 		while(cpu->PC < 3){
-			run_cpu(cpu);
+			run_test_cpu(cpu);
 		}
 		
-		check_result(&result, !(cpu->flags));
+		check_result(&result, !(get_flags(cpu)));
 		check_result(&result, cpu->A  == 0x5F);
 		check_result(&result, cpu->PC == 0x03);
 	}
 
 	{   
 		Gameboy gmb = {};
-		init_gameboy(&gmb);
+		init_test_gameboy(&gmb);
 
 		CPU *cpu = &gmb.cpu;
 		u8 mem[] = {0xF6, 0x00};
-		memcpy(cpu->memory, mem, array_size(mem));
+		memcpy(cpu->memory->data, mem, array_size(mem));
 		cpu->A = 0x00;
 		while(cpu->PC < 3){
-			run_cpu(cpu);
+			run_test_cpu(cpu);
 		}
 		
-		check_result(&result, (cpu->flags & FLAG_ZERO));
+		check_result(&result, (get_flags(cpu) & FLAG_ZERO));
 		check_result(&result, cpu->A  == 0x00);
 		check_result(&result, cpu->PC == 0x03);
 	}
@@ -1853,51 +1890,51 @@ void cp_imm8(){
 	bool result = true;
 	{   
 		Gameboy gmb = {};
-		init_gameboy(&gmb);
+		init_test_gameboy(&gmb);
 
 		CPU *cpu = &gmb.cpu;
 		u8 mem[] = {0xFE, 0x01};
-		memcpy(cpu->memory, mem, array_size(mem));
+		memcpy(cpu->memory->data, mem, array_size(mem));
 		cpu->A = 0x00;
 		while(cpu->PC < 3){
-			run_cpu(cpu);
+			run_test_cpu(cpu);
 		}
 		
-		check_result(&result, (cpu->flags & FLAG_HALFCARRY|FLAG_CARRY|FLAG_SUB));
+		check_result(&result, (get_flags(cpu) & FLAG_HALFCARRY|FLAG_CARRY|FLAG_SUB));
 		check_result(&result, cpu->A  == 0x00);
 		check_result(&result, cpu->PC == 0x03);
 	}
 
 	{   
 		Gameboy gmb = {};
-		init_gameboy(&gmb);
+		init_test_gameboy(&gmb);
 
 		CPU *cpu = &gmb.cpu;
 		u8 mem[] = {0xFE, 0x01};
-		memcpy(cpu->memory, mem, array_size(mem));
+		memcpy(cpu->memory->data, mem, array_size(mem));
 		cpu->A = 0x01;
 		while(cpu->PC < 3){
-			run_cpu(cpu);
+			run_test_cpu(cpu);
 		}
 		
-		check_result(&result, (cpu->flags & FLAG_ZERO|FLAG_SUB));
+		check_result(&result, (get_flags(cpu) & FLAG_ZERO|FLAG_SUB));
 		check_result(&result, cpu->A  == 0x01);
 		check_result(&result, cpu->PC == 0x03);
 	}
 
 	{   
 		Gameboy gmb = {};
-		init_gameboy(&gmb);
+		init_test_gameboy(&gmb);
 
 		CPU *cpu = &gmb.cpu;
 		u8 mem[] = {0xFE, 0x01};
-		memcpy(cpu->memory, mem, array_size(mem));
+		memcpy(cpu->memory->data, mem, array_size(mem));
 		cpu->A = 0xFF;
 		while(cpu->PC < 3){
-			run_cpu(cpu);
+			run_test_cpu(cpu);
 		}
 		
-		check_result(&result, (cpu->flags & FLAG_SUB));
+		check_result(&result, (get_flags(cpu) & FLAG_SUB));
 		check_result(&result, cpu->A  == 0xFF);
 		check_result(&result, cpu->PC == 0x03);
 	}
@@ -1910,11 +1947,11 @@ void ret_cc(){
 	bool result = true;
 	{   // RET NZ
 		Gameboy gmb = {};
-		init_gameboy(&gmb);
+		init_test_gameboy(&gmb);
 
 		CPU *cpu = &gmb.cpu;
 		u8 mem[] = {0xC0};
-		memcpy(cpu->memory, mem, array_size(mem));
+		memcpy(cpu->memory->data, mem, array_size(mem));
 		unset_flag(cpu, FLAG_ZERO);
 
 		cpu->SP = 0xFFFF;
@@ -1922,7 +1959,7 @@ void ret_cc(){
 		push_stack(cpu, 0x50);
 
 		while(cpu->PC != 0x2051){
-			run_cpu(cpu);
+			run_test_cpu(cpu);
 		}
 		
 		check_result(&result, cpu->PC == 0x2051);
@@ -1930,11 +1967,11 @@ void ret_cc(){
 
 	{   // RET Z
 		Gameboy gmb = {};
-		init_gameboy(&gmb);
+		init_test_gameboy(&gmb);
 
 		CPU *cpu = &gmb.cpu;
 		u8 mem[] = {0xC8};
-		memcpy(cpu->memory, mem, array_size(mem));
+		memcpy(cpu->memory->data, mem, array_size(mem));
 		unset_flag(cpu, FLAG_ZERO);
 
 		cpu->SP = 0xFFFF;
@@ -1942,7 +1979,7 @@ void ret_cc(){
 		push_stack(cpu, 0x50);
 
 		while(cpu->PC < 2){
-			run_cpu(cpu);
+			run_test_cpu(cpu);
 		}
 		
 		check_result(&result, cpu->PC == 0x02);
@@ -1950,11 +1987,11 @@ void ret_cc(){
 
 	{   // RET NC
 		Gameboy gmb = {};
-		init_gameboy(&gmb);
+		init_test_gameboy(&gmb);
 
 		CPU *cpu = &gmb.cpu;
 		u8 mem[] = {0xD0};
-		memcpy(cpu->memory, mem, array_size(mem));
+		memcpy(cpu->memory->data, mem, array_size(mem));
 		set_flag(cpu, FLAG_CARRY);
 
 		cpu->SP = 0xFFFF;
@@ -1962,7 +1999,7 @@ void ret_cc(){
 		push_stack(cpu, 0x50);
 
 		while(cpu->PC < 0x02){
-			run_cpu(cpu);
+			run_test_cpu(cpu);
 		}
 		
 		check_result(&result, cpu->PC == 0x02);
@@ -1970,11 +2007,11 @@ void ret_cc(){
 
 	{   // RET C
 		Gameboy gmb = {};
-		init_gameboy(&gmb);
+		init_test_gameboy(&gmb);
 
 		CPU *cpu = &gmb.cpu;
 		u8 mem[] = {0xD8};
-		memcpy(cpu->memory, mem, array_size(mem));
+		memcpy(cpu->memory->data, mem, array_size(mem));
 		set_flag(cpu, FLAG_CARRY);
 
 		cpu->SP = 0xFFFF;
@@ -1982,7 +2019,7 @@ void ret_cc(){
 		push_stack(cpu, 0x50);
 
 		while(cpu->PC != 0x2051){
-			run_cpu(cpu);
+			run_test_cpu(cpu);
 		}
 		
 		check_result(&result, cpu->PC == 0x2051);
@@ -1996,18 +2033,18 @@ void pop(){
 	bool result = true;
 	{   // POP BC
 		Gameboy gmb = {};
-		init_gameboy(&gmb);
+		init_test_gameboy(&gmb);
 
 		CPU *cpu = &gmb.cpu;
 		u8 mem[] = {0xC1};
-		memcpy(cpu->memory, mem, array_size(mem));
+		memcpy(cpu->memory->data, mem, array_size(mem));
 
 		cpu->SP = 0xFFFF;
 		push_stack(cpu, 0x20);
 		push_stack(cpu, 0x50);
 
 		while(cpu->PC < 4){
-			run_cpu(cpu);
+			run_test_cpu(cpu);
 		}
 		check_result(&result, cpu->BC == 0x2050);
 		check_result(&result, cpu->PC == 0x04);
@@ -2015,20 +2052,20 @@ void pop(){
 
 	{   // POP AF
 		Gameboy gmb = {};
-		init_gameboy(&gmb);
+		init_test_gameboy(&gmb);
 
 		CPU *cpu = &gmb.cpu;
 		u8 mem[] = {0xF1};
-		memcpy(cpu->memory, mem, array_size(mem));
+		memcpy(cpu->memory->data, mem, array_size(mem));
 
 		cpu->SP = 0xFFFF;
 		push_stack(cpu, 0x33);
 		push_stack(cpu, 0xFF);
 
 		while(cpu->PC < 4){
-			run_cpu(cpu);
+			run_test_cpu(cpu);
 		}
-		check_result(&result, cpu->AF == 0x33FF);
+		check_result(&result, cpu->AF == 0x33F0);
 		check_result(&result, cpu->PC == 0x04);
 	}
 
@@ -2040,17 +2077,17 @@ void push(){
 	bool result = true;
 	{   // PUSH DE
 		Gameboy gmb = {};
-		init_gameboy(&gmb);
+		init_test_gameboy(&gmb);
 
 		CPU *cpu = &gmb.cpu;
 		u8 mem[] = {0xD5};
-		memcpy(cpu->memory, mem, array_size(mem));
+		memcpy(cpu->memory->data, mem, array_size(mem));
 
 		cpu->SP = 0xFFFF;
 		cpu->DE = 0x20AA;
 
 		while(cpu->PC < 4){
-			run_cpu(cpu);
+			run_test_cpu(cpu);
 		}
 		check_result(&result, pop_stack(cpu) == 0xAA);
 		check_result(&result, pop_stack(cpu) == 0x20);
@@ -2059,17 +2096,17 @@ void push(){
 
 	{   // PUSH HL
 		Gameboy gmb = {};
-		init_gameboy(&gmb);
+		init_test_gameboy(&gmb);
 
 		CPU *cpu = &gmb.cpu;
 		u8 mem[] = {0xE5};
-		memcpy(cpu->memory, mem, array_size(mem));
+		memcpy(cpu->memory->data, mem, array_size(mem));
 
 		cpu->SP = 0xFFFF;
 		cpu->HL = 0x4AB5;
 
 		while(cpu->PC < 4){
-			run_cpu(cpu);
+			run_test_cpu(cpu);
 		}
 		check_result(&result, pop_stack(cpu) == 0xB5);
 		check_result(&result, pop_stack(cpu) == 0x4A);
@@ -2084,17 +2121,17 @@ void ldh_c_a(){
 	bool result = true;
 	{   
 		Gameboy gmb = {};
-		init_gameboy(&gmb);
+		init_test_gameboy(&gmb);
 
 		CPU *cpu = &gmb.cpu;
 		u8 mem[] = {0xE2};
-		memcpy(cpu->memory, mem, array_size(mem));
+		memcpy(cpu->memory->data, mem, array_size(mem));
 
 		cpu->A = 0x6;
 		cpu->C = 0x80;
 
 		while(cpu->PC < 2){
-			run_cpu(cpu);
+			run_test_cpu(cpu);
 		}
 		check_result(&result, read_memory(cpu->memory, 0xFF00 + cpu->C) == 0x06);
 		check_result(&result, cpu->PC == 0x02);
@@ -2108,16 +2145,16 @@ void ldh_imm8_a(){
 	bool result = true;
 	{   
 		Gameboy gmb = {};
-		init_gameboy(&gmb);
+		init_test_gameboy(&gmb);
 
 		CPU *cpu = &gmb.cpu;
 		u8 mem[] = {0xE0, 0x50};
-		memcpy(cpu->memory, mem, array_size(mem));
+		memcpy(cpu->memory->data, mem, array_size(mem));
 
 		cpu->A = 0xAA;
 
 		while(cpu->PC < 3){
-			run_cpu(cpu);
+			run_test_cpu(cpu);
 		}
 		check_result(&result, read_memory(cpu->memory, 0xFF00 + 0x50) == 0xAA);
 		check_result(&result, cpu->PC == 0x03);
@@ -2131,16 +2168,16 @@ void ldh_imm16_a(){
 	bool result = true;
 	{   
 		Gameboy gmb = {};
-		init_gameboy(&gmb);
+		init_test_gameboy(&gmb);
 
 		CPU *cpu = &gmb.cpu;
 		u8 mem[] = {0xEA, 0x80, 0xFF};
-		memcpy(cpu->memory, mem, array_size(mem));
+		memcpy(cpu->memory->data, mem, array_size(mem));
 
 		cpu->A = 0xEF;
 
 		while(cpu->PC < 4){
-			run_cpu(cpu);
+			run_test_cpu(cpu);
 		}
 		check_result(&result, read_memory(cpu->memory, 0xFF80) == 0xEF);
 		check_result(&result, cpu->PC == 0x04);
@@ -2154,11 +2191,11 @@ void ldh_a_c(){
 	bool result = true;
 	{   
 		Gameboy gmb = {};
-		init_gameboy(&gmb);
+		init_test_gameboy(&gmb);
 
 		CPU *cpu = &gmb.cpu;
 		u8 mem[] = {0xF2};
-		memcpy(cpu->memory, mem, array_size(mem));
+		memcpy(cpu->memory->data, mem, array_size(mem));
 
 		cpu->A = 0x6;
 		cpu->C = 0x80;
@@ -2166,7 +2203,7 @@ void ldh_a_c(){
 		write_memory(cpu->memory, 0xFF00 + cpu->C, 0x2A);
 
 		while(cpu->PC < 2){
-			run_cpu(cpu);
+			run_test_cpu(cpu);
 		}
 		check_result(&result, cpu->A == 0x2A);
 		check_result(&result, cpu->PC == 0x02);
@@ -2180,17 +2217,17 @@ void ldh_a_imm8(){
 	bool result = true;
 	{   
 		Gameboy gmb = {};
-		init_gameboy(&gmb);
+		init_test_gameboy(&gmb);
 
 		CPU *cpu = &gmb.cpu;
 		u8 mem[] = {0xF0, 0x50};
-		memcpy(cpu->memory, mem, array_size(mem));
+		memcpy(cpu->memory->data, mem, array_size(mem));
 
 		cpu->A = 0xAA;
 		write_memory(cpu->memory, 0xFF00 + 0x50, 0x56);
 
 		while(cpu->PC < 3){
-			run_cpu(cpu);
+			run_test_cpu(cpu);
 		}
 		check_result(&result, cpu->A == 0x56);
 		check_result(&result, cpu->PC == 0x03);
@@ -2204,17 +2241,17 @@ void ldh_a_imm16(){
 	bool result = true;
 	{   
 		Gameboy gmb = {};
-		init_gameboy(&gmb);
+		init_test_gameboy(&gmb);
 
 		CPU *cpu = &gmb.cpu;
 		u8 mem[] = {0xFA, 0x80, 0xFF};
-		memcpy(cpu->memory, mem, array_size(mem));
+		memcpy(cpu->memory->data, mem, array_size(mem));
 
 		cpu->A = 0xEF;
 		write_memory(cpu->memory, 0xFF80, 0x66);
 
 		while(cpu->PC < 4){
-			run_cpu(cpu);
+			run_test_cpu(cpu);
 		}
 		check_result(&result, cpu->A == 0x66);
 		check_result(&result, cpu->PC == 0x04);
@@ -2228,15 +2265,15 @@ void add_sp_imm8(){
 	bool result = true;
 	{   
 		Gameboy gmb = {};
-		init_gameboy(&gmb);
+		init_test_gameboy(&gmb);
 
 		CPU *cpu = &gmb.cpu;
 		u8 mem[2] = {0xE8, 0xFF};
-		memcpy(cpu->memory, mem, 2);
+		memcpy(cpu->memory->data, mem, 2);
 
 		cpu->SP = 0xFFFF;
 		while(cpu->PC < 4){
-			run_cpu(cpu);
+			run_test_cpu(cpu);
 		}
 		
 		check_result(&result, cpu->SP == 0xFFFE);
@@ -2245,15 +2282,15 @@ void add_sp_imm8(){
 
 	{   
 		Gameboy gmb = {};
-		init_gameboy(&gmb);
+		init_test_gameboy(&gmb);
 
 		CPU *cpu = &gmb.cpu;
 		u8 mem[2] = {0xE8, 0x0A};
-		memcpy(cpu->memory, mem, 2);
+		memcpy(cpu->memory->data, mem, 2);
 
 		cpu->SP = 0xFFFF;
 		while(cpu->PC < 4){
-			run_cpu(cpu);
+			run_test_cpu(cpu);
 		}
 		
 		check_result(&result, cpu->SP == 0x0009);
@@ -2268,15 +2305,15 @@ void ld_hl_spe(){
 	bool result = true;
 	{   
 		Gameboy gmb = {};
-		init_gameboy(&gmb);
+		init_test_gameboy(&gmb);
 
 		CPU *cpu = &gmb.cpu;
 		u8 mem[2] = {0xF8, 0x20};
-		memcpy(cpu->memory, mem, 2);
+		memcpy(cpu->memory->data, mem, 2);
 
 		cpu->SP = 0xFF00;
 		while(cpu->PC < 3){
-			run_cpu(cpu);
+			run_test_cpu(cpu);
 		}
 		
 		check_result(&result, cpu->HL == 0xFF20);
@@ -2285,15 +2322,15 @@ void ld_hl_spe(){
 	
 	{   
 		Gameboy gmb = {};
-		init_gameboy(&gmb);
+		init_test_gameboy(&gmb);
 
 		CPU *cpu = &gmb.cpu;
 		u8 mem[2] = {0xF8, 0xFF};
-		memcpy(cpu->memory, mem, 2);
+		memcpy(cpu->memory->data, mem, 2);
 
 		cpu->SP = 0xFFFF;
 		while(cpu->PC < 3){
-			run_cpu(cpu);
+			run_test_cpu(cpu);
 		}
 		
 		check_result(&result, cpu->HL == 0xFFFE);
@@ -2308,56 +2345,56 @@ void cb_rlc_r(){
 	bool result = true;
 	{   
 		Gameboy gmb = {};
-		init_gameboy(&gmb);
+		init_test_gameboy(&gmb);
 
 		CPU *cpu = &gmb.cpu;
 		u8 mem[2] = {0xCB, 0x01};
-		memcpy(cpu->memory, mem, 2);
+		memcpy(cpu->memory->data, mem, 2);
 
 		cpu->C = 0x04;
 		while(cpu->PC < 3){
-			run_cpu(cpu);
+			run_test_cpu(cpu);
 		}
 		
 		check_result(&result, cpu->C == 0x08);
-		check_result(&result, !(cpu->flags & FLAG_ZERO));
+		check_result(&result, !(get_flags(cpu) & FLAG_ZERO));
 		check_result(&result, cpu->PC == 0x03);
 	}
 	
 	{   
 		Gameboy gmb = {};
-		init_gameboy(&gmb);
+		init_test_gameboy(&gmb);
 
 		CPU *cpu = &gmb.cpu;
 		u8 mem[2] = {0xCB, 0x02};
-		memcpy(cpu->memory, mem, 2);
+		memcpy(cpu->memory->data, mem, 2);
 
 		cpu->D = 0x80;
 		while(cpu->PC < 3){
-			run_cpu(cpu);
+			run_test_cpu(cpu);
 		}
 		
 		check_result(&result, cpu->D == 0x01);
-		check_result(&result, !(cpu->flags & FLAG_ZERO));
+		check_result(&result, !(get_flags(cpu) & FLAG_ZERO));
 		check_result(&result, cpu->PC == 0x03);
 	}
 
 	{   
 		Gameboy gmb = {};
-		init_gameboy(&gmb);
+		init_test_gameboy(&gmb);
 
 		CPU *cpu = &gmb.cpu;
 		u8 mem[2] = {0xCB, 0x06};
-		memcpy(cpu->memory, mem, 2);
+		memcpy(cpu->memory->data, mem, 2);
 
 		cpu->HL = 0xFF05;
 		write_memory(cpu->memory, cpu->HL, 0x02);
 		while(cpu->PC < 3){
-			run_cpu(cpu);
+			run_test_cpu(cpu);
 		}
 		
 		check_result(&result, read_memory(cpu->memory, cpu->HL) == 0x04);
-		check_result(&result, !(cpu->flags & FLAG_ZERO));
+		check_result(&result, !(get_flags(cpu) & FLAG_ZERO));
 		check_result(&result, cpu->PC == 0x03);
 	}
 
@@ -2369,56 +2406,56 @@ void cb_rrc_r(){
 	bool result = true;
 	{   
 		Gameboy gmb = {};
-		init_gameboy(&gmb);
+		init_test_gameboy(&gmb);
 
 		CPU *cpu = &gmb.cpu;
 		u8 mem[2] = {0xCB, 0x08};
-		memcpy(cpu->memory, mem, 2);
+		memcpy(cpu->memory->data, mem, 2);
 
 		cpu->B = 0x04;
 		while(cpu->PC < 3){
-			run_cpu(cpu);
+			run_test_cpu(cpu);
 		}
 		
 		check_result(&result, cpu->B == 0x02);
-		check_result(&result, !(cpu->flags & FLAG_ZERO));
+		check_result(&result, !(get_flags(cpu) & FLAG_ZERO));
 		check_result(&result, cpu->PC == 0x03);
 	}
 	
 	{   
 		Gameboy gmb = {};
-		init_gameboy(&gmb);
+		init_test_gameboy(&gmb);
 
 		CPU *cpu = &gmb.cpu;
 		u8 mem[2] = {0xCB, 0x0F};
-		memcpy(cpu->memory, mem, 2);
+		memcpy(cpu->memory->data, mem, 2);
 
 		cpu->A = 0x01;
 		while(cpu->PC < 3){
-			run_cpu(cpu);
+			run_test_cpu(cpu);
 		}
 		
 		check_result(&result, cpu->A == 0x80);
-		check_result(&result, !(cpu->flags & FLAG_ZERO));
+		check_result(&result, !(get_flags(cpu) & FLAG_ZERO));
 		check_result(&result, cpu->PC == 0x03);
 	}
 
 	{   
 		Gameboy gmb = {};
-		init_gameboy(&gmb);
+		init_test_gameboy(&gmb);
 
 		CPU *cpu = &gmb.cpu;
 		u8 mem[2] = {0xCB, 0x0E};
-		memcpy(cpu->memory, mem, 2);
+		memcpy(cpu->memory->data, mem, 2);
 
 		cpu->HL = 0xFF05;
 		write_memory(cpu->memory, cpu->HL, 0x02);
 		while(cpu->PC < 3){
-			run_cpu(cpu);
+			run_test_cpu(cpu);
 		}
 		
 		check_result(&result, read_memory(cpu->memory, cpu->HL) == 0x01);
-		check_result(&result, !(cpu->flags & FLAG_ZERO));
+		check_result(&result, !(get_flags(cpu) & FLAG_ZERO));
 		check_result(&result, cpu->PC == 0x03);
 	}
 
@@ -2430,59 +2467,59 @@ void cb_rl_r(){
 	bool result = true;
 	{   
 		Gameboy gmb = {};
-		init_gameboy(&gmb);
+		init_test_gameboy(&gmb);
 
 		CPU *cpu = &gmb.cpu;
 		u8 mem[2] = {0xCB, 0x13};
-		memcpy(cpu->memory, mem, 2);
+		memcpy(cpu->memory->data, mem, 2);
 
 		set_flag(cpu , FLAG_CARRY);
 		cpu->E = 0x04;
 		while(cpu->PC < 3){
-			run_cpu(cpu);
+			run_test_cpu(cpu);
 		}
 		
 		check_result(&result, cpu->E == 0x09);
-		check_result(&result, !(cpu->flags & FLAG_ZERO));
+		check_result(&result, !(get_flags(cpu) & FLAG_ZERO));
 		check_result(&result, cpu->PC == 0x03);
 	}
 	
 	{   
 		Gameboy gmb = {};
-		init_gameboy(&gmb);
+		init_test_gameboy(&gmb);
 
 		CPU *cpu = &gmb.cpu;
 		u8 mem[2] = {0xCB, 0x15};
-		memcpy(cpu->memory, mem, 2);
+		memcpy(cpu->memory->data, mem, 2);
 
 		set_flag(cpu , FLAG_CARRY);
 		cpu->L = 0x80;
 		while(cpu->PC < 3){
-			run_cpu(cpu);
+			run_test_cpu(cpu);
 		}
 		
 		check_result(&result, cpu->L == 0x01);
-		check_result(&result, (cpu->flags & FLAG_CARRY));
+		check_result(&result, (get_flags(cpu) & FLAG_CARRY));
 		check_result(&result, cpu->PC == 0x03);
 	}
 
 	{   
 		Gameboy gmb = {};
-		init_gameboy(&gmb);
+		init_test_gameboy(&gmb);
 
 		CPU *cpu = &gmb.cpu;
 		u8 mem[2] = {0xCB, 0x16};
-		memcpy(cpu->memory, mem, 2);
+		memcpy(cpu->memory->data, mem, 2);
 
 		set_flag(cpu , FLAG_CARRY);
 		cpu->HL = 0xFF05;
 		write_memory(cpu->memory, cpu->HL, 0x02);
 		while(cpu->PC < 3){
-			run_cpu(cpu);
+			run_test_cpu(cpu);
 		}
 		
 		check_result(&result, read_memory(cpu->memory, cpu->HL) == 0x05);
-		check_result(&result, !(cpu->flags & FLAG_ZERO));
+		check_result(&result, !(get_flags(cpu) & FLAG_ZERO));
 		check_result(&result, cpu->PC == 0x03);
 	}
 
@@ -2494,59 +2531,59 @@ void cb_rr_r(){
 	bool result = true;
 	{   
 		Gameboy gmb = {};
-		init_gameboy(&gmb);
+		init_test_gameboy(&gmb);
 
 		CPU *cpu = &gmb.cpu;
 		u8 mem[2] = {0xCB, 0x19};
-		memcpy(cpu->memory, mem, 2);
+		memcpy(cpu->memory->data, mem, 2);
 
 		set_flag(cpu, FLAG_CARRY);
 		cpu->C = 0x04;
 		while(cpu->PC < 3){
-			run_cpu(cpu);
+			run_test_cpu(cpu);
 		}
 		
 		check_result(&result, cpu->C == 0x82);
-		check_result(&result, !(cpu->flags & (FLAG_ZERO|FLAG_CARRY)));
+		check_result(&result, !(get_flags(cpu) & (FLAG_ZERO|FLAG_CARRY)));
 		check_result(&result, cpu->PC == 0x03);
 	}
 	
 	{   
 		Gameboy gmb = {};
-		init_gameboy(&gmb);
+		init_test_gameboy(&gmb);
 
 		CPU *cpu = &gmb.cpu;
 		u8 mem[2] = {0xCB, 0x1F};
-		memcpy(cpu->memory, mem, 2);
+		memcpy(cpu->memory->data, mem, 2);
 
 		set_flag(cpu, FLAG_CARRY);
 		cpu->A = 0x01;
 		while(cpu->PC < 3){
-			run_cpu(cpu);
+			run_test_cpu(cpu);
 		}
 		
 		check_result(&result, cpu->A == 0x80);
-		check_result(&result, (cpu->flags & FLAG_CARRY));
+		check_result(&result, (get_flags(cpu) & FLAG_CARRY));
 		check_result(&result, cpu->PC == 0x03);
 	}
 
 	{   
 		Gameboy gmb = {};
-		init_gameboy(&gmb);
+		init_test_gameboy(&gmb);
 
 		CPU *cpu = &gmb.cpu;
 		u8 mem[2] = {0xCB, 0x1E};
-		memcpy(cpu->memory, mem, 2);
+		memcpy(cpu->memory->data, mem, 2);
 
 		set_flag(cpu, FLAG_CARRY);
 		cpu->HL = 0xFF05;
 		write_memory(cpu->memory, cpu->HL, 0x02);
 		while(cpu->PC < 3){
-			run_cpu(cpu);
+			run_test_cpu(cpu);
 		}
 		
 		check_result(&result, read_memory(cpu->memory, cpu->HL) == 0x81);
-		check_result(&result, !(cpu->flags & (FLAG_ZERO|FLAG_CARRY)));
+		check_result(&result, !(get_flags(cpu) & (FLAG_ZERO|FLAG_CARRY)));
 		check_result(&result, cpu->PC == 0x03);
 	}
 
@@ -2558,56 +2595,56 @@ void cb_sla_r(){
 	bool result = true;
 	{   
 		Gameboy gmb = {};
-		init_gameboy(&gmb);
+		init_test_gameboy(&gmb);
 
 		CPU *cpu = &gmb.cpu;
 		u8 mem[2] = {0xCB, 0x20};
-		memcpy(cpu->memory, mem, 2);
+		memcpy(cpu->memory->data, mem, 2);
 
 		cpu->B = 0x04;
 		while(cpu->PC < 3){
-			run_cpu(cpu);
+			run_test_cpu(cpu);
 		}
 		
 		check_result(&result, cpu->B == 0x08);
-		check_result(&result, !(cpu->flags & (FLAG_ZERO|FLAG_CARRY)));
+		check_result(&result, !(get_flags(cpu) & (FLAG_ZERO|FLAG_CARRY)));
 		check_result(&result, cpu->PC == 0x03);
 	}
 	
 	{   
 		Gameboy gmb = {};
-		init_gameboy(&gmb);
+		init_test_gameboy(&gmb);
 
 		CPU *cpu = &gmb.cpu;
 		u8 mem[2] = {0xCB, 0x24};
-		memcpy(cpu->memory, mem, 2);
+		memcpy(cpu->memory->data, mem, 2);
 
 		cpu->H = 0x80;
 		while(cpu->PC < 3){
-			run_cpu(cpu);
+			run_test_cpu(cpu);
 		}
 		
 		check_result(&result, cpu->H == 0x00);
-		check_result(&result, (cpu->flags & (FLAG_CARRY|FLAG_ZERO)));
+		check_result(&result, (get_flags(cpu) & (FLAG_CARRY|FLAG_ZERO)));
 		check_result(&result, cpu->PC == 0x03);
 	}
 
 	{   
 		Gameboy gmb = {};
-		init_gameboy(&gmb);
+		init_test_gameboy(&gmb);
 
 		CPU *cpu = &gmb.cpu;
 		u8 mem[2] = {0xCB, 0x26};
-		memcpy(cpu->memory, mem, 2);
+		memcpy(cpu->memory->data, mem, 2);
 
 		cpu->HL = 0xFF05;
 		write_memory(cpu->memory, cpu->HL, 0x82);
 		while(cpu->PC < 3){
-			run_cpu(cpu);
+			run_test_cpu(cpu);
 		}
 		
 		check_result(&result, read_memory(cpu->memory, cpu->HL) == 0x04);
-		check_result(&result, (cpu->flags & (FLAG_ZERO|FLAG_CARRY)));
+		check_result(&result, (get_flags(cpu) & (FLAG_ZERO|FLAG_CARRY)));
 		check_result(&result, cpu->PC == 0x03);
 	}
 
@@ -2619,56 +2656,56 @@ void cb_sra_r(){
 	bool result = true;
 	{   
 		Gameboy gmb = {};
-		init_gameboy(&gmb);
+		init_test_gameboy(&gmb);
 
 		CPU *cpu = &gmb.cpu;
 		u8 mem[2] = {0xCB, 0x28};
-		memcpy(cpu->memory, mem, 2);
+		memcpy(cpu->memory->data, mem, 2);
 
 		cpu->B = 0x84;
 		while(cpu->PC < 3){
-			run_cpu(cpu);
+			run_test_cpu(cpu);
 		}
 		
-		check_result(&result, cpu->B == 0x82);
-		check_result(&result, !(cpu->flags & (FLAG_ZERO|FLAG_CARRY)));
+		check_result(&result, cpu->B == 0xC2);
+		check_result(&result, !(get_flags(cpu) & (FLAG_ZERO|FLAG_CARRY)));
 		check_result(&result, cpu->PC == 0x03);
 	}
 	
 	{   
 		Gameboy gmb = {};
-		init_gameboy(&gmb);
+		init_test_gameboy(&gmb);
 
 		CPU *cpu = &gmb.cpu;
 		u8 mem[2] = {0xCB, 0x2B};
-		memcpy(cpu->memory, mem, 2);
+		memcpy(cpu->memory->data, mem, 2);
 
 		cpu->E = 0x80;
 		while(cpu->PC < 3){
-			run_cpu(cpu);
+			run_test_cpu(cpu);
 		}
 		
-		check_result(&result, cpu->E == 0x80);
-		check_result(&result, !(cpu->flags & (FLAG_CARRY|FLAG_ZERO)));
+		check_result(&result, cpu->E == 0xC0);
+		check_result(&result, !(get_flags(cpu) & (FLAG_CARRY|FLAG_ZERO)));
 		check_result(&result, cpu->PC == 0x03);
 	}
 
 	{   
 		Gameboy gmb = {};
-		init_gameboy(&gmb);
+		init_test_gameboy(&gmb);
 
 		CPU *cpu = &gmb.cpu;
 		u8 mem[2] = {0xCB, 0x2E};
-		memcpy(cpu->memory, mem, 2);
+		memcpy(cpu->memory->data, mem, 2);
 
 		cpu->HL = 0xFF05;
 		write_memory(cpu->memory, cpu->HL, 0x83);
 		while(cpu->PC < 3){
-			run_cpu(cpu);
+			run_test_cpu(cpu);
 		}
 		
-		check_result(&result, read_memory(cpu->memory, cpu->HL) == 0x81);
-		check_result(&result, (cpu->flags & (FLAG_CARRY)));
+		check_result(&result, read_memory(cpu->memory, cpu->HL) == 0xC1);
+		check_result(&result, (get_flags(cpu) & (FLAG_CARRY)));
 		check_result(&result, cpu->PC == 0x03);
 	}
 
@@ -2680,56 +2717,56 @@ void cb_swap_r(){
 	bool result = true;
 	{   
 		Gameboy gmb = {};
-		init_gameboy(&gmb);
+		init_test_gameboy(&gmb);
 
 		CPU *cpu = &gmb.cpu;
 		u8 mem[2] = {0xCB, 0x31};
-		memcpy(cpu->memory, mem, 2);
+		memcpy(cpu->memory->data, mem, 2);
 
 		cpu->C = 0x84;
 		while(cpu->PC < 3){
-			run_cpu(cpu);
+			run_test_cpu(cpu);
 		}
 		
 		check_result(&result, cpu->C == 0x48);
-		check_result(&result, !(cpu->flags & (FLAG_ZERO|FLAG_CARRY|FLAG_SUB|FLAG_HALFCARRY)));
+		check_result(&result, !(get_flags(cpu) & (FLAG_ZERO|FLAG_CARRY|FLAG_SUB|FLAG_HALFCARRY)));
 		check_result(&result, cpu->PC == 0x03);
 	}
 	
 	{   
 		Gameboy gmb = {};
-		init_gameboy(&gmb);
+		init_test_gameboy(&gmb);
 
 		CPU *cpu = &gmb.cpu;
 		u8 mem[2] = {0xCB, 0x37};
-		memcpy(cpu->memory, mem, 2);
+		memcpy(cpu->memory->data, mem, 2);
 
 		cpu->A = 0x00;
 		while(cpu->PC < 3){
-			run_cpu(cpu);
+			run_test_cpu(cpu);
 		}
 		
 		check_result(&result, cpu->A == 0x00);
-		check_result(&result, (cpu->flags & (FLAG_ZERO)));
+		check_result(&result, (get_flags(cpu) & (FLAG_ZERO)));
 		check_result(&result, cpu->PC == 0x03);
 	}
 
 	{   
 		Gameboy gmb = {};
-		init_gameboy(&gmb);
+		init_test_gameboy(&gmb);
 
 		CPU *cpu = &gmb.cpu;
 		u8 mem[2] = {0xCB, 0x36};
-		memcpy(cpu->memory, mem, 2);
+		memcpy(cpu->memory->data, mem, 2);
 
 		cpu->HL = 0xFF05;
 		write_memory(cpu->memory, cpu->HL, 0x53);
 		while(cpu->PC < 3){
-			run_cpu(cpu);
+			run_test_cpu(cpu);
 		}
 		
 		check_result(&result, read_memory(cpu->memory, cpu->HL) == 0x35);
-		check_result(&result, !(cpu->flags & (FLAG_ZERO|FLAG_CARRY|FLAG_SUB|FLAG_HALFCARRY)));
+		check_result(&result, !(get_flags(cpu) & (FLAG_ZERO|FLAG_CARRY|FLAG_SUB|FLAG_HALFCARRY)));
 		check_result(&result, cpu->PC == 0x03);
 	}
 
@@ -2741,56 +2778,56 @@ void cb_srl_r(){
 	bool result = true;
 	{   
 		Gameboy gmb = {};
-		init_gameboy(&gmb);
+		init_test_gameboy(&gmb);
 
 		CPU *cpu = &gmb.cpu;
 		u8 mem[2] = {0xCB, 0x38};
-		memcpy(cpu->memory, mem, 2);
+		memcpy(cpu->memory->data, mem, 2);
 
 		cpu->B = 0x84;
 		while(cpu->PC < 3){
-			run_cpu(cpu);
+			run_test_cpu(cpu);
 		}
 		
 		check_result(&result, cpu->B == 0x42);
-		check_result(&result, !(cpu->flags & (FLAG_ZERO|FLAG_CARRY)));
+		check_result(&result, !(get_flags(cpu) & (FLAG_ZERO|FLAG_CARRY)));
 		check_result(&result, cpu->PC == 0x03);
 	}
 	
 	{   
 		Gameboy gmb = {};
-		init_gameboy(&gmb);
+		init_test_gameboy(&gmb);
 
 		CPU *cpu = &gmb.cpu;
 		u8 mem[2] = {0xCB, 0x3B};
-		memcpy(cpu->memory, mem, 2);
+		memcpy(cpu->memory->data, mem, 2);
 
 		cpu->E = 0x80;
 		while(cpu->PC < 3){
-			run_cpu(cpu);
+			run_test_cpu(cpu);
 		}
 		
 		check_result(&result, cpu->E == 0x40);
-		check_result(&result, !(cpu->flags & (FLAG_CARRY|FLAG_ZERO)));
+		check_result(&result, !(get_flags(cpu) & (FLAG_CARRY|FLAG_ZERO)));
 		check_result(&result, cpu->PC == 0x03);
 	}
 
 	{   
 		Gameboy gmb = {};
-		init_gameboy(&gmb);
+		init_test_gameboy(&gmb);
 
 		CPU *cpu = &gmb.cpu;
 		u8 mem[2] = {0xCB, 0x3E};
-		memcpy(cpu->memory, mem, 2);
+		memcpy(cpu->memory->data, mem, 2);
 
 		cpu->HL = 0xFF05;
 		write_memory(cpu->memory, cpu->HL, 0x83);
 		while(cpu->PC < 3){
-			run_cpu(cpu);
+			run_test_cpu(cpu);
 		}
 		
 		check_result(&result, read_memory(cpu->memory, cpu->HL) == 0x41);
-		check_result(&result, (cpu->flags & (FLAG_CARRY)));
+		check_result(&result, (get_flags(cpu) & (FLAG_CARRY)));
 		check_result(&result, cpu->PC == 0x03);
 	}
 
@@ -2802,53 +2839,53 @@ void cb_bit_r(){
 	bool result = true;
 	{   
 		Gameboy gmb = {};
-		init_gameboy(&gmb);
+		init_test_gameboy(&gmb);
 
 		CPU *cpu = &gmb.cpu;
 		u8 mem[2] = {0xCB, 0x40};
-		memcpy(cpu->memory, mem, 2);
+		memcpy(cpu->memory->data, mem, 2);
 
 		cpu->B = 0xFE;
 		while(cpu->PC < 3){
-			run_cpu(cpu);
+			run_test_cpu(cpu);
 		}
 		
-		check_result(&result, (cpu->flags & (FLAG_ZERO)));
+		check_result(&result, (get_flags(cpu) & (FLAG_ZERO)));
 		check_result(&result, cpu->PC == 0x03);
 	}
 
 	{   
 		Gameboy gmb = {};
-		init_gameboy(&gmb);
+		init_test_gameboy(&gmb);
 
 		CPU *cpu = &gmb.cpu;
 		u8 mem[2] = {0xCB, 0x5B};
-		memcpy(cpu->memory, mem, 2);
+		memcpy(cpu->memory->data, mem, 2);
 
 		cpu->B = 0xF7;
 		while(cpu->PC < 3){
-			run_cpu(cpu);
+			run_test_cpu(cpu);
 		}
 		
-		check_result(&result, (cpu->flags & (FLAG_ZERO)));
+		check_result(&result, (get_flags(cpu) & (FLAG_ZERO)));
 		check_result(&result, cpu->PC == 0x03);
 	}
 
 	{   
 		Gameboy gmb = {};
-		init_gameboy(&gmb);
+		init_test_gameboy(&gmb);
 
 		CPU *cpu = &gmb.cpu;
 		u8 mem[2] = {0xCB, 0x6E};
-		memcpy(cpu->memory, mem, 2);
+		memcpy(cpu->memory->data, mem, 2);
 
 		cpu->HL = 0xFF05;
 		write_memory(cpu->memory, cpu->HL, 0xDF);
 		while(cpu->PC < 3){
-			run_cpu(cpu);
+			run_test_cpu(cpu);
 		}
 		
-		check_result(&result, (cpu->flags & (FLAG_ZERO)));
+		check_result(&result, (get_flags(cpu) & (FLAG_ZERO)));
 		check_result(&result, cpu->PC == 0x03);
 	}
 
@@ -2860,56 +2897,56 @@ void cb_res_r(){
 	bool result = true;
 	{   
 		Gameboy gmb = {};
-		init_gameboy(&gmb);
+		init_test_gameboy(&gmb);
 
 		CPU *cpu = &gmb.cpu;
 		u8 mem[2] = {0xCB, 0x93};
-		memcpy(cpu->memory, mem, 2);
+		memcpy(cpu->memory->data, mem, 2);
 
 		cpu->E = 0xFF;
 		while(cpu->PC < 3){
-			run_cpu(cpu);
+			run_test_cpu(cpu);
 		}
 		
 		check_result(&result, cpu->E == 0xFB);
-		check_result(&result, !(cpu->flags & (FLAG_ZERO)));
+		check_result(&result, !(get_flags(cpu) & (FLAG_ZERO)));
 		check_result(&result, cpu->PC == 0x03);
 	}
 
 	{   
 		Gameboy gmb = {};
-		init_gameboy(&gmb);
+		init_test_gameboy(&gmb);
 
 		CPU *cpu = &gmb.cpu;
 		u8 mem[2] = {0xCB, 0xAF};
-		memcpy(cpu->memory, mem, 2);
+		memcpy(cpu->memory->data, mem, 2);
 
 		cpu->A = 0xFF;
 		while(cpu->PC < 3){
-			run_cpu(cpu);
+			run_test_cpu(cpu);
 		}
 		
 		check_result(&result, cpu->A == 0xDF);
-		check_result(&result, !(cpu->flags & (FLAG_ZERO)));
+		check_result(&result, !(get_flags(cpu) & (FLAG_ZERO)));
 		check_result(&result, cpu->PC == 0x03);
 	}
 
 	{   
 		Gameboy gmb = {};
-		init_gameboy(&gmb);
+		init_test_gameboy(&gmb);
 
 		CPU *cpu = &gmb.cpu;
 		u8 mem[2] = {0xCB, 0xBE};
-		memcpy(cpu->memory, mem, 2);
+		memcpy(cpu->memory->data, mem, 2);
 
 		cpu->HL = 0xFF05;
 		write_memory(cpu->memory, cpu->HL, 0xFF);
 		while(cpu->PC < 3){
-			run_cpu(cpu);
+			run_test_cpu(cpu);
 		}
 		
 		check_result(&result, read_memory(cpu->memory, cpu->HL) == 0x7F);
-		check_result(&result, !(cpu->flags & (FLAG_ZERO)));
+		check_result(&result, !(get_flags(cpu) & (FLAG_ZERO)));
 		check_result(&result, cpu->PC == 0x03);
 	}
 
@@ -2921,63 +2958,1055 @@ void cb_set_r(){
 	bool result = true;
 	{   
 		Gameboy gmb = {};
-		init_gameboy(&gmb);
+		init_test_gameboy(&gmb);
 
 		CPU *cpu = &gmb.cpu;
 		u8 mem[2] = {0xCB, 0xC4};
-		memcpy(cpu->memory, mem, 2);
+		memcpy(cpu->memory->data, mem, 2);
 
 		cpu->H = 0xFE;
 		while(cpu->PC < 3){
-			run_cpu(cpu);
+			run_test_cpu(cpu);
 		}
 		
 		check_result(&result, cpu->H == 0xFF);
-		check_result(&result, !(cpu->flags & (FLAG_ZERO)));
+		check_result(&result, !(get_flags(cpu) & (FLAG_ZERO)));
 		check_result(&result, cpu->PC == 0x03);
 	}
 
 	{   
 		Gameboy gmb = {};
-		init_gameboy(&gmb);
+		init_test_gameboy(&gmb);
 
 		CPU *cpu = &gmb.cpu;
 		u8 mem[2] = {0xCB, 0xFF};
-		memcpy(cpu->memory, mem, 2);
+		memcpy(cpu->memory->data, mem, 2);
 
 		cpu->A = 0x7A;
 		while(cpu->PC < 3){
-			run_cpu(cpu);
+			run_test_cpu(cpu);
 		}
 		
 		check_result(&result, cpu->A == 0xFA);
-		check_result(&result, !(cpu->flags & (FLAG_ZERO)));
+		check_result(&result, !(get_flags(cpu) & (FLAG_ZERO)));
 		check_result(&result, cpu->PC == 0x03);
 	}
 
 	{   
 		Gameboy gmb = {};
-		init_gameboy(&gmb);
+		init_test_gameboy(&gmb);
 
 		CPU *cpu = &gmb.cpu;
 		u8 mem[2] = {0xCB, 0xD6};
-		memcpy(cpu->memory, mem, 2);
+		memcpy(cpu->memory->data, mem, 2);
 
 		cpu->HL = 0xFF05;
 		write_memory(cpu->memory, cpu->HL, 0xAB);
 		while(cpu->PC < 3){
-			run_cpu(cpu);
+			run_test_cpu(cpu);
 		}
 		
 		check_result(&result, read_memory(cpu->memory, cpu->HL) == 0xAF);
-		check_result(&result, !(cpu->flags & (FLAG_ZERO)));
+		check_result(&result, !(get_flags(cpu) & (FLAG_ZERO)));
 		check_result(&result, cpu->PC == 0x03);
 	}
 
 	show_test_result(test_name, result);
 }
 
-int main(){
+// Random rows of tile data and palettes through every kernel the CPU has, against the scalar one.
+void scanline_kernels(){
+	const char *names[SCANLINE_KERNEL_COUNT] = {"Scalar", "SSE2", "AVX2"};
+	srand(1);
+
+	for(i32 kernel = SCANLINE_KERNEL_SCALAR + 1; kernel < SCANLINE_KERNEL_COUNT; kernel++){
+		if(!is_scanline_kernel_supported((ScanlineKernel)kernel)) continue;
+
+		bool result = true;
+		for(i32 i = 0; i < 1000; i++){
+			u8 rows[2 * 32];
+			for(u32 j = 0; j < array_size(rows); j++) rows[j] = rand();
+			u8 palette = rand();
+			u32 count = rand() % 33;
+
+			u8 expected[8 * 32 + 1];
+			u8 shades[8 * 32 + 1];
+			expected[8 * count] = shades[8 * count] = 0xAA; // Nothing is written past the rows.
+			decode_tile_rows(SCANLINE_KERNEL_SCALAR, rows, count, palette, expected);
+			decode_tile_rows((ScanlineKernel)kernel, rows, count, palette, shades);
+			check_result(&result, memcmp(expected, shades, 8 * count + 1) == 0);
+		}
+		show_test_result(names[kernel], result);
+	}
+}
+
+static u8 program_rom[0x10000]; // Four banks, enough for the MBC1 programs.
+
+// Starts an empty ROM of the given cartridge type, the programs are copied in with put_program.
+static void clear_program_rom(u8 cartridge_type, u8 rom_size){
+	memset(program_rom, 0, sizeof(program_rom));
+	program_rom[0x147] = cartridge_type;
+	program_rom[0x148] = rom_size;
+}
+
+static void put_program(u32 offset, const u8 *program, u32 size){
+	memcpy(program_rom + offset, program, size);
+}
+
+static Gameboy* start_program(ExecutionMode mode){
+	Gameboy *gmb = (Gameboy*)calloc(1, sizeof(Gameboy));
+	init_gameboy_from_rom(gmb, program_rom, sizeof(program_rom));
+	if(!set_execution_mode(gmb, mode)){
+		free_gameboy(gmb);
+		free(gmb);
+		return NULL;
+	}
+	return gmb;
+}
+
+static void stop_program(Gameboy *gmb){
+	free_gameboy(gmb);
+	free(gmb);
+}
+
+// Registers, the time and WRAM, where the test programs log what they see.
+static void check_same_state(bool *result, Gameboy *gmb, Gameboy *reference){
+	CPU *expected = &reference->cpu;
+	CPU *cpu = &gmb->cpu;
+	check_result(result, cpu->A == expected->A && get_flags(cpu) == get_flags(expected));
+	check_result(result, cpu->BC == expected->BC && cpu->DE == expected->DE && cpu->HL == expected->HL);
+	check_result(result, cpu->SP == expected->SP && cpu->PC == expected->PC);
+	check_result(result, gmb->scheduler.cycle + cpu->pending_cycles == reference->scheduler.cycle + expected->pending_cycles);
+	check_result(result, memcmp(&gmb->memory.data[0xC000], &reference->memory.data[0xC000], 0x2000) == 0);
+}
+
+// Runs the program in the instruction mode and with the JIT, after every frame both have to be on the
+// same cycle with the same registers and WRAM.
+static bool run_against_instruction_mode(i32 frames, Gameboy **result_gmb){
+	Gameboy *reference = start_program(EXECUTION_INSTRUCTION);
+	Gameboy *gmb = start_program(EXECUTION_JIT);
+	bool result = reference && gmb;
+
+	for(i32 frame = 0; frame < frames && result; frame++){
+		run_gameboy(reference, 0, 1, 0);
+		run_gameboy(gmb, 0, 1, 0);
+
+		check_same_state(&result, gmb, reference);
+	}
+	if(gmb) check_result(&result, gmb->jit.compiled_blocks > 0);
+
+	if(reference) stop_program(reference);
+	*result_gmb = gmb;
+	return result;
+}
+
+// A loop that stays in its compiled block, interrupted by VBlank and by timer interrupts it requests
+// itself by writing IF. The handlers log B and C, so an interrupt taken one instruction late shows.
+void jit_block_interrupts(){
+	const char *test_name = "Interrupt exits";
+	clear_program_rom(0x00, 0x00);
+
+	u8 vblank[] = {0x78, 0x22, 0xD9};  // LD A, B; LD [HL+], A; RETI
+	u8 timer[]  = {0x79, 0x22, 0xD9};  // LD A, C; LD [HL+], A; RETI
+	u8 program[] = {
+		0x31, 0xFE, 0xFF,                         // LD SP, FFFEh
+		0x21, 0x00, 0xC0,                         // LD HL, C000h
+		0x3E, 0x05, 0xE0, 0xFF,                   // IE = VBlank and timer
+		0xAF, 0xE0, 0x0F,                         // IF = 0
+		0x3E, 0x05, 0xE0, 0x07,                   // TAC = enabled, every 4 machine cycles
+		0xFB,                                     // EI
+		0x04, 0x0C, 0x14, 0x1C, 0x80, 0x81, 0x04, 0x0C, // INC B; INC C; INC D; INC E; ADD A, B; ADD A, C; INC B; INC C
+		0x3E, 0x04, 0xE0, 0x0F,                   // IF = timer
+		0x04,                                     // INC B
+		0x18, 0xF1,                               // JR back to INC B
+	};
+	put_program(0x40, vblank, sizeof(vblank));
+	put_program(0x50, timer, sizeof(timer));
+	put_program(0x100, program, sizeof(program));
+
+	Gameboy *gmb;
+	bool result = run_against_instruction_mode(3, &gmb);
+	if(gmb){
+		check_result(&result, gmb->cpu.HL > 0xC100); // Both handlers ran many times.
+		stop_program(gmb);
+	}
+	show_test_result(test_name, result);
+}
+
+// Code in bank 1 switches to bank 2, which has different code right after the write.
+void jit_block_bank_switch(){
+	const char *test_name = "MBC bank write exits";
+	clear_program_rom(0x01, 0x01); // MBC1, 64 KiB
+
+	u8 start[] = {
+		0x31, 0xFE, 0xFF,       // LD SP, FFFEh
+		0x01, 0x00, 0x00,       // LD BC, 0
+		0x11, 0x00, 0x00,       // LD DE, 0
+		0xC3, 0x00, 0x40,       // JP 4000h
+	};
+	u8 bank_1[] = {
+		0x3E, 0x02,             // LD A, 2
+		0xEA, 0x00, 0x20,       // LD [2000h], A
+		0x04, 0x04, 0x04, 0x04, // INC B four times, replaced by bank 2
+		0x18, 0xFE,             // JR to itself
+	};
+	u8 bank_2[] = {
+		0x0C, 0x0C, 0x0C, 0x0C, // INC C four times
+		0x3E, 0x01,             // LD A, 1
+		0xEA, 0x00, 0x20,       // LD [2000h], A
+		0x18, 0xFE,             // JR to itself, in bank 1 that is the JR above
+	};
+	put_program(0x100, start, sizeof(start));
+	put_program(0x4000, bank_1, sizeof(bank_1));
+	put_program(0x8005, bank_2, sizeof(bank_2));
+	program_rom[0x400E] = 0x14; // INC D in bank 1, where bank 2 switches back.
+	program_rom[0x400F] = 0x18;
+	program_rom[0x4010] = 0xFE;
+
+	Gameboy *gmb;
+	bool result = run_against_instruction_mode(2, &gmb);
+	if(gmb){
+		check_result(&result, gmb->cpu.B == 0 && gmb->cpu.C == 4 && gmb->cpu.D == 1);
+		stop_program(gmb);
+	}
+	show_test_result(test_name, result);
+}
+
+// Calls, returns and a conditional jump at the end of blocks, with VBlank interrupts coming in between.
+void jit_block_branches(){
+	const char *test_name = "Branches through run_cpu";
+	clear_program_rom(0x00, 0x00);
+
+	u8 vblank[] = {0x78, 0xEA, 0x00, 0xC0, 0xD9}; // LD A, B; LD [C000h], A; RETI
+	u8 program[] = {
+		0x31, 0xFE, 0xFF,       // LD SP, FFFEh
+		0x3E, 0x01, 0xE0, 0xFF, // IE = VBlank
+		0xFB,                   // EI
+		0x04,                   // INC B
+		0xCD, 0x00, 0x02,       // CALL 0200h
+		0x14,                   // INC D
+		0x79, 0xE6, 0x07,       // LD A, C; AND 7
+		0x20, 0xF6,             // JR NZ, back to INC B
+		0x1C,                   // INC E
+		0x18, 0xF3,             // JR back to INC B
+	};
+	u8 function[] = {
+		0x0C,                   // INC C
+		0x79, 0xFE, 0x80,       // LD A, C; CP 80h
+		0xC0,                   // RET NZ
+		0x0E, 0x00,             // LD C, 0
+		0xC9,                   // RET
+	};
+	put_program(0x40, vblank, sizeof(vblank));
+	put_program(0x100, program, sizeof(program));
+	put_program(0x200, function, sizeof(function));
+
+	Gameboy *gmb;
+	bool result = run_against_instruction_mode(3, &gmb);
+	if(gmb){
+		check_result(&result, gmb->cpu.E > 0 && gmb->memory.data[0xC000] != 0);
+		stop_program(gmb);
+	}
+	show_test_result(test_name, result);
+}
+
+// Cartridge where every 16 KiB bank starts with its 9-bit number, low byte first.
+static Gameboy* start_banked_cartridge(u8 cartridge_type, u8 rom_size, u8 ram_size, u8 **rom){
+	u32 size = 0x8000 << rom_size;
+	*rom = (u8*)calloc(1, size);
+	for(u32 bank = 0; bank < size / 0x4000; bank++){
+		(*rom)[bank * 0x4000] = bank & 0xFF;
+		(*rom)[bank * 0x4000 + 1] = bank >> 8;
+	}
+	(*rom)[0x100] = 0x18; // JR to itself, for the tests that run frames.
+	(*rom)[0x101] = 0xFE;
+	(*rom)[0x147] = cartridge_type;
+	(*rom)[0x148] = rom_size;
+	(*rom)[0x149] = ram_size;
+
+	Gameboy *gmb = (Gameboy*)calloc(1, sizeof(Gameboy));
+	init_gameboy_from_rom(gmb, *rom, size);
+	return gmb;
+}
+
+static void stop_banked_cartridge(Gameboy *gmb, u8 *rom){
+	stop_program(gmb);
+	free(rom);
+}
+
+static u16 read_rom_bank(CPU *cpu){
+	return read_memory_cpu(cpu, 0x4000) | (read_memory_cpu(cpu, 0x4001) << 8);
+}
+
+void mbc_rom_bank_zero(){
+	const char *test_name = "ROM bank 0";
+	bool result = true;
+	u8 *rom;
+	{	// MBC3 maps bank 1 instead.
+		Gameboy *gmb = start_banked_cartridge(0x11, 0x02, 0x00, &rom);
+		write_memory_cpu(&gmb->cpu, 0x2000, 0x00);
+		check_result(&result, read_rom_bank(&gmb->cpu) == 1);
+		write_memory_cpu(&gmb->cpu, 0x2000, 0x03);
+		check_result(&result, read_rom_bank(&gmb->cpu) == 3);
+		stop_banked_cartridge(gmb, rom);
+	}
+	{	// MBC5 can map bank 0 at 0x4000.
+		Gameboy *gmb = start_banked_cartridge(0x19, 0x02, 0x00, &rom);
+		write_memory_cpu(&gmb->cpu, 0x2000, 0x00);
+		check_result(&result, read_rom_bank(&gmb->cpu) == 0);
+		stop_banked_cartridge(gmb, rom);
+	}
+	show_test_result(test_name, result);
+}
+
+void mbc5_9_bit_bank(){
+	const char *test_name = "MBC5 9-bit ROM bank";
+	bool result = true;
+	u8 *rom;
+	Gameboy *gmb = start_banked_cartridge(0x19, 0x08, 0x00, &rom); // 8 MiB, 512 banks
+	write_memory_cpu(&gmb->cpu, 0x2000, 0x23);
+	write_memory_cpu(&gmb->cpu, 0x3000, 0x01);
+	check_result(&result, read_rom_bank(&gmb->cpu) == 0x123);
+	write_memory_cpu(&gmb->cpu, 0x2000, 0x45); // The low byte keeps the high bit.
+	check_result(&result, read_rom_bank(&gmb->cpu) == 0x145);
+	write_memory_cpu(&gmb->cpu, 0x3000, 0x00);
+	check_result(&result, read_rom_bank(&gmb->cpu) == 0x045);
+	stop_banked_cartridge(gmb, rom);
+	show_test_result(test_name, result);
+}
+
+void mbc_bank_wrapping(){
+	const char *test_name = "ROM bank wrapping";
+	bool result = true;
+	u8 *rom;
+	{
+		Gameboy *gmb = start_banked_cartridge(0x19, 0x01, 0x00, &rom); // 4 banks
+		write_memory_cpu(&gmb->cpu, 0x2000, 0x06);
+		check_result(&result, read_rom_bank(&gmb->cpu) == 2);
+		write_memory_cpu(&gmb->cpu, 0x3000, 0x01); // Bank 0x106
+		check_result(&result, read_rom_bank(&gmb->cpu) == 2);
+		stop_banked_cartridge(gmb, rom);
+	}
+	{
+		Gameboy *gmb = start_banked_cartridge(0x01, 0x02, 0x00, &rom); // MBC1, 8 banks
+		write_memory_cpu(&gmb->cpu, 0x2000, 0x1D);
+		check_result(&result, read_rom_bank(&gmb->cpu) == 5);
+		stop_banked_cartridge(gmb, rom);
+	}
+	{	// MBC1 with RAM, 128 banks and 4 RAM banks. 0x4000-0x5FFF holds ROM bank bits 5-6.
+		Gameboy *gmb = start_banked_cartridge(0x02, 0x06, 0x03, &rom);
+		CPU *cpu = &gmb->cpu;
+		write_memory_cpu(cpu, 0x4000, 0x02);
+		write_memory_cpu(cpu, 0x2000, 0x03);
+		check_result(&result, read_rom_bank(cpu) == 0x43);
+		write_memory_cpu(cpu, 0x2000, 0x00); // Bits 5-6 stay, only the low 5 are checked for 0.
+		check_result(&result, read_rom_bank(cpu) == 0x41);
+
+		write_memory_cpu(cpu, 0x0000, 0x1A); // Only the low nibble enables the RAM.
+		write_memory_cpu(cpu, 0xA000, 0x11);
+		check_result(&result, gmb->memory.mbc.ram_banks[0][0] == 0x11); // Mode 0 keeps RAM bank 0...
+		check_result(&result, read_memory_cpu(cpu, 0x0000) == 0x00);  // ...and ROM bank 0.
+		write_memory_cpu(cpu, 0x0000, 0x08);
+		check_result(&result, read_memory_cpu(cpu, 0xA000) == 0xFF);
+
+		write_memory_cpu(cpu, 0x6000, 0x01);
+		write_memory_cpu(cpu, 0x0000, 0x0A);
+		write_memory_cpu(cpu, 0xA000, 0x22);
+		check_result(&result, gmb->memory.mbc.ram_banks[2][0] == 0x22);
+		check_result(&result, read_memory_cpu(cpu, 0x0000) == 0x40);
+		check_result(&result, read_rom_bank(cpu) == 0x41);
+		stop_banked_cartridge(gmb, rom);
+	}
+	show_test_result(test_name, result);
+}
+
+void mbc3_ram_and_rtc(){
+	const char *test_name = "MBC3 RAM banks and clock registers";
+	bool result = true;
+	u8 *rom;
+	Gameboy *gmb = start_banked_cartridge(0x10, 0x01, 0x03, &rom); // Timer, RAM and battery, 4 RAM banks
+	CPU *cpu = &gmb->cpu;
+	write_memory_cpu(cpu, 0x0000, 0x0A);
+
+	write_memory_cpu(cpu, 0x4000, 0x02);
+	write_memory_cpu(cpu, 0xA000, 0x55);
+	check_result(&result, read_memory_cpu(cpu, 0xA000) == 0x55);
+	check_result(&result, gmb->memory.mbc.ram_banks[2][0] == 0x55);
+
+	write_memory_cpu(cpu, 0x4000, 0x08); // Seconds
+	write_memory_cpu(cpu, 0xA000, 0x3B);
+	check_result(&result, read_memory_cpu(cpu, 0xA000) == 0x3B);
+	check_result(&result, gmb->memory.mbc.rtc[0] == 0x3B);
+	check_result(&result, gmb->memory.mbc.ram_banks[2][0] == 0x55);
+	write_memory_cpu(cpu, 0x4000, 0x0C); // Day high
+	check_result(&result, read_memory_cpu(cpu, 0xA000) == 0x00);
+
+	write_memory_cpu(cpu, 0x4000, 0x02);
+	check_result(&result, read_memory_cpu(cpu, 0xA000) == 0x55);
+
+	write_memory_cpu(cpu, 0x0000, 0x00); // Neither is reachable while disabled.
+	check_result(&result, read_memory_cpu(cpu, 0xA000) == 0xFF);
+	write_memory_cpu(cpu, 0x4000, 0x08);
+	check_result(&result, read_memory_cpu(cpu, 0xA000) == 0xFF);
+	stop_banked_cartridge(gmb, rom);
+	show_test_result(test_name, result);
+}
+
+void mbc5_rumble(){
+	const char *test_name = "MBC5 rumble";
+	bool result = true;
+	u8 *rom;
+	for(i32 rumble = 0; rumble < 2; rumble++){
+		Gameboy *gmb = start_banked_cartridge(rumble ? 0x1D : 0x1A, 0x01, 0x04, &rom); // 16 RAM banks
+		CPU *cpu = &gmb->cpu;
+		write_memory_cpu(cpu, 0x0000, 0x0A);
+		write_memory_cpu(cpu, 0x4000, 0x09);
+		write_memory_cpu(cpu, 0xA000, 0x77);
+		u8 bank = rumble ? 1 : 9; // Bit 3 drives the motor on rumble carts.
+		check_result(&result, gmb->memory.mbc.RAM_bank_number == bank);
+		check_result(&result, gmb->memory.mbc.ram_banks[bank][0] == 0x77);
+		stop_banked_cartridge(gmb, rom);
+	}
+	show_test_result(test_name, result);
+}
+
+#define SAVE_TEST_ROM_PATH "save_test.gb" // Never opened, only the .sav next to it.
+#define SAVE_TEST_PATH "save_test.sav"
+
+static i32 get_file_size(const char *path){
+	FILE *file = fopen(path, "rb");
+	if(!file) return -1;
+	fseek(file, 0, SEEK_END);
+	i32 size = (i32)ftell(file);
+	fclose(file);
+	return size;
+}
+
+// MBC1 with RAM and battery, 4 RAM banks of 8 KiB saved to SAVE_TEST_PATH.
+static Gameboy* start_battery_cartridge(u8 **rom){
+	Gameboy *gmb = start_banked_cartridge(0x03, 0x01, 0x03, rom);
+	load_save_ram(&gmb->memory, SAVE_TEST_ROM_PATH);
+	write_memory_cpu(&gmb->cpu, 0x0000, 0x0A);
+	write_memory_cpu(&gmb->cpu, 0x6000, 0x01); // Mode 1, MBC1 only switches RAM banks in it.
+	return gmb;
+}
+
+void save_file(){
+	const char *test_name = "Save file";
+	bool result = true;
+	u8 *rom;
+	{	// Created with the size of the RAM.
+		remove(SAVE_TEST_PATH);
+		Gameboy *gmb = start_battery_cartridge(&rom);
+		check_result(&result, gmb->memory.mbc.save_data != NULL);
+		check_result(&result, get_file_size(SAVE_TEST_PATH) == 4 * 0x2000);
+		stop_banked_cartridge(gmb, rom);
+	}
+	{	// Grown from a shorter file, keeping what it held.
+		FILE *file = fopen(SAVE_TEST_PATH, "wb");
+		fwrite("AB", 1, 2, file);
+		fclose(file);
+		Gameboy *gmb = start_battery_cartridge(&rom);
+		check_result(&result, get_file_size(SAVE_TEST_PATH) == 4 * 0x2000);
+		check_result(&result, read_memory_cpu(&gmb->cpu, 0xA000) == 'A' && read_memory_cpu(&gmb->cpu, 0xA001) == 'B');
+		check_result(&result, read_memory_cpu(&gmb->cpu, 0xA002) == 0x00);
+		stop_banked_cartridge(gmb, rom);
+	}
+	remove(SAVE_TEST_PATH);
+	show_test_result(test_name, result);
+}
+
+void save_dirty_pages(){
+	const char *test_name = "Dirty save pages";
+	bool result = true;
+	u8 *rom;
+	remove(SAVE_TEST_PATH);
+	Gameboy *gmb = start_battery_cartridge(&rom);
+	CPU *cpu = &gmb->cpu;
+	MBC *mbc = &gmb->memory.mbc;
+
+	check_result(&result, mbc->dirty_save_pages == 0);
+	write_memory_cpu(cpu, 0xA000, 0x11);
+	check_result(&result, mbc->dirty_save_pages == 0x01);
+	write_memory_cpu(cpu, 0xB000, 0x22); // Second page of bank 0
+	write_memory_cpu(cpu, 0x4000, 0x01);
+	write_memory_cpu(cpu, 0xA010, 0x33); // Bank 1 starts at page 2
+	write_memory_cpu(cpu, 0x4000, 0x03);
+	write_memory_cpu(cpu, 0xBFFF, 0x44); // Last page of the file
+	check_result(&result, mbc->dirty_save_pages == 0x87);
+
+	// The flush clears the bits, the file already holds what was written.
+	flush_save_ram(&gmb->memory);
+	check_result(&result, mbc->dirty_save_pages == 0);
+	FILE *file = fopen(SAVE_TEST_PATH, "rb");
+	u8 *contents = (u8*)calloc(1, 4 * 0x2000);
+	check_result(&result, file && fread(contents, 1, 4 * 0x2000, file) == 4 * 0x2000);
+	if(file) fclose(file);
+	check_result(&result, contents[0x0000] == 0x11 && contents[0x1000] == 0x22);
+	check_result(&result, contents[0x2010] == 0x33 && contents[0x7FFF] == 0x44);
+	free(contents);
+
+	stop_banked_cartridge(gmb, rom);
+	remove(SAVE_TEST_PATH);
+	show_test_result(test_name, result);
+}
+
+void save_flushes(){
+	const char *test_name = "Save flushes";
+	bool result = true;
+	u8 *rom;
+	remove(SAVE_TEST_PATH);
+	{	// Every save_flush_interval frames.
+		Gameboy *gmb = start_battery_cartridge(&rom);
+		set_execution_mode(gmb, EXECUTION_INSTRUCTION);
+		MBC *mbc = &gmb->memory.mbc;
+		mbc->save_flush_interval = 3;
+		write_memory_cpu(&gmb->cpu, 0xA000, 0x11);
+		run_gameboy(gmb, 0, 1, 0);
+		run_gameboy(gmb, 0, 1, 0);
+		check_result(&result, mbc->dirty_save_pages == 0x01);
+		run_gameboy(gmb, 0, 1, 0);
+		check_result(&result, mbc->dirty_save_pages == 0);
+
+		mbc->save_flush_interval = 0; // Never on frames.
+		write_memory_cpu(&gmb->cpu, 0xA000, 0x22);
+		for(i32 i = 0; i < 5; i++) run_gameboy(gmb, 0, 1, 0);
+		check_result(&result, mbc->dirty_save_pages == 0x01);
+		stop_banked_cartridge(gmb, rom);
+	}
+	{	// When the game disables the RAM.
+		Gameboy *gmb = start_battery_cartridge(&rom);
+		MBC *mbc = &gmb->memory.mbc;
+		write_memory_cpu(&gmb->cpu, 0xA000, 0x33);
+		check_result(&result, mbc->dirty_save_pages == 0x01);
+		write_memory_cpu(&gmb->cpu, 0x0000, 0x00);
+		check_result(&result, mbc->dirty_save_pages == 0);
+		stop_banked_cartridge(gmb, rom);
+	}
+	remove(SAVE_TEST_PATH);
+	show_test_result(test_name, result);
+}
+
+// Lets the hardware run on its own for the given machine cycles, like the CPU does between accesses.
+static void run_hardware_cycles(Gameboy *gmb, i32 cycles){
+	gmb->cpu.pending_cycles += cycles;
+	catch_up_hardware(gmb);
+}
+
+void timer_rates(){
+	const char *test_name = "DIV and TIMA";
+	bool result = true;
+	const i32 periods[4] = {256, 4, 16, 64}; // Machine cycles per TIMA increment for each TAC rate.
+
+	for(u8 rate = 0; rate < 4; rate++){
+		clear_program_rom(0x00, 0x00);
+		Gameboy *gmb = start_program(EXECUTION_INSTRUCTION);
+		CPU *cpu = &gmb->cpu;
+		write_memory_cpu(cpu, 0xFF07, 0x04 | rate);
+		u16 counter = cpu->internal_counter;
+
+		i32 elapsed = 0;
+		const i32 steps[] = {1, 3, 250, 777, 1000};
+		for(u32 i = 0; i < array_size(steps); i++){
+			run_hardware_cycles(gmb, steps[i]);
+			elapsed += steps[i];
+			check_result(&result, read_memory_cpu(cpu, 0xFF04) == (u8)((counter + elapsed * 4) >> 8));
+			check_result(&result, read_memory_cpu(cpu, 0xFF05) == (u8)(elapsed / periods[rate]));
+		}
+		stop_program(gmb);
+	}
+	show_test_result(test_name, result);
+}
+
+void timer_tac_change(){
+	const char *test_name = "TAC changes";
+	bool result = true;
+	clear_program_rom(0x00, 0x00);
+	Gameboy *gmb = start_program(EXECUTION_INSTRUCTION);
+	CPU *cpu = &gmb->cpu;
+	Scheduler *scheduler = &gmb->scheduler;
+
+	write_memory_cpu(cpu, 0xFF0F, 0x00);
+	write_memory_cpu(cpu, 0xFF05, 0xF0);
+	write_memory_cpu(cpu, 0xFF07, 0x05); // Every 4 cycles, 16 increments to go.
+	u64 start = scheduler->cycle;
+	check_result(&result, scheduler->deadlines[EVENT_TIMER] == start + 64);
+
+	run_hardware_cycles(gmb, 10);
+	write_memory_cpu(cpu, 0xFF07, 0x04); // Every 256 cycles from TIMA F2h, 40 cycles into the period.
+	check_result(&result, read_memory_cpu(cpu, 0xFF05) == 0xF2);
+	u64 overflow = start + 10 + 14 * 256 - 10;
+	check_result(&result, scheduler->deadlines[EVENT_TIMER] == overflow);
+
+	write_memory_cpu(cpu, 0xFF07, 0x00); // Stopped
+	check_result(&result, !is_event_scheduled(scheduler, EVENT_TIMER));
+	run_hardware_cycles(gmb, 5000);
+	check_result(&result, read_memory_cpu(cpu, 0xFF05) == 0xF2);
+	check_result(&result, !(read_memory_cpu(cpu, 0xFF0F) & INT_TIMER));
+
+	write_memory_cpu(cpu, 0xFF05, 0xFF);
+	write_memory_cpu(cpu, 0xFF07, 0x06); // Every 16 cycles
+	check_result(&result, is_event_scheduled(scheduler, EVENT_TIMER));
+	check_result(&result, scheduler->deadlines[EVENT_TIMER] > scheduler->cycle);
+	check_result(&result, scheduler->deadlines[EVENT_TIMER] <= scheduler->cycle + 16);
+	stop_program(gmb);
+	show_test_result(test_name, result);
+}
+
+void timer_overflow(){
+	const char *test_name = "TIMA overflow";
+	bool result = true;
+	const i32 periods[4] = {256, 4, 16, 64};
+	for(u8 rate = 0; rate < 4; rate++){
+		clear_program_rom(0x00, 0x00);
+		Gameboy *gmb = start_program(EXECUTION_INSTRUCTION);
+		CPU *cpu = &gmb->cpu;
+
+		write_memory_cpu(cpu, 0xFF0F, 0x00);
+		write_memory_cpu(cpu, 0xFF05, 0xFE);
+		write_memory_cpu(cpu, 0xFF07, 0x04 | rate);
+
+		run_hardware_cycles(gmb, 2 * periods[rate] - 1); // One cycle short.
+		check_result(&result, !(cpu->memory->data[0xFF0F] & INT_TIMER));
+		check_result(&result, read_memory_cpu(cpu, 0xFF05) == 0xFF);
+		run_hardware_cycles(gmb, 1);
+		check_result(&result, cpu->memory->data[0xFF0F] & INT_TIMER);
+		check_result(&result, read_memory_cpu(cpu, 0xFF05) == 0x00);
+
+		// The next overflows reload TIMA from TMA, 4 increments short of the one after.
+		write_memory_cpu(cpu, 0xFF06, 0xFC);
+		write_memory_cpu(cpu, 0xFF05, 0xFF);
+		write_memory_cpu(cpu, 0xFF0F, 0x00);
+		run_hardware_cycles(gmb, periods[rate]);
+		check_result(&result, cpu->memory->data[0xFF0F] & INT_TIMER);
+		check_result(&result, read_memory_cpu(cpu, 0xFF05) == 0xFC);
+		write_memory_cpu(cpu, 0xFF0F, 0x00);
+		run_hardware_cycles(gmb, 4 * periods[rate] - 1);
+		check_result(&result, !(cpu->memory->data[0xFF0F] & INT_TIMER));
+		check_result(&result, read_memory_cpu(cpu, 0xFF05) == 0xFF);
+		run_hardware_cycles(gmb, 1);
+		check_result(&result, cpu->memory->data[0xFF0F] & INT_TIMER);
+		check_result(&result, read_memory_cpu(cpu, 0xFF05) == 0xFC);
+		stop_program(gmb);
+	}
+	show_test_result(test_name, result);
+}
+
+// Runs the program with and without skipping idle time, the skips may only change how fast it runs.
+// The machine cycle mode never fast-forwards a HALT.
+static bool run_against_unskipped(ExecutionMode reference_mode, i32 frames, Gameboy **result_gmb){
+	Gameboy *reference = start_program(reference_mode);
+	Gameboy *gmb = start_program(EXECUTION_INSTRUCTION);
+	reference->skip_idle_loops = false;
+	bool result = true;
+	for(i32 frame = 0; frame < frames; frame++){
+		run_gameboy(reference, 0, 1, 0);
+		run_gameboy(gmb, 0, 1, 0);
+		check_same_state(&result, gmb, reference);
+	}
+	check_result(&result, reference->halt_skipped_cycles == 0 && reference->idle_loop_skipped_cycles == 0);
+	stop_program(reference);
+	*result_gmb = gmb;
+	return result;
+}
+
+// Waits for VBlank and timer interrupts, the handlers log LY so an interrupt taken late shows.
+void halt_skip(){
+	const char *test_name = "HALT";
+	clear_program_rom(0x00, 0x00);
+
+	u8 vblank[] = {0xF0, 0x44, 0x77, 0x2C, 0xD9};       // LDH A, (44h); LD [HL], A; INC L; RETI
+	u8 timer[]  = {0xF0, 0x44, 0x77, 0x2C, 0x0C, 0xD9}; // LDH A, (44h); LD [HL], A; INC L; INC C; RETI
+	u8 program[] = {
+		0x31, 0xFE, 0xFF,       // LD SP, FFFEh
+		0x21, 0x00, 0xC0,       // LD HL, C000h
+		0x3E, 0x05, 0xE0, 0xFF, // IE = VBlank and timer
+		0xAF, 0xE0, 0x0F,       // IF = 0
+		0x3E, 0xF0, 0xE0, 0x06, // TMA = F0h, an overflow every 4096 machine cycles
+		0x3E, 0x04, 0xE0, 0x07, // TAC = enabled, every 256 machine cycles
+		0xFB,                   // EI
+		0x76,                   // HALT
+		0x04,                   // INC B
+		0x18, 0xFC,             // JR back to HALT
+	};
+	put_program(0x40, vblank, sizeof(vblank));
+	put_program(0x50, timer, sizeof(timer));
+	put_program(0x100, program, sizeof(program));
+
+	Gameboy *gmb;
+	bool result = run_against_unskipped(EXECUTION_MACHINE_CYCLE, 4, &gmb);
+	check_result(&result, gmb->halt_skipped_cycles > 0);
+	check_result(&result, gmb->cpu.B > 0 && gmb->cpu.C > 0);
+	stop_program(gmb);
+	show_test_result(test_name, result);
+}
+
+// Waits for a line with LY and for HBlank with STAT, logging both once they change.
+void polling_loop_skip(){
+	const char *test_name = "LY and STAT polling loops";
+	clear_program_rom(0x00, 0x00);
+
+	u8 program[] = {
+		0x21, 0x00, 0xC0,             // LD HL, C000h
+		0xF0, 0x44, 0xFE, 0x90,       // LDH A, (44h); CP 90h
+		0x20, 0xFA,                   // JR NZ, back to LDH
+		0xF0, 0x41, 0x77, 0x2C,       // LDH A, (41h); LD [HL], A; INC L
+		0xF0, 0x41, 0xE6, 0x03,       // LDH A, (41h); AND 3
+		0x20, 0xFA,                   // JR NZ, back to LDH
+		0xF0, 0x44, 0x77, 0x2C,       // LDH A, (44h); LD [HL], A; INC L
+		0x04,                         // INC B
+		0x18, 0xE9,                   // JR back to the first LDH
+	};
+	put_program(0x100, program, sizeof(program));
+
+	Gameboy *gmb;
+	bool result = run_against_unskipped(EXECUTION_INSTRUCTION, 4, &gmb);
+	check_result(&result, gmb->idle_loop_skipped_cycles > 0);
+	check_result(&result, gmb->cpu.B > 0 && gmb->memory.data[0xC000] != 0);
+	stop_program(gmb);
+	show_test_result(test_name, result);
+}
+
+void map_pages_bank_switch(){
+	const char *test_name = "Page table follows the ROM bank";
+	bool result = true;
+	u8 *rom;
+	Gameboy *gmb = start_banked_cartridge(0x19, 0x01, 0x00, &rom); // MBC5, 4 banks
+	Memory *memory = &gmb->memory;
+	check_result(&result, memory->read_pages[0x40][0] == 1);
+	write_memory_cpu(&gmb->cpu, 0x2000, 0x02);
+	check_result(&result, memory->read_pages[0x40] == memory->mbc.rom_bank);
+	check_result(&result, memory->read_pages[0x40][0] == 2);
+	check_result(&result, memory->read_pages[0x7F] == memory->mbc.rom_bank + 0x3F00);
+	check_result(&result, memory->read_pages[0x00][0] == 0); // Bank 0 stays.
+	for(u32 page = 0x00; page <= 0x7F; page++){
+		check_result(&result, memory->write_pages[page] == NULL); // Writes set the MBC registers.
+	}
+	stop_banked_cartridge(gmb, rom);
+	show_test_result(test_name, result);
+}
+
+void map_pages_vram_lock(){
+	const char *test_name = "Page table follows the VRAM lock";
+	bool result = true;
+	clear_program_rom(0x00, 0x00);
+	Gameboy *gmb = start_program(EXECUTION_INSTRUCTION);
+	Memory *memory = &gmb->memory;
+	set_vram_locked(memory, false);
+	u8 *tile_map_write = memory->write_pages[0x98];
+	check_result(&result, memory->read_pages[0x80] == &memory->data[0x8000]);
+	check_result(&result, memory->read_pages[0x9F] == &memory->data[0x9F00]);
+	check_result(&result, memory->write_pages[0x80] == NULL); // The PPU keeps the tiles decoded.
+
+	set_vram_locked(memory, true);
+	for(u32 page = 0x80; page <= 0x9F; page++){
+		check_result(&result, memory->read_pages[page] == NULL && memory->write_pages[page] == NULL);
+	}
+	check_result(&result, read_memory_cpu(&gmb->cpu, 0x9800) == 0xFF);
+	check_result(&result, memory->read_pages[0xC0] == &memory->data[0xC000]);
+
+	set_vram_locked(memory, false);
+	check_result(&result, memory->read_pages[0x80] == &memory->data[0x8000]);
+	check_result(&result, memory->write_pages[0x98] == tile_map_write);
+	stop_program(gmb);
+	show_test_result(test_name, result);
+}
+
+void map_pages_code_page(){
+	const char *test_name = "Page table follows WRAM code";
+	bool result = true;
+	clear_program_rom(0x00, 0x00);
+	Gameboy *gmb = start_program(EXECUTION_INSTRUCTION);
+	Memory *memory = &gmb->memory;
+	CPU *cpu = &gmb->cpu;
+	write_memory_cpu(cpu, 0xC100, 0x04); // INC B
+	write_memory_cpu(cpu, 0xC101, 0x18); // JR to INC B
+	write_memory_cpu(cpu, 0xC102, 0xFD);
+	check_result(&result, memory->write_pages[0xC1] == &memory->data[0xC100]);
+
+	check_result(&result, get_basic_block(&gmb->block_cache, memory, 0xC100) != NULL);
+	check_result(&result, memory->write_pages[0xC1] == NULL); // Writes have to invalidate the blocks.
+	check_result(&result, memory->read_pages[0xC1] == &memory->data[0xC100]);
+	check_result(&result, memory->write_pages[0xC0] == &memory->data[0xC000]);
+	check_result(&result, memory->write_pages[0xC2] == &memory->data[0xC200]);
+
+	write_memory_cpu(cpu, 0xC100, 0x0C); // INC C
+	check_result(&result, memory->data[0xC100] == 0x0C);
+	check_result(&result, memory->write_pages[0xC1] == &memory->data[0xC100]);
+	BasicBlock *block = get_basic_block(&gmb->block_cache, memory, 0xC100);
+	check_result(&result, block && block->instructions[0].bytes[0] == 0x0C);
+	check_result(&result, memory->write_pages[0xC1] == NULL);
+	stop_program(gmb);
+	show_test_result(test_name, result);
+}
+
+// Random tiles and tile map, written while the LCD is off so the PPU decodes them.
+static void fill_background(Gameboy *gmb){
+	srand(2);
+	write_memory_cpu(&gmb->cpu, 0xFF40, 0x00);
+	for(u32 address = 0x8000; address < 0x9C00; address++) write_memory_cpu(&gmb->cpu, address, rand());
+	write_memory_cpu(&gmb->cpu, 0xFF40, 0x91);
+}
+
+// Scrolls SCY every frame, and on every 16th line keeps changing SCX while the line is drawn. The
+// lines in between start at all kinds of SCX % 8, 0 included, and are drawn in one go.
+void fast_scanlines_frames(){
+	const char *test_name = "Whole lines against the FIFO";
+	clear_program_rom(0x00, 0x00);
+
+	u8 vblank[] = {0xF0, 0x42, 0x3C, 0xE0, 0x42, 0xD9}; // LDH A, (42h); INC A; LDH (42h), A; RETI
+	u8 program[] = {
+		0x31, 0xFE, 0xFF,       // LD SP, FFFEh
+		0x3E, 0x01, 0xE0, 0xFF, // IE = VBlank
+		0xAF, 0xE0, 0x0F,       // IF = 0
+		0xFB,                   // EI
+		0xF0, 0x44, 0xE6, 0x0F, // LDH A, (44h); AND 0Fh
+		0x20, 0xFA,             // JR NZ, back to LDH
+		0x04, 0x78, 0xE0, 0x43, // INC B; LD A, B; LDH (43h), A
+		0x18, 0xF4,             // JR back to the first LDH
+	};
+	put_program(0x40, vblank, sizeof(vblank));
+	put_program(0x100, program, sizeof(program));
+
+	Gameboy *reference = start_program(EXECUTION_INSTRUCTION);
+	Gameboy *gmb = start_program(EXECUTION_INSTRUCTION);
+	reference->ppu.fast_scanlines = false;
+	fill_background(reference);
+	fill_background(gmb);
+
+	bool result = true;
+	for(i32 frame = 0; frame < 8; frame++){
+		run_gameboy(reference, 0, 1, 0);
+		run_gameboy(gmb, 0, 1, 0);
+		check_same_state(&result, gmb, reference);
+		check_result(&result, memcmp(gmb->ppu.frame, reference->ppu.frame, BUFFER_SIZE) == 0);
+	}
+	check_result(&result, gmb->cpu.B > 0 && gmb->memory.data[0xFF42] > 0);
+	stop_program(reference);
+	stop_program(gmb);
+	show_test_result(test_name, result);
+}
+
+// Runs the hardware until the PPU is at the dot of the line.
+static void run_to_dot(Gameboy *gmb, u8 line, u32 dot){
+	while(gmb->memory.data[0xFF44] != line || gmb->ppu.cycles < dot){
+		run_hardware_cycles(gmb, 1);
+	}
+}
+
+static void set_sprite(Gameboy *gmb, u32 entry, u8 y_position, u8 x_position){
+	write_memory_cpu(&gmb->cpu, 0xFE00 + entry * 4, y_position);
+	write_memory_cpu(&gmb->cpu, 0xFE00 + entry * 4 + 1, x_position);
+}
+
+// The sprites the OAM scan found on the line being drawn, sprites are told apart by X.
+static bool has_line_sprites(Gameboy *gmb, u8 line, const u8 *x_positions, u32 count){
+	run_to_dot(gmb, line, 100);
+	PPU *ppu = &gmb->ppu;
+	if(ppu->sprites.size != count) return false;
+	for(u32 i = 0; i < count; i++){
+		if(ppu->sprites.data[i].x_position != x_positions[i]) return false;
+	}
+	return true;
+}
+
+static Gameboy* start_sprite_program(){
+	clear_program_rom(0x00, 0x00);
+	Gameboy *gmb = start_program(EXECUTION_INSTRUCTION);
+	write_memory_cpu(&gmb->cpu, 0xFF40, 0x93); // LCD, background and sprites on, 8x8 sprites
+	run_to_dot(gmb, 144, 8);
+	for(u32 address = 0xFE00; address < 0xFEA0; address++) write_memory_cpu(&gmb->cpu, address, 0x00);
+	return gmb;
+}
+
+void line_sprites_oam_writes(){
+	const char *test_name = "Sprite lists after OAM writes";
+	bool result = true;
+	Gameboy *gmb = start_sprite_program();
+	set_sprite(gmb, 0, 36, 8);  // Lines 20 to 27
+	set_sprite(gmb, 30, 36, 16);
+	const u8 line_20[] = {8, 16};
+	check_result(&result, has_line_sprites(gmb, 20, line_20, 2));
+
+	run_to_dot(gmb, 20, 300); // HBlank
+	set_sprite(gmb, 5, 37, 24);
+	const u8 line_21[] = {8, 16, 24};
+	check_result(&result, has_line_sprites(gmb, 21, line_21, 3));
+
+	run_to_dot(gmb, 22, 40); // The scan went by the first 20 entries.
+	set_sprite(gmb, 0, 0, 8);
+	set_sprite(gmb, 30, 0, 16);
+	set_sprite(gmb, 35, 36, 32);
+	const u8 line_22[] = {8, 24, 32};
+	check_result(&result, has_line_sprites(gmb, 22, line_22, 3));
+	const u8 line_23[] = {24, 32};
+	check_result(&result, has_line_sprites(gmb, 23, line_23, 2));
+	stop_program(gmb);
+	show_test_result(test_name, result);
+}
+
+void line_sprites_dma(){
+	const char *test_name = "Sprite lists after OAM DMA";
+	bool result = true;
+	Gameboy *gmb = start_sprite_program();
+	CPU *cpu = &gmb->cpu;
+	check_result(&result, has_line_sprites(gmb, 20, NULL, 0));
+
+	for(u32 i = 0; i < OAM_SIZE; i++){
+		write_memory_cpu(cpu, 0xC100 + i, 0x00);
+		write_memory_cpu(cpu, 0xC200 + i, 0x00);
+	}
+	write_memory_cpu(cpu, 0xC100, 36); // Entry 0 on lines 20 to 27
+	write_memory_cpu(cpu, 0xC101, 40);
+	write_memory_cpu(cpu, 0xC200 + 39 * 4, 36); // Only entry 39 in the second table
+	write_memory_cpu(cpu, 0xC200 + 39 * 4 + 1, 48);
+
+	run_to_dot(gmb, 144, 8);
+	write_memory_cpu(cpu, 0xFF46, 0xC1);
+	const u8 line_20[] = {40};
+	check_result(&result, has_line_sprites(gmb, 20, line_20, 1));
+
+	run_to_dot(gmb, 21, 40); // The scan went by entry 0 before the copy.
+	write_memory_cpu(cpu, 0xFF46, 0xC2);
+	const u8 line_21[] = {40, 48};
+	check_result(&result, has_line_sprites(gmb, 21, line_21, 2));
+	const u8 line_22[] = {48};
+	check_result(&result, has_line_sprites(gmb, 22, line_22, 1));
+	stop_program(gmb);
+	show_test_result(test_name, result);
+}
+
+void line_sprites_height(){
+	const char *test_name = "Sprite lists after sprite height changes";
+	bool result = true;
+	Gameboy *gmb = start_sprite_program();
+	set_sprite(gmb, 0, 36, 8);   // Lines 20 to 27, or to 35 in 8x16
+	set_sprite(gmb, 35, 36, 16);
+	check_result(&result, has_line_sprites(gmb, 30, NULL, 0));
+
+	run_to_dot(gmb, 144, 8);
+	write_memory_cpu(&gmb->cpu, 0xFF40, 0x97);
+	const u8 tall[] = {8, 16};
+	check_result(&result, has_line_sprites(gmb, 30, tall, 2));
+
+	run_to_dot(gmb, 144, 8);
+	write_memory_cpu(&gmb->cpu, 0xFF40, 0x93);
+	check_result(&result, has_line_sprites(gmb, 30, NULL, 0));
+
+	run_to_dot(gmb, 31, 40); // Entry 0 was scanned as 8x8, entry 35 is 8x16.
+	write_memory_cpu(&gmb->cpu, 0xFF40, 0x97);
+	const u8 line_31[] = {16};
+	check_result(&result, has_line_sprites(gmb, 31, line_31, 1));
+	check_result(&result, has_line_sprites(gmb, 32, tall, 2));
+	stop_program(gmb);
+	show_test_result(test_name, result);
+}
+
+// Checks the bus stays locked for the whole transfer, then hands it back.
+static void check_dma_bus(bool *result, Gameboy *gmb, u16 source){
+	CPU *cpu = &gmb->cpu;
+	u8 source_byte = gmb->memory.data[source];
+	for(i32 cycle = 1; cycle < DMA_MACHINE_CYCLES; cycle++){
+		check_result(result, read_memory_cpu(cpu, 0x0150) == 0xFF);
+		check_result(result, read_memory_cpu(cpu, source) == 0xFF);
+		check_result(result, read_memory_cpu(cpu, 0xFE00) == 0xFF);
+		check_result(result, read_memory_cpu(cpu, 0xFF80) == 0x12); // HRAM
+		check_result(result, read_memory_cpu(cpu, 0xFF47) == 0xE4); // BGP
+		write_memory_cpu(cpu, source, ~source_byte); // Dropped, WRAM is on the locked bus too.
+		check_result(result, gmb->memory.data[source] == source_byte);
+		run_hardware_cycles(gmb, 1);
+	}
+	check_result(result, !cpu->DMA_transfer_in_progress);
+	check_result(result, read_memory_cpu(cpu, 0x0150) == 0x3C);
+	check_result(result, read_memory_cpu(cpu, source) == source_byte);
+}
+
+static bool is_oam_filled(Gameboy *gmb, u8 (*byte)(u32 i)){
+	for(u32 i = 0; i < OAM_SIZE; i++){
+		if(gmb->memory.data[0xFE00 + i] != byte(i)) return false;
+	}
+	return true;
+}
+
+static u8 wram_pattern(u32 i)  { return (u8)(i ^ 0x5A); }
+static u8 wram_pattern_2(u32 i){ return (u8)(i * 3); }
+static u8 open_bus(u32)        { return 0xFF; }
+static u8 clock_register(u32)  { return 0x2A; }
+
+void dma_sources(){
+	const char *test_name = "OAM DMA sources";
+	bool result = true;
+	{	// WRAM, copied straight from the page table.
+		clear_program_rom(0x00, 0x00);
+		program_rom[0x150] = 0x3C;
+		Gameboy *gmb = start_program(EXECUTION_INSTRUCTION);
+		CPU *cpu = &gmb->cpu;
+		for(u32 i = 0; i < OAM_SIZE; i++) write_memory_cpu(cpu, 0xC100 + i, wram_pattern(i));
+		write_memory_cpu(cpu, 0xFF80, 0x12);
+		write_memory_cpu(cpu, 0xFF46, 0xC1);
+		check_result(&result, cpu->DMA_transfer_in_progress);
+		run_hardware_cycles(gmb, 1);
+		check_result(&result, is_oam_filled(gmb, wram_pattern));
+		check_dma_bus(&result, gmb, 0xC100);
+		check_result(&result, read_memory_cpu(cpu, 0xC100) == wram_pattern(0));
+		stop_program(gmb);
+	}
+	{	// Locked VRAM, read byte by byte like the CPU would.
+		clear_program_rom(0x00, 0x00);
+		program_rom[0x150] = 0x3C;
+		Gameboy *gmb = start_program(EXECUTION_INSTRUCTION);
+		CPU *cpu = &gmb->cpu;
+		memset(&gmb->memory.data[0x8000], 0x77, OAM_SIZE);
+		write_memory_cpu(cpu, 0xFF80, 0x12);
+		set_vram_locked(&gmb->memory, true);
+		write_memory_cpu(cpu, 0xFF46, 0x80);
+		run_hardware_cycles(gmb, 1);
+		check_result(&result, is_oam_filled(gmb, open_bus));
+		stop_program(gmb);
+	}
+	{	// MBC3 clock register, which has no page to copy from.
+		u8 *rom;
+		Gameboy *gmb = start_banked_cartridge(0x10, 0x01, 0x03, &rom);
+		CPU *cpu = &gmb->cpu;
+		write_memory_cpu(cpu, 0x0000, 0x0A);
+		write_memory_cpu(cpu, 0x4000, 0x08);
+		write_memory_cpu(cpu, 0xA000, 0x2A);
+		check_result(&result, gmb->memory.read_pages[0xA0] == NULL);
+		write_memory_cpu(cpu, 0xFF46, 0xA0);
+		run_hardware_cycles(gmb, 1);
+		check_result(&result, is_oam_filled(gmb, clock_register));
+		stop_banked_cartridge(gmb, rom);
+	}
+	show_test_result(test_name, result);
+}
+
+void dma_restart(){
+	const char *test_name = "OAM DMA restart";
+	bool result = true;
+	clear_program_rom(0x00, 0x00);
+	program_rom[0x150] = 0x3C;
+	Gameboy *gmb = start_program(EXECUTION_INSTRUCTION);
+	CPU *cpu = &gmb->cpu;
+	for(u32 i = 0; i < OAM_SIZE; i++){
+		write_memory_cpu(cpu, 0xC100 + i, wram_pattern(i));
+		write_memory_cpu(cpu, 0xC200 + i, wram_pattern_2(i));
+	}
+	write_memory_cpu(cpu, 0xFF80, 0x12);
+
+	write_memory_cpu(cpu, 0xFF46, 0xC1);
+	run_hardware_cycles(gmb, 20);
+	check_result(&result, is_oam_filled(gmb, wram_pattern));
+
+	write_memory_cpu(cpu, 0xFF46, 0xC2); // Copies again and locks the bus for another 40 cycles.
+	run_hardware_cycles(gmb, 1);
+	check_result(&result, is_oam_filled(gmb, wram_pattern_2));
+	check_dma_bus(&result, gmb, 0xC200);
+	stop_program(gmb);
+	show_test_result(test_name, result);
+}
+
+static void run_opcode_tests(){
+
 	ld_r16_imm16();
 	ld_memr16_a();
 	ld_a_memr16();
@@ -3040,6 +4069,67 @@ int main(){
 	cb_bit_r();
 	cb_res_r();
 	cb_set_r();
+}
+
+int main(){
+	init_arena(&test_arena, megabytes(1));
+
+	printf("Interpreter\n");
+	run_opcode_tests();
+
+	if(init_jit(&test_jit, &test_arena)){
+		test_jit.max_block_instructions = 1; // One instruction per block so every opcode is compiled on its own.
+		use_jit = true;
+
+		printf("\nJIT\n");
+		run_opcode_tests();
+		free_jit(&test_jit);
+		use_jit = false;
+
+		printf("\nJIT blocks\n");
+		jit_block_interrupts();
+		jit_block_bank_switch();
+		jit_block_branches();
+	}
+
+	printf("\nMBC\n");
+	mbc_rom_bank_zero();
+	mbc5_9_bit_bank();
+	mbc_bank_wrapping();
+	mbc3_ram_and_rtc();
+	mbc5_rumble();
+
+	printf("\nSave RAM\n");
+	save_file();
+	save_dirty_pages();
+	save_flushes();
+
+	printf("\nTimer\n");
+	timer_rates();
+	timer_tac_change();
+	timer_overflow();
+
+	printf("\nIdle skipping\n");
+	halt_skip();
+	polling_loop_skip();
+
+	printf("\nPage table\n");
+	map_pages_bank_switch();
+	map_pages_vram_lock();
+	map_pages_code_page();
+
+	printf("\nOAM DMA\n");
+	dma_sources();
+	dma_restart();
+
+	printf("\nSprite lists\n");
+	line_sprites_oam_writes();
+	line_sprites_dma();
+	line_sprites_height();
+
+	printf("\nScanlines\n");
+	fast_scanlines_frames();
+	scanline_kernels();
 
 	return 0;
 }
\ No newline at end of file